@@ -0,0 +1,252 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <dirent.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "archive.h"
+#include "tlz.h"
+
+// Partition waiting for the archiver
+typedef struct archive_job {
+  struct archive_job *next;
+  char path[];
+} archive_job_t;
+
+// Archiver state, the counters are written by its thread only
+static struct {
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  archive_job_t *head, *tail;
+  int running;
+  int stop;
+  archive_stats_t stats;
+} archiver = { .lock = PTHREAD_MUTEX_INITIALIZER, .cond = PTHREAD_COND_INITIALIZER };
+
+static long long now_ns (void)
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// Length of a period given by name ("hour" or "day"), 0 if unknown
+int64_t archive_parse_period (const char *name)
+{
+  if (strcmp (name, "hour") == 0) return ARCHIVE_HOUR_MS;
+  if (strcmp (name, "day") == 0) return ARCHIVE_DAY_MS;
+  return 0;
+}
+
+// Start of the partition holding exchange time 'time' (ms since the epoch)
+int64_t archive_partition_start (int64_t time, int64_t period)
+{
+  int64_t start = time - time % period;
+  return time < 0 && start != time ? start - period : start;
+}
+
+// Path of a new .tlog for the partition starting at 'start': the first sequence number
+// not used by a .tlog or .tlz of an earlier run. Returns -1 if it doesn't fit in 'path'.
+int archive_partition_path (char *path, size_t size, const char *symbol, int64_t start, int64_t period)
+{
+  time_t seconds = start / 1000;
+  struct tm tm;
+  char stamp[32];
+  int n;
+
+  gmtime_r (&seconds, &tm);
+  strftime (stamp, sizeof (stamp), period < ARCHIVE_DAY_MS ? "%Y-%m-%dT%H" : "%Y-%m-%d", &tm);
+  for (int seq = 0; seq < 100; seq++) {
+    n = snprintf (path, size, "%s.%s.%02d.tlz", symbol, stamp, seq);
+    if (n < 0 || (size_t)n + 1 >= size) return -1;
+    if (access (path, F_OK) == 0) continue;
+    strcpy (path + n - 3, "tlog");
+    if (access (path, F_OK) != 0) return 0;
+  }
+  return -1;
+}
+
+static void compress_one (const char *tlog_path)
+{
+  char tlz_path[PATH_MAX];
+  struct stat raw, packed;
+  long long start = now_ns (), ns;
+  size_t len = strlen (tlog_path);
+
+  if (len < 5 || len >= sizeof (tlz_path) || strcmp (tlog_path + len - 5, ".tlog") != 0) {
+    archiver.stats.failed++;
+    return;
+  }
+  memcpy (tlz_path, tlog_path, len - 4);
+  strcpy (tlz_path + len - 4, "tlz");
+
+  if (stat (tlog_path, &raw) < 0 || tlz_compress (tlog_path, tlz_path) < 0 || stat (tlz_path, &packed) < 0) {
+    archiver.stats.failed++;
+    return;
+  }
+  unlink (tlog_path);
+
+  ns = now_ns () - start;
+  archiver.stats.files++;
+  archiver.stats.raw_bytes += raw.st_size;
+  archiver.stats.compressed_bytes += packed.st_size;
+  archiver.stats.ns_total += ns;
+  if ((unsigned long long)ns > archiver.stats.ns_max) archiver.stats.ns_max = ns;
+}
+
+// Compress the submitted partitions one by one, then drain the queue on stop
+static void *archive_thread (void *arg)
+{
+  archive_job_t *job;
+
+  pthread_mutex_lock (&archiver.lock);
+  for (;;) {
+    while (archiver.head == NULL && !archiver.stop) pthread_cond_wait (&archiver.cond, &archiver.lock);
+    if (archiver.head == NULL) break;
+    job = archiver.head;
+    archiver.head = job->next;
+    if (archiver.head == NULL) archiver.tail = NULL;
+    pthread_mutex_unlock (&archiver.lock);
+
+    compress_one (job->path);
+    free (job);
+
+    pthread_mutex_lock (&archiver.lock);
+  }
+  pthread_mutex_unlock (&archiver.lock);
+  return (NULL);
+}
+
+int archive_start (void)
+{
+  memset (&archiver.stats, 0, sizeof (archiver.stats));
+  archiver.stop = 0;
+  if (pthread_create (&archiver.thread, NULL, archive_thread, NULL) != 0) return -1;
+  archiver.running = 1;
+  return 0;
+}
+
+// Queue a closed .tlog for compression. Returns -1 (the .tlog stays) if the archiver isn't running.
+int archive_submit (const char *tlog_path)
+{
+  size_t len = strlen (tlog_path) + 1;
+  archive_job_t *job;
+
+  if (!archiver.running) return -1;
+  job = (archive_job_t *) malloc (sizeof (archive_job_t) + len);
+  if (job == NULL) return -1;
+  job->next = NULL;
+  memcpy (job->path, tlog_path, len);
+
+  pthread_mutex_lock (&archiver.lock);
+  if (archiver.tail != NULL) archiver.tail->next = job;
+  else archiver.head = job;
+  archiver.tail = job;
+  pthread_cond_signal (&archiver.cond);
+  pthread_mutex_unlock (&archiver.lock);
+  return 0;
+}
+
+// Compress everything still queued, stop the thread and return its counters
+void archive_stop (archive_stats_t *stats)
+{
+  if (archiver.running) {
+    pthread_mutex_lock (&archiver.lock);
+    archiver.stop = 1;
+    pthread_cond_signal (&archiver.cond);
+    pthread_mutex_unlock (&archiver.lock);
+    pthread_join (archiver.thread, NULL);
+    archiver.running = 0;
+  }
+  if (stats != NULL) *stats = archiver.stats;
+}
+
+static int compare_paths (const void *a, const void *b)
+{
+  return strcmp (*(char * const *)a, *(char * const *)b);
+}
+
+// Partition file of 'symbol': <symbol>.<digit>...(.tlog|.tlz). Returns its suffix length, 0 if it isn't one.
+static size_t partition_suffix (const char *name, const char *symbol, size_t symbol_len)
+{
+  size_t len = strlen (name);
+
+  if (strncmp (name, symbol, symbol_len) != 0 || name[symbol_len] != '.' || !isdigit ((unsigned char)name[symbol_len + 1])) return 0;
+  if (len > 5 && strcmp (name + len - 5, ".tlog") == 0) return 5;
+  if (len > 4 && strcmp (name + len - 4, ".tlz") == 0) return 4;
+  return 0;
+}
+
+// Collect the partitions of 'symbol' in 'dir' in time order into a malloc'd array of paths.
+// A partition found both compressed and not (the archiver stopped before removing the .tlog)
+// is only listed as .tlz. The single <symbol>.tlog of a run before partitioning comes first.
+// Returns the number of paths, -1 on error.
+int archive_list (const char *dir, const char *symbol, char ***paths)
+{
+  size_t symbol_len = strlen (symbol), stem;
+  char **list = NULL, **grown, path[PATH_MAX];
+  int count = 0, max = 0, out = 0;
+  struct dirent *entry;
+  DIR *d = opendir (dir);
+
+  *paths = NULL;
+  if (d == NULL) return -1;
+  while ((entry = readdir (d)) != NULL) {
+    if (partition_suffix (entry->d_name, symbol, symbol_len) == 0) continue;
+    if (count == max) {
+      max = max ? max * 2 : 16;
+      grown = (char **) realloc (list, max * sizeof (char *));
+      if (grown == NULL) goto fail;
+      list = grown;
+    }
+    snprintf (path, sizeof (path), "%s/%s", dir, entry->d_name);
+    if ((list[count] = strdup (path)) == NULL) goto fail;
+    count++;
+  }
+  closedir (d);
+  d = NULL;
+  qsort (list, count, sizeof (char *), compare_paths);
+
+  // ".tlog" sorts before ".tlz", so a duplicate is the .tlog just before its .tlz
+  for (int i = 0; i < count; i++) {
+    stem = strrchr (list[i], '.') - list[i];
+    if (out > 0 && (size_t)(strrchr (list[out - 1], '.') - list[out - 1]) == stem && strncmp (list[out - 1], list[i], stem) == 0) {
+      free (list[out - 1]);
+      out--;
+    }
+    list[out++] = list[i];
+  }
+  count = out;
+
+  snprintf (path, sizeof (path), "%s/%s.tlog", dir, symbol);
+  if (access (path, F_OK) == 0) {
+    grown = (char **) realloc (list, (count + 1) * sizeof (char *));
+    if (grown == NULL) goto fail;
+    list = grown;
+    memmove (list + 1, list, count * sizeof (char *));
+    if ((list[0] = strdup (path)) == NULL) {
+      memmove (list, list + 1, count * sizeof (char *));
+      goto fail;
+    }
+    count++;
+  }
+  *paths = list;
+  return count;
+
+fail:
+  if (d != NULL) closedir (d);
+  archive_list_free (list, count);
+  return -1;
+}
+
+void archive_list_free (char **paths, int count)
+{
+  for (int i = 0; i < count; i++) free (paths[i]);
+  free (paths);
+}
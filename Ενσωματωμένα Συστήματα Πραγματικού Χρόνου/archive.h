@@ -0,0 +1,40 @@
+#ifndef ARCHIVE_H
+#define ARCHIVE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Time-partitioned trade archive.
+// The trade log of a symbol is rolled every hour or day of exchange time (UTC) into
+// <SYMBOL>.<YYYY-MM-DDTHH | YYYY-MM-DD>.<NN>.tlog; NN only grows past 00 when a partition is
+// written again (a restart within the same hour). A closed partition is handed to the background
+// archiver thread, which compresses it to a .tlz next to it and removes the .tlog.
+
+#define ARCHIVE_HOUR_MS 3600000LL
+#define ARCHIVE_DAY_MS 86400000LL
+
+// Counters of the archiver
+typedef struct {
+  unsigned long long files;         // Partitions compressed
+  unsigned long long failed;        // Partitions left as .tlog
+  unsigned long long raw_bytes;     // Size of the .tlog files compressed
+  unsigned long long compressed_bytes;
+  unsigned long long ns_total;      // Time spent compressing
+  unsigned long long ns_max;
+} archive_stats_t;
+
+// Partition functions
+int64_t archive_parse_period (const char *name);
+int64_t archive_partition_start (int64_t time, int64_t period);
+int archive_partition_path (char *path, size_t size, const char *symbol, int64_t start, int64_t period);
+
+// Archiver functions
+int archive_start (void);
+int archive_submit (const char *tlog_path);
+void archive_stop (archive_stats_t *stats);
+
+// Partitions of a symbol in 'dir', oldest first
+int archive_list (const char *dir, const char *symbol, char ***paths);
+void archive_list_free (char **paths, int count);
+
+#endif
@@ -0,0 +1,286 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "backlog.h"
+
+static const char *policy_names[] = { "block", "drop-oldest", "conflate", "spill" };
+
+// Counter with a single writer
+static inline void count_add (_Atomic uint64_t *c, uint64_t n)
+{
+  atomic_store_explicit (c, atomic_load_explicit (c, memory_order_relaxed) + n, memory_order_relaxed);
+}
+
+static inline backlog_entry_t *entry (const backlog_t *b, uint64_t seq)
+{
+  return &b->entries[seq & (b->capacity - 1)];
+}
+
+static inline uint64_t spilled (const backlog_t *b)
+{
+  return (uint64_t)(b->spill_write - b->spill_read) / sizeof (trade_t) + b->spill_buffered;
+}
+
+int backlog_parse_policy (const char *name)
+{
+  for (int p = 0; p < (int)(sizeof (policy_names) / sizeof (policy_names[0])); p++) {
+    if (strcmp (name, policy_names[p]) == 0) return p;
+  }
+  return -1;
+}
+
+const char *backlog_policy_name (backlog_policy_t policy)
+{
+  return policy_names[policy];
+}
+
+// 'capacity' entries wait in memory, rounded up to a power of two. The spill file is only
+// created once needed (only with the spill policy, 'spill_path' may be NULL otherwise).
+// Returns -1 if out of memory.
+int backlog_init (backlog_t *b, backlog_policy_t policy, size_t capacity, int64_t bucket_ms,
+                  const char *spill_path, backlog_counts_cb counts)
+{
+  size_t size = 1;
+
+  memset (b, 0, sizeof (*b));
+  b->policy = policy;
+  b->bucket_ms = bucket_ms;
+  b->counts = counts;
+  snprintf (b->spill_path, sizeof (b->spill_path), "%s", spill_path != NULL ? spill_path : "");
+  b->spill_fd = -1;
+  if (policy == BACKLOG_BLOCK) return 0;
+
+  while (size < capacity) size <<= 1;
+  b->entries = (backlog_entry_t *) malloc (size * sizeof (backlog_entry_t));
+  if (b->entries == NULL) return -1;
+  b->capacity = size;
+  return 0;
+}
+
+void backlog_free (backlog_t *b)
+{
+  free (b->entries);
+  free (b->slot);
+  if (b->spill_fd >= 0) close (b->spill_fd);
+  memset (b, 0, sizeof (*b));
+  b->spill_fd = -1;
+}
+
+// Trades waiting for room in the ring, in memory and spilled
+uint64_t backlog_waiting (const backlog_t *b)
+{
+  return b->queued + spilled (b);
+}
+
+// Drop the oldest waiting trades to make room. Wall-clock ticks are kept (they close the minutes
+// of the symbols that stopped trading): the oldest entry of trades goes and the ticks before it
+// move up one entry. Only a backlog of nothing but ticks drops one, counted in 'ticks_dropped'.
+static void drop_oldest (backlog_t *b)
+{
+  uint64_t seq = b->head;
+  backlog_entry_t *e;
+  int n;
+
+  while (seq != b->tail && entry (b, seq)->trade[0].id < 0) seq++;
+  if (seq == b->tail) {
+    b->head++;
+    b->queued--;
+    b->ticks_dropped++;
+    return;
+  }
+  e = entry (b, seq);
+  n = e->count - e->sent;
+  b->queued -= n;
+  if (b->counts != NULL) count_add (&b->counts (e->trade[0].id)->dropped, n);
+  for (; seq != b->head; seq--) *entry (b, seq) = *entry (b, seq - 1);
+  b->head++;
+}
+
+static void append (backlog_t *b, const trade_t *t)
+{
+  backlog_entry_t *e;
+
+  if (b->tail - b->head == b->capacity || b->queued >= b->capacity) drop_oldest (b);
+  e = entry (b, b->tail++);
+  e->trade[0] = *t;
+  e->extra_volume = 0;
+  e->count = 1;
+  e->sent = 0;
+  e->first = e->last = e->high = e->low = 0;
+  b->queued++;
+}
+
+// Add 't' to the waiting trades of its symbol and minute, keeping only the ones with a role in the
+// candle (earliest and latest with the same tie rules as candle_add_trade(), highest, lowest)
+static void merge (backlog_t *b, backlog_entry_t *e, const trade_t *t)
+{
+  trade_t all[BACKLOG_ENTRY_TRADES + 1];
+  int n = e->count, kept[BACKLOG_ENTRY_TRADES + 1], role[4], k = 0;
+
+  memcpy (all, e->trade, n * sizeof (trade_t));
+  all[n] = *t;
+  role[0] = t->time < all[e->first].time ? n : e->first;
+  role[1] = t->time >= all[e->last].time ? n : e->last;
+  role[2] = t->price > all[e->high].price ? n : e->high;
+  role[3] = t->price < all[e->low].price ? n : e->low;
+
+  for (int i = 0; i <= n; i++) {
+    kept[i] = -1;
+    for (int r = 0; r < 4; r++) {
+      if (role[r] == i) kept[i] = k;
+    }
+    if (kept[i] < 0) {
+      e->extra_volume += all[i].volume;
+      continue;
+    }
+    e->trade[k++] = all[i];
+  }
+  e->first = kept[role[0]];
+  e->last = kept[role[1]];
+  e->high = kept[role[2]];
+  e->low = kept[role[3]];
+  e->count = k;
+  b->queued += k - n;
+  if (b->counts != NULL) count_add (&b->counts (t->id)->conflated, n + 1 - k);
+}
+
+// Append to the spill file through a buffer. Returns -1 if it can't be written.
+static int spill (backlog_t *b, const trade_t *t)
+{
+  size_t bytes = BACKLOG_FLUSH_BATCH * sizeof (trade_t);
+
+  if (b->spill_buffered == BACKLOG_FLUSH_BATCH) {
+    if (b->spill_fd < 0) {
+      b->spill_fd = open (b->spill_path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+      if (b->spill_fd < 0) return -1;
+      unlink (b->spill_path);   // Only the descriptor keeps it
+    }
+    if (pwrite (b->spill_fd, b->spill_buf, bytes, b->spill_write) != (ssize_t)bytes) return -1;
+    b->spill_write += bytes;
+    b->spill_buffered = 0;
+  }
+  b->spill_buf[b->spill_buffered++] = *t;
+  if (t->id >= 0 && b->counts != NULL) count_add (&b->counts (t->id)->spilled, 1);
+  return 0;
+}
+
+// Move the oldest spilled trades into the empty backlog. Returns the number moved.
+static size_t refill (backlog_t *b)
+{
+  trade_t buf[BACKLOG_FLUSH_BATCH];
+  size_t max = b->capacity < BACKLOG_FLUSH_BATCH ? b->capacity : BACKLOG_FLUSH_BATCH, n = 0;
+  ssize_t got;
+
+  if (b->spill_read < b->spill_write) {
+    if ((size_t)(b->spill_write - b->spill_read) < max * sizeof (trade_t)) max = (b->spill_write - b->spill_read) / sizeof (trade_t);
+    got = pread (b->spill_fd, buf, max * sizeof (trade_t), b->spill_read);
+    n = got > 0 ? got / sizeof (trade_t) : 0;
+    b->spill_read = got > 0 ? b->spill_read + (off_t)(n * sizeof (trade_t)) : b->spill_write;  // An unreadable file is given up
+    if (b->spill_read == b->spill_write) {
+      if (ftruncate (b->spill_fd, 0) < 0) perror ("backlog: truncating the spill file");
+      b->spill_read = b->spill_write = 0;
+    }
+  } else if (b->spill_buffered > 0) {
+    n = b->spill_buffered < max ? b->spill_buffered : max;
+    memcpy (buf, b->spill_buf, n * sizeof (trade_t));
+    memmove (b->spill_buf, b->spill_buf + n, (b->spill_buffered - n) * sizeof (trade_t));
+    b->spill_buffered -= n;
+  }
+  for (size_t i = 0; i < n; i++) append (b, &buf[i]);
+  return n;
+}
+
+static void add (backlog_t *b, const trade_t *t)
+{
+  backlog_entry_t *e;
+  uint64_t *slot;
+  int size;
+
+  if (b->policy == BACKLOG_CONFLATE && t->id >= 0) {
+    if (t->id < b->slots && b->slot[t->id] > b->head) {
+      e = entry (b, b->slot[t->id] - 1);   // Unless dropped, and a tick moved into it
+      if (e->trade[0].id == t->id && e->sent == 0 && e->trade[0].time / b->bucket_ms == t->time / b->bucket_ms) {
+        merge (b, e, t);
+        if (b->queued > b->capacity) drop_oldest (b);   // A kept trade more
+        return;
+      }
+    }
+    if (t->id >= b->slots) {
+      size = b->slots ? b->slots : 64;
+      while (size <= t->id) size *= 2;
+      if ((slot = (uint64_t *) realloc (b->slot, size * sizeof (uint64_t))) != NULL) {
+        memset (slot + b->slots, 0, (size - b->slots) * sizeof (uint64_t));
+        b->slot = slot;
+        b->slots = size;
+      }
+    }
+    append (b, t);
+    if (t->id < b->slots) b->slot[t->id] = b->tail;
+    return;
+  }
+
+  // Once spilling, everything goes through the spill file to stay in order
+  if (b->policy == BACKLOG_SPILL && (spilled (b) > 0 || b->tail - b->head == b->capacity)) {
+    if (spill (b, t) == 0) return;
+    if (t->id < 0) b->ticks_dropped++;
+    else if (b->counts != NULL) count_add (&b->counts (t->id)->dropped, 1);
+    return;
+  }
+  append (b, t);
+}
+
+// Move the waiting trades into the ring, oldest first, as far as it has room.
+// Returns the number of trades still waiting.
+uint64_t backlog_flush (backlog_t *b, spsc_ring_t *ring)
+{
+  trade_t buf[BACKLOG_FLUSH_BATCH];
+  backlog_entry_t *e;
+  size_t m, k, left;
+
+  if (b->policy == BACKLOG_BLOCK) return 0;
+  while (b->head != b->tail || refill (b) > 0) {
+    m = 0;
+    for (uint64_t seq = b->head; seq != b->tail && m + BACKLOG_ENTRY_TRADES <= BACKLOG_FLUSH_BATCH; seq++) {
+      e = entry (b, seq);
+      for (int i = e->sent; i < e->count; i++) {
+        buf[m] = e->trade[i];
+        if (i == e->last) buf[m].volume += e->extra_volume;
+        m++;
+      }
+    }
+    k = spsc_ring_try_push_batch (ring, buf, m);
+    b->queued -= k;
+    for (left = k; left > 0; ) {
+      e = entry (b, b->head);
+      if (left < (size_t)(e->count - e->sent)) {
+        e->sent += left;
+        break;
+      }
+      left -= e->count - e->sent;
+      b->head++;
+    }
+    if (k < m) break;
+  }
+  return backlog_waiting (b);
+}
+
+// Hand trades to the ring. With the block policy this waits for room and returns -1 if the ring
+// was closed; otherwise it never waits, older waiting trades go first and what doesn't fit waits
+// in the backlog (or is dropped, merged or spilled by the policy).
+int backlog_publish (backlog_t *b, spsc_ring_t *ring, const trade_t *trades, size_t n)
+{
+  size_t k = 0;
+  uint64_t waiting;
+
+  if (b->policy == BACKLOG_BLOCK) return spsc_ring_push_batch (ring, trades, n);
+  if (atomic_load_explicit (&ring->closed, memory_order_relaxed)) return -1;
+
+  if (backlog_flush (b, ring) == 0) k = spsc_ring_try_push_batch (ring, trades, n);
+  for (; k < n; k++) add (b, &trades[k]);
+  waiting = backlog_waiting (b);
+  if (waiting > b->waiting_max) b->waiting_max = waiting;
+  return 0;
+}
@@ -0,0 +1,84 @@
+#ifndef BACKLOG_H
+#define BACKLOG_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <sys/types.h>
+#include "spsc_ring.h"
+#include "trade.h"
+
+// Overflow of a trade ring, owned by the producer that feeds the ring.
+// With the block policy the producer waits for room in the ring. With any other policy it never
+// waits: what doesn't fit waits in the backlog, in order, and goes into the ring as the worker
+// makes room (backlog_flush), and when the backlog is full too:
+//   drop-oldest  the oldest waiting trades are dropped (wall-clock ticks are kept)
+//   conflate     the waiting trades of a symbol and minute are merged, only its first, highest,
+//                lowest and latest trades are kept and the volume of the others is added to the
+//                latest; the candle (open, high, low, close, volume) stays exact, the trade count,
+//                SMA and VWAP of the minute are approximated. Merging starts once the ring is full,
+//                if the backlog still fills up the oldest entries are dropped as with drop-oldest.
+// Either way at most 'capacity' trades wait in memory, however many entries they take.
+//   spill        the trades are appended to a spill file (unlinked, it doesn't outlive the run)
+//                and read back in order once the ring and the backlog have room. They reach the
+//                worker late and are dropped there if their minute was closed meanwhile.
+
+#define BACKLOG_ENTRY_TRADES 4    // Trades kept by a conflated entry
+#define BACKLOG_FLUSH_BATCH 256   // Trades moved into the ring at once
+
+typedef enum {
+  BACKLOG_BLOCK,
+  BACKLOG_DROP_OLDEST,
+  BACKLOG_CONFLATE,
+  BACKLOG_SPILL
+} backlog_policy_t;
+
+// Counters of a symbol, written by the producer only, readable from any thread
+typedef struct {
+  _Atomic uint64_t dropped;       // Trades dropped (drop-oldest, conflate with a full backlog, unwritable spill file)
+  _Atomic uint64_t conflated;     // Trades merged into another one
+  _Atomic uint64_t spilled;       // Trades that went through the spill file
+} backlog_counts_t;
+
+// Counters of the symbol with this ID
+typedef backlog_counts_t *(*backlog_counts_cb)(int id);
+
+// Waiting trades: one, or with conflation the kept trades of a symbol and minute in arrival order
+typedef struct {
+  trade_t trade[BACKLOG_ENTRY_TRADES];
+  int64_t extra_volume;           // Volume of the merged trades, added to the latest one
+  uint8_t count;
+  uint8_t sent;                   // Trades already in the ring, the entry can't be merged into any more
+  uint8_t first, last, high, low; // Roles of the kept trades
+} backlog_entry_t;
+
+typedef struct {
+  backlog_policy_t policy;
+  int64_t bucket_ms;              // Trades of a symbol within the same bucket (minute) are conflated
+  backlog_counts_cb counts;
+  backlog_entry_t *entries;       // Circular, 'capacity' entries (a power of two)
+  size_t capacity;
+  uint64_t head, tail;            // Sequence numbers of the oldest and next entry
+  uint64_t queued;                // Trades in the entries not in the ring yet
+  uint64_t *slot;                 // Per symbol ID: sequence + 1 of its entry open for merging
+  int slots;
+  char spill_path[64];
+  int spill_fd;                   // -1 until the first spill
+  off_t spill_read, spill_write;  // The spill file holds trade_t records between the two
+  trade_t spill_buf[BACKLOG_FLUSH_BATCH];   // Newest spilled trades, written out once full
+  size_t spill_buffered;
+  uint64_t waiting_max;           // Largest number of trades waiting at once (backlog and spill)
+  uint64_t ticks_dropped;         // Wall-clock ticks dropped, a backlog of nothing but ticks was full
+} backlog_t;
+
+// Backlog functions
+int backlog_parse_policy (const char *name);
+const char *backlog_policy_name (backlog_policy_t policy);
+int backlog_init (backlog_t *b, backlog_policy_t policy, size_t capacity, int64_t bucket_ms,
+                  const char *spill_path, backlog_counts_cb counts);
+void backlog_free (backlog_t *b);
+int backlog_publish (backlog_t *b, spsc_ring_t *ring, const trade_t *trades, size_t n);
+uint64_t backlog_flush (backlog_t *b, spsc_ring_t *ring);
+uint64_t backlog_waiting (const backlog_t *b);
+
+#endif
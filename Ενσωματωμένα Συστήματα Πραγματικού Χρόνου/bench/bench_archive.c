@@ -0,0 +1,252 @@
+/*
+Size, speed and exactness of the compressed trade log partitions (.tlz) against the .tlog.
+>Usage: ./bench_archive [hours] [file.tlog ...]
+  hours: length of the synthetic partitions (default 1, pi_code's default '-p hour')
+  files: recorded trade logs to compress as well (size and exactness only, they are not changed)
+Two synthetic partitions are written to the current directory and removed afterwards:
+  stock:  ~20 trades/s in bursts, price on a 0.01 grid around 180, volumes in shares (round lots common)
+  crypto: ~50 trades/s in bursts, price on a 0.01 grid around 63000, volumes on a 1e-5 grid
+For each: sizes and ratio, compression and decoding throughput, a bit-for-bit check of every row,
+and the cost of reading the trades of random 1-minute and 10-minute ranges three ways:
+  tlz:       decode only the blocks the index of the .tlz points at
+  tlog_seek: seek the .tlog with its footer index and read up to the end of the range
+  tlog_scan: read the whole .tlog
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "../tlog.h"
+#include "../tlz.h"
+#include "../trade.h"
+#include "bench_common.h"
+
+#define HOUR_MS 3600000LL
+#define QUERIES 200
+
+typedef struct {
+  const char *name;
+  double rate;          // Trades per second
+  double price;         // Start price
+  double tick;          // Price grid
+  double lot;           // Volume grid
+  int whole_lots;       // Volumes are mostly round lots of 100
+} profile_t;
+
+static double uniform (void)
+{
+  return (rand () + 1.0) / (RAND_MAX + 2.0);
+}
+
+// Write 'hours' of synthetic trades. Values go through trade_fixed() like the pipeline's.
+static uint64_t generate (const profile_t *p, int hours, const char *path)
+{
+  tlog_t *out = tlog_create (path, p->name);
+  int64_t time = 1700000000000LL, end = time + hours * HOUR_MS;
+  double ticks = p->price / p->tick, volume;
+  uint64_t rows = 0;
+  int burst = 0;
+
+  if (out == NULL) return 0;
+  while (time < end) {
+    // Bursts of trades in the same or next ms, then an exponential pause
+    if (burst > 0) {
+      burst--;
+      time += rand () % 3 == 0;
+    } else {
+      time += (int64_t)(-log (uniform ()) * 1300.0 / p->rate);
+      burst = rand () % 8 == 0 ? rand () % 6 : 0;
+    }
+    if (rand () % 3 == 0) ticks += (rand () % 2 ? 1 : -1) * (1 + rand () % 3);
+    if (p->whole_lots) volume = rand () % 4 == 0 ? 100.0 * (1 + rand () % 5) : 1 + rand () % 99;
+    else volume = floor (-log (uniform ()) * 2000.0 + 1) * p->lot;
+    tlog_append (out, trade_decimal (trade_fixed (ticks * p->tick)), trade_decimal (trade_fixed (volume)), time, time / 60000);
+    rows++;
+  }
+  tlog_close (out);
+  return rows;
+}
+
+static long file_size (const char *path)
+{
+  struct stat st;
+  return stat (path, &st) == 0 ? (long)st.st_size : -1;
+}
+
+// Compress 'tlog_path', check it row by row and print the sizes. Returns -1 on a mismatch.
+static int check (const char *tlog_path, const char *tlz_path, int timed)
+{
+  static double price[TLZ_BLOCK_ROWS], volume[TLZ_BLOCK_ROWS];
+  static int64_t time[TLZ_BLOCK_ROWS], closed[TLZ_BLOCK_ROWS];
+  tlog_reader_t raw;
+  tlz_reader_t packed;
+  const double *p, *v;
+  const int64_t *t, *c;
+  uint64_t row = 0, block = 0, mismatches = 0;
+  uint32_t n = 0, k = 0, rows;
+  long long start, compress_ns, decode_ns;
+
+  start = bench_now_ns ();
+  if (tlz_compress (tlog_path, tlz_path) < 0) {
+    perror (tlog_path);
+    return -1;
+  }
+  compress_ns = bench_now_ns () - start;
+  if (tlog_open (tlog_path, &raw) < 0 || tlz_open (tlz_path, &packed) < 0) {
+    perror (tlz_path);
+    return -1;
+  }
+
+  start = bench_now_ns ();
+  for (uint64_t b = 0; b < packed.blocks; b++) tlz_block (&packed, b, price, volume, time, closed);
+  decode_ns = bench_now_ns () - start;
+
+  // Walk both files row by row, their blocks have different sizes
+  for (uint64_t b = 0; b < raw.blocks; b++) {
+    rows = tlog_block (&raw, b, &p, &v, &t);
+    c = tlog_closed (&raw, b);
+    for (uint32_t i = 0; i < rows; i++, row++) {
+      if (k == n) {
+        n = tlz_block (&packed, block++, price, volume, time, closed);
+        k = 0;
+        if (n == 0) break;
+      }
+      if (memcmp (&p[i], &price[k], sizeof (double)) != 0 || memcmp (&v[i], &volume[k], sizeof (double)) != 0 ||
+          t[i] != time[k] || c[i] != closed[k]) {
+        if (mismatches++ < 10) fprintf (stderr, "%s: row %llu differs\n", tlz_path, (unsigned long long)row);
+      }
+      k++;
+    }
+  }
+  if (row != raw.rows || packed.rows != raw.rows) mismatches++;
+
+  printf ("%-28s %10llu %12ld %12ld %8.2fx %8.2f B/row %10s\n", tlog_path, (unsigned long long)raw.rows,
+          file_size (tlog_path), file_size (tlz_path), (double)file_size (tlog_path) / file_size (tlz_path),
+          (double)file_size (tlz_path) / (raw.rows ? raw.rows : 1), mismatches ? "MISMATCH" : "exact");
+  if (timed) {
+    printf ("%28s compress %.1f MB/s, decode %.1f M rows/s\n", "", raw.size / 1e6 / (compress_ns / 1e9),
+            raw.rows / 1e6 / (decode_ns / 1e9));
+  }
+  tlog_release (&raw);
+  tlz_release (&packed);
+  return mismatches ? -1 : 0;
+}
+
+// Sum of the volumes of the trades in [from, to) read from the .tlz
+static double range_tlz (const tlz_reader_t *r, int64_t from, int64_t to, uint64_t *decoded)
+{
+  static double price[TLZ_BLOCK_ROWS], volume[TLZ_BLOCK_ROWS];
+  static int64_t time[TLZ_BLOCK_ROWS];
+  uint64_t first, end;
+  uint32_t n;
+  double sum = 0;
+
+  tlz_range (r, from, to, &first, &end);
+  for (uint64_t b = first; b < end; b++) {
+    n = tlz_block (r, b, price, volume, time, NULL);
+    *decoded += n;
+    for (uint32_t i = 0; i < n; i++) {
+      if (time[i] >= from && time[i] < to) sum += volume[i];
+    }
+  }
+  return sum;
+}
+
+// Same from the .tlog, from its first block that can hold the range (or from the start)
+static double range_tlog (const tlog_reader_t *r, int64_t from, int64_t to, int seek, uint64_t *decoded)
+{
+  const double *price, *volume;
+  const int64_t *time;
+  uint32_t n;
+  double sum = 0;
+
+  for (uint64_t b = seek ? tlog_seek_time (r, from) : 0; b < r->blocks; b++) {
+    n = tlog_block (r, b, &price, &volume, &time);
+    *decoded += n;
+    for (uint32_t i = 0; i < n; i++) {
+      if (time[i] >= from && time[i] < to) sum += volume[i];
+    }
+    if (seek && r->index[b].first_time >= to) break;
+  }
+  return sum;
+}
+
+static void ranges (const char *tlog_path, const char *tlz_path, int minutes)
+{
+  tlog_reader_t raw;
+  tlz_reader_t packed;
+  const double *p, *v;
+  const int64_t *t;
+  int64_t first, last, from;
+  uint64_t rows[3] = { 0 };
+  long long ns[3] = { 0 }, start;
+  double sum[3];
+  int wrong = 0;
+
+  tlog_open (tlog_path, &raw);
+  tlz_open (tlz_path, &packed);
+  tlog_block (&raw, 0, &p, &v, &t);
+  first = t[0];
+  last = raw.index[raw.blocks - 1].last_time;
+
+  for (int q = 0; q < QUERIES; q++) {
+    from = first + (int64_t)(uniform () * (last - first - minutes * 60000LL));
+    start = bench_now_ns ();
+    sum[0] = range_tlz (&packed, from, from + minutes * 60000LL, &rows[0]);
+    ns[0] += bench_now_ns () - start;
+    start = bench_now_ns ();
+    sum[1] = range_tlog (&raw, from, from + minutes * 60000LL, 1, &rows[1]);
+    ns[1] += bench_now_ns () - start;
+    start = bench_now_ns ();
+    sum[2] = range_tlog (&raw, from, from + minutes * 60000LL, 0, &rows[2]);
+    ns[2] += bench_now_ns () - start;
+    if (sum[0] != sum[1] || sum[0] != sum[2]) wrong++;
+  }
+
+  const char *names[3] = { "tlz", "tlog_seek", "tlog_scan" };
+  for (int m = 0; m < 3; m++) {
+    printf ("%28s %2d min %-10s %10.1f us/query %10.0f rows read/query%s\n", "", minutes, names[m],
+            ns[m] / 1e3 / QUERIES, (double)rows[m] / QUERIES, wrong ? "  WRONG RESULTS" : "");
+  }
+  tlog_release (&raw);
+  tlz_release (&packed);
+}
+
+int main (int argc, char *argv[])
+{
+  profile_t profiles[] = {
+    { "STOCK", 20, 180.00, 0.01, 1, 1 },
+    { "CRYPTO", 50, 63000.00, 0.01, 0.00001, 0 },
+  };
+  int hours = argc > 1 ? atoi (argv[1]) : 1, failed = 0;
+  char tlog_path[64], tlz_path[64];
+
+  if (hours < 1) hours = 1;
+  srand (1);
+  printf ("%-28s %10s %12s %12s %9s %14s %10s\n", "file", "rows", "tlog_bytes", "tlz_bytes", "ratio", "", "check");
+  for (size_t i = 0; i < sizeof (profiles) / sizeof (profiles[0]); i++) {
+    snprintf (tlog_path, sizeof (tlog_path), "bench_archive_%s.tlog", profiles[i].name);
+    snprintf (tlz_path, sizeof (tlz_path), "bench_archive_%s.tlz", profiles[i].name);
+    if (generate (&profiles[i], hours, tlog_path) == 0) {
+      perror (tlog_path);
+      return 1;
+    }
+    if (check (tlog_path, tlz_path, 1) < 0) failed = 1;
+    else {
+      ranges (tlog_path, tlz_path, 1);
+      ranges (tlog_path, tlz_path, 10);
+    }
+    unlink (tlog_path);
+    unlink (tlz_path);
+  }
+
+  // Recorded logs, compressed next to a temporary name
+  for (int i = 2; i < argc; i++) {
+    snprintf (tlz_path, sizeof (tlz_path), "bench_archive_%d.tlz", i);
+    if (check (argv[i], tlz_path, 0) < 0) failed = 1;
+    unlink (tlz_path);
+  }
+  return failed;
+}
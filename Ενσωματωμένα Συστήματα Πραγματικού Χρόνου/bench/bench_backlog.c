@@ -0,0 +1,229 @@
+/*
+Overflow policies of the trade rings (backlog.h) with a worker slower than the feed.
+>Usage: ./bench_backlog [-t trades] [-s symbols] [-q queue_size] [-b burst] [-r rate] [-d consumer_ns]
+  -t: trades to publish (default 1000000), -s: symbols (default 16)
+  -q: capacity of the ring and of the backlog (default 512)
+  -b: trades per message, published at once like the producer does (default 64)
+  -r: trades per second of the feed (default 2000000, 0 for as fast as possible)
+  -d: work of the consumer per trade in ns, to make it slower than the producer (default 300)
+The producer publishes the messages at the feed rate and moves the waiting trades into the ring
+while it waits for the next message, like pi_code's network thread between two lws_service()
+calls. The worker builds 1-minute candles. Each policy reports how long the producer spent in a publish (p50, p99,
+max: the block policy waits for the worker there, the others must not), the trades dropped,
+conflated and spilled, and how many candles are identical (open, high, low, close, volume and
+their times) to the ones of the same trades fed straight into the candle code. Spill must give
+all of them, conflate too unless its backlog filled up (dropped > 0), drop-oldest loses some.
+On a single CPU the worker gets only part of it, and the publish times include the time the
+producer was preempted by the worker it woke up.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include "../backlog.h"
+#include "../candle.h"
+#include "../spsc_ring.h"
+#include "../trade.h"
+#include "bench_common.h"
+
+#define START 1700000000000LL
+#define MAX_CANDLES 4096      // Per symbol
+#define POP_BATCH 256
+
+static long trades = 1000000;
+static int symbols = 16;
+static size_t queue_size = 512;
+static int burst = 64;
+static long consumer_ns = 300;
+static long rate = 2000000;
+
+static trade_t *feed;
+static backlog_counts_t *counts;
+static spsc_ring_t *ring;
+
+typedef struct {
+  candle_series_t series;
+  candle_t candles[MAX_CANDLES];
+  int count;
+} symbol_candles_t;
+
+static symbol_candles_t *reference, *result;
+
+static backlog_counts_t *symbol_counts (int id)
+{
+  return &counts[id];
+}
+
+// A random walk per symbol, ~50 trades per symbol and minute, in exchange time order
+static void generate (void)
+{
+  int64_t *price = malloc (symbols * sizeof (int64_t)), time = START;
+
+  for (int s = 0; s < symbols; s++) price[s] = (100 + s) * TRADE_SCALE;
+  for (long i = 0; i < trades; i++) {
+    int id = rand () % symbols;
+    price[id] += (rand () % 2001 - 1000) * (TRADE_SCALE / 1000);
+    if (price[id] < TRADE_SCALE) price[id] = TRADE_SCALE;
+    time += rand () % (2 * 60000 / 50 / symbols + 1);
+    feed[i].price = price[id];
+    feed[i].volume = (1 + rand () % 1000) * (TRADE_SCALE / 10);
+    feed[i].time = time;
+    feed[i].id = id;
+    feed[i].pub_ns = 0;
+  }
+  free (price);
+}
+
+static void add (symbol_candles_t *all, const trade_t *t)
+{
+  symbol_candles_t *sc = &all[t->id];
+  int n;
+
+  n = candle_close (&sc->series, t->time, 0, sc->candles + sc->count, MAX_CANDLES - sc->count);
+  sc->count += n;
+  candle_add_trade (&sc->series, t->time, t->price, t->volume);
+}
+
+static void finish (symbol_candles_t *all)
+{
+  for (int s = 0; s < symbols; s++) {
+    symbol_candles_t *sc = &all[s];
+    sc->count += candle_close (&sc->series, feed[trades - 1].time + 2 * CANDLE_MINUTE_MS, 0,
+                               sc->candles + sc->count, MAX_CANDLES - sc->count);
+  }
+}
+
+static void *consumer (void *arg)
+{
+  trade_t batch[POP_BATCH];
+  size_t n;
+
+  (void)arg;
+  while ((n = spsc_ring_pop_batch (ring, batch, POP_BATCH)) > 0) {
+    for (size_t i = 0; i < n; i++) {
+      bench_spin_until (bench_now_ns () + consumer_ns);
+      add (result, &batch[i]);
+    }
+  }
+  return NULL;
+}
+
+static int same (const candle_t *a, const candle_t *b)
+{
+  return a->minute == b->minute && a->open == b->open && a->high == b->high && a->low == b->low &&
+         a->close == b->close && a->volume == b->volume && a->open_time == b->open_time &&
+         a->close_time == b->close_time;
+}
+
+static void run (backlog_policy_t policy)
+{
+  long messages = (trades + burst - 1) / burst, exact = 0, total = 0;
+  long long *samples = malloc (messages * sizeof (long long)), start, t0, t1;
+  uint64_t dropped = 0, conflated = 0, spilled = 0;
+  backlog_t backlog;
+  pthread_t thread;
+
+  memset (counts, 0, symbols * sizeof (backlog_counts_t));
+  for (int s = 0; s < symbols; s++) {
+    candle_series_init (&result[s].series, s, CANDLE_MINUTE_MS);
+    result[s].count = 0;
+  }
+  ring = spsc_ring_init (queue_size, sizeof (trade_t));
+  if (samples == NULL || ring == NULL ||
+      backlog_init (&backlog, policy, queue_size, CANDLE_MINUTE_MS, "bench_backlog.spill", symbol_counts) < 0) {
+    fprintf (stderr, "bench_backlog: out of memory\n");
+    exit (1);
+  }
+  pthread_create (&thread, NULL, consumer, NULL);
+
+  start = bench_now_ns ();
+  for (long m = 0; m < messages; m++) {
+    long first = m * burst, n = first + burst > trades ? trades - first : burst;
+    // Waiting for the next message, like lws_service() with a short timeout
+    while (rate > 0 && bench_now_ns () < start + (long long)(first * 1e9 / rate)) {
+      if (backlog_flush (&backlog, ring) == 0) sched_yield ();
+    }
+    t0 = bench_now_ns ();
+    backlog_publish (&backlog, ring, feed + first, n);
+    t1 = bench_now_ns ();
+    samples[m] = t1 - t0;
+  }
+  while (backlog_flush (&backlog, ring) > 0) sched_yield ();
+  spsc_ring_close (ring);
+  pthread_join (thread, NULL);
+  t1 = bench_now_ns ();
+  finish (result);
+
+  for (int s = 0; s < symbols; s++) {
+    dropped += counts[s].dropped;
+    conflated += counts[s].conflated;
+    spilled += counts[s].spilled;
+    total += reference[s].count;
+    for (int k = 0; k < reference[s].count && k < result[s].count; k++) exact += same (&reference[s].candles[k], &result[s].candles[k]);
+  }
+  bench_sort (samples, messages);
+  printf ("%-12s %8.1f %8.1f %9.1f %9.3f %9llu %9llu %9llu %8llu %6ld/%ld\n", backlog_policy_name (policy),
+          bench_percentile (samples, messages, 50) / 1e3, bench_percentile (samples, messages, 99) / 1e3,
+          samples[messages - 1] / 1e3, (t1 - start) / 1e9, (unsigned long long)dropped,
+          (unsigned long long)conflated, (unsigned long long)spilled,
+          (unsigned long long)backlog.waiting_max, exact, total);
+
+  backlog_free (&backlog);
+  spsc_ring_delete (ring);
+  free (samples);
+}
+
+int main (int argc, char *argv[])
+{
+  int opt;
+
+  while ((opt = getopt (argc, argv, "t:s:q:b:r:d:")) != -1) {
+    switch (opt) {
+      case 't':
+        trades = atol (optarg);
+        break;
+      case 's':
+        symbols = atoi (optarg);
+        break;
+      case 'q':
+        queue_size = (size_t)atol (optarg);
+        break;
+      case 'b':
+        burst = atoi (optarg);
+        break;
+      case 'r':
+        rate = atol (optarg);
+        break;
+      case 'd':
+        consumer_ns = atol (optarg);
+        break;
+      default:
+        fprintf (stderr, "Usage: %s [-t trades] [-s symbols] [-q queue_size] [-b burst] [-r rate] [-d consumer_ns]\n", argv[0]);
+        return 1;
+    }
+  }
+  if (trades < 1 || symbols < 1 || queue_size < 2 || burst < 1 || rate < 0 || consumer_ns < 0) return 1;
+
+  feed = malloc (trades * sizeof (trade_t));
+  counts = malloc (symbols * sizeof (backlog_counts_t));
+  reference = malloc (symbols * sizeof (symbol_candles_t));
+  result = malloc (symbols * sizeof (symbol_candles_t));
+  if (feed == NULL || counts == NULL || reference == NULL || result == NULL) return 1;
+  srand (1);
+  generate ();
+  for (int s = 0; s < symbols; s++) {
+    candle_series_init (&reference[s].series, s, CANDLE_MINUTE_MS);
+    reference[s].count = 0;
+  }
+  for (long i = 0; i < trades; i++) add (reference, &feed[i]);
+  finish (reference);
+
+  printf ("%ld trades of %d symbols at %ld/s, %d per message, ring and backlog of %zu, worker %ld ns per trade\n",
+          trades, symbols, rate, burst, queue_size, consumer_ns);
+  printf ("%-12s %8s %8s %9s %9s %9s %9s %9s %8s %s\n", "policy", "p50 us", "p99 us", "max us", "total s",
+          "dropped", "conflated", "spilled", "waiting", "exact candles");
+  for (int p = BACKLOG_BLOCK; p <= BACKLOG_SPILL; p++) run ((backlog_policy_t)p);
+  return 0;
+}
@@ -0,0 +1,42 @@
+#ifndef BENCH_COMMON_H
+#define BENCH_COMMON_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+// Monotonic time in nanoseconds
+static inline long long bench_now_ns (void)
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// Busy-wait until the given monotonic deadline (used to pace producers without a syscall)
+static inline void bench_spin_until (long long deadline_ns)
+{
+  while (bench_now_ns () < deadline_ns)
+    ;
+}
+
+static int bench_cmp_ll (const void *a, const void *b)
+{
+  long long x = *(const long long *)a, y = *(const long long *)b;
+  return (x > y) - (x < y);
+}
+
+// Sort the samples so that bench_percentile() can be used on them
+static inline void bench_sort (long long *samples, size_t n)
+{
+  qsort (samples, n, sizeof (long long), bench_cmp_ll);
+}
+
+// Value at percentile 'p' (0-100) of already sorted samples
+static inline long long bench_percentile (const long long *sorted, size_t n, double p)
+{
+  if (n == 0) return 0;
+  return sorted[(size_t)(p / 100.0 * (double)(n - 1) + 0.5)];
+}
+
+#endif
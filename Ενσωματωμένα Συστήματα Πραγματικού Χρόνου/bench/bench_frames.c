@@ -0,0 +1,147 @@
+/*
+Throughput of handing whole WebSocket messages to a worker, one push per trade versus one batch push per message.
+>Usage: ./bench_frames [frames] [gap_us]
+  frames: number of messages pushed per run (default 50000)
+  gap_us: pause between messages in the paced run, in microseconds (default 50)
+Every message carries 'frame size' trades stamped with the same receive time, like pi_code.c does.
+The burst run shows frames/s and trades/s, the paced run shows how many times the consumer
+wakes up per message (pops/frame) and the handoff latency of the last trade of each message.
+*/
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../trade.h"
+#include "../spsc_ring.h"
+#include "bench_common.h"
+
+#define QUEUESIZE 512
+#define CONSUMER_BATCH 256
+#define MAX_FRAME 256
+
+static const int frame_sizes[] = { 1, 4, 16, 64, 256 };
+
+typedef struct {
+  const char *name;
+  int use_batch;
+  long frames;
+  int frame_size;
+  long gap_ns;
+  spsc_ring_t *ring;
+  long pops;            // Number of times the consumer got trades out of the ring
+  long long *latency;   // Handoff latency of the last trade of each message
+  long long elapsed_ns;
+} run_t;
+
+static void *producer (void *arg)
+{
+  run_t *run = arg;
+  trade_t frame[MAX_FRAME];
+  long long next = bench_now_ns (), recv_time;
+
+  memset (frame, 0, sizeof (frame));
+  for (int k = 0; k < run->frame_size; k++) {
+    frame[k].price = trade_fixed (63000.0);
+    frame[k].volume = trade_fixed (0.01);
+    frame[k].id = k;
+  }
+
+  for (long f = 0; f < run->frames; f++) {
+    if (run->gap_ns > 0) {
+      next += run->gap_ns;
+      bench_spin_until (next);
+    }
+
+    // All trades of a message arrived together and share the receive time
+    recv_time = bench_now_ns ();
+    for (int k = 0; k < run->frame_size; k++) {
+      frame[k].time = f;
+      frame[k].pub_ns = (uint32_t)recv_time;
+    }
+
+    if (run->use_batch) {
+      spsc_ring_push_batch (run->ring, frame, run->frame_size);
+    } else {
+      for (int k = 0; k < run->frame_size; k++) spsc_ring_push (run->ring, &frame[k]);
+    }
+  }
+  return (NULL);
+}
+
+static void *consumer (void *arg)
+{
+  run_t *run = arg;
+  trade_t batch[CONSUMER_BATCH];
+  long received = 0, total = run->frames * run->frame_size;
+  long long now;
+  size_t n;
+
+  while (received < total) {
+    n = spsc_ring_pop_batch (run->ring, batch, CONSUMER_BATCH);
+    run->pops++;
+
+    now = bench_now_ns ();
+    for (size_t k = 0; k < n; k++) {
+      if (batch[k].id == run->frame_size - 1) run->latency[batch[k].time] = trade_age_ns (&batch[k], now);
+    }
+    received += n;
+  }
+  return (NULL);
+}
+
+static void run_once (run_t *run)
+{
+  pthread_t pro, con;
+  long long start;
+
+  run->ring = spsc_ring_init (QUEUESIZE, sizeof (trade_t));
+  run->pops = 0;
+
+  start = bench_now_ns ();
+  pthread_create (&con, NULL, consumer, run);
+  pthread_create (&pro, NULL, producer, run);
+  pthread_join (pro, NULL);
+  pthread_join (con, NULL);
+  run->elapsed_ns = bench_now_ns () - start;
+
+  spsc_ring_delete (run->ring);
+}
+
+static void report (const char *mode, run_t *run)
+{
+  double seconds = run->elapsed_ns / 1e9;
+
+  bench_sort (run->latency, run->frames);
+  printf ("%-6s %-10s %5d %11.0f %12.0f %11.2f %9lld %9lld\n", mode, run->name, run->frame_size,
+          run->frames / seconds, run->frames * run->frame_size / seconds,
+          (double)run->pops / run->frames,
+          bench_percentile (run->latency, run->frames, 50.0),
+          bench_percentile (run->latency, run->frames, 99.0));
+}
+
+int main (int argc, char *argv[])
+{
+  long frames = argc > 1 ? atol (argv[1]) : 50000;
+  long gap_us = argc > 2 ? atol (argv[2]) : 50;
+  run_t runs[2] = {
+    { .name = "per-trade", .use_batch = 0 },
+    { .name = "batch", .use_batch = 1 },
+  };
+
+  printf ("%-6s %-10s %5s %11s %12s %11s %9s %9s\n", "mode", "push", "frame", "frames/s", "trades/s", "pops/frame", "p50_ns", "p99_ns");
+
+  for (int paced = 0; paced <= 1; paced++) {
+    for (size_t s = 0; s < sizeof (frame_sizes) / sizeof (frame_sizes[0]); s++) {
+      for (int i = 0; i < 2; i++) {
+        runs[i].frames = frames;
+        runs[i].frame_size = frame_sizes[s];
+        runs[i].gap_ns = paced ? gap_us * 1000 : 0;
+        runs[i].latency = calloc (frames, sizeof (long long));
+        run_once (&runs[i]);
+        report (paced ? "paced" : "burst", &runs[i]);
+        free (runs[i].latency);
+      }
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,459 @@
+/*
+Exactness and cost of the incremental indicators (indicator.h) against a brute-force recomputation.
+>Usage: ./bench_indicators [-I indicators_file] [-n minutes] [-s symbols] [-t trades] [-r replay_dir symbol ...]
+  -I: indicators to check (default every built-in one: ema(20) rsi(14) bollinger(20,2) atr(14) vwapdev(15)),
+      use '*' rules, the synthetic symbols are SYN0, SYN1 ...
+  -n: minutes of synthetic trades (default 1440), -s: synthetic symbols (default 4)
+  -t: average trades per minute of a symbol (default 50), 10% of the minutes have none and 5% of
+      the trades are out of order by up to 3 s, so some are late
+  -r: instead, replay the trade logs of these symbols from a directory (pi_code's -r)
+Every trade of a symbol goes through the candles and the indicators the way its worker feeds them:
+the minutes it moves past are closed (grace period 2 s) and handed to the indicators first, then
+the trade is added if it isn't late. After the last trade every open minute is closed.
+The reference recomputes every value of every closed minute from the whole history of the symbol
+(the closed candles and the accepted trades), in long double. A value matches if both are NAN or
+they differ by less than 1e-9 of the larger of 1 and the reference. Reports the mismatches of each
+indicator and the cost of the trade and candle hooks.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include "../indicator.h"
+#include "../candle.h"
+#include "../archive.h"
+#include "../replay.h"
+#include "../trade.h"
+#include "bench_common.h"
+
+#define GRACE_MS CANDLE_DEFAULT_GRACE_MS
+#define START 1700000000000LL
+#define TOLERANCE 1e-9
+#define DEFAULT_CONFIG "* ema(20) rsi(14) bollinger(20,2) atr(14) vwapdev(15)\n"
+
+typedef struct {
+  int64_t price, volume, time;
+  size_t closed;            // Candles of the symbol closed before the trade was added
+} ref_trade_t;
+
+typedef struct {
+  char name[32];
+  candle_series_t series;
+  indicator_set_t set;
+  ref_trade_t *trades;
+  size_t trade_count, trade_cap;
+  candle_t *candles;
+  double *values;           // set.values of every candle, as the indicators gave them
+  size_t candle_count, candle_cap;
+  long *events;             // Trade index, or -1 - candle index, in the order the indicators saw them
+  size_t event_count, event_cap;
+  uint64_t late;
+} bench_symbol_t;
+
+static void *grow (void *p, size_t *cap, size_t need, size_t size)
+{
+  if (need <= *cap) return p;
+  *cap = *cap ? *cap * 2 : 1024;
+  if (*cap < need) *cap = need;
+  if ((p = realloc (p, *cap * size)) == NULL) {
+    fprintf (stderr, "Out of memory\n");
+    exit (1);
+  }
+  return p;
+}
+
+static void add_event (bench_symbol_t *s, long e)
+{
+  s->events = grow (s->events, &s->event_cap, s->event_count + 1, sizeof (long));
+  s->events[s->event_count++] = e;
+}
+
+static void close_minutes (bench_symbol_t *s, int64_t watermark)
+{
+  candle_t out[64];
+  size_t cap;
+  int n;
+
+  do {
+    n = candle_close (&s->series, watermark, GRACE_MS, out, 64);
+    for (int k = 0; k < n; k++) {
+      cap = s->candle_cap;
+      s->candles = grow (s->candles, &s->candle_cap, s->candle_count + 1, sizeof (candle_t));
+      s->values = grow (s->values, &cap, s->candle_count + 1, INDICATOR_MAX_VALUES * sizeof (double));
+      s->candles[s->candle_count] = out[k];
+      indicator_set_candle (&s->set, &out[k], &s->values[s->candle_count * INDICATOR_MAX_VALUES]);
+      add_event (s, -1 - (long)s->candle_count);
+      s->candle_count++;
+    }
+  } while (n == 64);
+}
+
+static void feed (bench_symbol_t *s, int64_t price, int64_t volume, int64_t time)
+{
+  if (time > s->series.watermark) close_minutes (s, time);
+  if (candle_add_trade (&s->series, time, price, volume) < 0) {
+    s->late++;
+    return;
+  }
+  indicator_set_trade (&s->set, price, volume, time);
+  s->trades = grow (s->trades, &s->trade_cap, s->trade_count + 1, sizeof (ref_trade_t));
+  s->trades[s->trade_count] = (ref_trade_t){ price, volume, time, s->candle_count };
+  add_event (s, (long)s->trade_count++);
+}
+
+static void finish (bench_symbol_t *s)
+{
+  if (s->series.watermark != INT64_MIN) close_minutes (s, s->series.watermark + CANDLE_MINUTE_MS + GRACE_MS);
+}
+
+static double random_unit (void)
+{
+  return (rand () + 0.5) / ((double)RAND_MAX + 1);
+}
+
+static void synthetic (bench_symbol_t *syms, int count, int minutes, int per_minute)
+{
+  double *price = malloc (count * sizeof (double));
+  int64_t time;
+  int trades;
+
+  for (int s = 0; s < count; s++) price[s] = 50.0 * (s + 1);
+  for (int m = 0; m < minutes; m++) {
+    for (int s = 0; s < count; s++) {
+      trades = random_unit () < 0.1 ? 0 : (int)(random_unit () * 2 * per_minute);
+      for (int k = 0; k < trades; k++) {
+        time = START + (int64_t)m * CANDLE_MINUTE_MS + (int64_t)k * CANDLE_MINUTE_MS / trades;
+        if (random_unit () < 0.05) time -= (int64_t)(random_unit () * 3000);
+        price[s] *= exp ((random_unit () - 0.5) * 0.002);
+        feed (&syms[s], trade_fixed (price[s]), trade_fixed (random_unit () * 100), time);
+      }
+    }
+  }
+  free (price);
+}
+
+static int replayed (bench_symbol_t *syms, int count, const char *dir)
+{
+  replay_t r;
+  char **paths;
+  int id, n;
+  double price, volume;
+  int64_t time, closed;
+
+  if (replay_init (&r, count) < 0) return -1;
+  for (int s = 0; s < count; s++) {
+    n = archive_list (dir, syms[s].name, &paths);
+    if (n > 0 && replay_add (&r, paths, n, s) < 0) return -1;
+    if (n <= 0) fprintf (stderr, "No trade log of %s in %s\n", syms[s].name, dir);
+    archive_list_free (paths, n > 0 ? n : 0);
+  }
+  while (replay_next (&r, &id, &price, &volume, &time, &closed)) feed (&syms[id], trade_fixed (price), trade_fixed (volume), time);
+  replay_free (&r);
+  return 0;
+}
+
+// Closes of the non-empty candles 0..k
+static size_t closes (const bench_symbol_t *s, size_t k, long double *out)
+{
+  size_t n = 0;
+
+  for (size_t i = 0; i <= k; i++) {
+    if (s->candles[i].bucket.trades > 0) out[n++] = trade_decimal (s->candles[i].close);
+  }
+  return n;
+}
+
+static void ref_ema (const long double *x, size_t count, int n, double *out)
+{
+  long double alpha = 2.0L / (n + 1), ema = 0;
+
+  if (count < (size_t)n) {
+    out[0] = NAN;
+    return;
+  }
+  for (int i = 0; i < n; i++) ema += x[i];
+  ema /= n;
+  for (size_t i = n; i < count; i++) ema += alpha * (x[i] - ema);
+  out[0] = (double)ema;
+}
+
+// Wilder's average of the 'count' samples
+static long double wilder (const long double *x, size_t count, int n)
+{
+  long double avg = 0;
+
+  for (int i = 0; i < n; i++) avg += x[i];
+  avg /= n;
+  for (size_t i = n; i < count; i++) avg = (avg * (n - 1) + x[i]) / n;
+  return avg;
+}
+
+static void ref_rsi (const long double *x, size_t count, int n, long double *tmp, double *out)
+{
+  long double gain, loss;
+  size_t changes = count > 0 ? count - 1 : 0;
+
+  if (changes < (size_t)n) {
+    out[0] = NAN;
+    return;
+  }
+  for (size_t i = 0; i < changes; i++) tmp[i] = x[i + 1] > x[i] ? x[i + 1] - x[i] : 0;
+  gain = wilder (tmp, changes, n);
+  for (size_t i = 0; i < changes; i++) tmp[i] = x[i + 1] < x[i] ? x[i] - x[i + 1] : 0;
+  loss = wilder (tmp, changes, n);
+  if (loss == 0) out[0] = gain == 0 ? 50 : 100;
+  else out[0] = (double)(100 - 100 / (1 + gain / loss));
+}
+
+static void ref_bollinger (const long double *x, size_t count, int n, double k, double *out)
+{
+  long double mean = 0, var = 0;
+
+  if (count < (size_t)n) {
+    out[0] = out[1] = out[2] = NAN;
+    return;
+  }
+  for (size_t i = count - n; i < count; i++) mean += x[i];
+  mean /= n;
+  for (size_t i = count - n; i < count; i++) var += (x[i] - mean) * (x[i] - mean);
+  var = sqrtl (var / n);
+  out[0] = (double)mean;
+  out[1] = (double)(mean + k * var);
+  out[2] = (double)(mean - k * var);
+}
+
+static void ref_atr (const bench_symbol_t *s, size_t k, int n, long double *tmp, double *out)
+{
+  size_t count = 0;
+  long double high, low, prev = 0;
+
+  for (size_t i = 0; i <= k; i++) {
+    const candle_t *c = &s->candles[i];
+    if (c->bucket.trades == 0) continue;
+    high = trade_decimal (c->high);
+    low = trade_decimal (c->low);
+    if (count > 0) {
+      if (prev > high) high = prev;
+      if (prev < low) low = prev;
+    }
+    tmp[count++] = high - low;
+    prev = trade_decimal (c->close);
+  }
+  out[0] = count < (size_t)n ? NAN : (double)wilder (tmp, count, n);
+}
+
+// Deviations of the trades added between the closes of candles k - 1 and k, each against the
+// VWAP of the n candles closed before it and of every trade of the minutes still open then
+static void ref_vwapdev (const bench_symbol_t *s, size_t k, size_t first, int n, double *out)
+{
+  long double notional, volume, vwap, dev, last = NAN, max = NAN;
+  int64_t open_from = s->candles[k].minute;
+
+  for (size_t j = first; j < s->trade_count && s->trades[j].closed == k; j++) {
+    notional = volume = 0;
+    for (size_t i = k > (size_t)n ? k - n : 0; i < k; i++) {
+      notional += s->candles[i].bucket.notional;
+      volume += s->candles[i].bucket.volume;
+    }
+    // A trade added while fewer than k - CANDLE_MAX_OPEN candles were closed was in a minute closed since
+    for (size_t i = j + 1; i-- > 0 && s->trades[i].closed + CANDLE_MAX_OPEN > k;) {
+      if (candle_bucket (s->trades[i].time, CANDLE_MINUTE_MS) * CANDLE_MINUTE_MS < open_from) continue;
+      notional += trade_notional (s->trades[i].price, s->trades[i].volume);
+      volume += s->trades[i].volume;
+    }
+    if (notional <= 0 || volume <= 0) continue;
+    vwap = notional / volume * TRADE_SCALE;
+    dev = (s->trades[j].price - vwap) / vwap * 100;
+    last = dev;
+    if (isnan (max) || fabsl (dev) > fabsl (max)) max = dev;
+  }
+  out[0] = (double)last;
+  out[1] = (double)max;
+}
+
+static int same (double value, double ref)
+{
+  if (isnan (value) || isnan (ref)) return isnan (value) && isnan (ref);
+  return fabs (value - ref) <= TOLERANCE * fmax (1, fabs (ref));
+}
+
+// Compare every value of every candle of a symbol, count the checks and mismatches per value
+static void check (const bench_symbol_t *s, uint64_t *checked, uint64_t *wrong, int *unchecked)
+{
+  long double *x = malloc ((s->candle_count + 1) * sizeof (long double));
+  long double *tmp = malloc ((s->candle_count + 1) * sizeof (long double));
+  double ref[INDICATOR_MAX_VALUES];
+  const double *value;
+  const indicator_spec_t *spec;
+  size_t count, first = 0;
+  int v, n;
+
+  for (size_t k = 0; k < s->candle_count; k++) {
+    count = closes (s, k, x);
+    value = &s->values[k * INDICATOR_MAX_VALUES];
+    v = 0;
+    while (first < s->trade_count && s->trades[first].closed < k) first++;
+    for (int i = 0; i < s->set.count; v += spec->outputs, i++) {
+      spec = s->set.spec[i];
+      n = (int)spec->params[0];
+      if (strcmp (spec->ind->name, "ema") == 0) ref_ema (x, count, n, ref);
+      else if (strcmp (spec->ind->name, "rsi") == 0) ref_rsi (x, count, n, tmp, ref);
+      else if (strcmp (spec->ind->name, "bollinger") == 0) ref_bollinger (x, count, n, spec->count > 1 ? spec->params[1] : 2, ref);
+      else if (strcmp (spec->ind->name, "atr") == 0) ref_atr (s, k, n, tmp, ref);
+      else if (strcmp (spec->ind->name, "vwapdev") == 0) ref_vwapdev (s, k, first, n, ref);
+      else {
+        for (int o = 0; o < spec->outputs; o++) unchecked[v + o] = 1;
+        continue;
+      }
+      for (int o = 0; o < spec->outputs; o++) {
+        checked[v + o]++;
+        if (!same (value[v + o], ref[o])) {
+          if (wrong[v + o]++ == 0) {
+            fprintf (stderr, "%s minute %lld value %d: %.12g, reference %.12g\n", s->name,
+                     (long long)s->candles[k].minute, v + o, value[v + o], ref[o]);
+          }
+        }
+      }
+    }
+  }
+  free (x);
+  free (tmp);
+}
+
+// Time the hooks alone on the same trades and candles: all of them, then the candles only
+static void time_hooks (bench_symbol_t *syms, int count, const indicator_config_t *cfg, double *trade_ns, double *candle_ns)
+{
+  indicator_set_t set;
+  double values[INDICATOR_MAX_VALUES];
+  long long t0, all = 0, candles_only = 0;
+  uint64_t trades = 0, candles = 0;
+  const ref_trade_t *t;
+
+  for (int s = 0; s < count; s++) {
+    indicator_set_init (&set, cfg, syms[s].name);
+    t0 = bench_now_ns ();
+    for (size_t e = 0; e < syms[s].event_count; e++) {
+      long ev = syms[s].events[e];
+      if (ev < 0) {
+        indicator_set_candle (&set, &syms[s].candles[-1 - ev], values);
+        continue;
+      }
+      t = &syms[s].trades[ev];
+      indicator_set_trade (&set, t->price, t->volume, t->time);
+    }
+    all += bench_now_ns () - t0;
+    indicator_set_free (&set);
+
+    indicator_set_init (&set, cfg, syms[s].name);
+    t0 = bench_now_ns ();
+    for (size_t k = 0; k < syms[s].candle_count; k++) indicator_set_candle (&set, &syms[s].candles[k], values);
+    candles_only += bench_now_ns () - t0;
+    indicator_set_free (&set);
+
+    trades += syms[s].trade_count;
+    candles += syms[s].candle_count;
+  }
+  *candle_ns = candles ? (double)candles_only / candles : 0;
+  *trade_ns = trades ? (double)(all - candles_only) / trades : 0;
+}
+
+int main (int argc, char *argv[])
+{
+  const char *config = NULL, *dir = NULL;
+  char tmp_path[] = "/tmp/bench_indicators.XXXXXX";
+  indicator_config_t cfg;
+  bench_symbol_t *syms;
+  uint64_t checked[INDICATOR_MAX_VALUES] = { 0 }, wrong[INDICATOR_MAX_VALUES] = { 0 }, trades = 0, candles = 0, late = 0, failed = 0;
+  int unchecked[INDICATOR_MAX_VALUES] = { 0 };
+  int opt, minutes = 1440, count = 4, per_minute = 50, fd;
+  double trade_ns, candle_ns;
+  char column[64];
+
+  while ((opt = getopt (argc, argv, "I:n:s:t:r:")) != -1) {
+    switch (opt) {
+      case 'I':
+        config = optarg;
+        break;
+      case 'n':
+        minutes = atoi (optarg);
+        break;
+      case 's':
+        count = atoi (optarg);
+        break;
+      case 't':
+        per_minute = atoi (optarg);
+        break;
+      case 'r':
+        dir = optarg;
+        break;
+      default:
+        fprintf (stderr, "Usage: %s [-I indicators_file] [-n minutes] [-s symbols] [-t trades] [-r replay_dir symbol ...]\n", argv[0]);
+        return 1;
+    }
+  }
+  if (dir != NULL) count = argc - optind;
+  if (count < 1 || minutes < 1 || per_minute < 1) return 1;
+
+  if (config == NULL) {
+    if ((fd = mkstemp (tmp_path)) < 0 || write (fd, DEFAULT_CONFIG, strlen (DEFAULT_CONFIG)) < 0) return 1;
+    close (fd);
+    config = tmp_path;
+  }
+  fd = indicator_config_load (&cfg, config);
+  if (config == tmp_path) unlink (tmp_path);
+  if (fd < 0) return 1;
+
+  syms = calloc (count, sizeof (bench_symbol_t));
+  for (int s = 0; s < count; s++) {
+    if (dir != NULL) snprintf (syms[s].name, sizeof (syms[s].name), "%s", argv[optind + s]);
+    else snprintf (syms[s].name, sizeof (syms[s].name), "SYN%d", s);
+    candle_series_init (&syms[s].series, s, CANDLE_MINUTE_MS);
+    if (indicator_set_init (&syms[s].set, &cfg, syms[s].name) < 0) return 1;
+  }
+
+  srand (1);
+  if (dir != NULL) {
+    if (replayed (syms, count, dir) < 0) return 1;
+  } else {
+    synthetic (syms, count, minutes, per_minute);
+  }
+
+  for (int s = 0; s < count; s++) {
+    finish (&syms[s]);
+    trades += syms[s].trade_count;
+    candles += syms[s].candle_count;
+    late += syms[s].late;
+  }
+  printf ("%d symbols, %llu trades (%llu late, dropped), %llu minutes closed\n", count,
+          (unsigned long long)trades, (unsigned long long)late, (unsigned long long)candles);
+
+  for (int s = 0; s < count; s++) {
+    memset (checked, 0, sizeof (checked));
+    memset (wrong, 0, sizeof (wrong));
+    check (&syms[s], checked, wrong, unchecked);
+    for (int v = 0; v < syms[s].set.values; v++) {
+      indicator_set_column (&syms[s].set, v, column, sizeof (column));
+      if (unchecked[v]) printf ("%-10s %-24s no reference\n", syms[s].name, column);
+      else printf ("%-10s %-24s %8llu values, %llu mismatches\n", syms[s].name, column,
+                   (unsigned long long)checked[v], (unsigned long long)wrong[v]);
+      failed += wrong[v];
+    }
+    memset (unchecked, 0, sizeof (unchecked));
+  }
+
+  time_hooks (syms, count, &cfg, &trade_ns, &candle_ns);
+  printf ("trade hooks: %.1f ns per trade, candle hooks: %.1f ns per minute (all the indicators of a symbol)\n",
+          trade_ns, candle_ns);
+
+  for (int s = 0; s < count; s++) {
+    indicator_set_free (&syms[s].set);
+    free (syms[s].trades);
+    free (syms[s].candles);
+    free (syms[s].values);
+    free (syms[s].events);
+  }
+  free (syms);
+  indicator_config_free (&cfg);
+  return failed > 0;
+}
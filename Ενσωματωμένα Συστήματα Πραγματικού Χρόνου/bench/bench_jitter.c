@@ -0,0 +1,184 @@
+/*
+Tail latency of the producer to consumer hand-off with and without the real-time placement (rt_thread.h).
+>Usage: ./bench_jitter [-R placement] [-s seconds] [-r rate] [-l load_threads]
+  -R: placement of the second run, a file like rt.conf or inline lines
+      (default "main 0; producer 1 fifo 70; consumer 2 fifo 80; mlock")
+  -s: length of each run in seconds (default 10)
+  -r: messages per second (default 2000)
+  -l: threads of background load on any CPU (default two per CPU)
+A producer wakes up at fixed deadlines like a message arriving, pushes a timestamp into an SPSC
+ring and a consumer takes it out, while the load threads fault memory in, pollute the caches and
+write files. Each run reports the wake-up lateness of the producer and the hand-off latency
+(deadline to consumer) as p50/p99/p99.9/max, first with the default scheduling, then placed.
+Run it as root (or with CAP_SYS_NICE and CAP_IPC_LOCK) for the placement to apply, otherwise
+it falls back and says so.
+*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include "../latency.h"
+#include "../rt_thread.h"
+#include "../spsc_ring.h"
+#include "bench_common.h"
+
+#define DEFAULT_PLACEMENT "main 0; producer 1 fifo 70; consumer 2 fifo 80; mlock"
+#define LOAD_BYTES (4 * 1024 * 1024)
+#define LOAD_WRITE 65536
+
+static spsc_ring_t *ring;
+static latency_hist_t wakeup, handoff;
+static _Atomic int load_stop;
+static double seconds = 10;
+static long rate = 2000;
+
+// Background load: page faults, cache misses and file writes, the way logging and the kernel disturb the pipeline
+static void *load (void *arg)
+{
+  char path[] = "/tmp/bench_jitter.XXXXXX";
+  char *block = malloc (LOAD_WRITE);
+  int fd = mkstemp (path);
+
+  (void)arg;
+  if (fd >= 0) unlink (path);
+  if (block != NULL) memset (block, 1, LOAD_WRITE);
+  while (!atomic_load_explicit (&load_stop, memory_order_relaxed)) {
+    char *buf = malloc (LOAD_BYTES);
+    if (buf != NULL) {
+      memset (buf, 2, LOAD_BYTES);
+      free (buf);
+    }
+    if (fd >= 0 && block != NULL && write (fd, block, LOAD_WRITE) == LOAD_WRITE && lseek (fd, 0, SEEK_CUR) > 64 * LOAD_WRITE) {
+      if (ftruncate (fd, 0) < 0 || lseek (fd, 0, SEEK_SET) < 0) break;
+    }
+  }
+  if (fd >= 0) close (fd);
+  free (block);
+  return NULL;
+}
+
+// Wakes up at every deadline and hands the deadline to the consumer
+static void *producer (void *arg)
+{
+  long messages = (long)(seconds * rate);
+  int64_t period = 1000000000LL / rate, deadline;
+  struct timespec ts;
+
+  (void)arg;
+  rt_place_self (RT_PRODUCER, 0);
+  deadline = latency_now_ns () + period;
+  for (long i = 0; i < messages; i++, deadline += period) {
+    ts.tv_sec = deadline / 1000000000LL;
+    ts.tv_nsec = deadline % 1000000000LL;
+    while (clock_nanosleep (CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) != 0)
+      ;
+    latency_record (&wakeup, latency_now_ns () - deadline);
+    spsc_ring_push (ring, &deadline);
+  }
+  spsc_ring_close (ring);
+  return NULL;
+}
+
+static void *consumer (void *arg)
+{
+  int64_t batch[64];
+  size_t n;
+
+  (void)arg;
+  rt_place_self (RT_CONSUMER, 0);
+  while ((n = spsc_ring_pop_batch (ring, batch, 64)) > 0) {
+    int64_t now = latency_now_ns ();
+    for (size_t i = 0; i < n; i++) latency_record (&handoff, now - batch[i]);
+  }
+  return NULL;
+}
+
+static void report (const char *run, const char *stage, latency_hist_t *h)
+{
+  latency_prev_t prev;
+  latency_stats_t s;
+
+  memset (&prev, 0, sizeof (prev));
+  latency_snapshot (h, &prev, &s);
+  printf ("%-8s %-8s %9llu %9.1f %9.1f %9.1f %9.1f\n", run, stage, (unsigned long long)s.count,
+          s.p50 / 1e3, s.p99 / 1e3, s.p999 / 1e3, s.max / 1e3);
+  memset (h, 0, sizeof (*h));
+}
+
+// One run: the load on any CPU, the producer and the consumer placed by their role
+static void run (const char *name, int loads, const cpu_set_t *any)
+{
+  pthread_t prod, cons, load_threads[loads];
+  pthread_attr_t attr;
+  struct sched_param param = { 0 };
+
+  ring = spsc_ring_init (1024, sizeof (int64_t));
+  if (ring == NULL) exit (1);
+  if (rt_busy_poll (1)) spsc_event_busy_poll (&ring->not_empty, 1);
+  atomic_store (&load_stop, 0);
+
+  // The load doesn't inherit the placement of main
+  pthread_attr_init (&attr);
+  pthread_attr_setaffinity_np (&attr, sizeof (*any), any);
+  pthread_attr_setinheritsched (&attr, PTHREAD_EXPLICIT_SCHED);
+  pthread_attr_setschedpolicy (&attr, SCHED_OTHER);
+  pthread_attr_setschedparam (&attr, &param);
+  for (int i = 0; i < loads; i++) pthread_create (&load_threads[i], &attr, load, NULL);
+  pthread_attr_destroy (&attr);
+
+  pthread_create (&cons, NULL, consumer, NULL);
+  pthread_create (&prod, NULL, producer, NULL);
+  pthread_join (prod, NULL);
+  pthread_join (cons, NULL);
+  atomic_store (&load_stop, 1);
+  for (int i = 0; i < loads; i++) pthread_join (load_threads[i], NULL);
+  spsc_ring_delete (ring);
+
+  report (name, "wakeup", &wakeup);
+  report (name, "handoff", &handoff);
+}
+
+int main (int argc, char *argv[])
+{
+  const char *placement = DEFAULT_PLACEMENT;
+  int opt, loads = 2 * (int)sysconf (_SC_NPROCESSORS_ONLN);
+  cpu_set_t any;
+
+  while ((opt = getopt (argc, argv, "R:s:r:l:")) != -1) {
+    switch (opt) {
+      case 'R':
+        placement = optarg;
+        break;
+      case 's':
+        seconds = atof (optarg);
+        break;
+      case 'r':
+        rate = atol (optarg);
+        break;
+      case 'l':
+        loads = atoi (optarg);
+        break;
+      default:
+        fprintf (stderr, "Usage: %s [-R placement] [-s seconds] [-r rate] [-l load_threads]\n", argv[0]);
+        return 1;
+    }
+  }
+  if (seconds <= 0 || rate < 1 || rate > 1000000 || loads < 0) return 1;
+  if (sched_getaffinity (0, sizeof (any), &any) < 0) return 1;
+
+  printf ("%ld messages/s for %.0f s, %d load threads\n", rate, seconds, loads);
+  printf ("%-8s %-8s %9s %9s %9s %9s %9s\n", "run", "stage", "count", "p50 us", "p99 us", "p99.9 us", "max us");
+  run ("default", loads, &any);
+
+  if (rt_configure (placement) < 0) return 1;
+  rt_lock_memory ();
+  rt_place_self (RT_MAIN, 0);
+  fflush (stdout);
+  rt_print_config ();
+  run ("placed", loads, &any);
+  return 0;
+}
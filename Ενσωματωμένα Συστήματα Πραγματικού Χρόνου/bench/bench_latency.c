@@ -0,0 +1,75 @@
+/*
+Cost and accuracy of the latency histograms.
+>Usage: ./bench_latency [values]
+  values: number of random latencies recorded (default 10000000)
+Prints the cost of a timestamp and of recording one value, then compares the histogram's
+p50/p99/p99.9/max of log-normally distributed values (100 ns to seconds) against the exact
+percentiles of the sorted values. The relative error must stay below 1/32.
+*/
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "../latency.h"
+#include "bench_common.h"
+
+// Log-normal latency around 20 us with a long tail
+static long long random_latency (void)
+{
+  double u1 = (rand () + 1.0) / (RAND_MAX + 2.0), u2 = (rand () + 1.0) / (RAND_MAX + 2.0);
+  double normal = sqrt (-2.0 * log (u1)) * cos (2.0 * M_PI * u2);
+  return (long long)exp (log (20000.0) + 1.5 * normal);
+}
+
+static int check (const char *name, long long exact, long long approx)
+{
+  double error = exact ? fabs ((double)(approx - exact)) / exact : 0.0;
+  int ok = error <= 1.0 / 32;
+
+  printf ("%-6s %14lld %14lld %9.4f%%%s\n", name, exact, approx, error * 100.0, ok ? "" : "  FAIL");
+  return ok;
+}
+
+int main (int argc, char *argv[])
+{
+  long values = argc > 1 ? atol (argv[1]) : 10000000;
+  long long *samples = malloc (values * sizeof (long long));
+  static latency_hist_t hist;
+  static latency_prev_t prev;
+  latency_stats_t stats;
+  long long start, clock_ns, record_ns;
+  volatile int64_t sink = 0;
+  int ok = 1;
+
+  if (samples == NULL) return 1;
+  srand (1);
+  for (long i = 0; i < values; i++) samples[i] = random_latency ();
+
+  start = bench_now_ns ();
+  for (long i = 0; i < values; i++) sink += latency_now_ns ();
+  clock_ns = bench_now_ns () - start;
+
+  start = bench_now_ns ();
+  for (long i = 0; i < values; i++) latency_record (&hist, samples[i]);
+  record_ns = bench_now_ns () - start;
+
+  printf ("%-24s %8.2f ns\n", "latency_now_ns", (double)clock_ns / values);
+  printf ("%-24s %8.2f ns\n", "latency_record", (double)record_ns / values);
+  printf ("%-24s %8zu bytes\n", "histogram size", sizeof (latency_hist_t));
+
+  latency_snapshot (&hist, &prev, &stats);
+  bench_sort (samples, values);
+  printf ("\n%-6s %14s %14s %10s\n", "", "exact_ns", "histogram_ns", "error");
+  ok &= check ("p50", bench_percentile (samples, values, 50.0), stats.p50);
+  ok &= check ("p99", bench_percentile (samples, values, 99.0), stats.p99);
+  ok &= check ("p99.9", bench_percentile (samples, values, 99.9), stats.p999);
+  ok &= check ("max", samples[values - 1], stats.max);
+
+  // A second snapshot without new values is an empty interval
+  if (latency_snapshot (&hist, &prev, &stats) != 0) {
+    printf ("empty interval not empty\n");
+    ok = 0;
+  }
+
+  free (samples);
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,120 @@
+/*
+Cost of the live metrics (metrics.h) on the hot path, with and without scrapes.
+>Usage: ./bench_metrics [-n loops] [-t threads] [-i scrape_interval_us]
+  -n: loops per thread (default 50000000), -t: updating threads (default 2)
+  -i: interval between two scrapes in us (default 1000)
+Every thread adds to three counters of its own block and sets a gauge in a loop, like a consumer
+per trade, first with nobody reading, then while another thread renders the metrics at the
+interval. Reports ns per loop (the updates of one trade) and the time a scrape takes. The two
+costs should be the same: a scrape only reads the blocks, it never writes a line a thread updates.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include "../metrics.h"
+#include "bench_common.h"
+
+enum { M_TRADES, M_BATCHES, M_VOLUME, M_DEPTH, METRICS };
+static const metric_def_t defs[METRICS] = {
+  { "bench_trades_total", "Trades", METRIC_COUNTER, "worker" },
+  { "bench_batches_total", "Batches", METRIC_COUNTER, "worker" },
+  { "bench_volume_total", "Volume", METRIC_COUNTER, "worker" },
+  { "bench_depth", "Depth", METRIC_GAUGE, "worker" },
+};
+
+static long updates = 50000000;
+static long interval_us = 1000;
+static _Atomic int scraping;
+static _Atomic long long scrapes, scrape_ns;
+
+static void *worker (void *arg)
+{
+  metrics_thread_t *m = metrics_thread ("worker", (int)(long)arg);
+  long long *ns = malloc (sizeof (long long)), start = bench_now_ns ();
+
+  for (long i = 0; i < updates; i++) {
+    metrics_add (m, M_TRADES, 1);
+    metrics_add (m, M_VOLUME, i & 1023);
+    if ((i & 255) == 0) metrics_add (m, M_BATCHES, 1);
+    metrics_set (m, M_DEPTH, i & 511);
+  }
+  *ns = bench_now_ns () - start;
+  return ns;
+}
+
+static void *scraper (void *arg)
+{
+  char *text = NULL;
+  size_t len = 0;
+  long long t0;
+  FILE *out;
+
+  (void)arg;
+  while (atomic_load (&scraping)) {
+    t0 = bench_now_ns ();
+    if ((out = open_memstream (&text, &len)) == NULL) break;
+    metrics_render (out);
+    fclose (out);
+    free (text);
+    text = NULL;
+    atomic_fetch_add (&scrape_ns, bench_now_ns () - t0);
+    atomic_fetch_add (&scrapes, 1);
+    usleep (interval_us);
+  }
+  return NULL;
+}
+
+static double run (int threads, int scrape)
+{
+  pthread_t t[threads], s;
+  long long total = 0;
+  void *ns;
+
+  atomic_store (&scraping, scrape);
+  if (scrape) pthread_create (&s, NULL, scraper, NULL);
+  for (int k = 0; k < threads; k++) pthread_create (&t[k], NULL, worker, (void *)(long)k);
+  for (int k = 0; k < threads; k++) {
+    pthread_join (t[k], &ns);
+    total += *(long long *)ns;
+    free (ns);
+  }
+  atomic_store (&scraping, 0);
+  if (scrape) pthread_join (s, NULL);
+  return (double)total / threads / updates;
+}
+
+int main (int argc, char *argv[])
+{
+  int opt, threads = 2;
+  double quiet, scraped;
+
+  while ((opt = getopt (argc, argv, "n:t:i:")) != -1) {
+    switch (opt) {
+      case 'n':
+        updates = atol (optarg);
+        break;
+      case 't':
+        threads = atoi (optarg);
+        break;
+      case 'i':
+        interval_us = atol (optarg);
+        break;
+      default:
+        fprintf (stderr, "Usage: %s [-n loops] [-t threads] [-i scrape_interval_us]\n", argv[0]);
+        return 1;
+    }
+  }
+  if (updates < 1 || threads < 1 || threads > METRICS_MAX_THREADS / 2 || interval_us < 0) return 1;
+  if (metrics_init (defs, METRICS) < 0) return 1;
+
+  quiet = run (threads, 0);
+  scraped = run (threads, 1);
+  printf ("%d threads, %ld loops each\n", threads, updates);
+  printf ("no scrapes:         %.2f ns per loop\n", quiet);
+  printf ("scrape every %ld us: %.2f ns per loop, %lld scrapes of %.1f us\n", interval_us, scraped,
+          (long long)scrapes, scrapes ? scrape_ns / 1e3 / scrapes : 0.0);
+  return 0;
+}
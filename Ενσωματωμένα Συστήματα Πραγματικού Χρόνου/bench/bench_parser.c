@@ -0,0 +1,178 @@
+/*
+Differential check and throughput of the fast trade parser against jansson.
+>Usage: ./bench_parser [frames] [max_trades_per_frame]
+Random Finnhub-like messages (varying decimals, integer and exponent numbers, "c" arrays,
+white space, key order) plus pings and malformed messages are decoded by both parsers.
+Every message the fast parser accepts must give bit-identical stock_data_t fields to the
+jansson reference; messages it declines (PARSE_SLOW) are counted. Each message is also fed
+in random fragments through trade_parser_feed() to check the reassembly.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <jansson.h>
+#include "../trade_parser.h"
+#include "bench_common.h"
+
+#define MAX_TRADES 256
+#define MSG_SIZE 65536
+
+static const char *symbols[] = { "GOOGL", "BINANCE:BTCUSDT", "AAPL", "NVDA", "BINANCE:ETHUSDT", "OANDA:EUR_USD" };
+
+// Reference: the jansson slow path of pi_code.c, collecting the trades instead of queueing them.
+// Returns the number of trades extracted before the first error, or -1 for pings and invalid JSON.
+static int jansson_parse (const char *msg, size_t len, stock_data_t *out, int max)
+{
+  json_t *root, *array, *data, *symbol, *price, *time, *volume;
+  json_error_t error;
+  int n = 0;
+
+  root = json_loadb (msg, len, 0, &error);
+  if (!root) return -1;
+  array = json_object_get (root, "data");
+  if (!json_is_array (array)) {
+    json_decref (root);
+    return -1;
+  }
+  for (size_t i = 0; i < json_array_size (array) && n < max; i++) {
+    data = json_array_get (array, i);
+    if (!json_is_object (data)) break;
+    symbol = json_object_get (data, "s");
+    price = json_object_get (data, "p");
+    volume = json_object_get (data, "v");
+    time = json_object_get (data, "t");
+    if (!json_is_string (symbol) || !json_is_number (price) || !json_is_number (volume) || !json_is_integer (time)) break;
+
+    memset (&out[n], 0, sizeof (stock_data_t));
+    strncpy (out[n].symbol, json_string_value (symbol), MAX_SYMBOL_LEN - 1);
+    out[n].price = json_number_value (price);
+    out[n].volume = json_number_value (volume);
+    out[n].time = json_integer_value (time);
+    n++;
+  }
+  json_decref (root);
+  return n;
+}
+
+// Random number token in one of the forms Finnhub (or a broken feed) may send
+static int random_number (char *buf)
+{
+  double v = (rand () % 100000000) / 1000.0;
+  int dec = rand () % 10;
+
+  switch (rand () % 8) {
+    case 0: return sprintf (buf, "%d", rand () % 100000);
+    case 1: return sprintf (buf, "%.*e", dec, v);
+    case 2: return sprintf (buf, "%.*f", dec, v / 1e6);
+    default: return sprintf (buf, "%.*f", dec, v);
+  }
+}
+
+static int random_message (char *buf, int max_trades)
+{
+  int n, k = 1 + rand () % max_trades;
+  char p[64], v[64];
+  const char *ws = (rand () % 10 == 0) ? " \n" : "";
+
+  switch (rand () % 50) {
+    case 0: return sprintf (buf, "{\"type\":\"ping\"}");
+    case 1: return sprintf (buf, "{\"data\":[{\"p\":1,\"s\":\"AAPL\",\"t\":1.5,\"v\":1}],\"type\":\"trade\"}");
+    case 2: return sprintf (buf, "{\"data\":[{\"p\":1,\"s\":\"AAPL\",\"t\":1,\"v\":1},{\"p\":\"x\"}],\"type\":\"trade\"}");
+    case 3: return sprintf (buf, "{\"data\":[{\"p\":1,\"s\":\"AA\\u0050L\",\"t\":1,\"v\":1}],\"type\":\"trade\"}");
+    case 4: return sprintf (buf, "{\"data\":[{\"p\":1,\"s\":\"AAPL\",\"t\":1,\"v\":1}],\"type\":\"trade\"");
+  }
+
+  n = sprintf (buf, "{%s\"data\":%s[", ws, ws);
+  for (int i = 0; i < k; i++) {
+    random_number (p);
+    random_number (v);
+    if (rand () % 2) {
+      n += sprintf (buf + n, "%s{\"c\":%s,\"p\":%s,\"s\":\"%s\",\"t\":%lld,\"v\":%s}", i ? "," : "",
+                    rand () % 2 ? "null" : "[\"1\",\"12\"]", p, symbols[rand () % 6], 1727790000000LL + rand (), v);
+    } else {
+      n += sprintf (buf + n, "%s{%s\"s\"%s:%s\"%s\",\"v\":%s,\"t\":%lld,\"p\":%s}", i ? "," : "",
+                    ws, ws, ws, symbols[rand () % 6], v, 1727790000000LL + rand (), p);
+    }
+  }
+  n += sprintf (buf + n, "]%s,\"type\":\"trade\"}%s", ws, ws);
+  return n;
+}
+
+static int same_trades (const stock_data_t *a, const stock_data_t *b, int n)
+{
+  for (int i = 0; i < n; i++) {
+    if (strcmp (a[i].symbol, b[i].symbol) != 0 || a[i].time != b[i].time ||
+        memcmp (&a[i].price, &b[i].price, sizeof (double)) != 0 ||
+        memcmp (&a[i].volume, &b[i].volume, sizeof (double)) != 0)
+      return 0;
+  }
+  return 1;
+}
+
+int main (int argc, char *argv[])
+{
+  long frames = argc > 1 ? atol (argv[1]) : 100000;
+  int max_trades = argc > 2 ? atoi (argv[2]) : 40;
+  char **msgs = malloc (frames * sizeof (char *));
+  int *lens = malloc (frames * sizeof (int));
+  stock_data_t fast[MAX_TRADES], ref[MAX_TRADES];
+  trade_parser_t parser;
+  long slow = 0, mismatches = 0, trades = 0;
+  long long start, fast_ns, jansson_ns;
+  volatile long sink = 0;
+
+  if (max_trades > MAX_TRADES) max_trades = MAX_TRADES;
+  srand (1);
+  trade_parser_init (&parser, PARSER_INITIAL_SIZE);
+
+  // Differential check, whole messages and fragmented ones
+  for (long f = 0; f < frames; f++) {
+    msgs[f] = malloc (MSG_SIZE);
+    lens[f] = random_message (msgs[f], max_trades);
+
+    int r = trade_parse (msgs[f], lens[f], fast, MAX_TRADES);
+    int e = jansson_parse (msgs[f], lens[f], ref, MAX_TRADES);
+    if (r == PARSE_SLOW) {
+      slow++;
+      continue;
+    }
+    trades += r;
+    if (r != e || !same_trades (fast, ref, r)) {
+      mismatches++;
+      fprintf (stderr, "mismatch: %.*s\n", lens[f], msgs[f]);
+      continue;
+    }
+
+    const char *msg = NULL;
+    size_t msg_len = 0, off = 0;
+    while (off < (size_t)lens[f]) {
+      size_t chunk = 1 + rand () % (lens[f] - off);
+      msg = trade_parser_feed (&parser, msgs[f] + off, chunk, off + chunk == (size_t)lens[f], &msg_len);
+      off += chunk;
+    }
+    if (msg == NULL || trade_parse (msg, msg_len, fast, MAX_TRADES) != r || !same_trades (fast, ref, r)) {
+      mismatches++;
+      fprintf (stderr, "fragmented mismatch: %.*s\n", lens[f], msgs[f]);
+    }
+  }
+
+  // Throughput of both parsers over the same messages
+  start = bench_now_ns ();
+  for (long f = 0; f < frames; f++) sink += trade_parse (msgs[f], lens[f], fast, MAX_TRADES);
+  fast_ns = bench_now_ns () - start;
+
+  start = bench_now_ns ();
+  for (long f = 0; f < frames; f++) sink += jansson_parse (msgs[f], lens[f], ref, MAX_TRADES);
+  jansson_ns = bench_now_ns () - start;
+
+  printf ("messages %ld, trades %ld, slow path %ld, mismatches %ld\n", frames, trades, slow, mismatches);
+  printf ("%-8s %12s %10s\n", "parser", "msgs/s", "ns/trade");
+  printf ("%-8s %12.0f %10.1f\n", "fast", frames / (fast_ns / 1e9), (double)fast_ns / trades);
+  printf ("%-8s %12.0f %10.1f\n", "jansson", frames / (jansson_ns / 1e9), (double)jansson_ns / trades);
+
+  for (long f = 0; f < frames; f++) free (msgs[f]);
+  free (msgs);
+  free (lens);
+  trade_parser_free (&parser);
+  return mismatches ? 1 : 0;
+}
@@ -0,0 +1,243 @@
+/*
+Exactness and speed of the historical query (query.c) on synthetic trade log partitions.
+>Usage: ./bench_query [symbols] [hours] [max_threads]
+  symbols: symbols to generate (default 8), hours: hourly partitions of each (default 6),
+  max_threads: the query runs with 1, 2, 4 ... up to this many threads (default one per core)
+The partitions are written to bench_query.d/ and removed afterwards, every other one compressed to
+a .tlz like the archiver does. ~20 trades/s per symbol with 2% of them out of order by up to 4 s,
+so some are late and some minutes span two partitions.
+The reference feeds every trade of a symbol, in logged order, through the candle and window code
+the way the worker and sleepyhead do. The query (1m and 5m candles, over everything and over a
+range in the middle) must give the same candles, bit for bit, and the same window sums.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "../archive.h"
+#include "../query.h"
+#include "../tlog.h"
+#include "../tlz.h"
+#include "../trade.h"
+#include "bench_common.h"
+
+#define DIR "bench_query.d"
+#define START 1700000000000LL
+#define HOUR_MS 3600000LL
+
+static double uniform (void)
+{
+  return (rand () + 1.0) / (RAND_MAX + 2.0);
+}
+
+// Write the hourly partitions of a symbol, a late trade stays in the current partition like in
+// pi_code. Returns the number of trades.
+static uint64_t generate (const char *symbol, int hours, int compress)
+{
+  char name[PATH_MAX], path[PATH_MAX + 16], tlz_path[PATH_MAX + 16];
+  int64_t time = START + rand () % 60000, end = START + hours * HOUR_MS, log_end = 0, t;
+  double ticks = 10000 + rand () % 10000;
+  uint64_t rows = 0;
+  tlog_t *out = NULL;
+  int part = 0;
+
+  while (time < end) {
+    time += (int64_t)(-log (uniform ()) * 50.0);
+    t = rand () % 50 == 0 ? time - rand () % 4000 : time;
+    if (t >= log_end) {
+      if (out != NULL) {
+        tlog_close (out);
+        if (compress && part++ % 2 == 0) {
+          snprintf (tlz_path, sizeof (tlz_path), "%.*stlz", (int)strlen (path) - 4, path);
+          tlz_compress (path, tlz_path);
+          unlink (path);
+        }
+      }
+      archive_partition_path (name, sizeof (name), symbol, archive_partition_start (t, HOUR_MS), HOUR_MS);
+      snprintf (path, sizeof (path), DIR "/%s", name);
+      if ((out = tlog_create (path, symbol)) == NULL) exit (1);
+      log_end = archive_partition_start (t, HOUR_MS) + HOUR_MS;
+    }
+    if (rand () % 3 == 0) ticks += rand () % 2 ? 1 : -1;
+    tlog_append (out, trade_decimal (trade_fixed (ticks * 0.01)), trade_decimal (trade_fixed (1 + rand () % 300)), t, t / 60000);
+    rows++;
+  }
+  tlog_close (out);
+  return rows;
+}
+
+// Every trade of the symbol through one series, as the worker and sleepyhead would see them
+static size_t reference (const query_t *q, const char *symbol, query_row_t **out)
+{
+  tlog_reader_t raw;
+  tlz_reader_t packed;
+  candle_series_t series;
+  rolling_t rolling;
+  candle_t closed[64];
+  static double price[TLZ_BLOCK_ROWS], volume[TLZ_BLOCK_ROWS];
+  static int64_t time[TLZ_BLOCK_ROWS];
+  const double *p, *v;
+  const int64_t *t;
+  query_row_t *rows = NULL;
+  size_t count = 0, max = 0;
+  char **paths;
+  int n, parts, buckets[ROLLING_MAX_WINDOWS];
+  uint32_t rows_in;
+
+  for (int w = 0; w < q->windows; w++) buckets[w] = (int)(q->window_minutes[w] * 60000LL / q->interval);
+  rolling_init (&rolling, buckets, q->windows);
+  candle_series_init (&series, 0, q->interval);
+  parts = archive_list (DIR, symbol, &paths);
+
+  for (int k = 0; k <= parts; k++) {
+    int last = k == parts, compressed = !last && strstr (paths[k], ".tlz") != NULL;
+    uint64_t blocks = 0;
+
+    if (!last && (compressed ? tlz_open (paths[k], &packed) : tlog_open (paths[k], &raw)) < 0) continue;
+    if (!last) blocks = compressed ? packed.blocks : raw.blocks;
+    for (uint64_t b = 0; b <= blocks; b++) {
+      int64_t mark = INT64_MIN;
+      rows_in = 0;
+      if (b < blocks) {
+        if (compressed) {
+          rows_in = tlz_block (&packed, b, price, volume, time, NULL);
+          p = price, v = volume, t = time;
+        } else {
+          rows_in = tlog_block (&raw, b, &p, &v, &t);
+        }
+      } else if (last && series.watermark != INT64_MIN) {
+        mark = (candle_bucket (series.watermark, q->interval) + 1) * q->interval + q->grace_ms;   // Flush at the end
+      }
+      for (uint32_t i = 0; i <= rows_in; i++) {
+        if (i < rows_in && t[i] > series.watermark) mark = t[i];
+        while (mark != INT64_MIN && (n = candle_close (&series, mark, q->grace_ms, closed, 64)) > 0) {
+          for (int c = 0; c < n; c++) {
+            rolling_push (&rolling, &closed[c].bucket);
+            if (closed[c].minute < q->from - q->from % q->interval || closed[c].minute >= q->to) continue;
+            if (count == max) {
+              max = max ? max * 2 : 1024;
+              rows = (query_row_t *) realloc (rows, max * sizeof (query_row_t));
+            }
+            rows[count].candle = closed[c];
+            for (int w = 0; w < q->windows; w++) rolling_get (&rolling, w, &rows[count].window[w]);
+            count++;
+          }
+          if (n < 64) break;
+        }
+        mark = INT64_MIN;
+        if (i < rows_in) candle_add_trade (&series, t[i], trade_fixed (p[i]), trade_fixed (v[i]));
+      }
+      if (last) break;
+    }
+    if (!last) {
+      if (compressed) tlz_release (&packed);
+      else tlog_release (&raw);
+    }
+  }
+  archive_list_free (paths, parts);
+  rolling_free (&rolling);
+  *out = rows;
+  return count;
+}
+
+// Same candles (bit for bit) and windows; 'full' depends on how much history was read, it isn't compared
+static int same (const query_t *q, const query_row_t *a, size_t na, const query_row_t *b, size_t nb)
+{
+  if (na != nb) {
+    fprintf (stderr, "%zu candles instead of %zu\n", nb, na);
+    return 0;
+  }
+  for (size_t r = 0; r < na; r++) {
+    candle_t x = a[r].candle, y = b[r].candle;
+    x.id = y.id = 0;
+    if (memcmp (&x, &y, sizeof (candle_t)) != 0) {
+      fprintf (stderr, "candle %zu (%lld) differs\n", r, (long long)x.minute);
+      return 0;
+    }
+    for (int w = 0; w < q->windows; w++) {
+      const rolling_stats_t *s = &a[r].window[w], *u = &b[r].window[w];
+      if (s->trades != u->trades || s->volume != u->volume || memcmp (&s->sma, &u->sma, sizeof (double)) != 0 ||
+          memcmp (&s->vwap, &u->vwap, sizeof (double)) != 0) {
+        fprintf (stderr, "window %d of candle %zu (%lld) differs\n", w, r, (long long)x.minute);
+        return 0;
+      }
+    }
+  }
+  return 1;
+}
+
+int main (int argc, char *argv[])
+{
+  int symbols = argc > 1 ? atoi (argv[1]) : 8, hours = argc > 2 ? atoi (argv[2]) : 6;
+  int max_threads = argc > 3 ? atoi (argv[3]) : (int)sysconf (_SC_NPROCESSORS_ONLN), failed = 0;
+  char names[symbols][16];
+  const char *list[symbols];
+  query_result_t results[symbols];
+  query_row_t *ref;
+  size_t ref_count;
+  uint64_t trades = 0;
+  long long start, ns, ns1 = 0;
+  query_t q;
+  struct {
+    int64_t interval;
+    int64_t from, to;
+    const char *name;
+  } cases[] = {
+    { 60000, 0, INT64_MAX, "1m, everything" },
+    { 300000, 0, INT64_MAX, "5m, everything" },
+    { 60000, START + HOUR_MS + 1234567, START + 3 * HOUR_MS + 7654, "1m, range" },
+  };
+
+  if (symbols < 1 || hours < 2) return 1;
+  srand (1);
+  mkdir (DIR, 0755);
+  for (int s = 0; s < symbols; s++) {
+    snprintf (names[s], sizeof (names[s]), "SYM%d", s);
+    list[s] = names[s];
+    trades += generate (names[s], hours, 1);
+  }
+  printf ("%d symbols, %d hours, %llu trades\n", symbols, hours, (unsigned long long)trades);
+
+  memset (&q, 0, sizeof (q));
+  q.dir = DIR;
+  q.grace_ms = CANDLE_DEFAULT_GRACE_MS;
+  q.windows = 2;
+  q.window_minutes[0] = 5;
+  q.window_minutes[1] = 60;
+  for (size_t c = 0; c < sizeof (cases) / sizeof (cases[0]); c++) {
+    q.interval = cases[c].interval;
+    q.from = cases[c].from;
+    q.to = cases[c].to;
+    for (int threads = 1; threads <= max_threads; threads = threads * 2 > max_threads && threads < max_threads ? max_threads : threads * 2) {
+      q.threads = threads;
+      start = bench_now_ns ();
+      if (query_run (&q, list, symbols, results) < 0) return 1;
+      ns = bench_now_ns () - start;
+      if (threads == 1) ns1 = ns;
+      for (int s = 0; s < symbols; s++) {
+        ref_count = reference (&q, names[s], &ref);
+        if (!same (&q, ref, ref_count, results[s].rows, results[s].count)) {
+          fprintf (stderr, "%s: %s with %d threads differs from the reference\n", cases[c].name, names[s], threads);
+          failed = 1;
+        }
+        free (ref);
+      }
+      printf ("%-16s %2d threads %8.1f ms %6.1f M trades/s %5.2fx %s\n", cases[c].name, threads, ns / 1e6,
+              trades / 1e6 / (ns / 1e9), (double)ns1 / ns, failed ? "MISMATCH" : "exact");
+      query_free (results, symbols);
+    }
+  }
+
+  // Leave no partitions behind
+  for (int s = 0; s < symbols; s++) {
+    char **paths;
+    int n = archive_list (DIR, names[s], &paths);
+    for (int k = 0; k < n; k++) unlink (paths[k]);
+    archive_list_free (paths, n);
+  }
+  rmdir (DIR);
+  return failed;
+}
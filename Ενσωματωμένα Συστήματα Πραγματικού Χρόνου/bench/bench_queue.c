@@ -0,0 +1,188 @@
+/*
+Per-trade producer->consumer handoff latency of the old mutex/condvar queue versus the SPSC ring.
+>Usage: ./bench_queue [trades] [gap_us]
+  trades: number of trades pushed per run (default 200000)
+  gap_us: pause between trades in the paced run, in microseconds (default 20)
+The burst run pushes back-to-back and shows throughput, the paced run shows the wake-up cost
+the consumer pays for every trade, which is what producer_consumer_delay.txt measures.
+*/
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../trade.h"
+#include "../spsc_ring.h"
+#include "bench_common.h"
+
+#define QUEUESIZE 512
+#define CONSUMER_BATCH 64
+
+// The mutex/condvar queue used by pi_code.c before the SPSC ring, kept here as the baseline
+typedef struct {
+  trade_t buf[QUEUESIZE];
+  long head, tail;
+  int full, empty;
+  pthread_mutex_t mut;
+  pthread_cond_t notFull, notEmpty;
+} queue;
+
+typedef struct {
+  const char *name;
+  int use_ring;
+  long trades;
+  long gap_ns;
+  queue *q;
+  spsc_ring_t *ring;
+  long long *latency;   // One handoff sample per trade
+  long long elapsed_ns;
+} run_t;
+
+static void queueAdd (queue *q, trade_t in)
+{
+  q->buf[q->tail] = in;
+  q->tail++;
+  if (q->tail == QUEUESIZE)
+    q->tail = 0;
+  if (q->tail == q->head)
+    q->full = 1;
+  q->empty = 0;
+}
+
+static void queueDel (queue *q, trade_t *out)
+{
+  *out = q->buf[q->head];
+  q->head++;
+  if (q->head == QUEUESIZE)
+    q->head = 0;
+  if (q->head == q->tail)
+    q->empty = 1;
+  q->full = 0;
+}
+
+static void *producer (void *arg)
+{
+  run_t *run = arg;
+  trade_t trade;
+  long long next = bench_now_ns ();
+
+  memset (&trade, 0, sizeof (trade));
+  trade.price = trade_fixed (63000.0);
+  trade.volume = trade_fixed (0.01);
+
+  for (long i = 0; i < run->trades; i++) {
+    if (run->gap_ns > 0) {
+      next += run->gap_ns;
+      bench_spin_until (next);
+    }
+    trade.time = i;
+    trade.pub_ns = (uint32_t)bench_now_ns ();
+
+    if (run->use_ring) {
+      spsc_ring_push (run->ring, &trade);
+    } else {
+      pthread_mutex_lock (&run->q->mut);
+      while (run->q->full)
+        pthread_cond_wait (&run->q->notFull, &run->q->mut);
+      queueAdd (run->q, trade);
+      pthread_mutex_unlock (&run->q->mut);
+      pthread_cond_signal (&run->q->notEmpty);
+    }
+  }
+  return (NULL);
+}
+
+static void *consumer (void *arg)
+{
+  run_t *run = arg;
+  trade_t batch[CONSUMER_BATCH];
+  long received = 0;
+  size_t n;
+
+  while (received < run->trades) {
+    if (run->use_ring) {
+      n = spsc_ring_pop_batch (run->ring, batch, CONSUMER_BATCH);
+    } else {
+      pthread_mutex_lock (&run->q->mut);
+      while (run->q->empty)
+        pthread_cond_wait (&run->q->notEmpty, &run->q->mut);
+      queueDel (run->q, &batch[0]);
+      pthread_mutex_unlock (&run->q->mut);
+      pthread_cond_signal (&run->q->notFull);
+      n = 1;
+    }
+
+    long long now = bench_now_ns ();
+    for (size_t k = 0; k < n; k++) {
+      run->latency[batch[k].time] = trade_age_ns (&batch[k], now);
+    }
+    received += n;
+  }
+  return (NULL);
+}
+
+static void run_once (run_t *run)
+{
+  pthread_t pro, con;
+  long long start;
+
+  if (run->use_ring) {
+    run->ring = spsc_ring_init (QUEUESIZE, sizeof (trade_t));
+  } else {
+    run->q = calloc (1, sizeof (queue));
+    run->q->empty = 1;
+    pthread_mutex_init (&run->q->mut, NULL);
+    pthread_cond_init (&run->q->notFull, NULL);
+    pthread_cond_init (&run->q->notEmpty, NULL);
+  }
+
+  start = bench_now_ns ();
+  pthread_create (&con, NULL, consumer, run);
+  pthread_create (&pro, NULL, producer, run);
+  pthread_join (pro, NULL);
+  pthread_join (con, NULL);
+  run->elapsed_ns = bench_now_ns () - start;
+
+  if (run->use_ring) {
+    spsc_ring_delete (run->ring);
+  } else {
+    pthread_mutex_destroy (&run->q->mut);
+    pthread_cond_destroy (&run->q->notFull);
+    pthread_cond_destroy (&run->q->notEmpty);
+    free (run->q);
+  }
+}
+
+static void report (const char *mode, run_t *run)
+{
+  bench_sort (run->latency, run->trades);
+  printf ("%-6s %-13s %12.0f %9lld %9lld %9lld %9lld\n", mode, run->name,
+          run->trades / (run->elapsed_ns / 1e9),
+          bench_percentile (run->latency, run->trades, 50.0),
+          bench_percentile (run->latency, run->trades, 99.0),
+          bench_percentile (run->latency, run->trades, 99.9),
+          run->latency[run->trades - 1]);
+}
+
+int main (int argc, char *argv[])
+{
+  long trades = argc > 1 ? atol (argv[1]) : 200000;
+  long gap_us = argc > 2 ? atol (argv[2]) : 20;
+  run_t runs[2] = {
+    { .name = "mutex+condvar", .use_ring = 0 },
+    { .name = "spsc_ring", .use_ring = 1 },
+  };
+
+  printf ("%-6s %-13s %12s %9s %9s %9s %9s\n", "mode", "queue", "trades/s", "p50_ns", "p99_ns", "p99.9_ns", "max_ns");
+
+  for (int paced = 0; paced <= 1; paced++) {
+    for (int i = 0; i < 2; i++) {
+      runs[i].trades = trades;
+      runs[i].gap_ns = paced ? gap_us * 1000 : 0;
+      runs[i].latency = calloc (trades, sizeof (long long));
+      run_once (&runs[i]);
+      report (paced ? "paced" : "burst", &runs[i]);
+      free (runs[i].latency);
+    }
+  }
+  return 0;
+}
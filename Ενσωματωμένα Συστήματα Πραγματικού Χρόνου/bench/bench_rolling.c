@@ -0,0 +1,98 @@
+/*
+Check of the rolling statistics against a brute-force recomputation, and the cost of both.
+>Usage: ./bench_rolling [minutes] [windows]
+  minutes: number of 1-minute buckets pushed (default 100000)
+  windows: comma separated window lengths in minutes (default "1,5,15,60")
+After every push, each window's sums and statistics (SMA, VWAP, volume) must be exactly
+equal to summing the last 'window' buckets again. Random minutes include empty ones.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../rolling.h"
+#include "bench_common.h"
+
+// Sum the last 'minutes' buckets of the history from scratch
+static void brute_force (const rolling_bucket_t *history, long pushed, int minutes, rolling_bucket_t *sum)
+{
+  memset (sum, 0, sizeof (rolling_bucket_t));
+  for (long m = pushed - minutes < 0 ? 0 : pushed - minutes; m < pushed; m++) {
+    sum->trades += history[m].trades;
+    sum->price_sum += history[m].price_sum;
+    sum->volume += history[m].volume;
+    sum->notional += history[m].notional;
+  }
+}
+
+int main (int argc, char *argv[])
+{
+  long minutes = argc > 1 ? atol (argv[1]) : 100000;
+  const char *spec = argc > 2 ? argv[2] : ROLLING_DEFAULT_WINDOWS;
+  int lengths[ROLLING_MAX_WINDOWS], windows;
+  rolling_bucket_t *history = calloc (minutes, sizeof (rolling_bucket_t)), sum;
+  rolling_stats_t fast, slow;
+  rolling_t r;
+  long mismatches = 0;
+  long long start, rolling_ns, brute_ns;
+  volatile int64_t sink = 0;
+
+  windows = rolling_parse_windows (spec, lengths, ROLLING_MAX_WINDOWS);
+  if (windows < 0 || history == NULL || rolling_init (&r, lengths, windows) < 0) {
+    fprintf (stderr, "Invalid windows '%s'\n", spec);
+    return 1;
+  }
+  srand (1);
+
+  // Random minutes: some empty, prices around 100 or 60000, fractional volumes
+  for (long m = 0; m < minutes; m++) {
+    int trades = rand () % 4 == 0 ? 0 : rand () % 200;
+    double base = rand () % 2 ? 100.0 : 60000.0;
+    for (int t = 0; t < trades; t++) {
+      rolling_add_trade (&history[m], trade_fixed (base + (rand () % 100000) / 1000.0), trade_fixed ((rand () % 1000000) / 1e4));
+    }
+  }
+
+  // Exactness check after every push
+  for (long m = 0; m < minutes; m++) {
+    rolling_push (&r, &history[m]);
+    for (int w = 0; w < windows; w++) {
+      brute_force (history, m + 1, lengths[w], &sum);
+      rolling_get (&r, w, &fast);
+      rolling_stats (&sum, &slow);
+      if (memcmp (&r.window[w].sum, &sum, sizeof (sum)) != 0 || fast.trades != slow.trades ||
+          memcmp (&fast.sma, &slow.sma, sizeof (double)) != 0 ||
+          memcmp (&fast.vwap, &slow.vwap, sizeof (double)) != 0 ||
+          memcmp (&fast.volume, &slow.volume, sizeof (double)) != 0) {
+        if (mismatches++ < 10) fprintf (stderr, "mismatch at minute %ld, window %d\n", m, lengths[w]);
+      }
+    }
+  }
+  rolling_free (&r);
+
+  // Cost per minute of both ways of updating every window
+  rolling_init (&r, lengths, windows);
+  start = bench_now_ns ();
+  for (long m = 0; m < minutes; m++) {
+    rolling_push (&r, &history[m]);
+    for (int w = 0; w < windows; w++) sink += r.window[w].sum.volume;
+  }
+  rolling_ns = bench_now_ns () - start;
+
+  start = bench_now_ns ();
+  for (long m = 0; m < minutes; m++) {
+    for (int w = 0; w < windows; w++) {
+      brute_force (history, m + 1, lengths[w], &sum);
+      sink += sum.volume;
+    }
+  }
+  brute_ns = bench_now_ns () - start;
+
+  printf ("minutes %ld, windows %s, mismatches %ld\n", minutes, spec, mismatches);
+  printf ("%-12s %12s\n", "update", "ns/minute");
+  printf ("%-12s %12.1f\n", "rolling", (double)rolling_ns / minutes);
+  printf ("%-12s %12.1f\n", "brute-force", (double)brute_ns / minutes);
+
+  rolling_free (&r);
+  free (history);
+  return mismatches ? 1 : 0;
+}
@@ -0,0 +1,337 @@
+/*
+Micro-benchmarks of the pipeline's hot components, with machine-readable results.
+>Usage: ./bench_suite [-f csv|json] [-t ms] [-r repeats] [filter]
+  -f: output format, one line per case (default csv)
+  -t: target run time of each repeat in ms (default 100)
+  -r: repeats of each case, the median is reported (default 5)
+  filter: only run the cases whose "component/case" name contains this string
+Columns: component, case, ops (per repeat), ns_per_op (median), ns_min, ops_per_sec (median) and
+allocs_per_op, the malloc/calloc/realloc/posix_memalign calls made inside the measured loop
+(counted by linking with -Wl,--wrap, see the Makefile). Hot paths must stay at 0.
+>Build and run natively: make bench NATIVE=1, or cross-compile bench/bench_suite and run it on the Pi.
+*/
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "../trade.h"
+#include "../spsc_ring.h"
+#include "../trade_parser.h"
+#include "../candle.h"
+#include "../rolling.h"
+#include "../log_writer.h"
+#include "../tlog.h"
+#include "../latency.h"
+#include "bench_common.h"
+
+// Allocation counting, the linker sends every call of the benchmarked code through these
+static _Atomic long long allocs;
+void *__real_malloc (size_t size);
+void *__real_calloc (size_t n, size_t size);
+void *__real_realloc (void *p, size_t size);
+int __real_posix_memalign (void **p, size_t align, size_t size);
+
+void *__wrap_malloc (size_t size) { atomic_fetch_add (&allocs, 1); return __real_malloc (size); }
+void *__wrap_calloc (size_t n, size_t size) { atomic_fetch_add (&allocs, 1); return __real_calloc (n, size); }
+void *__wrap_realloc (void *p, size_t size) { atomic_fetch_add (&allocs, 1); return __real_realloc (p, size); }
+int __wrap_posix_memalign (void **p, size_t align, size_t size) { atomic_fetch_add (&allocs, 1); return __real_posix_memalign (p, align, size); }
+
+// One measured run: 'ops' operations in 'ns' with 'allocs' allocations
+typedef struct {
+  long long ops;
+  long long ns;
+  long long allocs;
+} sample_t;
+
+#define MEASURE_BEGIN(s) do { (s)->allocs = atomic_load (&allocs); (s)->ns = bench_now_ns (); } while (0)
+#define MEASURE_END(s, n) do { (s)->ns = bench_now_ns () - (s)->ns; (s)->allocs = atomic_load (&allocs) - (s)->allocs; (s)->ops = (n); } while (0)
+
+typedef struct {
+  const char *component;
+  const char *name;
+  void (*run) (long iters, sample_t *s);
+} bench_case_t;
+
+static volatile long long sink;
+
+// ---------- queue: producer and consumer threads on one ring ----------
+
+#define RING_SIZE 512
+#define RING_BATCH 256
+
+typedef struct {
+  spsc_ring_t *ring;
+  long count;
+  int batch;
+} ring_run_t;
+
+static void *ring_consumer (void *arg)
+{
+  ring_run_t *run = arg;
+  trade_t batch[RING_BATCH];
+  long received = 0;
+
+  while (received < run->count) received += spsc_ring_pop_batch (run->ring, batch, RING_BATCH);
+  return (NULL);
+}
+
+static void ring_case (long iters, sample_t *s, int batch)
+{
+  trade_t frame[64];
+  ring_run_t run = { spsc_ring_init (RING_SIZE, sizeof (trade_t)), iters - iters % batch, batch };
+  pthread_t con;
+
+  memset (frame, 0, sizeof (frame));
+  pthread_create (&con, NULL, ring_consumer, &run);
+  MEASURE_BEGIN (s);
+  for (long i = 0; i < run.count; i += batch) {
+    if (batch == 1) spsc_ring_push (run.ring, frame);
+    else spsc_ring_push_batch (run.ring, frame, batch);
+  }
+  pthread_join (con, NULL);
+  MEASURE_END (s, run.count);
+  spsc_ring_delete (run.ring);
+}
+
+static void bench_ring_push (long iters, sample_t *s) { ring_case (iters, s, 1); }
+static void bench_ring_push_batch (long iters, sample_t *s) { ring_case (iters, s, 64); }
+
+// ---------- parser: realistic Finnhub trade messages ----------
+
+static int make_message (char *buf, int trades)
+{
+  static const char *symbols[] = { "BINANCE:BTCUSDT", "AAPL", "NVDA", "GOOGL" };
+  int len = sprintf (buf, "{\"data\":[");
+
+  for (int k = 0; k < trades; k++) {
+    len += sprintf (buf + len, "%s{\"c\":[\"1\",\"12\"],\"p\":%.2f,\"s\":\"%s\",\"t\":%lld,\"v\":%.8f}",
+                    k ? "," : "", 63000.5 + k, symbols[k % 4], 1727790000000LL + k, 0.00012 * (k + 1));
+  }
+  return len + sprintf (buf + len, "],\"type\":\"trade\"}");
+}
+
+static void parse_case (long iters, sample_t *s, int trades)
+{
+  static char msg[65536];
+  static stock_data_t out[256];
+  int len = make_message (msg, trades);
+  long frames = iters / trades + 1;
+
+  MEASURE_BEGIN (s);
+  for (long f = 0; f < frames; f++) sink += trade_parse (msg, len, out, 256);
+  MEASURE_END (s, frames * trades);
+}
+
+static void bench_parse_1 (long iters, sample_t *s) { parse_case (iters, s, 1); }
+static void bench_parse_16 (long iters, sample_t *s) { parse_case (iters, s, 16); }
+static void bench_parse_64 (long iters, sample_t *s) { parse_case (iters, s, 64); }
+
+// A 16-trade message arriving in 3 fragments, joined by trade_parser_feed() and then parsed
+static void bench_parse_fragmented (long iters, sample_t *s)
+{
+  static char msg[65536];
+  static stock_data_t out[256];
+  trade_parser_t parser;
+  int len = make_message (msg, 16), cut1 = len / 3, cut2 = 2 * len / 3;
+  long frames = iters / 16 + 1;
+  const char *whole;
+  size_t whole_len;
+
+  trade_parser_init (&parser, PARSER_INITIAL_SIZE);
+  MEASURE_BEGIN (s);
+  for (long f = 0; f < frames; f++) {
+    trade_parser_feed (&parser, msg, cut1, 0, &whole_len);
+    trade_parser_feed (&parser, msg + cut1, cut2 - cut1, 0, &whole_len);
+    whole = trade_parser_feed (&parser, msg + cut2, len - cut2, 1, &whole_len);
+    sink += trade_parse (whole, whole_len, out, 256);
+  }
+  MEASURE_END (s, frames * 16);
+  trade_parser_free (&parser);
+}
+
+// ---------- candle: the consumer's per-trade aggregation (was process_trade) ----------
+
+static void bench_candle_add (long iters, sample_t *s)
+{
+  static candle_series_t series;
+  candle_t closed[64];
+  int64_t time = 1727790000000LL;
+
+  candle_series_init (&series, 0, CANDLE_MINUTE_MS);
+  MEASURE_BEGIN (s);
+  for (long i = 0; i < iters; i++) {
+    time += 7;      // ~8500 trades per minute
+    if (time > series.watermark) sink += candle_close (&series, time, CANDLE_DEFAULT_GRACE_MS, closed, 64);
+    candle_add_trade (&series, time, 63000500000LL + (i & 63) * TRADE_SCALE, (i & 15) * 1000LL);  // 63000.5 + n, 0.001 * n
+  }
+  MEASURE_END (s, iters);
+}
+
+// ---------- sleepyhead: saving one closed candle (windows plus the text rows) ----------
+
+static void bench_save_candle (long iters, sample_t *s)
+{
+  int minutes[] = { 1, 5, 15, 60 };
+  rolling_t rolling;
+  rolling_stats_t stats;
+  rolling_bucket_t bucket = { 0 };
+  char line[ROLLING_MAX_WINDOWS * 72 + 128];
+  int len;
+
+  rolling_init (&rolling, minutes, 4);
+  for (int t = 0; t < 500; t++) rolling_add_trade (&bucket, trade_fixed (63000.5 + t), trade_fixed (0.01));
+  MEASURE_BEGIN (s);
+  for (long i = 0; i < iters; i++) {
+    rolling_push (&rolling, &bucket);
+    len = snprintf (line, sizeof (line), "%.4f\t%.4f\t%.4f\t%.4f\t%.4f\n", 63000.5, 63010.25, 63020.0, 62990.75, 12.5);
+    for (int w = 0; w < 4; w++) {
+      rolling_get (&rolling, w, &stats);
+      len += snprintf (line + len, sizeof (line) - len, "%.4f\t%.4f\t%.4f\t", stats.sma, stats.vwap, stats.volume);
+    }
+    sink += len;
+  }
+  MEASURE_END (s, iters);
+  rolling_free (&rolling);
+}
+
+// ---------- file logging: text rows through the log writer, trades to the binary log ----------
+
+// The writer only starts once, so the file and the buffer live for the whole run
+static char log_path[] = "/tmp/bench_suite_log_XXXXXX";
+static log_file_t *log_file;
+static log_buffer_t *log_buf;
+
+static void bench_log_printf (long iters, sample_t *s)
+{
+  if (log_file == NULL) {
+    close (mkstemp (log_path));
+    log_file = log_open (log_path);
+    log_buf = log_buffer_create ();
+  }
+  MEASURE_BEGIN (s);
+  for (long i = 0; i < iters; i++) {
+    log_printf (log_buf, log_file, "%.4f\t%.4f\t%.4f\t%.4f\t%.4f\n", 63000.5, 63010.25, 63020.0, 62990.75, 0.001 * i);
+    if ((i & 63) == 63) log_commit (log_buf);
+  }
+  log_commit (log_buf);
+  MEASURE_END (s, iters);
+}
+
+static void bench_tlog_append (long iters, sample_t *s)
+{
+  char path[] = "/tmp/bench_suite_tlog_XXXXXX";
+  int fd = mkstemp (path);
+  tlog_t *log;
+
+  close (fd);
+  log = tlog_create (path, "BINANCE:BTCUSDT");
+  MEASURE_BEGIN (s);
+  for (long i = 0; i < iters; i++) tlog_append (log, 63000.5 + (i & 63), 0.001, 1727790000000LL + i, (1727790000000LL + i) / 60000);
+  MEASURE_END (s, iters);
+  tlog_close (log);
+  unlink (path);
+}
+
+// ---------- latency accounting ----------
+
+static void bench_latency_record (long iters, sample_t *s)
+{
+  static latency_hist_t hist;
+
+  MEASURE_BEGIN (s);
+  for (long i = 0; i < iters; i++) latency_record (&hist, (i * 2654435761LL) & 0xfffff);
+  MEASURE_END (s, iters);
+}
+
+static const bench_case_t cases[] = {
+  { "queue", "push_pop", bench_ring_push },
+  { "queue", "push_batch_64", bench_ring_push_batch },
+  { "parser", "frame_1", bench_parse_1 },
+  { "parser", "frame_16", bench_parse_16 },
+  { "parser", "frame_64", bench_parse_64 },
+  { "parser", "fragmented_16", bench_parse_fragmented },
+  { "candle", "add_trade", bench_candle_add },
+  { "sleepyhead", "save_candle", bench_save_candle },
+  { "log", "log_printf", bench_log_printf },
+  { "log", "tlog_append", bench_tlog_append },
+  { "latency", "record", bench_latency_record },
+};
+
+static int cmp_double (const void *a, const void *b)
+{
+  double x = *(const double *)a, y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+int main (int argc, char *argv[])
+{
+  const char *format = "csv", *filter = NULL;
+  long long target_ns = 100 * 1000000LL;
+  int repeats = 5, opt, json;
+  double ns_per_op[64], ns_min;
+  char name[64];
+  sample_t s;
+  long iters;
+
+  while ((opt = getopt (argc, argv, "f:t:r:")) != -1) {
+    switch (opt) {
+      case 'f': format = optarg; break;
+      case 't': target_ns = atol (optarg) * 1000000LL; break;
+      case 'r': repeats = atoi (optarg); break;
+      default:
+        fprintf (stderr, "Usage: %s [-f csv|json] [-t ms] [-r repeats] [filter]\n", argv[0]);
+        return 1;
+    }
+  }
+  if (optind < argc) filter = argv[optind];
+  if (repeats < 1 || repeats > 64) repeats = 5;
+  json = strcmp (format, "json") == 0;
+
+  log_writer_init (64 * 1024, 200);
+  log_writer_start ();
+  if (!json) printf ("component,case,ops,ns_per_op,ns_min,ops_per_sec,allocs_per_op\n");
+
+  for (size_t c = 0; c < sizeof (cases) / sizeof (cases[0]); c++) {
+    snprintf (name, sizeof (name), "%s/%s", cases[c].component, cases[c].name);
+    if (filter != NULL && strstr (name, filter) == NULL) continue;
+
+    // Calibrate the number of operations to the target time, then measure
+    iters = 1000;
+    while (1) {
+      cases[c].run (iters, &s);
+      if (s.ns >= target_ns / 10 || iters >= 1L << 30) break;
+      iters *= 4;
+    }
+    iters = (long)((double)s.ops * target_ns / (s.ns > 0 ? s.ns : 1)) + 1;
+
+    long long ops = 0, alloc_total = 0;
+    for (int r = 0; r < repeats; r++) {
+      cases[c].run (iters, &s);
+      ns_per_op[r] = (double)s.ns / s.ops;
+      ops = s.ops;
+      alloc_total += s.allocs;
+    }
+    qsort (ns_per_op, repeats, sizeof (double), cmp_double);
+    ns_min = ns_per_op[0];
+
+    if (json) {
+      printf ("{\"component\":\"%s\",\"case\":\"%s\",\"ops\":%lld,\"ns_per_op\":%.3f,\"ns_min\":%.3f,"
+              "\"ops_per_sec\":%.0f,\"allocs_per_op\":%.6f}\n",
+              cases[c].component, cases[c].name, ops, ns_per_op[repeats / 2], ns_min,
+              1e9 / ns_per_op[repeats / 2], (double)alloc_total / repeats / ops);
+    } else {
+      printf ("%s,%s,%lld,%.3f,%.3f,%.0f,%.6f\n", cases[c].component, cases[c].name, ops,
+              ns_per_op[repeats / 2], ns_min, 1e9 / ns_per_op[repeats / 2], (double)alloc_total / repeats / ops);
+    }
+    fflush (stdout);
+  }
+
+  log_writer_stop ();
+  if (log_file != NULL) {
+    log_close (log_file);
+    unlink (log_path);
+  }
+  return 0;
+}
@@ -0,0 +1,321 @@
+/*
+Local stand-in for ws.finnhub.io: a WebSocket server (plain or TLS) that speaks the Finnhub protocol
+(subscribe/unsubscribe messages in, trade and ping messages out) with synthetic trades.
+>Usage: ./mock_finnhub [-p port] [-r rate] [-f frame] [-n symbols] [-b factor,period_s,length_ms]
+                       [-q period_s,length_s] [-d period_s] [-t seconds] [-c cert.pem,key.pem]
+  -p: port to listen on (default 8080)
+  -r: trades per second sent to every client (default 1000)
+  -f: trades per message (default 8)
+  -n: write 'mock_symbols.conf' with this many symbols (MOCK0000, MOCK0001, ...) for the client's '-s'
+  -b: bursts, the rate is multiplied by 'factor' for 'length_ms' every 'period_s' seconds
+  -q: pings-only periods, no trades (only a ping every second) for 'length_s' every 'period_s' seconds
+  -d: close every connection every 'period_s' seconds (the client has to reconnect)
+      Send SIGUSR1 (kill -USR1 <pid>) to close every connection on command
+  -t: stop after this many seconds (default: run until Ctrl-C)
+  -c: serve wss:// with this certificate and key, e.g. a self-signed pair made with
+      openssl req -x509 -newkey rsa:2048 -nodes -days 365 -subj /CN=localhost -keyout key.pem -out cert.pem
+Trades go to the symbols each client subscribed to, round robin. Their time ('t') is the wall clock
+when the message is sent, so the client's network_producer latency is the end-to-end delay.
+Every second the server prints the trades it offered to each client and the trades and messages
+it sent in total; a client that doesn't keep up stops being writable and falls behind the offer.
+>End-to-end benchmark:
+  ./bench/mock_finnhub -n 16 -r 20000 -f 16 -t 60 &
+  ./pi_code -u ws://localhost:8080/ -s mock_symbols.conf   (stop it with Ctrl-C after the server)
+  then read the per-stage latencies of 'latency.txt'.
+>Reconnection test:
+  ./bench/mock_finnhub -n 16 -r 2000 -c cert.pem,key.pem &
+  ./pi_code -u wss://localhost:8080/ -k -s mock_symbols.conf
+  kill -USR1 %1   (repeat, then stop the server for a while to see the backoff)
+  then read the outage, handshake and data gap of every reconnection in 'reconnects.txt'.
+*/
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <libwebsockets.h>
+#include "bench_common.h"
+
+#define MAX_SYMBOLS 1024
+#define MAX_SYMBOL_NAME 32
+#define MAX_FRAME 1024
+#define TRADE_JSON_LEN 96         // Upper bound of one trade object in a message
+
+typedef struct {
+  unsigned char subscribed[MAX_SYMBOLS];
+  int count;                    // Number of subscribed symbols
+  int cursor;                   // Next symbol of the round robin
+  long long sent;               // Trades sent to this client
+  long long next_ping;          // Monotonic time of the next ping of a pings-only period
+  int epoch;                    // Disconnect period the connection was opened in
+} session_t;
+
+static char names[MAX_SYMBOLS][MAX_SYMBOL_NAME];  // Symbols any client subscribed to
+static double prices[MAX_SYMBOLS];                // Random walk of each symbol
+static int number_of_names;
+
+static int port = 8080;
+static double rate = 1000;
+static int frame = 8;
+static double burst_factor = 1, burst_period = 0, burst_length = 0;
+static double quiet_period = 0, quiet_length = 0;
+static double disconnect_period = 0;
+static double duration = 0;
+static char cert_path[256], key_path[256];
+
+static volatile sig_atomic_t stop;
+static volatile sig_atomic_t drop_requested;  // Set by SIGUSR1
+static long long offered;         // Trades due to every client since the start
+static int pings_only;            // Inside a pings-only period
+static int epoch;                 // Incremented at every forced disconnect
+static long long trades_sent, messages_sent, clients;
+
+static void handle_sigint (int sig)
+{
+  stop = 1;
+}
+
+static void handle_sigusr1 (int sig)
+{
+  drop_requested = 1;
+}
+
+static long long wall_ms (void)
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_REALTIME, &ts);
+  return (long long)ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+// Index of a symbol name, added to the table the first time
+static int symbol_index (const char *name, size_t len)
+{
+  for (int i = 0; i < number_of_names; i++) {
+    if (strlen (names[i]) == len && memcmp (names[i], name, len) == 0) return i;
+  }
+  if (number_of_names == MAX_SYMBOLS || len >= MAX_SYMBOL_NAME) return -1;
+  memcpy (names[number_of_names], name, len);
+  names[number_of_names][len] = '\0';
+  prices[number_of_names] = 100.0 + number_of_names;
+  return number_of_names++;
+}
+
+// Handle {"type":"subscribe","symbol":"X"} and {"type":"unsubscribe","symbol":"X"}
+static void handle_request (session_t *s, const char *msg, size_t len)
+{
+  char text[256];
+  const char *symbol, *end;
+  int subscribe, i;
+
+  if (len >= sizeof (text)) return;
+  memcpy (text, msg, len);
+  text[len] = '\0';
+
+  subscribe = strstr (text, "\"unsubscribe\"") == NULL;
+  symbol = strstr (text, "\"symbol\"");
+  if (symbol == NULL || (symbol = strchr (symbol + 8, '"')) == NULL) return;
+  symbol++;
+  if ((end = strchr (symbol, '"')) == NULL) return;
+
+  i = symbol_index (symbol, end - symbol);
+  if (i < 0 || s->subscribed[i] == subscribe) return;
+  s->subscribed[i] = subscribe;
+  s->count += subscribe ? 1 : -1;
+}
+
+// Build a trade message of up to 'n' trades for the client's symbols. Returns its length.
+static int build_trades (session_t *s, char *out, int n)
+{
+  long long now = wall_ms ();
+  int len = 0, added = 0;
+
+  len += sprintf (out + len, "{\"data\":[");
+  while (added < n) {
+    s->cursor = (s->cursor + 1) % number_of_names;
+    if (!s->subscribed[s->cursor]) continue;
+
+    prices[s->cursor] *= 1.0 + ((rand () % 2001) - 1000) / 1e6;
+    len += sprintf (out + len, "%s{\"c\":null,\"p\":%.4f,\"s\":\"%s\",\"t\":%lld,\"v\":%.4f}",
+                    added ? "," : "", prices[s->cursor], names[s->cursor], now, (rand () % 10000) / 1000.0);
+    added++;
+  }
+  len += sprintf (out + len, "],\"type\":\"trade\"}");
+  return len;
+}
+
+static int callback_mock (struct lws *wsi, enum lws_callback_reasons reason, void *user, void *in, size_t len)
+{
+  session_t *s = (session_t *)user;
+  static unsigned char buf[LWS_PRE + MAX_FRAME * TRADE_JSON_LEN + 64];
+  char *out = (char *)&buf[LWS_PRE];
+  int n;
+
+  switch (reason) {
+    case LWS_CALLBACK_ESTABLISHED:
+      memset (s, 0, sizeof (session_t));
+      s->sent = offered;      // A new client only gets the trades offered from now on
+      s->epoch = epoch;
+      clients++;
+      break;
+
+    case LWS_CALLBACK_RECEIVE:
+      handle_request (s, (const char *)in, len);
+      break;
+
+    case LWS_CALLBACK_SERVER_WRITEABLE:
+      if (s->epoch != epoch) {
+        lws_close_reason (wsi, LWS_CLOSE_STATUS_GOINGAWAY, (unsigned char *)"forced disconnect", 17);
+        return -1;
+      }
+
+      if (pings_only) {
+        s->sent = offered;
+        if (bench_now_ns () < s->next_ping) break;
+        s->next_ping = bench_now_ns () + 1000000000LL;
+        n = sprintf (out, "{\"type\":\"ping\"}");
+      } else {
+        // One message per writeable callback, ask for another while the client is behind
+        if (s->count == 0 || offered - s->sent < frame) break;
+        n = build_trades (s, out, frame);
+        s->sent += frame;
+        trades_sent += frame;
+      }
+
+      if (lws_write (wsi, (unsigned char *)out, n, LWS_WRITE_TEXT) < n) return -1;
+      messages_sent++;
+      if (offered - s->sent >= frame) lws_callback_on_writable (wsi);
+      break;
+
+    case LWS_CALLBACK_CLOSED:
+      clients--;
+      break;
+
+    default:
+      break;
+  }
+  return 0;
+}
+
+static struct lws_protocols protocols[] = {
+  { "http", lws_callback_http_dummy, 0, 0 },
+  { "ws-protocol", callback_mock, sizeof (session_t), 4096 },   // Name used by pi_code
+  { NULL, NULL, 0, 0 }
+};
+
+// Time inside a repeating period, in seconds
+static double phase (double t, double period)
+{
+  return period > 0 ? t - period * (long long)(t / period) : -1;
+}
+
+static void write_symbols_file (int count)
+{
+  FILE *f = fopen ("mock_symbols.conf", "w");
+
+  if (f == NULL) {
+    perror ("mock_symbols.conf");
+    exit (1);
+  }
+  for (int i = 0; i < count; i++) fprintf (f, "MOCK%04d\n", i);
+  fclose (f);
+}
+
+int main (int argc, char *argv[])
+{
+  struct lws_context_creation_info info;
+  struct lws_context *context;
+  long long start, last, last_report, last_offered = 0, last_trades = 0, last_messages = 0, now;
+  double t, current_rate, due = 0;
+  int opt, last_epoch = 0;
+
+  while ((opt = getopt (argc, argv, "p:r:f:n:b:q:d:t:c:")) != -1) {
+    switch (opt) {
+      case 'p': port = atoi (optarg); break;
+      case 'r': rate = atof (optarg); break;
+      case 'f': frame = atoi (optarg); break;
+      case 'n': write_symbols_file (atoi (optarg)); break;
+      case 'b': sscanf (optarg, "%lf,%lf,%lf", &burst_factor, &burst_period, &burst_length); break;
+      case 'q': sscanf (optarg, "%lf,%lf", &quiet_period, &quiet_length); break;
+      case 'd': disconnect_period = atof (optarg); break;
+      case 't': duration = atof (optarg); break;
+      case 'c': sscanf (optarg, "%255[^,],%255s", cert_path, key_path); break;
+      default:
+        fprintf (stderr, "Usage: %s [-p port] [-r rate] [-f frame] [-n symbols] [-b factor,period_s,length_ms] "
+                         "[-q period_s,length_s] [-d period_s] [-t seconds] [-c cert.pem,key.pem]\n", argv[0]);
+        return 1;
+    }
+  }
+  if (frame < 1 || frame > MAX_FRAME) {
+    fprintf (stderr, "Frame size must be 1 to %d trades\n", MAX_FRAME);
+    return 1;
+  }
+
+  signal (SIGINT, handle_sigint);
+  signal (SIGUSR1, handle_sigusr1);
+  lws_set_log_level (LLL_ERR | LLL_WARN, NULL);
+
+  memset (&info, 0, sizeof (info));
+  info.port = port;
+  info.protocols = protocols;
+  if (cert_path[0] != '\0') {
+    info.options |= LWS_SERVER_OPTION_DO_SSL_GLOBAL_INIT;
+    info.ssl_cert_filepath = cert_path;
+    info.ssl_private_key_filepath = key_path;
+  }
+  context = lws_create_context (&info);
+  if (context == NULL) {
+    fprintf (stderr, "Error creating the server context\n");
+    return 1;
+  }
+  printf ("Mock Finnhub on %s://localhost:%d/, %.0f trades/s in messages of %d trades\n",
+          cert_path[0] != '\0' ? "wss" : "ws", port, rate, frame);
+
+  start = last = last_report = bench_now_ns ();
+  while (!stop) {
+    lws_service (context, 0);
+
+    // Offered load: the configured rate, times the burst factor inside a burst, none when pings-only
+    now = bench_now_ns ();
+    t = (now - start) / 1e9;
+    pings_only = quiet_period > 0 && phase (t, quiet_period) >= quiet_period - quiet_length;
+    current_rate = rate;
+    if (burst_period > 0 && phase (t, burst_period) < burst_length / 1000.0) current_rate *= burst_factor;
+    if (!pings_only) due += current_rate * (now - last) / 1e9;
+    last = now;
+    if (due >= 1) {
+      offered += (long long)due;
+      due -= (long long)due;
+    }
+
+    if (disconnect_period > 0 && (int)(t / disconnect_period) != last_epoch) {
+      last_epoch = (int)(t / disconnect_period);
+      epoch++;
+    }
+    if (drop_requested) {
+      drop_requested = 0;
+      printf ("%6.0f s: closing %lld connections\n", t, clients);
+      epoch++;
+    }
+    lws_callback_on_writable_all_protocol (context, &protocols[1]);
+
+    if (now - last_report >= 1000000000LL) {
+      printf ("%6.0f s: %lld clients, offered %lld trades/s, sent %lld trades/s in %lld messages/s%s\n", t, clients,
+              offered - last_offered, trades_sent - last_trades, messages_sent - last_messages,
+              pings_only ? " (pings only)" : "");
+      fflush (stdout);
+      last_offered = offered;
+      last_trades = trades_sent;
+      last_messages = messages_sent;
+      last_report = now;
+    }
+    if (duration > 0 && t >= duration) break;
+
+    // At low message rates don't spin between messages
+    if (current_rate / frame < 5000) usleep (100);
+  }
+
+  printf ("Sent %lld trades in %lld messages\n", trades_sent, messages_sent);
+  lws_context_destroy (context);
+  return 0;
+}
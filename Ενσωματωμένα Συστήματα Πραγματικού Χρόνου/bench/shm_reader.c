@@ -0,0 +1,172 @@
+/*
+Demo reader of the shared memory feed of pi_code, and measurement of its staleness.
+>Usage: ./shm_reader [-n shm_name] [-i interval_ms] [-l seconds] [symbol ...]
+  -n: name of the feed (default "/pi_code", pi_code's '-m')
+  -i: print the table every this many ms (default 1000)
+  -l: instead of the table, poll every record in a busy loop for this many seconds and measure
+      how old each new version is when the reader first sees it
+  symbols: only these symbols (default all)
+The table has the last trade, the open candle, the rolling windows and the indicators of every symbol.
+Staleness is measured from the worker's write (update_ns) and from the producer publishing the
+trade (pub_ns), both on the monotonic clock of the machine. 'missed' counts the versions that
+were overwritten before the reader got to them (a polling reader only needs the latest).
+>Staleness under load:
+  ./pi_code -r <recorded logs> -m /pi_code -s symbols.conf &   (or a live run against bench/mock_finnhub)
+  ./bench/shm_reader -l 10
+Give the reader its own core, on a busy core its staleness is the scheduler's time slice.
+*/
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+#include <unistd.h>
+#include "../shm_feed.h"
+#include "../latency.h"
+#include "bench_common.h"
+
+static volatile sig_atomic_t stop;
+
+static void handle_sigint (int sig)
+{
+  stop = 1;
+}
+
+// Symbol 'rec' is one of the symbols asked for
+static int wanted (const shm_symbol_t *rec, char **symbols, int n)
+{
+  if (n == 0) return 1;
+  for (int i = 0; i < n; i++) {
+    if (strncmp (rec->name, symbols[i], SHM_FEED_NAME_LEN) == 0) return 1;
+  }
+  return 0;
+}
+
+static void print_table (const shm_feed_t *feed, char **symbols, int n)
+{
+  uint32_t count = atomic_load_explicit (&feed->hdr->count, memory_order_acquire);
+  long long now = bench_now_ns ();
+  shm_symbol_t *rec;
+  shm_live_t live;
+  shm_stats_t stats;
+
+  printf ("%-20s %12s %10s %8s %12s %12s %12s %12s %10s\n", "symbol", "price", "volume", "age_ms",
+          "open", "high", "low", "close", "trades");
+  for (uint32_t id = 0; id < count; id++) {
+    rec = shm_feed_symbol (feed, id);
+    if (rec == NULL || !wanted (rec, symbols, n)) continue;
+    if (shm_feed_read_live (rec, &live) == 0) {
+      printf ("%-20s %12s\n", rec->name, "no_data");
+      continue;
+    }
+    printf ("%-20s %12.4f %10.4f %8.1f %12.4f %12.4f %12.4f %12.4f %10lld\n", rec->name, live.price, live.volume,
+            (now - live.update_ns) / 1e6, live.open, live.high, live.low, live.close, (long long)live.candle_trades);
+
+    if (shm_feed_read_stats (rec, &stats) == 0) continue;
+    for (int w = 0; w < stats.windows; w++) {
+      printf ("%20s %5dm SMA %.4f VWAP %.4f volume %.4f%s\n", "", stats.window[w].minutes, stats.window[w].sma,
+              stats.window[w].vwap, stats.window[w].volume, stats.window[w].full ? "" : " (filling)");
+    }
+    for (int k = 0; k < stats.indicators; k++) {
+      if (isnan (stats.indicator[k].value)) printf ("%20s %s no_data\n", "", stats.indicator[k].name);
+      else printf ("%20s %s %.4f\n", "", stats.indicator[k].name, stats.indicator[k].value);
+    }
+  }
+  printf ("\n");
+  fflush (stdout);
+}
+
+static void print_stats (const char *name, const latency_hist_t *h)
+{
+  static latency_prev_t prev;
+  latency_stats_t s;
+
+  memset (&prev, 0, sizeof (prev));
+  latency_snapshot (h, &prev, &s);
+  printf ("%-16s %10llu %10.2f %10.2f %10.2f %10.2f\n", name, (unsigned long long)s.count,
+          s.p50 / 1e3, s.p99 / 1e3, s.p999 / 1e3, s.max / 1e3);
+}
+
+// Busy-poll the live section of every record and histogram the age of each new version
+static int measure (const shm_feed_t *feed, double seconds, char **symbols, int n)
+{
+  static latency_hist_t write_age, publish_age, read_cost;
+  uint32_t *seen = calloc (feed->hdr->capacity, sizeof (uint32_t));
+  long long start = bench_now_ns (), end = start + (long long)(seconds * 1e9), t0, now;
+  unsigned long long polls = 0, missed = 0;
+  uint32_t count, seq;
+  shm_symbol_t *rec;
+  shm_live_t live;
+
+  if (seen == NULL) return 1;
+  while (!stop && !atomic_load_explicit (&feed->hdr->closed, memory_order_acquire)) {
+    count = atomic_load_explicit (&feed->hdr->count, memory_order_acquire);
+    for (uint32_t id = 0; id < count; id++) {
+      rec = shm_feed_symbol (feed, id);
+      if (rec == NULL || !wanted (rec, symbols, n)) continue;
+      polls++;
+      seq = atomic_load_explicit (&rec->live_seq, memory_order_relaxed);
+      if (seq == seen[id] || (seq & 1)) continue;
+
+      t0 = bench_now_ns ();
+      seq = shm_feed_read_live (rec, &live);
+      now = bench_now_ns ();
+      latency_record (&read_cost, now - t0);
+      latency_record (&write_age, now - live.update_ns);
+      latency_record (&publish_age, now - live.pub_ns);
+      if (seen[id] != 0 && seq - seen[id] > 2) missed += (seq - seen[id]) / 2 - 1;
+      seen[id] = seq;
+    }
+    if (bench_now_ns () >= end) break;
+  }
+
+  printf ("Polled %.1f s, %llu record polls, %llu versions missed\n", (bench_now_ns () - start) / 1e9, polls, missed);
+  printf ("%-16s %10s %10s %10s %10s %10s\n", "us", "count", "p50", "p99", "p99.9", "max");
+  print_stats ("write_to_read", &write_age);
+  print_stats ("publish_to_read", &publish_age);
+  print_stats ("read_cost", &read_cost);
+  free (seen);
+  return 0;
+}
+
+int main (int argc, char *argv[])
+{
+  const char *name = SHM_FEED_DEFAULT_NAME;
+  int interval_ms = 1000, opt;
+  double seconds = 0;
+  shm_feed_t *feed;
+
+  while ((opt = getopt (argc, argv, "n:i:l:")) != -1) {
+    switch (opt) {
+      case 'n': name = optarg; break;
+      case 'i': interval_ms = atoi (optarg); break;
+      case 'l': seconds = atof (optarg); break;
+      default:
+        fprintf (stderr, "Usage: %s [-n shm_name] [-i interval_ms] [-l seconds] [symbol ...]\n", argv[0]);
+        return 1;
+    }
+  }
+
+  feed = shm_feed_open (name);
+  if (feed == NULL) {
+    fprintf (stderr, "Cannot open the feed %s: %s\n", name, strerror (errno));
+    return 1;
+  }
+  printf ("Feed %s of pid %d, %u of %u records in use\n", name, feed->hdr->writer_pid,
+          atomic_load (&feed->hdr->count), feed->hdr->capacity);
+  signal (SIGINT, handle_sigint);
+
+  if (seconds > 0) {
+    opt = measure (feed, seconds, argv + optind, argc - optind);
+  } else {
+    while (!stop && !atomic_load_explicit (&feed->hdr->closed, memory_order_acquire)) {
+      print_table (feed, argv + optind, argc - optind);
+      usleep (interval_ms * 1000);
+    }
+    opt = 0;
+  }
+  if (atomic_load (&feed->hdr->closed)) printf ("The writer closed the feed\n");
+  shm_feed_close (feed);
+  return opt;
+}
@@ -0,0 +1,133 @@
+#include <string.h>
+#include "candle.h"
+
+// Interval (minute) of an exchange time, rounding down for times before the epoch too
+int64_t candle_bucket (int64_t time, int64_t interval)
+{
+  return time >= 0 ? time / interval : -((-time + interval - 1) / interval);
+}
+
+void candle_series_init (candle_series_t *s, int id, int64_t interval)
+{
+  memset (s, 0, sizeof (candle_series_t));
+  s->id = id;
+  s->interval = interval;
+  s->next_close = -1;
+  s->watermark = INT64_MIN;
+}
+
+// Add a trade to the candle of its minute. The caller closes the minutes the trade's time
+// moves past first (candle_close), so the minute is always one of the open ones.
+// Returns -1 if the trade is late (its minute was already closed) and was dropped.
+int candle_add_trade (candle_series_t *s, int64_t time, int64_t price, int64_t volume)
+{
+  int64_t m = candle_bucket (time, s->interval);
+  candle_t *c;
+
+  if (s->next_close < 0) s->next_close = m;
+  if (m < s->next_close || m >= s->next_close + CANDLE_MAX_OPEN) {
+    s->late++;
+    return -1;
+  }
+  if (time > s->watermark) s->watermark = time;
+
+  c = &s->open[m % CANDLE_MAX_OPEN];
+  if (c->bucket.trades == 0) {
+    c->minute = m * s->interval;
+    c->open = c->high = c->low = c->close = price;
+    c->open_time = c->close_time = time;
+  } else {
+    if (price > c->high) c->high = price;
+    if (price < c->low) c->low = price;
+    // Out of order trades: the open is the earliest trade, the close the latest (ties go to the later arrival)
+    if (time < c->open_time) {
+      c->open = price;
+      c->open_time = time;
+    }
+    if (time >= c->close_time) {
+      c->close = price;
+      c->close_time = time;
+    }
+  }
+  c->volume += volume;
+  rolling_add_trade (&c->bucket, price, volume);
+  return 0;
+}
+
+// Close, oldest first, every minute whose end plus the grace period is at or before 'watermark'.
+// Minutes without trades give empty candles, so every minute of the symbol is handed over once.
+// Returns the number of candles copied to 'out' (at most 'max'; call again while it returns 'max').
+int candle_close (candle_series_t *s, int64_t watermark, int64_t grace_ms, candle_t *out, int max)
+{
+  if (s->next_close < 0) {
+    // No trade yet, start with the minute of the first tick
+    s->next_close = candle_bucket (watermark, s->interval);
+    return 0;
+  }
+  return candle_close_before (s, candle_bucket (watermark - grace_ms, s->interval), out, max);
+}
+
+// Close, oldest first, every minute before 'minute' (an interval number, time / interval), like
+// candle_close; before the first trade or tick the series starts at 'minute' instead.
+int candle_close_before (candle_series_t *s, int64_t minute, candle_t *out, int max)
+{
+  int n = 0;
+  candle_t *c;
+
+  if (s->next_close < 0) {
+    s->next_close = minute;
+    return 0;
+  }
+
+  while (n < max && s->next_close < minute) {
+    c = &s->open[s->next_close % CANDLE_MAX_OPEN];
+    if (c->bucket.trades == 0) {
+      memset (c, 0, sizeof (candle_t));
+      c->minute = s->next_close * s->interval;
+    }
+    c->id = s->id;
+    out[n++] = *c;
+
+    memset (c, 0, sizeof (candle_t));
+    s->next_close++;
+  }
+  return n;
+}
+
+// Open candle of the symbol's latest minute, NULL before the first trade or once that minute is closed
+const candle_t *candle_current (const candle_series_t *s)
+{
+  int64_t m;
+
+  if (s->next_close < 0 || s->watermark == INT64_MIN) return (NULL);
+  m = candle_bucket (s->watermark, s->interval);
+  if (m < s->next_close) return (NULL);
+  return &s->open[m % CANDLE_MAX_OPEN];
+}
+
+// Merge into 'c' the candle of the same minute built from the trades that arrived after those
+// of 'c' (a minute split over two trade log partitions). The result is the candle the worker
+// builds from all of them in arrival order, ties of the open and close included.
+void candle_merge (candle_t *c, const candle_t *later)
+{
+  if (later->bucket.trades == 0) return;
+  if (c->bucket.trades == 0) {
+    *c = *later;
+    return;
+  }
+  if (later->high > c->high) c->high = later->high;
+  if (later->low < c->low) c->low = later->low;
+  if (later->open_time < c->open_time) {
+    c->open = later->open;
+    c->open_time = later->open_time;
+  }
+  if (later->close_time >= c->close_time) {
+    c->close = later->close;
+    c->close_time = later->close_time;
+  }
+  c->volume += later->volume;
+  c->bucket.trades += later->bucket.trades;
+  c->bucket.price_sum += later->bucket.price_sum;
+  c->bucket.volume += later->bucket.volume;
+  c->bucket.notional += later->bucket.notional;
+}
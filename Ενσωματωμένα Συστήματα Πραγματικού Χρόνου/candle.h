@@ -0,0 +1,54 @@
+#ifndef CANDLE_H
+#define CANDLE_H
+
+#include <stdint.h>
+#include "rolling.h"
+
+// Candles bucketed by exchange time, 1-minute ones in the pipeline (any interval for pi_query).
+// A trade at time t (ms) belongs to minute floor(t / 60000); a minute is closed once the
+// symbol's latest exchange time (or a wall-clock tick) reaches the end of the minute plus
+// the grace period. Trades for a closed minute are late and dropped. Candles only depend on
+// the trades and their order, so replaying the same trades gives the same candles.
+// 'Minute' below stands for the interval of the series.
+
+#define CANDLE_MINUTE_MS 60000LL
+#define CANDLE_MAX_OPEN 8               // Minutes of a symbol that can be open at once
+#define CANDLE_MAX_GRACE_MS ((CANDLE_MAX_OPEN - 2) * CANDLE_MINUTE_MS)
+#define CANDLE_DEFAULT_GRACE_MS 2000
+
+// Candle of one symbol and minute, handed from the worker to sleepyhead when it is closed.
+// Prices and volume are fixed point (TRADE_SCALE), exact sums of the trades.
+typedef struct {
+  int id;                   // Symbol ID
+  int64_t minute;           // Start of the minute (interval), ms since the epoch
+  int64_t open;
+  int64_t high;
+  int64_t low;
+  int64_t close;
+  int64_t volume;
+  int64_t open_time;        // Exchange time of the open and close trades
+  int64_t close_time;
+  rolling_bucket_t bucket;  // Sums of the minute for the rolling windows, trades == 0 if empty
+  int64_t closed_ns;        // Monotonic time the candle was closed, set by the publisher
+} candle_t;
+
+// Open candles of one symbol, owned by the worker of the symbol
+typedef struct {
+  int id;
+  int64_t interval;                 // Length of a candle, CANDLE_MINUTE_MS in the pipeline
+  candle_t open[CANDLE_MAX_OPEN];   // Indexed by minute % CANDLE_MAX_OPEN
+  int64_t next_close;               // Oldest minute that is not closed yet, -1 before the first trade or tick
+  int64_t watermark;                // Latest exchange time of the symbol's trades
+  uint64_t late;                    // Trades dropped because their minute was closed
+} candle_series_t;
+
+// Candle functions
+void candle_series_init (candle_series_t *s, int id, int64_t interval);
+int candle_add_trade (candle_series_t *s, int64_t time, int64_t price, int64_t volume);
+int candle_close (candle_series_t *s, int64_t watermark, int64_t grace_ms, candle_t *out, int max);
+int candle_close_before (candle_series_t *s, int64_t minute, candle_t *out, int max);
+const candle_t *candle_current (const candle_series_t *s);
+int64_t candle_bucket (int64_t time, int64_t interval);
+void candle_merge (candle_t *c, const candle_t *later);
+
+#endif
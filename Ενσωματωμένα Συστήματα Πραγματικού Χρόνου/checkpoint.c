@@ -0,0 +1,287 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <libgen.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "checkpoint.h"
+
+_Static_assert (sizeof (checkpoint_header_t) == CHECKPOINT_HEADER_SIZE, "checkpoint header must be 64 bytes");
+_Static_assert (sizeof (checkpoint_symbol_t) % 8 == 0, "the buckets after a symbol must stay aligned");
+
+static size_t padded (size_t size)
+{
+  return (size + 7) & ~(size_t)7;
+}
+
+static uint64_t fnv1a (const char *data, size_t size)
+{
+  uint64_t h = 0xcbf29ce484222325ULL;
+
+  for (size_t i = 0; i < size; i++) {
+    h ^= (unsigned char)data[i];
+    h *= 0x100000001b3ULL;
+  }
+  return h;
+}
+
+static int reserve (char **data, size_t *capacity, size_t size)
+{
+  size_t grown = *capacity ? *capacity : 4096;
+  char *p;
+
+  if (size <= *capacity) return 0;
+  while (grown < size) grown *= 2;
+  if ((p = (char *) realloc (*data, grown)) == NULL) return -1;
+  *data = p;
+  *capacity = grown;
+  return 0;
+}
+
+// Copy the state of a symbol its worker owns: the open candles, the indicators and the position
+// in the trade log. The buffer of the part is kept for the next time. Returns -1 if out of memory.
+int checkpoint_take (checkpoint_part_t *part, const candle_series_t *candles, const indicator_set_t *indicators,
+                     const char *log_path, uint64_t log_rows)
+{
+  const indicator_spec_t *spec;
+  checkpoint_symbol_t *s;
+  checkpoint_indicator_t *ind;
+  size_t size = sizeof (checkpoint_symbol_t), state;
+
+  for (int i = 0; i < indicators->count; i++) {
+    spec = indicators->spec[i];
+    size += sizeof (checkpoint_indicator_t) + padded (spec->ind->size (spec->params, spec->count));
+  }
+  if (reserve (&part->data, &part->capacity, size) < 0) return -1;
+  memset (part->data, 0, size);
+
+  s = (checkpoint_symbol_t *)part->data;
+  strncpy (s->log_path, log_path, sizeof (s->log_path) - 1);
+  s->log_rows = log_rows;
+  s->indicators = indicators->count;
+  s->candles = *candles;
+  part->size = sizeof (checkpoint_symbol_t);
+  for (int i = 0; i < indicators->count; i++) {
+    spec = indicators->spec[i];
+    state = spec->ind->size (spec->params, spec->count);
+    ind = (checkpoint_indicator_t *)(part->data + part->size);
+    snprintf (ind->label, sizeof (ind->label), "%s", spec->label);
+    ind->size = state;
+    memcpy (ind + 1, indicators->state[i], state);
+    part->size += sizeof (checkpoint_indicator_t) + padded (state);
+  }
+  return 0;
+}
+
+void checkpoint_part_free (checkpoint_part_t *part)
+{
+  free (part->data);
+  memset (part, 0, sizeof (*part));
+}
+
+// Start a new file, the buffer of the previous one is reused
+void checkpoint_begin (checkpoint_writer_t *w)
+{
+  w->size = CHECKPOINT_HEADER_SIZE;
+  w->symbols = 0;
+}
+
+// Add a symbol: the part its worker took and its rolling windows as of the same minute.
+// Returns -1 if out of memory.
+int checkpoint_add (checkpoint_writer_t *w, const char *symbol, const checkpoint_part_t *part, const rolling_t *rolling)
+{
+  uint64_t buckets = rolling->pushed < (uint64_t)rolling->capacity ? rolling->pushed : (uint64_t)rolling->capacity;
+  size_t size = part->size + buckets * sizeof (rolling_bucket_t);
+  rolling_bucket_t *bucket;
+  checkpoint_symbol_t *s;
+
+  if (reserve (&w->data, &w->capacity, w->size + size) < 0) return -1;
+  s = (checkpoint_symbol_t *)(w->data + w->size);
+  memcpy (s, part->data, sizeof (checkpoint_symbol_t));
+  memset (s->symbol, 0, sizeof (s->symbol));
+  strncpy (s->symbol, symbol, sizeof (s->symbol) - 1);
+  s->buckets = buckets;
+  s->size = size;
+
+  bucket = (rolling_bucket_t *)(s + 1);
+  for (uint64_t k = rolling->pushed - buckets; k < rolling->pushed; k++) *bucket++ = rolling->ring[k % rolling->capacity];
+  memcpy (bucket, part->data + sizeof (checkpoint_symbol_t), part->size - sizeof (checkpoint_symbol_t));
+  w->size += size;
+  w->symbols++;
+  return 0;
+}
+
+// Write the file to 'path' atomically: to a temporary file, fsynced, renamed over the previous
+// checkpoint, and the directory fsynced. Returns -1 with errno set on failure, the previous
+// checkpoint is left as it is then.
+int checkpoint_commit (checkpoint_writer_t *w, const char *path, int64_t written)
+{
+  checkpoint_header_t *hdr;
+  char tmp_path[PATH_MAX], dir_path[PATH_MAX];
+  size_t done = 0;
+  ssize_t n;
+  int fd, err;
+
+  if (reserve (&w->data, &w->capacity, CHECKPOINT_HEADER_SIZE) < 0) return -1;
+  hdr = (checkpoint_header_t *)w->data;
+  memset (hdr, 0, sizeof (*hdr));
+  memcpy (hdr->magic, CHECKPOINT_MAGIC, sizeof (hdr->magic));
+  hdr->version = CHECKPOINT_VERSION;
+  hdr->header_size = CHECKPOINT_HEADER_SIZE;
+  hdr->symbols = w->symbols;
+  hdr->series_size = sizeof (candle_series_t);
+  hdr->written = written;
+  hdr->size = w->size;
+  hdr->checksum = fnv1a (w->data + CHECKPOINT_HEADER_SIZE, w->size - CHECKPOINT_HEADER_SIZE);
+
+  snprintf (tmp_path, sizeof (tmp_path), "%s.tmp", path);
+  if ((fd = open (tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) return -1;
+  while (done < w->size) {
+    if ((n = write (fd, w->data + done, w->size - done)) < 0) {
+      if (errno == EINTR) continue;
+      goto fail;
+    }
+    done += n;
+  }
+  if (fsync (fd) < 0) goto fail;
+  if (close (fd) < 0) {
+    fd = -1;
+    goto fail;
+  }
+  fd = -1;
+  if (rename (tmp_path, path) < 0) goto fail;
+
+  // The rename itself survives a power cut only once the directory is on disk
+  snprintf (dir_path, sizeof (dir_path), "%s", path);
+  if ((fd = open (dirname (dir_path), O_RDONLY | O_DIRECTORY)) >= 0) {
+    fsync (fd);
+    close (fd);
+  }
+  return 0;
+
+fail:
+  err = errno;
+  if (fd >= 0) close (fd);
+  unlink (tmp_path);
+  errno = err;
+  return -1;
+}
+
+void checkpoint_writer_free (checkpoint_writer_t *w)
+{
+  free (w->data);
+  memset (w, 0, sizeof (*w));
+}
+
+// Load and check a checkpoint. Returns 0, 1 if there is none, -1 if it can't be read or is
+// corrupt (with a message).
+int checkpoint_load (checkpoint_t *c, const char *path)
+{
+  const checkpoint_symbol_t *s;
+  const checkpoint_indicator_t *ind;
+  struct stat st;
+  size_t done = 0, offset, end;
+  ssize_t n;
+  int fd;
+
+  memset (c, 0, sizeof (*c));
+  if ((fd = open (path, O_RDONLY)) < 0) {
+    if (errno == ENOENT) return 1;
+    fprintf (stderr, "checkpoint: %s: %s\n", path, strerror (errno));
+    return -1;
+  }
+  if (fstat (fd, &st) < 0 || st.st_size < CHECKPOINT_HEADER_SIZE || (c->data = (char *) malloc (st.st_size)) == NULL) {
+    fprintf (stderr, "checkpoint: %s: can't be read\n", path);
+    close (fd);
+    return -1;
+  }
+  c->size = st.st_size;
+  while (done < c->size && (n = read (fd, c->data + done, c->size - done)) > 0) done += n;
+  close (fd);
+  c->hdr = (const checkpoint_header_t *)c->data;
+  if (done != c->size || memcmp (c->hdr->magic, CHECKPOINT_MAGIC, sizeof (c->hdr->magic)) != 0 ||
+      c->hdr->header_size != CHECKPOINT_HEADER_SIZE || c->hdr->size != c->size) {
+    fprintf (stderr, "checkpoint: %s: not a checkpoint or truncated\n", path);
+    goto fail;
+  }
+  if (c->hdr->version != CHECKPOINT_VERSION || c->hdr->series_size != sizeof (candle_series_t)) {
+    fprintf (stderr, "checkpoint: %s: written by another version\n", path);
+    goto fail;
+  }
+  if (c->hdr->checksum != fnv1a (c->data + CHECKPOINT_HEADER_SIZE, c->size - CHECKPOINT_HEADER_SIZE)) {
+    fprintf (stderr, "checkpoint: %s: checksum mismatch\n", path);
+    goto fail;
+  }
+
+  // Every symbol and indicator must lie inside the file, checkpoint_next() relies on it
+  offset = CHECKPOINT_HEADER_SIZE;
+  for (uint32_t k = 0; k < c->hdr->symbols; k++) {
+    s = (const checkpoint_symbol_t *)(c->data + offset);
+    if (c->size - offset < sizeof (*s) || s->size > c->size - offset) goto corrupt;
+    end = offset + s->size;
+    offset += sizeof (*s) + (size_t)s->buckets * sizeof (rolling_bucket_t);
+    for (uint32_t i = 0; i < s->indicators && offset <= end; i++) {
+      ind = (const checkpoint_indicator_t *)(c->data + offset);
+      if (end - offset < sizeof (*ind)) goto corrupt;
+      offset += sizeof (*ind) + padded (ind->size);
+    }
+    if (offset != end) goto corrupt;
+  }
+  if (offset != c->size) goto corrupt;
+  return 0;
+
+corrupt:
+  fprintf (stderr, "checkpoint: %s: corrupt symbol records\n", path);
+fail:
+  checkpoint_free (c);
+  return -1;
+}
+
+// Symbols of a loaded checkpoint: the first one if 'prev' is NULL, NULL after the last one
+const checkpoint_symbol_t *checkpoint_next (const checkpoint_t *c, const checkpoint_symbol_t *prev)
+{
+  const char *next = prev == NULL ? c->data + CHECKPOINT_HEADER_SIZE : (const char *)prev + prev->size;
+
+  return next < c->data + c->size ? (const checkpoint_symbol_t *)next : NULL;
+}
+
+// Restore a symbol into freshly initialized state. The windows get the buckets pushed again, so
+// they can differ from the ones of the checkpoint; an indicator is restored if one with the same
+// label and state size was checkpointed, the others start over. Returns -1 if the candles are of
+// another interval (nothing is restored then), else the number of indicators restored.
+int checkpoint_restore (const checkpoint_symbol_t *s, candle_series_t *candles, rolling_t *rolling, indicator_set_t *indicators)
+{
+  const rolling_bucket_t *bucket = (const rolling_bucket_t *)(s + 1);
+  const checkpoint_indicator_t *ind;
+  const indicator_spec_t *spec;
+  int id = candles->id, restored = 0;
+
+  if (s->candles.interval != candles->interval) return -1;
+  *candles = s->candles;
+  candles->id = id;
+  for (uint32_t k = 0; k < s->buckets; k++) rolling_push (rolling, &bucket[k]);
+
+  for (int i = 0; i < indicators->count; i++) {
+    spec = indicators->spec[i];
+    ind = (const checkpoint_indicator_t *)(bucket + s->buckets);
+    for (uint32_t k = 0; k < s->indicators; k++) {
+      if (strcmp (ind->label, spec->label) == 0 && ind->size == spec->ind->size (spec->params, spec->count)) {
+        memcpy (indicators->state[i], ind + 1, ind->size);
+        restored++;
+        break;
+      }
+      ind = (const checkpoint_indicator_t *)((const char *)(ind + 1) + padded (ind->size));
+    }
+  }
+  return restored;
+}
+
+void checkpoint_free (checkpoint_t *c)
+{
+  free (c->data);
+  memset (c, 0, sizeof (*c));
+}
@@ -0,0 +1,97 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "candle.h"
+#include "rolling.h"
+#include "indicator.h"
+
+// Checkpoint of the aggregator state of every symbol (<name>.ckpt), binary, native byte order.
+//
+//   [header, 64 bytes] [symbol 0] [symbol 1] ... [symbol n-1]
+//
+// A symbol holds its open candles, the buckets of its rolling windows (oldest first, up to the
+// longest window), the state of each of its indicators, and the position in its trade log the
+// candles had reached: the partition and the rows of it they have seen. Restoring a symbol and
+// adding the trades logged after that position gives the state it would have had without the
+// restart. The file is written to a temporary file, fsynced and renamed, and its checksum
+// covers everything after the header, so a checkpoint is either complete or not loaded at all.
+// It is only read back by the same build (the sizes of the structs are checked).
+
+#define CHECKPOINT_MAGIC "CKPT\0\0\0\1"
+#define CHECKPOINT_VERSION 1
+#define CHECKPOINT_HEADER_SIZE 64
+#define CHECKPOINT_PATH_LEN 64
+
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  uint32_t header_size;
+  uint32_t symbols;
+  uint32_t series_size;       // sizeof (candle_series_t) of the build that wrote it
+  int64_t written;            // Wall-clock time of the checkpoint, ms since the epoch
+  uint64_t size;              // Of the whole file
+  uint64_t checksum;          // FNV-1a of the bytes after the header
+  uint64_t reserved[2];
+} checkpoint_header_t;
+
+// One symbol, followed by its buckets and indicators
+typedef struct {
+  char symbol[32];
+  char log_path[CHECKPOINT_PATH_LEN];   // Trade log partition, "" if the symbol never had one
+  uint64_t log_rows;                    // Rows of it already in the candles
+  uint32_t size;                        // Bytes of the symbol, this header included
+  uint32_t buckets;                     // rolling_bucket_t that follow, oldest first
+  uint32_t indicators;                  // checkpoint_indicator_t (and state) that follow the buckets
+  uint32_t reserved;
+  candle_series_t candles;
+} checkpoint_symbol_t;
+
+// State of one indicator, followed by 'size' bytes padded to 8
+typedef struct {
+  char label[INDICATOR_LABEL_LEN];
+  uint32_t size;
+  uint32_t reserved;
+} checkpoint_indicator_t;
+
+// Part of a symbol's checkpoint its worker takes: a checkpoint_symbol_t without the buckets,
+// then the indicators. Sleepyhead adds the buckets when it writes the symbol to the file.
+typedef struct {
+  char *data;
+  size_t size;
+  size_t capacity;
+  uint64_t epoch;             // Checkpoint the part was taken for
+} checkpoint_part_t;
+
+// File being built in memory
+typedef struct {
+  char *data;
+  size_t size;
+  size_t capacity;
+  uint32_t symbols;
+} checkpoint_writer_t;
+
+// Loaded file
+typedef struct {
+  char *data;
+  size_t size;
+  const checkpoint_header_t *hdr;
+} checkpoint_t;
+
+// Taking and writing a checkpoint
+int checkpoint_take (checkpoint_part_t *part, const candle_series_t *candles, const indicator_set_t *indicators,
+                     const char *log_path, uint64_t log_rows);
+void checkpoint_part_free (checkpoint_part_t *part);
+void checkpoint_begin (checkpoint_writer_t *w);
+int checkpoint_add (checkpoint_writer_t *w, const char *symbol, const checkpoint_part_t *part, const rolling_t *rolling);
+int checkpoint_commit (checkpoint_writer_t *w, const char *path, int64_t written);
+void checkpoint_writer_free (checkpoint_writer_t *w);
+
+// Loading and restoring one
+int checkpoint_load (checkpoint_t *c, const char *path);
+const checkpoint_symbol_t *checkpoint_next (const checkpoint_t *c, const checkpoint_symbol_t *prev);
+int checkpoint_restore (const checkpoint_symbol_t *s, candle_series_t *candles, rolling_t *rolling, indicator_set_t *indicators);
+void checkpoint_free (checkpoint_t *c);
+
+#endif
@@ -0,0 +1,584 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+#include "indicator.h"
+#include "trade.h"
+
+#define MAX_INDICATORS 32     // Built in and registered
+#define MAX_PERIOD 100000     // Minutes
+#define STATE_ALIGN 16
+
+static double price_of (int64_t fixed)
+{
+  return trade_decimal (fixed);
+}
+
+// Period parameter: a whole number of minutes. Returns -1 if it isn't one.
+static int period (double p)
+{
+  if (p < 1 || p > MAX_PERIOD || p != floor (p)) return -1;
+  return (int)p;
+}
+
+// Wilder's smoothing: the mean of the first n samples, then avg += (x - avg) / n
+typedef struct {
+  int n;
+  int count;
+  double sum;
+  double avg;
+} wilder_t;
+
+static void wilder_add (wilder_t *w, double x)
+{
+  if (w->count < w->n) {
+    w->sum += x;
+    if (++w->count == w->n) w->avg = w->sum / w->n;
+  } else {
+    w->avg = (w->avg * (w->n - 1) + x) / w->n;
+  }
+}
+
+// ema(n)
+typedef struct {
+  int n;
+  int count;
+  double alpha;
+  double sum;
+  double ema;
+} ema_t;
+
+static size_t ema_size (const double *params, int count)
+{
+  (void)params, (void)count;
+  return sizeof (ema_t);
+}
+
+static int ema_init (void *state, const double *params, int count)
+{
+  ema_t *e = state;
+
+  (void)count;
+  memset (e, 0, sizeof (*e));
+  if ((e->n = period (params[0])) < 0) return -1;
+  e->alpha = 2.0 / (e->n + 1);
+  return 0;
+}
+
+static void ema_candle (void *state, const candle_t *c)
+{
+  ema_t *e = state;
+  double x = price_of (c->close);
+
+  if (c->bucket.trades == 0) return;
+  if (e->count < e->n) {
+    e->sum += x;
+    if (++e->count == e->n) e->ema = e->sum / e->n;
+  } else {
+    e->ema += e->alpha * (x - e->ema);
+  }
+}
+
+static void ema_value (const void *state, double *out)
+{
+  const ema_t *e = state;
+  out[0] = e->count == e->n ? e->ema : NAN;
+}
+
+// rsi(n)
+typedef struct {
+  int started;
+  double prev;
+  wilder_t gain, loss;
+} rsi_t;
+
+static size_t rsi_size (const double *params, int count)
+{
+  (void)params, (void)count;
+  return sizeof (rsi_t);
+}
+
+static int rsi_init (void *state, const double *params, int count)
+{
+  rsi_t *r = state;
+
+  (void)count;
+  memset (r, 0, sizeof (*r));
+  if ((r->gain.n = r->loss.n = period (params[0])) < 0) return -1;
+  return 0;
+}
+
+static void rsi_candle (void *state, const candle_t *c)
+{
+  rsi_t *r = state;
+  double x = price_of (c->close), change;
+
+  if (c->bucket.trades == 0) return;
+  if (r->started) {
+    change = x - r->prev;
+    wilder_add (&r->gain, change > 0 ? change : 0);
+    wilder_add (&r->loss, change < 0 ? -change : 0);
+  }
+  r->started = 1;
+  r->prev = x;
+}
+
+static void rsi_value (const void *state, double *out)
+{
+  const rsi_t *r = state;
+
+  if (r->gain.count < r->gain.n) out[0] = NAN;
+  else if (r->loss.avg == 0) out[0] = r->gain.avg == 0 ? 50 : 100;
+  else out[0] = 100 - 100 / (1 + r->gain.avg / r->loss.avg);
+}
+
+// bollinger(n,k): the closes are fixed point and kept relative to an anchor, their sum is exact.
+// Every n closes the anchor moves to the mean of the window and the squares are added again, so
+// they stay as small as the spread of the window and the rounding of their running sum doesn't
+// build up (O(1) amortized).
+typedef struct {
+  int n;
+  double k;
+  uint64_t pushed;
+  int64_t anchor;
+  int64_t sum;              // Of close - anchor
+  double sum_sq;
+  int64_t ring[];           // The last n closes - anchor
+} bollinger_t;
+
+static size_t bollinger_size (const double *params, int count)
+{
+  (void)count;
+  return sizeof (bollinger_t) + (period (params[0]) > 0 ? period (params[0]) : 0) * sizeof (int64_t);
+}
+
+static int bollinger_init (void *state, const double *params, int count)
+{
+  bollinger_t *b = state;
+
+  memset (b, 0, sizeof (*b));
+  if ((b->n = period (params[0])) < 0) return -1;
+  b->k = count > 1 ? params[1] : 2;
+  if (!(b->k > 0 && b->k <= 100)) return -1;
+  return 0;
+}
+
+static void bollinger_candle (void *state, const candle_t *c)
+{
+  bollinger_t *b = state;
+  int64_t d, *slot;
+
+  if (c->bucket.trades == 0) return;
+  if (b->pushed == 0) b->anchor = c->close;
+  d = c->close - b->anchor;
+  slot = &b->ring[b->pushed % b->n];
+  if (b->pushed >= (uint64_t)b->n) {
+    b->sum -= *slot;
+    b->sum_sq -= (double)*slot * (double)*slot;
+  }
+  *slot = d;
+  b->sum += d;
+  b->sum_sq += (double)d * (double)d;
+  b->pushed++;
+
+  if (b->pushed % b->n == 0) {
+    d = b->sum / b->n;
+    b->anchor += d;
+    b->sum = 0;
+    b->sum_sq = 0;
+    for (int i = 0; i < b->n; i++) {
+      b->ring[i] -= d;
+      b->sum += b->ring[i];
+      b->sum_sq += (double)b->ring[i] * (double)b->ring[i];
+    }
+  }
+}
+
+static void bollinger_value (const void *state, double *out)
+{
+  const bollinger_t *b = state;
+  double mean, var, sd;
+
+  if (b->pushed < (uint64_t)b->n) {
+    out[0] = out[1] = out[2] = NAN;
+    return;
+  }
+  mean = (double)b->sum / b->n;
+  var = b->sum_sq / b->n - mean * mean;
+  sd = var > 0 ? sqrt (var) / TRADE_SCALE : 0;
+  out[0] = price_of (b->anchor) + mean / TRADE_SCALE;
+  out[1] = out[0] + b->k * sd;
+  out[2] = out[0] - b->k * sd;
+}
+
+// atr(n)
+typedef struct {
+  int started;
+  int64_t prev_close;
+  wilder_t tr;
+} atr_t;
+
+static size_t atr_size (const double *params, int count)
+{
+  (void)params, (void)count;
+  return sizeof (atr_t);
+}
+
+static int atr_init (void *state, const double *params, int count)
+{
+  atr_t *a = state;
+
+  (void)count;
+  memset (a, 0, sizeof (*a));
+  if ((a->tr.n = period (params[0])) < 0) return -1;
+  return 0;
+}
+
+static void atr_candle (void *state, const candle_t *c)
+{
+  atr_t *a = state;
+  int64_t high = c->high, low = c->low;
+
+  if (c->bucket.trades == 0) return;
+  if (a->started) {
+    if (a->prev_close > high) high = a->prev_close;
+    if (a->prev_close < low) low = a->prev_close;
+  }
+  wilder_add (&a->tr, price_of (high - low));
+  a->started = 1;
+  a->prev_close = c->close;
+}
+
+static void atr_value (const void *state, double *out)
+{
+  const atr_t *a = state;
+  out[0] = a->tr.count == a->tr.n ? a->tr.avg : NAN;
+}
+
+// vwapdev(n): exact fixed-point sums of the window and of the trades not closed yet. A closed
+// minute moves its sums (those of its candle) from the open trades to the window.
+typedef struct {
+  int64_t notional;
+  int64_t volume;
+} vwap_sum_t;
+
+typedef struct {
+  int n;
+  uint64_t pushed;
+  vwap_sum_t window;        // Last n closed minutes
+  vwap_sum_t open;          // Trades of the minutes not closed yet
+  int traded;               // Trades since the previous close
+  double last, max;
+  double out_last, out_max; // As of the last close
+  vwap_sum_t ring[];
+} vwapdev_t;
+
+static size_t vwapdev_size (const double *params, int count)
+{
+  (void)count;
+  return sizeof (vwapdev_t) + (period (params[0]) > 0 ? period (params[0]) : 0) * sizeof (vwap_sum_t);
+}
+
+static int vwapdev_init (void *state, const double *params, int count)
+{
+  vwapdev_t *v = state;
+
+  (void)count;
+  memset (v, 0, sizeof (*v));
+  if ((v->n = period (params[0])) < 0) return -1;
+  v->out_last = v->out_max = NAN;
+  return 0;
+}
+
+static void vwapdev_trade (void *state, int64_t price, int64_t volume, int64_t time)
+{
+  vwapdev_t *v = state;
+  int64_t notional, total;
+  double vwap, dev;
+
+  (void)time;
+  v->open.notional += trade_notional (price, volume);
+  v->open.volume += volume;
+  notional = v->window.notional + v->open.notional;
+  total = v->window.volume + v->open.volume;
+  if (total <= 0 || notional <= 0) return;
+  vwap = (double)notional / total * TRADE_SCALE;
+  dev = (price - vwap) / vwap * 100;
+  v->last = dev;
+  if (!v->traded || fabs (dev) > fabs (v->max)) v->max = dev;
+  v->traded = 1;
+}
+
+static void vwapdev_candle (void *state, const candle_t *c)
+{
+  vwapdev_t *v = state;
+  vwap_sum_t *slot = &v->ring[v->pushed % v->n];
+
+  if (v->pushed >= (uint64_t)v->n) {
+    v->window.notional -= slot->notional;
+    v->window.volume -= slot->volume;
+  }
+  slot->notional = c->bucket.notional;
+  slot->volume = c->bucket.volume;
+  v->window.notional += slot->notional;
+  v->window.volume += slot->volume;
+  v->open.notional -= slot->notional;
+  v->open.volume -= slot->volume;
+  v->pushed++;
+
+  v->out_last = v->traded ? v->last : NAN;
+  v->out_max = v->traded ? v->max : NAN;
+  v->traded = 0;
+}
+
+static void vwapdev_value (const void *state, double *out)
+{
+  const vwapdev_t *v = state;
+
+  out[0] = v->out_last;
+  out[1] = v->out_max;
+}
+
+static const indicator_t builtin[] = {
+  { "ema", NULL, 1, 1, ema_size, ema_init, NULL, ema_candle, ema_value },
+  { "rsi", NULL, 1, 1, rsi_size, rsi_init, NULL, rsi_candle, rsi_value },
+  { "bollinger", "mid,upper,lower", 1, 2, bollinger_size, bollinger_init, NULL, bollinger_candle, bollinger_value },
+  { "atr", NULL, 1, 1, atr_size, atr_init, NULL, atr_candle, atr_value },
+  { "vwapdev", "last,max", 1, 1, vwapdev_size, vwapdev_init, vwapdev_trade, vwapdev_candle, vwapdev_value },
+};
+
+static const indicator_t *registered[MAX_INDICATORS];
+static int registered_count = -1;
+
+static void register_builtin (void)
+{
+  if (registered_count >= 0) return;
+  registered_count = 0;
+  for (size_t i = 0; i < sizeof (builtin) / sizeof (builtin[0]); i++) registered[registered_count++] = &builtin[i];
+}
+
+// Add an indicator (before the configuration is loaded). Returns -1 if the name is taken or the
+// table is full.
+int indicator_register (const indicator_t *ind)
+{
+  register_builtin ();
+  if (indicator_find (ind->name) != NULL || registered_count == MAX_INDICATORS) return -1;
+  registered[registered_count++] = ind;
+  return 0;
+}
+
+const indicator_t *indicator_find (const char *name)
+{
+  register_builtin ();
+  for (int i = 0; i < registered_count; i++) {
+    if (strcmp (registered[i]->name, name) == 0) return registered[i];
+  }
+  return NULL;
+}
+
+static int count_outputs (const indicator_t *ind)
+{
+  int n = 1;
+
+  if (ind->outputs == NULL) return 1;
+  for (const char *p = ind->outputs; *p; p++) n += *p == ',';
+  return n;
+}
+
+// Parse "name" or "name(p1,p2...)" into 'spec' and check the parameters with the indicator's init.
+// Returns -1 with a message if it is invalid.
+static int parse_spec (const char *text, indicator_spec_t *spec, int line)
+{
+  char name[INDICATOR_LABEL_LEN], *end;
+  const char *p = text;
+  size_t len = strcspn (text, "(");
+  int label_len;
+  void *state;
+
+  memset (spec, 0, sizeof (*spec));
+  if (len == 0 || len >= sizeof (name)) goto invalid;
+  memcpy (name, text, len);
+  name[len] = '\0';
+  if ((spec->ind = indicator_find (name)) == NULL) {
+    fprintf (stderr, "indicator: line %d: unknown indicator '%s'\n", line, name);
+    return -1;
+  }
+
+  p = text + len;
+  if (*p == '(') {
+    p++;
+    while (*p != ')') {
+      if (spec->count == INDICATOR_MAX_PARAMS) goto invalid;
+      spec->params[spec->count++] = strtod (p, &end);
+      if (end == p || (*end != ',' && *end != ')')) goto invalid;
+      p = *end == ',' ? end + 1 : end;
+    }
+    p++;
+  }
+  if (*p != '\0' || spec->count < spec->ind->min_params || spec->count > spec->ind->max_params) goto invalid;
+
+  state = malloc (spec->ind->size (spec->params, spec->count));
+  if (state == NULL || spec->ind->init (state, spec->params, spec->count) < 0) {
+    free (state);
+    goto invalid;
+  }
+  free (state);
+
+  spec->outputs = count_outputs (spec->ind);
+  label_len = snprintf (spec->label, sizeof (spec->label), "%s", name);
+  for (int i = 0; i < spec->count && label_len < (int)sizeof (spec->label); i++) {
+    label_len += snprintf (spec->label + label_len, sizeof (spec->label) - label_len, "%s%g", i ? "," : "(", spec->params[i]);
+  }
+  if (spec->count > 0 && label_len < (int)sizeof (spec->label)) snprintf (spec->label + label_len, sizeof (spec->label) - label_len, ")");
+  return 0;
+
+invalid:
+  fprintf (stderr, "indicator: line %d: invalid '%s'\n", line, text);
+  return -1;
+}
+
+// Read the rules of a configuration file. Returns the number of rules, -1 if the file can't be
+// read or has an invalid line.
+int indicator_config_load (indicator_config_t *cfg, const char *path)
+{
+  FILE *fp;
+  char line[1024], *token, *save, *hash;
+  indicator_rule_t *rules, *rule;
+  int line_no = 0;
+
+  memset (cfg, 0, sizeof (*cfg));
+  if ((fp = fopen (path, "r")) == NULL) {
+    perror ("Error opening indicators file");
+    return -1;
+  }
+  while (fgets (line, sizeof (line), fp) != NULL) {
+    line_no++;
+    if ((hash = strchr (line, '#')) != NULL) *hash = '\0';
+    if ((token = strtok_r (line, " \t\r\n", &save)) == NULL) continue;
+
+    rules = (indicator_rule_t *) realloc (cfg->rules, (cfg->count + 1) * sizeof (indicator_rule_t));
+    if (rules == NULL) goto fail;
+    cfg->rules = rules;
+    rule = &cfg->rules[cfg->count];
+    memset (rule, 0, sizeof (*rule));
+    if ((rule->symbols = strdup (token)) == NULL) goto fail;
+    cfg->count++;
+
+    while ((token = strtok_r (NULL, " \t\r\n", &save)) != NULL) {
+      if (rule->count == INDICATOR_MAX) {
+        fprintf (stderr, "indicator: line %d: more than %d indicators\n", line_no, INDICATOR_MAX);
+        goto fail;
+      }
+      if (parse_spec (token, &rule->spec[rule->count], line_no) < 0) goto fail;
+      rule->count++;
+    }
+  }
+  fclose (fp);
+  return cfg->count;
+
+fail:
+  fclose (fp);
+  indicator_config_free (cfg);
+  return -1;
+}
+
+void indicator_config_free (indicator_config_t *cfg)
+{
+  for (int r = 0; r < cfg->count; r++) free (cfg->rules[r].symbols);
+  free (cfg->rules);
+  memset (cfg, 0, sizeof (*cfg));
+}
+
+static int rule_matches (const indicator_rule_t *rule, const char *symbol)
+{
+  size_t len = strlen (symbol);
+  const char *p = rule->symbols, *end;
+
+  if (strcmp (p, "*") == 0) return 1;
+  while (*p) {
+    end = strchr (p, ',');
+    if (end == NULL) end = p + strlen (p);
+    if ((size_t)(end - p) == len && strncmp (p, symbol, len) == 0) return 1;
+    p = *end ? end + 1 : end;
+  }
+  return 0;
+}
+
+static size_t aligned (size_t size)
+{
+  return (size + STATE_ALIGN - 1) & ~(size_t)(STATE_ALIGN - 1);
+}
+
+// Allocate and initialize the indicators of 'symbol' from every rule that matches it, the same
+// indicator listed twice runs once. Returns the number of indicators, -1 if out of memory.
+int indicator_set_init (indicator_set_t *set, const indicator_config_t *cfg, const char *symbol)
+{
+  size_t total = 0, offset = 0;
+  const indicator_spec_t *spec;
+  int dup;
+
+  memset (set, 0, sizeof (*set));
+  for (int r = 0; cfg != NULL && r < cfg->count; r++) {
+    if (!rule_matches (&cfg->rules[r], symbol)) continue;
+    for (int k = 0; k < cfg->rules[r].count; k++) {
+      spec = &cfg->rules[r].spec[k];
+      dup = 0;
+      for (int i = 0; i < set->count; i++) dup |= strcmp (set->spec[i]->label, spec->label) == 0;
+      if (dup) continue;
+      if (set->count == INDICATOR_MAX || set->values + spec->outputs > INDICATOR_MAX_VALUES) {
+        fprintf (stderr, "indicator: too many indicators for %s, %s is left out\n", symbol, spec->label);
+        continue;
+      }
+      set->spec[set->count++] = spec;
+      set->values += spec->outputs;
+      total += aligned (spec->ind->size (spec->params, spec->count));
+    }
+  }
+  if (set->count == 0) return 0;
+
+  if ((set->block = aligned_alloc (STATE_ALIGN, total)) == NULL) return -1;
+  for (int i = 0; i < set->count; i++) {
+    spec = set->spec[i];
+    set->state[i] = (char *)set->block + offset;
+    offset += aligned (spec->ind->size (spec->params, spec->count));
+    spec->ind->init (set->state[i], spec->params, spec->count);
+    if (spec->ind->on_trade != NULL) set->traded[set->trade_hooks++] = i;
+  }
+  return set->count;
+}
+
+void indicator_set_free (indicator_set_t *set)
+{
+  free (set->block);
+  memset (set, 0, sizeof (*set));
+}
+
+// Name of value 'value' of the set, e.g. "ema(20)" or "bollinger(20,2).upper"
+int indicator_set_column (const indicator_set_t *set, int value, char *buf, size_t size)
+{
+  const char *p;
+  size_t len;
+
+  for (int i = 0; i < set->count; i++) {
+    if (value >= set->spec[i]->outputs) {
+      value -= set->spec[i]->outputs;
+      continue;
+    }
+    if (set->spec[i]->ind->outputs == NULL) return snprintf (buf, size, "%s", set->spec[i]->label);
+    for (p = set->spec[i]->ind->outputs; value > 0; value--) p = strchr (p, ',') + 1;
+    len = strcspn (p, ",");
+    return snprintf (buf, size, "%s.%.*s", set->spec[i]->label, (int)len, p);
+  }
+  return -1;
+}
+
+// Hand a closed minute to every indicator and collect their values ('set->values' of them)
+void indicator_set_candle (indicator_set_t *set, const candle_t *candle, double *values)
+{
+  for (int i = 0; i < set->count; i++) {
+    set->spec[i]->ind->on_candle (set->state[i], candle);
+    set->spec[i]->ind->value (set->state[i], values);
+    values += set->spec[i]->outputs;
+  }
+}
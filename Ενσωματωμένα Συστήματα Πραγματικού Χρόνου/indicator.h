@@ -0,0 +1,94 @@
+#ifndef INDICATOR_H
+#define INDICATOR_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "candle.h"
+
+// Technical indicators of a symbol, updated incrementally by the symbol's worker.
+// An indicator is a plug-in (indicator_t): a state of fixed size, allocated once per symbol, and
+// O(1) hooks called for every trade the candles accept and for every closed minute (empty ones
+// too). The built-in ones are always there, indicator_register() adds others.
+// The configuration file lists which indicators run on which symbols, one rule per line:
+//   <symbols> <indicator>[(<param>,...)] ...
+// symbols: '*' for every symbol or a comma separated list; each matching line adds its indicators.
+//   *          ema(20) rsi(14)
+//   AAPL,MSFT  bollinger(20,2) atr(14) vwapdev(15)
+// Built in, periods in minutes:
+//   ema(n)          exponential moving average of the closes, seeded with the SMA of the first n
+//   rsi(n)          relative strength index of the closes, Wilder's smoothing
+//   bollinger(n,k)  SMA of the last n closes (mid) and mid +/- k population standard deviations
+//   atr(n)          average true range, Wilder's smoothing
+//   vwapdev(n)      deviation (%) of the trades from the VWAP of the last n closed minutes and
+//                   the trades received since: of the last trade (last) and the largest one (max)
+//                   since the previous minute was closed
+// Minutes without trades don't move the candle-based indicators, they do count in vwapdev's window.
+// A value is NAN until its indicator has seen enough minutes.
+
+#define INDICATOR_MAX_PARAMS 4
+#define INDICATOR_MAX 8               // Indicators of one symbol
+#define INDICATOR_MAX_VALUES 16       // Values of all the indicators of one symbol
+#define INDICATOR_LABEL_LEN 32
+
+typedef struct indicator {
+  const char *name;                   // Name in the configuration
+  const char *outputs;                // Names of its values, comma separated ("mid,upper,lower"), NULL for one
+  int min_params, max_params;
+  size_t (*size) (const double *params, int count);              // Bytes of state
+  int (*init) (void *state, const double *params, int count);    // -1 if the parameters are invalid
+  void (*on_trade) (void *state, int64_t price, int64_t volume, int64_t time);  // NULL if candles are enough
+  void (*on_candle) (void *state, const candle_t *candle);
+  void (*value) (const void *state, double *out);                // One value per output
+} indicator_t;
+
+// An indicator with its parameters, as listed in the configuration
+typedef struct {
+  const indicator_t *ind;
+  double params[INDICATOR_MAX_PARAMS];
+  int count;
+  int outputs;
+  char label[INDICATOR_LABEL_LEN];    // e.g. "bollinger(20,2)"
+} indicator_spec_t;
+
+typedef struct {
+  char *symbols;                      // "*" or a comma separated list
+  indicator_spec_t spec[INDICATOR_MAX];
+  int count;
+} indicator_rule_t;
+
+typedef struct {
+  indicator_rule_t *rules;
+  int count;
+} indicator_config_t;
+
+// Indicators of one symbol, owned by its worker. The specifications belong to the configuration.
+typedef struct {
+  int count;
+  int values;                         // Outputs of all of them
+  const indicator_spec_t *spec[INDICATOR_MAX];
+  void *state[INDICATOR_MAX];
+  int trade_hooks;                    // The first ones of 'traded' have a trade hook
+  int traded[INDICATOR_MAX];
+  void *block;                        // Every state, in one allocation
+} indicator_set_t;
+
+// Indicator functions
+int indicator_register (const indicator_t *ind);
+const indicator_t *indicator_find (const char *name);
+int indicator_config_load (indicator_config_t *cfg, const char *path);
+void indicator_config_free (indicator_config_t *cfg);
+int indicator_set_init (indicator_set_t *set, const indicator_config_t *cfg, const char *symbol);
+void indicator_set_free (indicator_set_t *set);
+int indicator_set_column (const indicator_set_t *set, int value, char *buf, size_t size);
+void indicator_set_candle (indicator_set_t *set, const candle_t *candle, double *values);
+
+// Hand an accepted trade to the indicators that use trades
+static inline void indicator_set_trade (indicator_set_t *set, int64_t price, int64_t volume, int64_t time)
+{
+  for (int k = 0; k < set->trade_hooks; k++) {
+    int i = set->traded[k];
+    set->spec[i]->ind->on_trade (set->state[i], price, volume, time);
+  }
+}
+
+#endif
@@ -0,0 +1,59 @@
+#include "latency.h"
+
+// Largest value counted in a bucket
+int64_t latency_bucket_high (int bucket)
+{
+  int shift, sub;
+
+  if (bucket < (2 << LATENCY_SUB_BITS)) return bucket;
+  shift = (bucket >> LATENCY_SUB_BITS) - 1;
+  sub = bucket - (shift << LATENCY_SUB_BITS);
+  return ((int64_t)(sub + 1) << shift) - 1;
+}
+
+// Value below which 'rank' of the interval's values are
+static int64_t value_at_rank (const uint32_t *interval, uint64_t rank, int64_t max)
+{
+  uint64_t seen = 0;
+  int64_t value;
+
+  for (int b = 0; b < LATENCY_BUCKETS; b++) {
+    seen += interval[b];
+    if (seen >= rank) {
+      value = latency_bucket_high (b);
+      return value < max ? value : max;
+    }
+  }
+  return max;
+}
+
+// Percentiles of the values recorded since 'prev' was taken, then 'prev' becomes the current state.
+// Can run concurrently with the owner recording. Returns the number of values in the interval.
+uint64_t latency_snapshot (const latency_hist_t *h, latency_prev_t *prev, latency_stats_t *out)
+{
+  uint32_t interval[LATENCY_BUCKETS], now;
+  uint64_t count = 0;
+  int64_t max = (int64_t)atomic_load_explicit (&h->max, memory_order_relaxed);
+  int top = 0;
+
+  for (int b = 0; b < LATENCY_BUCKETS; b++) {
+    now = atomic_load_explicit (&h->counts[b], memory_order_relaxed);
+    interval[b] = now - prev->counts[b];
+    prev->counts[b] = now;
+    count += interval[b];
+    if (interval[b] != 0) top = b;
+  }
+
+  out->count = count;
+  if (count == 0) {
+    out->p50 = out->p99 = out->p999 = out->max = 0;
+    return 0;
+  }
+  // The interval's maximum is known to its bucket, the all-time maximum bounds it
+  if (latency_bucket_high (top) < max) max = latency_bucket_high (top);
+  out->max = max;
+  out->p50 = value_at_rank (interval, (count * 500 + 999) / 1000, max);
+  out->p99 = value_at_rank (interval, (count * 990 + 999) / 1000, max);
+  out->p999 = value_at_rank (interval, (count * 999 + 999) / 1000, max);
+  return count;
+}
@@ -0,0 +1,72 @@
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include <time.h>
+#include "spsc_ring.h"
+
+// HDR-style latency histograms.
+// Values (ns) are counted in log-linear buckets: exact below 64 ns, then 32 buckets per power
+// of two, so any recorded value is known to within 1/32 (~3%). Recording is a few instructions
+// on fixed memory. Each histogram has a single writer; another thread can read it at any time
+// and gets the latencies of an interval by subtracting its previous snapshot.
+
+#define LATENCY_SUB_BITS 5                          // 32 buckets per power of two
+#define LATENCY_MAX_BITS 36                         // Values are clamped below 2^36 ns (~68 s)
+#define LATENCY_BUCKETS ((LATENCY_MAX_BITS - LATENCY_SUB_BITS + 1) << LATENCY_SUB_BITS)
+#define LATENCY_MAX_VALUE ((1LL << LATENCY_MAX_BITS) - 1)
+
+typedef struct {
+  _Alignas(CACHE_LINE_SIZE) _Atomic uint32_t counts[LATENCY_BUCKETS];
+  _Atomic uint64_t max;       // Largest recorded value (not clamped)
+} latency_hist_t;
+
+// Previous snapshot of a histogram, owned by the reader
+typedef struct {
+  uint32_t counts[LATENCY_BUCKETS];
+} latency_prev_t;
+
+// Percentiles of the values recorded since the previous snapshot, in ns
+typedef struct {
+  uint64_t count;
+  int64_t p50;
+  int64_t p99;
+  int64_t p999;
+  int64_t max;
+} latency_stats_t;
+
+// Monotonic time in nanoseconds (clock_gettime goes through the vDSO, no system call)
+static inline int64_t latency_now_ns (void)
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static inline int latency_bucket (int64_t value)
+{
+  int shift;
+
+  if (value < (2 << LATENCY_SUB_BITS)) return value < 0 ? 0 : (int)value;
+  if (value > LATENCY_MAX_VALUE) value = LATENCY_MAX_VALUE;
+  shift = 63 - __builtin_clzll ((uint64_t)value) - LATENCY_SUB_BITS;
+  return (shift << LATENCY_SUB_BITS) + (int)(value >> shift);
+}
+
+// Record one value. Only the owner of the histogram may call this: the relaxed load and store
+// compile to plain memory accesses, the atomics only keep the concurrent reader well defined.
+static inline void latency_record (latency_hist_t *h, int64_t value)
+{
+  _Atomic uint32_t *c = &h->counts[latency_bucket (value)];
+
+  atomic_store_explicit (c, atomic_load_explicit (c, memory_order_relaxed) + 1, memory_order_relaxed);
+  if (value > 0 && (uint64_t)value > atomic_load_explicit (&h->max, memory_order_relaxed))
+    atomic_store_explicit (&h->max, (uint64_t)value, memory_order_relaxed);
+}
+
+// Latency functions
+int64_t latency_bucket_high (int bucket);
+uint64_t latency_snapshot (const latency_hist_t *h, latency_prev_t *prev, latency_stats_t *out);
+
+#endif
@@ -0,0 +1,422 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#ifdef HAVE_LIBURING
+#include <liburing.h>
+#endif
+#include "log_writer.h"
+
+#define LOG_ALIGN(n) (((n) + 7) & ~(size_t)7)
+
+// Header of a record inside a buffer, the data follows it
+typedef struct {
+  log_file_t *file;
+  size_t len;
+} log_record_t;
+
+// Writer state; the counters are written by the flusher only
+static struct {
+  log_buffer_t *buffers[LOG_MAX_BUFFERS];
+  _Atomic int count;
+  size_t buffer_size;
+  int flush_interval_ms;
+  pthread_t thread;
+  _Atomic int stop;
+  spsc_event_t wake;          // Flusher sleeps here between flushes
+  log_file_t *dirty;          // Files with gathered records
+  _Atomic unsigned long long bytes, flushes, flush_ns_total, flush_ns_max;
+  unsigned long long stalls;  // Stalls of the buffers already freed
+  size_t budget;
+#ifdef HAVE_LIBURING
+  struct io_uring ring;
+  int uring;
+#endif
+} writer;
+
+static long futex_wait (_Atomic uint32_t *addr, uint32_t val, const struct timespec *timeout)
+{
+  return syscall (SYS_futex, addr, FUTEX_WAIT_PRIVATE, val, timeout, NULL, 0);
+}
+
+static long long now_ns (void)
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// Sleep on 'ev' until 'cond' holds (same protocol as the ring: flag, fence, re-check, sleep).
+// With a timeout, returns after at most one sleep.
+static void event_sleep (spsc_event_t *ev, _Atomic int *flag, int value, const struct timespec *timeout)
+{
+  uint32_t seq;
+
+  do {
+    seq = atomic_load_explicit (&ev->seq, memory_order_acquire);
+    atomic_store_explicit (&ev->sleeping, 1, memory_order_seq_cst);
+    atomic_thread_fence (memory_order_seq_cst);
+    if (atomic_load_explicit (flag, memory_order_acquire) == value) break;
+    futex_wait (&ev->seq, seq, timeout);
+  } while (timeout == NULL && atomic_load_explicit (flag, memory_order_acquire) != value);
+  atomic_store_explicit (&ev->sleeping, 0, memory_order_relaxed);
+}
+
+int log_writer_init (size_t buffer_size, int flush_interval_ms)
+{
+  memset (&writer, 0, sizeof (writer));
+  writer.buffer_size = LOG_ALIGN (buffer_size < 4096 ? 4096 : buffer_size);
+  writer.flush_interval_ms = flush_interval_ms;
+  spsc_event_init (&writer.wake);
+
+#ifdef HAVE_LIBURING
+  // Older kernels (or seccomp) refuse io_uring, pwritev is used then
+  writer.uring = io_uring_queue_init (LOG_IOV_MAX, &writer.ring, 0) == 0;
+#endif
+  return 0;
+}
+
+log_file_t *log_open (const char *path)
+{
+  log_file_t *file = (log_file_t *) calloc (1, sizeof (log_file_t));
+
+  if (file == NULL) return (NULL);
+  file->fd = open (path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (file->fd < 0) {
+    free (file);
+    return (NULL);
+  }
+  return (file);
+}
+
+int log_close (log_file_t *file)
+{
+  int ret = close (file->fd);
+  free (file);
+  return ret;
+}
+
+log_buffer_t *log_buffer_create (void)
+{
+  log_buffer_t *b;
+  int id = atomic_load (&writer.count);
+
+  if (id == LOG_MAX_BUFFERS) return (NULL);
+  if (posix_memalign ((void **)&b, CACHE_LINE_SIZE, sizeof (log_buffer_t)) != 0) return (NULL);
+  memset (b, 0, sizeof (log_buffer_t));
+
+  b->data[0] = (char *) malloc (writer.buffer_size);
+  b->data[1] = (char *) malloc (writer.buffer_size);
+  if (b->data[0] == NULL || b->data[1] == NULL) {
+    free (b->data[0]);
+    free (b->data[1]);
+    free (b);
+    return (NULL);
+  }
+  spsc_event_init (&b->free);
+
+  writer.buffers[id] = b;
+  atomic_store_explicit (&writer.count, id + 1, memory_order_release);
+  return (b);
+}
+
+// Hand the buffer being filled to the flusher and continue in the other one.
+// With 'wait' set, waits for the other buffer to be written first; otherwise gives up if it isn't.
+static int switch_buffer (log_buffer_t *b, int wait)
+{
+  int other = b->fill ^ 1;
+
+  if (atomic_load_explicit (&b->ready[other], memory_order_acquire)) {
+    if (!wait) return -1;
+    atomic_fetch_add_explicit (&b->stalls, 1, memory_order_relaxed);
+    spsc_event_signal (&writer.wake);   // The flusher may be waiting for its next tick
+    event_sleep (&b->free, &b->ready[other], 0, NULL);
+  }
+
+  atomic_store_explicit (&b->ready[b->fill], 1, memory_order_release);
+  b->fill = other;
+  return 0;
+}
+
+// Append a record. Only a record larger than a whole buffer is split.
+void log_write (log_buffer_t *b, log_file_t *file, const char *data, size_t len)
+{
+  size_t room, chunk;
+  log_record_t *rec;
+
+  while (len > 0) {
+    room = writer.buffer_size - b->used[b->fill];
+    if (room < sizeof (log_record_t) + len && b->used[b->fill] > 0) {
+      switch_buffer (b, 1);
+      continue;
+    }
+    chunk = room - sizeof (log_record_t);
+    if (chunk > len) chunk = len;
+
+    rec = (log_record_t *)(b->data[b->fill] + b->used[b->fill]);
+    rec->file = file;
+    rec->len = chunk;
+    memcpy (rec + 1, data, chunk);
+    b->used[b->fill] += LOG_ALIGN (sizeof (log_record_t) + chunk);
+
+    data += chunk;
+    len -= chunk;
+  }
+}
+
+// Format a record straight into the buffer
+void log_printf (log_buffer_t *b, log_file_t *file, const char *fmt, ...)
+{
+  va_list ap;
+  size_t room;
+  int n;
+  char *tmp;
+  log_record_t *rec;
+
+  for (int attempt = 0; attempt < 2; attempt++) {
+    room = writer.buffer_size - b->used[b->fill];
+    if (room > sizeof (log_record_t)) {
+      rec = (log_record_t *)(b->data[b->fill] + b->used[b->fill]);
+      va_start (ap, fmt);
+      n = vsnprintf ((char *)(rec + 1), room - sizeof (log_record_t), fmt, ap);
+      va_end (ap);
+      if (n < 0) return;
+      if ((size_t)n < room - sizeof (log_record_t)) {
+        rec->file = file;
+        rec->len = n;
+        b->used[b->fill] += LOG_ALIGN (sizeof (log_record_t) + n);
+        return;
+      }
+    }
+    if (b->used[b->fill] == 0) break;
+    switch_buffer (b, 1);
+  }
+
+  // Larger than a whole buffer: format it aside and split it
+  va_start (ap, fmt);
+  n = vasprintf (&tmp, fmt, ap);
+  va_end (ap);
+  if (n < 0) return;
+  log_write (b, file, tmp, n);
+  free (tmp);
+}
+
+// Hand what was appended so far to the flusher, if the other buffer is free.
+// Called at natural boundaries (after a batch of trades, after a minute's rows).
+void log_commit (log_buffer_t *b)
+{
+  if (b->used[b->fill] > 0) switch_buffer (b, 0);
+}
+
+// Write the gathered records of one file, continuing after short writes
+static void write_file (log_file_t *file, struct iovec *iov, int iovcnt, ssize_t done)
+{
+  ssize_t n;
+
+  while (iovcnt > 0) {
+    while (iovcnt > 0 && done >= (ssize_t)iov->iov_len) {
+      done -= iov->iov_len;
+      iov++;
+      iovcnt--;
+    }
+    if (iovcnt == 0) break;
+    iov->iov_base = (char *)iov->iov_base + done;
+    iov->iov_len -= done;
+    done = 0;
+
+    n = pwritev (file->fd, iov, iovcnt, file->offset);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      perror ("log_writer: write failed");
+      break;
+    }
+    file->offset += n;
+    atomic_fetch_add_explicit (&writer.bytes, n, memory_order_relaxed);
+    done = n;
+  }
+  file->iovcnt = 0;
+}
+
+// Write every dirty file
+static void write_dirty (void)
+{
+  log_file_t *file;
+
+#ifdef HAVE_LIBURING
+  // Submit one write per file and reap them together, finishing short writes with pwritev
+  for (log_file_t *batch = writer.dirty; writer.uring && batch != NULL; batch = file) {
+    struct io_uring_sqe *sqe;
+    struct io_uring_cqe *cqe;
+    int submitted = 0, ret;
+
+    for (file = batch; file != NULL && submitted < LOG_IOV_MAX; file = file->next_dirty) {
+      sqe = io_uring_get_sqe (&writer.ring);
+      if (sqe == NULL) break;
+      io_uring_prep_writev (sqe, file->fd, file->iov, file->iovcnt, file->offset);
+      io_uring_sqe_set_data (sqe, file);
+      submitted++;
+    }
+
+    ret = io_uring_submit_and_wait (&writer.ring, submitted);
+    for (int i = 0; i < ret; i++) {
+      if (io_uring_wait_cqe (&writer.ring, &cqe) < 0) break;
+      log_file_t *done = io_uring_cqe_get_data (cqe);
+      if (cqe->res > 0) {
+        done->offset += cqe->res;
+        atomic_fetch_add_explicit (&writer.bytes, cqe->res, memory_order_relaxed);
+      }
+      write_file (done, done->iov, done->iovcnt, cqe->res > 0 ? cqe->res : 0);
+      io_uring_cqe_seen (&writer.ring, cqe);
+    }
+    if (submitted == 0 || ret < submitted) writer.uring = 0;   // Fall back for good, the files left are written below
+  }
+#endif
+
+  for (file = writer.dirty; file != NULL; file = file->next_dirty) {
+    if (file->iovcnt > 0) write_file (file, file->iov, file->iovcnt, 0);
+    file->dirty = 0;
+  }
+  writer.dirty = NULL;
+}
+
+// Gather the records of a buffer per file
+static void gather (const char *data, size_t used)
+{
+  const log_record_t *rec;
+  log_file_t *file;
+
+  for (size_t pos = 0; pos < used; pos += LOG_ALIGN (sizeof (log_record_t) + rec->len)) {
+    rec = (const log_record_t *)(data + pos);
+    file = rec->file;
+
+    if (!file->dirty) {
+      file->dirty = 1;
+      file->next_dirty = writer.dirty;
+      writer.dirty = file;
+    }
+    if (file->iovcnt == LOG_IOV_MAX) write_file (file, file->iov, file->iovcnt, 0);
+
+    file->iov[file->iovcnt].iov_base = (void *)(rec + 1);
+    file->iov[file->iovcnt].iov_len = rec->len;
+    file->iovcnt++;
+  }
+}
+
+// Write every buffer handed over by the pipeline threads. With 'final' set the threads have
+// stopped, so the buffers they were still filling are written too.
+static void flush (int final)
+{
+  int count = atomic_load_explicit (&writer.count, memory_order_acquire);
+  unsigned char taken[LOG_MAX_BUFFERS][2];
+  long long start = now_ns (), elapsed;
+  unsigned long long before = atomic_load_explicit (&writer.bytes, memory_order_relaxed);
+
+  for (int i = 0; i < count; i++) {
+    log_buffer_t *b = writer.buffers[i];
+    // At most one buffer of a thread is handed over at a time, and it is older than the one
+    // being filled, so the records of a thread stay in order
+    for (int h = 0; h < 2; h++) {
+      taken[i][h] = atomic_load_explicit (&b->ready[h], memory_order_acquire);
+      if (taken[i][h]) gather (b->data[h], b->used[h]);
+    }
+    if (final && !taken[i][b->fill] && b->used[b->fill] > 0) {
+      taken[i][b->fill] = 1;
+      gather (b->data[b->fill], b->used[b->fill]);
+    }
+  }
+  write_dirty ();
+
+  for (int i = 0; i < count; i++) {
+    log_buffer_t *b = writer.buffers[i];
+    for (int h = 0; h < 2; h++) {
+      if (!taken[i][h]) continue;
+      b->used[h] = 0;
+      atomic_store_explicit (&b->ready[h], 0, memory_order_release);
+    }
+    spsc_event_signal (&b->free);
+  }
+
+  if (atomic_load_explicit (&writer.bytes, memory_order_relaxed) != before) {
+    elapsed = now_ns () - start;
+    atomic_fetch_add_explicit (&writer.flushes, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit (&writer.flush_ns_total, elapsed, memory_order_relaxed);
+    if ((unsigned long long)elapsed > atomic_load_explicit (&writer.flush_ns_max, memory_order_relaxed))
+      atomic_store_explicit (&writer.flush_ns_max, elapsed, memory_order_relaxed);
+  }
+}
+
+// Flusher thread: writes the handed over buffers every 'flush_interval_ms', or at once when
+// a pipeline thread is waiting for one of its buffers
+static void *flusher (void *arg)
+{
+  struct timespec interval = {
+    .tv_sec = writer.flush_interval_ms / 1000,
+    .tv_nsec = (writer.flush_interval_ms % 1000) * 1000000L,
+  };
+  (void)arg;
+
+  while (!atomic_load_explicit (&writer.stop, memory_order_acquire)) {
+    event_sleep (&writer.wake, &writer.stop, 1, &interval);
+    flush (0);
+  }
+  flush (1);
+  return (NULL);
+}
+
+int log_writer_start (void)
+{
+  return pthread_create (&writer.thread, NULL, flusher, NULL) == 0 ? 0 : -1;
+}
+
+// Make the flusher write what it has now. Safe to call from a signal handler.
+void log_writer_wake (void)
+{
+  spsc_event_wake_all (&writer.wake);
+}
+
+// Write everything that is left and stop the flusher. The appending threads must have stopped.
+void log_writer_stop (void)
+{
+  atomic_store_explicit (&writer.stop, 1, memory_order_release);
+  spsc_event_wake_all (&writer.wake);
+  pthread_join (writer.thread, NULL);
+
+  writer.budget = (size_t)atomic_load (&writer.count) * 2 * writer.buffer_size;
+  for (int i = 0; i < atomic_load (&writer.count); i++) {
+    writer.stalls += atomic_load (&writer.buffers[i]->stalls);
+    free (writer.buffers[i]->data[0]);
+    free (writer.buffers[i]->data[1]);
+    free (writer.buffers[i]);
+  }
+  atomic_store (&writer.count, 0);
+#ifdef HAVE_LIBURING
+  if (writer.uring) io_uring_queue_exit (&writer.ring);
+#endif
+}
+
+void log_writer_stats (log_stats_t *stats)
+{
+  int count = atomic_load_explicit (&writer.count, memory_order_acquire);
+
+  memset (stats, 0, sizeof (log_stats_t));
+  stats->bytes = atomic_load_explicit (&writer.bytes, memory_order_relaxed);
+  stats->flushes = atomic_load_explicit (&writer.flushes, memory_order_relaxed);
+  stats->flush_ns_total = atomic_load_explicit (&writer.flush_ns_total, memory_order_relaxed);
+  stats->flush_ns_max = atomic_load_explicit (&writer.flush_ns_max, memory_order_relaxed);
+  stats->stalls = writer.stalls;
+  for (int i = 0; i < count; i++)
+    stats->stalls += atomic_load_explicit (&writer.buffers[i]->stalls, memory_order_relaxed);
+  stats->budget = count ? (size_t)count * 2 * writer.buffer_size : writer.budget;
+#ifdef HAVE_LIBURING
+  stats->uring = writer.uring;
+#endif
+}
@@ -0,0 +1,68 @@
+#ifndef LOG_WRITER_H
+#define LOG_WRITER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <sys/uio.h>
+#include "spsc_ring.h"
+
+// Asynchronous writer of the text output files.
+// Every pipeline thread appends records (file + bytes) to its own pair of buffers without locks.
+// When a buffer is full, or at a natural boundary (log_commit), it is handed to the background
+// flusher thread, which writes the records of all buffers grouped per file in large sequential
+// writes (io_uring when built with HAVE_LIBURING and supported by the kernel, pwritev otherwise)
+// and hands the buffer back. A thread only waits if both of its buffers are waiting to be written.
+
+#define LOG_MAX_BUFFERS 256   // Maximum number of appending threads
+#define LOG_IOV_MAX 64        // Records of one file gathered in a single write
+
+// Output file, written only by the flusher thread
+typedef struct log_file {
+  int fd;
+  uint64_t offset;              // Next write position
+  struct iovec iov[LOG_IOV_MAX];// Records gathered for the current flush
+  int iovcnt;
+  int dirty;                    // Set while the file is in the list of the current flush
+  struct log_file *next_dirty;
+} log_file_t;
+
+// Double buffer of one appending thread
+typedef struct {
+  char *data[2];
+  size_t used[2];                   // Bytes appended to each buffer
+  _Atomic int ready[2];             // 1 while the buffer is handed to the flusher
+  int fill;                         // Buffer being appended to (owner only)
+  _Alignas(CACHE_LINE_SIZE) spsc_event_t free;  // Owner sleeps here when both buffers are full
+  _Atomic unsigned long long stalls;            // Times the owner had to wait for a buffer
+} log_buffer_t;
+
+// Counters of the writer
+typedef struct {
+  unsigned long long bytes;         // Bytes written to the files
+  unsigned long long flushes;       // Flushes that wrote something
+  unsigned long long flush_ns_total;// Time spent in those flushes
+  unsigned long long flush_ns_max;
+  unsigned long long stalls;        // Times a pipeline thread waited for a buffer
+  size_t budget;                    // Memory reserved for the buffers
+  int uring;                        // 1 if the flushes go through io_uring
+} log_stats_t;
+
+// Writer functions
+int log_writer_init (size_t buffer_size, int flush_interval_ms);
+int log_writer_start (void);
+void log_writer_wake (void);
+void log_writer_stop (void);
+void log_writer_stats (log_stats_t *stats);
+
+// File functions (open and close them while the flusher is not writing them)
+log_file_t *log_open (const char *path);
+int log_close (log_file_t *file);
+
+// Appending functions, each log_buffer_t is used by a single thread
+log_buffer_t *log_buffer_create (void);
+void log_write (log_buffer_t *b, log_file_t *file, const char *data, size_t len);
+void log_printf (log_buffer_t *b, log_file_t *file, const char *fmt, ...) __attribute__ ((format (printf, 3, 4)));
+void log_commit (log_buffer_t *b);
+
+#endif
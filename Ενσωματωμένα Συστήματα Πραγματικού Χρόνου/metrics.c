@@ -0,0 +1,297 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include "metrics.h"
+
+#define POLL_MS 250               // The server checks for metrics_stop() this often
+#define REQUEST_TIMEOUT_MS 1000   // A client has this long to send its request
+#define REQUEST_MAX 4096
+
+static struct {
+  const metric_def_t *defs;
+  int count;
+  metrics_thread_t *threads[METRICS_MAX_THREADS];
+  _Atomic int thread_count;       // Published after the block is filled in
+  metrics_thread_t overflow;      // Shared by the threads past METRICS_MAX_THREADS, not reported
+  metrics_collector_t collectors[METRICS_MAX_COLLECTORS];
+  void *collector_args[METRICS_MAX_COLLECTORS];
+  int collector_count;
+  pthread_mutex_t lock;           // Registration only
+  long clock_ticks;
+
+  // Server
+  int fd;
+  int is_unix;
+  char path[sizeof (((struct sockaddr_un *)0)->sun_path)];
+  pthread_t thread;
+  _Atomic int stop;
+  int running;
+} metrics = { .lock = PTHREAD_MUTEX_INITIALIZER, .fd = -1 };
+
+// The definitions must outlive the run. Returns -1 if there are too many.
+int metrics_init (const metric_def_t *defs, int count)
+{
+  if (count > METRICS_MAX) return -1;
+  metrics.defs = defs;
+  metrics.count = count;
+  metrics.clock_ticks = sysconf (_SC_CLK_TCK);
+  return 0;
+}
+
+// Block of values of the calling thread, zeroed. Never NULL, the blocks live for the whole run.
+metrics_thread_t *metrics_thread (const char *role, int index)
+{
+  metrics_thread_t *t;
+  int n;
+
+  pthread_mutex_lock (&metrics.lock);
+  n = atomic_load_explicit (&metrics.thread_count, memory_order_relaxed);
+  if (n == METRICS_MAX_THREADS || posix_memalign ((void **)&t, CACHE_LINE_SIZE, sizeof (metrics_thread_t)) != 0) {
+    pthread_mutex_unlock (&metrics.lock);
+    return &metrics.overflow;
+  }
+  memset (t, 0, sizeof (metrics_thread_t));
+  t->role = role;
+  t->index = index;
+  t->tid = (pid_t)syscall (SYS_gettid);
+  metrics.threads[n] = t;
+  atomic_store_explicit (&metrics.thread_count, n + 1, memory_order_release);
+  pthread_mutex_unlock (&metrics.lock);
+  return t;
+}
+
+// Collectors are added before the server starts. Returns -1 if there are too many.
+int metrics_add_collector (metrics_collector_t collect, void *arg)
+{
+  if (metrics.collector_count == METRICS_MAX_COLLECTORS) return -1;
+  metrics.collectors[metrics.collector_count] = collect;
+  metrics.collector_args[metrics.collector_count++] = arg;
+  return 0;
+}
+
+void metrics_header (FILE *out, const char *name, const char *help, metric_type_t type)
+{
+  fprintf (out, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type == METRIC_COUNTER ? "counter" : "gauge");
+}
+
+// CPU time (user + system) of a thread of this process in seconds, -1 if it is gone
+static double thread_cpu_seconds (pid_t tid)
+{
+  char path[64], buf[512], *p;
+  unsigned long utime, stime;
+  FILE *f;
+  size_t len;
+
+  snprintf (path, sizeof (path), "/proc/self/task/%d/stat", (int)tid);
+  if ((f = fopen (path, "r")) == NULL) return -1;
+  len = fread (buf, 1, sizeof (buf) - 1, f);
+  fclose (f);
+  buf[len] = '\0';
+
+  // The name in parentheses may contain spaces, the fields after it are: state ... utime (14) stime (15)
+  if ((p = strrchr (buf, ')')) == NULL) return -1;
+  if (sscanf (p + 1, " %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime) != 2) return -1;
+  return (double)(utime + stime) / metrics.clock_ticks;
+}
+
+// Write every metric in the Prometheus text format
+void metrics_render (FILE *out)
+{
+  int threads = atomic_load_explicit (&metrics.thread_count, memory_order_acquire);
+  metrics_thread_t *t;
+  double cpu;
+
+  for (int m = 0; m < metrics.count; m++) {
+    const metric_def_t *def = &metrics.defs[m];
+    metrics_header (out, def->name, def->help, def->type);
+    for (int k = 0; k < threads; k++) {
+      t = metrics.threads[k];
+      if (strcmp (t->role, def->role) != 0) continue;
+      fprintf (out, "%s{thread=\"%s\",index=\"%d\"} %lld\n", def->name, t->role, t->index,
+               (long long)atomic_load_explicit (&t->value[m], memory_order_relaxed));
+    }
+  }
+
+  metrics_header (out, "pi_thread_cpu_seconds_total", "CPU time of the thread (user and system)", METRIC_COUNTER);
+  for (int k = 0; k < threads; k++) {
+    t = metrics.threads[k];
+    if ((cpu = thread_cpu_seconds (t->tid)) < 0) continue;
+    fprintf (out, "pi_thread_cpu_seconds_total{thread=\"%s\",index=\"%d\"} %.2f\n", t->role, t->index, cpu);
+  }
+
+  for (int c = 0; c < metrics.collector_count; c++) metrics.collectors[c] (out, metrics.collector_args[c]);
+}
+
+static int write_all (int fd, const char *data, size_t len)
+{
+  ssize_t n;
+
+  while (len > 0) {
+    n = send (fd, data, len, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return -1;
+    data += n;
+    len -= n;
+  }
+  return 0;
+}
+
+// Read an HTTP request up to the end of its headers. Returns 1 for a GET, 0 for anything else,
+// -1 if the client went away or took too long.
+static int read_request (int fd)
+{
+  char buf[REQUEST_MAX];
+  struct pollfd pfd = { .fd = fd, .events = POLLIN };
+  size_t len = 0;
+  ssize_t n;
+
+  while (len < sizeof (buf) - 1) {
+    if (poll (&pfd, 1, REQUEST_TIMEOUT_MS) <= 0) return -1;
+    n = recv (fd, buf + len, sizeof (buf) - 1 - len, 0);
+    if (n <= 0) return -1;
+    len += n;
+    buf[len] = '\0';
+    if (strstr (buf, "\r\n\r\n") != NULL || strstr (buf, "\n\n") != NULL) break;
+  }
+  return strncmp (buf, "GET ", 4) == 0;
+}
+
+static void serve_client (int fd)
+{
+  static const char bad_request[] = "HTTP/1.0 405 Method Not Allowed\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+  char *text = NULL, header[160];
+  size_t len = 0;
+  FILE *out;
+  int get = 1, header_len;
+
+  if (!metrics.is_unix && (get = read_request (fd)) < 0) return;
+  if (!get) {
+    write_all (fd, bad_request, sizeof (bad_request) - 1);
+    return;
+  }
+  if ((out = open_memstream (&text, &len)) == NULL) return;
+  metrics_render (out);
+  fclose (out);
+
+  if (!metrics.is_unix) {
+    header_len = snprintf (header, sizeof (header), "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\n"
+                           "Content-Length: %zu\r\nConnection: close\r\n\r\n", len);
+    if (write_all (fd, header, header_len) < 0) {
+      free (text);
+      return;
+    }
+  }
+  write_all (fd, text, len);
+  free (text);
+}
+
+static void *server_thread (void *arg)
+{
+  struct pollfd pfd = { .fd = metrics.fd, .events = POLLIN };
+  int fd;
+
+  (void)arg;
+  while (!atomic_load_explicit (&metrics.stop, memory_order_relaxed)) {
+    if (poll (&pfd, 1, POLL_MS) <= 0) continue;
+    fd = accept4 (metrics.fd, NULL, NULL, SOCK_CLOEXEC);
+    if (fd < 0) continue;
+    serve_client (fd);
+    close (fd);
+  }
+  return NULL;
+}
+
+static int listen_unix (const char *path)
+{
+  struct sockaddr_un addr;
+  int fd;
+
+  if (strlen (path) >= sizeof (addr.sun_path)) {
+    fprintf (stderr, "metrics: socket path too long: %s\n", path);
+    return -1;
+  }
+  memset (&addr, 0, sizeof (addr));
+  addr.sun_family = AF_UNIX;
+  strcpy (addr.sun_path, path);
+  unlink (path);    // Left over by a previous run
+  if ((fd = socket (AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0) return -1;
+  if (bind (fd, (struct sockaddr *)&addr, sizeof (addr)) < 0 || listen (fd, 8) < 0) {
+    fprintf (stderr, "metrics: can't listen on %s: %s\n", path, strerror (errno));
+    close (fd);
+    return -1;
+  }
+  strcpy (metrics.path, path);
+  metrics.is_unix = 1;
+  return fd;
+}
+
+static int listen_tcp (const char *endpoint)
+{
+  char host[256] = "127.0.0.1";
+  const char *port = endpoint, *colon = strrchr (endpoint, ':');
+  struct addrinfo hints, *res;
+  int fd = -1, one = 1, err;
+
+  if (colon != NULL) {
+    if ((size_t)(colon - endpoint) >= sizeof (host)) return -1;
+    memcpy (host, endpoint, colon - endpoint);
+    host[colon - endpoint] = '\0';
+    port = colon + 1;
+  }
+  memset (&hints, 0, sizeof (hints));
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = AI_NUMERICSERV;
+  if ((err = getaddrinfo (host, port, &hints, &res)) != 0) {
+    fprintf (stderr, "metrics: invalid endpoint %s: %s\n", endpoint, gai_strerror (err));
+    return -1;
+  }
+  fd = socket (res->ai_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd >= 0) setsockopt (fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof (one));
+  if (fd < 0 || bind (fd, res->ai_addr, res->ai_addrlen) < 0 || listen (fd, 8) < 0) {
+    fprintf (stderr, "metrics: can't listen on %s: %s\n", endpoint, strerror (errno));
+    if (fd >= 0) close (fd);
+    fd = -1;
+  }
+  freeaddrinfo (res);
+  metrics.is_unix = 0;
+  return fd;
+}
+
+// Start serving the metrics on 'endpoint' (see metrics.h). Returns -1 if it can't listen there.
+int metrics_serve (const char *endpoint)
+{
+  if (strncmp (endpoint, "unix:", 5) == 0) metrics.fd = listen_unix (endpoint + 5);
+  else if (endpoint[0] == '/') metrics.fd = listen_unix (endpoint);
+  else metrics.fd = listen_tcp (endpoint);
+  if (metrics.fd < 0) return -1;
+
+  atomic_store (&metrics.stop, 0);
+  if (pthread_create (&metrics.thread, NULL, server_thread, NULL) != 0) {
+    close (metrics.fd);
+    metrics.fd = -1;
+    return -1;
+  }
+  metrics.running = 1;
+  return 0;
+}
+
+// Stop the server (before the state the collectors read is freed)
+void metrics_stop (void)
+{
+  if (!metrics.running) return;
+  atomic_store (&metrics.stop, 1);
+  pthread_join (metrics.thread, NULL);
+  close (metrics.fd);
+  metrics.fd = -1;
+  if (metrics.is_unix) unlink (metrics.path);
+  metrics.running = 0;
+}
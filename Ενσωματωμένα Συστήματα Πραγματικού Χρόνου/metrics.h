@@ -0,0 +1,68 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <sys/types.h>
+#include "spsc_ring.h"
+
+// Live counters and gauges of the pipeline threads, scraped as Prometheus text.
+// Every thread registers a block of values (metrics_thread) and updates only its own, with relaxed
+// stores on cache lines no other thread writes: no locks, no shared lines, no syscalls on the hot
+// path. A scrape reads every block, adds the CPU time of each registered thread and what the
+// collectors print (state read on demand, e.g. queue depths), on the server's own thread.
+// Endpoints (metrics_serve):
+//   [host:]port   HTTP on TCP, host 127.0.0.1 unless given; any GET path returns the metrics
+//   unix:<path>   Unix domain socket (an absolute path works too), the text is written as soon as
+//                 a client connects, e.g. nc -U <path>
+
+#define METRICS_MAX 32            // Metrics defined
+#define METRICS_MAX_THREADS 64    // Threads registered, more share a block that isn't reported
+#define METRICS_MAX_COLLECTORS 8
+
+typedef enum { METRIC_COUNTER, METRIC_GAUGE } metric_type_t;
+
+// Metric of one thread role, reported with the labels thread="<role>",index="<index>"
+typedef struct {
+  const char *name;         // e.g. "pi_trades_received_total"
+  const char *help;
+  metric_type_t type;
+  const char *role;         // Only the threads of this role report it
+} metric_def_t;
+
+// Values of one thread, indexed like the definitions, written by that thread only
+typedef struct {
+  _Alignas(CACHE_LINE_SIZE) _Atomic int64_t value[METRICS_MAX];
+  const char *role;
+  int index;
+  pid_t tid;                // For its CPU time
+} metrics_thread_t;
+
+// Prints extra metrics at every scrape, on the server's thread
+typedef void (*metrics_collector_t)(FILE *out, void *arg);
+
+// Metrics functions
+int metrics_init (const metric_def_t *defs, int count);
+metrics_thread_t *metrics_thread (const char *role, int index);
+int metrics_add_collector (metrics_collector_t collect, void *arg);
+void metrics_header (FILE *out, const char *name, const char *help, metric_type_t type);
+void metrics_render (FILE *out);
+
+// Server functions
+int metrics_serve (const char *endpoint);
+void metrics_stop (void);
+
+// Counter of the calling thread
+static inline void metrics_add (metrics_thread_t *t, int id, int64_t n)
+{
+  atomic_store_explicit (&t->value[id], atomic_load_explicit (&t->value[id], memory_order_relaxed) + n, memory_order_relaxed);
+}
+
+// Gauge of the calling thread
+static inline void metrics_set (metrics_thread_t *t, int id, int64_t v)
+{
+  atomic_store_explicit (&t->value[id], v, memory_order_relaxed);
+}
+
+#endif
@@ -1,8 +1,65 @@
 /*
 >To stop the programme use Cntrl-C
->To modify the stocks you want to gather data from, edit the:
-  i) line 19 "NUMBER_OF_SYMBOLS", depending on how many stocks you want to select
-  ii) lines 58 "sympol_message[]" and 60 "stock_symbols[]", modify the names of symbols 
+>Usage: ./pi_code [-w workers] [-c connections] [-s symbols_file] [-W windows] [-g grace_ms] [-u url [-k]] [-r replay_dir [-x speed]] [-m shm_name] [-p hour|day] [-R placement] [-q queue_size] [-o policy] [-M endpoint] [-I indicators_file] [-C checkpoint_file]
+  -w: number of consumer worker threads, each owning a subset of the symbols (default 2)
+  -c: number of WebSocket connections, each with its own service thread and a subset of the
+      symbols (default 1). Check how many connections the API key allows.
+  -s: file with the symbols to track, one per line (default "symbols.conf")
+  -W: rolling windows in minutes for the SMA, VWAP and volume of each symbol (default "1,5,15,60")
+  -g: grace period in ms for late trades before a minute's candle is closed (default 2000)
+  -u: WebSocket server to connect to, ws:// or wss:// (default Finnhub, "wss://ws.finnhub.io/?token=...").
+      Use e.g. "ws://localhost:8080/" for the mock server of bench/mock_finnhub.c
+  -k: accept a self-signed server certificate (for a local wss:// mock server)
+  -r: replay the trade logs (<SYMBOL>.*.tlog/.tlz, or <SYMBOL>.tlog) in this directory instead of connecting to Finnhub.
+      The trades of the symbols file go through the same workers and sleepyhead in exchange time
+      order, no trade logs are written. Run it in another directory to compare its candle files
+      with the ones of the live run; the programme stops when the logs are exhausted.
+      Minutes are closed where the live run closed them, as the logs recorded with every trade,
+      so the same late trades are dropped and the candle files match the live run's. Only the
+      empty minutes the wall-clock ticks closed before a symbol's first trade, or after its last
+      one (a last tick closes up to the latest trade), aren't in the logs. Logs written before
+      the minutes closed were recorded give the candles of the trades alone, without ticks.
+  -x: replay speed as a multiple of the recorded pace (default 0, as fast as possible)
+  -m: name of the shared memory feed (default "/pi_code", only with '-m' in replay mode), "none" to turn it off
+  -p: partition of the trade logs, "hour" or "day" of exchange time (default "hour")
+  -R: real-time placement of the threads (CPUs, SCHED_FIFO priorities, locked memory, busy-polling
+      consumers), a file like rt.conf or its lines inline, e.g. "producer 1 fifo 70; consumer 2,3 fifo 80; mlock".
+      Settings the privileges don't allow fall back with a warning (default: no placement)
+  -q: capacity of each trade ring from a connection to a worker, in trades (default 512)
+  -o: what the producer does when a trade ring is full (see backlog.h), default "block":
+      block        wait for the worker to make room, the network thread stalls meanwhile
+      drop-oldest  never wait, up to queue_size more trades wait in the producer and the oldest are dropped
+                   (wall-clock ticks are kept)
+      conflate     the same, but the waiting trades of a symbol and minute are merged into the ones
+                   that make its candle first, so the candles stay exact
+      spill        the same, but what doesn't fit is written to a spill file and sent in order later
+      A replay always blocks, so it gives the same candles as the live run.
+  -M: serve live metrics (Prometheus text) on this endpoint: "[host:]port" for HTTP, on 127.0.0.1
+      unless a host is given, or "unix:<path>" for a Unix socket (default: off), see metrics.h.
+      E.g. curl localhost:9100/metrics, or nc -U <path>
+  -I: technical indicators to compute per symbol, a file like indicators.conf (see indicator.h), default none.
+      Their values of every minute go to <SYMBOL>_indicators.txt and to the shared memory feed;
+      symbols added by a reload get the indicators of the same file.
+  -C: checkpoint of the aggregator state (default "pi_code.ckpt" on a live run, none in a replay), "none" to turn it off.
+      The open candles, rolling windows and indicators of every symbol are written to it atomically every
+      10 seconds and at exit. On start the checkpoint is restored and the trades the trade logs got after
+      it are added again, so the windows and indicators are right from the first minute instead of after
+      the longest window. A replay restored from a checkpoint skips the trades it already has.
+>Candles are bucketed by the exchange time of the trades, so replaying the same trades gives the same candles.
+>The trade log of a symbol is rolled every hour (or day) of exchange time, UTC, into
+ <SYMBOL>.<YYYY-MM-DDTHH>.<NN>.tlog; a closed partition is compressed in the background into a
+ .tlz (see tlz.h) with a block index for time range reads, and the .tlog is removed.
+>The latency of every pipeline stage is kept in a histogram per symbol, 'latency.txt' gets the
+ count, p50, p99, p99.9 and max (us) of each stage and symbol every 10 seconds.
+>The WebSocket context lives for the whole run, a dropped connection is retried right away and then
+ with jittered exponential backoff (TLS sessions are resumed when libwebsockets is built with
+ LWS_WITH_TLS_SESSIONS), and the subscriptions are sent again. 'reconnects.txt' gets the outage
+ and the data gap of every reconnection.
+>Other processes can read the last trade, the open candle and the rolling windows of every symbol
+ from the shared memory feed (/dev/shm/pi_code) without locks, see shm_feed.h and bench/shm_reader.c.
+>To modify the stocks you want to gather data from, edit the symbols file.
+ Send SIGHUP (kill -HUP <pid>) to reload it while running: new symbols are subscribed
+ and removed ones unsubscribed on the live connection, without losing the running windows.
 */
 #include <pthread.h>
 #include <stdio.h>
@@ -13,11 +70,52 @@
 #include <jansson.h>
 #include <math.h>
 #include <signal.h>
-
-#define QUEUESIZE 500
-#define MAX_SYMBOL_LEN 30
-#define NUMBER_OF_SYMBOLS 4
+#include <limits.h>
+#include <errno.h>
+#include "trade.h"
+#include "spsc_ring.h"
+#include "symbols.h"
+#include "trade_parser.h"
+#include "tlog.h"
+#include "log_writer.h"
+#include "rolling.h"
+#include "candle.h"
+#include "latency.h"
+#include "replay.h"
+#include "shm_feed.h"
+#include "archive.h"
+#include "rt_thread.h"
+#include "backlog.h"
+#include "metrics.h"
+#include "indicator.h"
+#include "checkpoint.h"
+
+#define QUEUESIZE 512       // Default capacity of the trade rings ('-q'), rounded up to a power of two by the ring anyway
+#define CONSUMER_BATCH 256  // Maximum number of trades the consumer drains from the ring at once (a whole message)
+#define DEFAULT_WORKERS 2   // Number of consumer workers when '-w' is not given
+#define DEFAULT_SYMBOLS_FILE "symbols.conf"
+#define MAX_MESSAGE_LEN 128
+#define MAX_FRAME_TRADES 256  // Trades of one message decoded by the fast parser, larger messages take the slow path
 #define PING_LIMIT 2
+#define DEFAULT_URL "wss://ws.finnhub.io/?token=cr7nsa1r01qotnb3qq60cr7nsa1r01qotnb3qq6g"
+#define MAX_URL_LEN 512
+#define LOG_BUFFER_SIZE (64 * 1024)  // Size of each of the two output buffers of every thread that writes files
+#define LOG_FLUSH_MS 200             // Interval of the log writer flushes
+#define CANDLE_QUEUESIZE 1024        // Closed candles waiting for sleepyhead, per worker
+#define CANDLE_BATCH 64              // Candles closed or drained at once
+#define TICK_ID -1                   // ID of the wall-clock ticks of the first connection, TICK_ID - c for connection c
+#define TICK_INTERVAL_MS 1000
+#define TICK_LAG_MS 1000             // Ticks close a minute this much later than the symbol's own trades would
+#define CLOSE_ID INT32_MIN           // ID of the closes of a replay: the minutes of symbol 'price' before minute 'time'
+#define LATENCY_SNAPSHOT_MS 10000    // Interval of the latency snapshots
+#define RECONNECT_MIN_MS 250         // Backoff of the second attempt after a drop, doubled at every failure
+#define RECONNECT_MAX_MS 30000       // Upper bound of the backoff
+#define RECONNECT_POLL_MS 50         // Sleep between ticks while waiting for the next attempt
+#define STALE_CONNECTION_MS 30000    // A connection without any message (not even a ping) for this long is dropped
+#define TLS_SESSION_TIMEOUT_S 3600   // Lifetime of the cached TLS sessions
+#define DEFAULT_CHECKPOINT_FILE "pi_code.ckpt"
+#define CHECKPOINT_INTERVAL_MS 10000 // Interval of the checkpoints, the trades since the last one are read back from the logs
+#define CHECKPOINT_MARK -1           // ID of the closed candle a worker sends behind its part of a checkpoint
 
 #define COLOR_RED     "\x1b[31m"
 #define COLOR_GREEN   "\x1b[32m"
@@ -26,86 +124,243 @@
 #define COLOR_MAGENTA "\x1b[35m"
 #define COLOR_RESET   "\x1b[0m"
 
-// Struct to hold stock data such as symbol, price, volume, time 
+// Pipeline stages with a latency histogram per symbol
+enum { STAGE_NETWORK, STAGE_PRODUCER, STAGE_QUEUE, STAGE_CANDLE, STAGES };
+const char *stage_names[STAGES] = {
+  "network_producer",   // Exchange time of the trade to the producer receiving its message
+  "producer_queue",     // Message received to its trades published to the worker's ring
+  "queue_consumer",     // Published to taken out of the ring by the worker
+  "consumer_candle",    // Candle closed by the worker to saved by sleepyhead
+};
+
+// Live metrics of the threads, each thread updates its own (see metrics.h)
+enum {
+  // Producer, one per connection
+  M_MESSAGES, M_TRADES_RECEIVED, M_PARSE_ERRORS, M_PINGS, M_CONTINUOUS_PINGS, M_CONNECTED,
+  M_RECONNECTS, M_BACKLOG_WAITING,
+  // Consumer, one per worker
+  M_TRADES_CONSUMED, M_TICKS, M_BATCHES, M_LATE_TRADES, M_CANDLES_CLOSED,
+  // Sleepyhead
+  M_CANDLES_SAVED, M_WAKEUPS, M_LATENCY_SNAPSHOTS, M_CHECKPOINTS,
+  METRICS
+};
+const metric_def_t metric_defs[METRICS] = {
+  { "pi_messages_total", "WebSocket messages received", METRIC_COUNTER, "producer" },
+  { "pi_trades_received_total", "Trades of tracked symbols received", METRIC_COUNTER, "producer" },
+  { "pi_parse_errors_total", "Messages that could not be parsed", METRIC_COUNTER, "producer" },
+  { "pi_pings_total", "Messages without trades (pings)", METRIC_COUNTER, "producer" },
+  { "pi_continuous_pings", "Messages without trades since the last trade", METRIC_GAUGE, "producer" },
+  { "pi_connected", "1 while the WebSocket connection is up", METRIC_GAUGE, "producer" },
+  { "pi_reconnects_total", "Completed reconnections", METRIC_COUNTER, "producer" },
+  { "pi_backlog_waiting", "Trades waiting in the producer for room in the rings", METRIC_GAUGE, "producer" },
+  { "pi_trades_consumed_total", "Trades taken out of the rings", METRIC_COUNTER, "consumer" },
+  { "pi_ticks_total", "Wall-clock ticks taken out of the rings", METRIC_COUNTER, "consumer" },
+  { "pi_batches_total", "Batches taken out of the rings", METRIC_COUNTER, "consumer" },
+  { "pi_late_trades_total", "Trades dropped because their minute was closed", METRIC_COUNTER, "consumer" },
+  { "pi_candles_closed_total", "Candles closed and handed to sleepyhead", METRIC_COUNTER, "consumer" },
+  { "pi_candles_saved_total", "Candles saved with their rolling windows", METRIC_COUNTER, "sleepyhead" },
+  { "pi_wakeups_total", "Times sleepyhead woke up", METRIC_COUNTER, "sleepyhead" },
+  { "pi_latency_snapshots_total", "Latency snapshots written", METRIC_COUNTER, "sleepyhead" },
+  { "pi_checkpoints_total", "Checkpoints of the aggregator state written", METRIC_COUNTER, "sleepyhead" },
+};
+
+// Per-symbol state, attached to the symbol's registry entry when it is first subscribed.
+// Each group of fields is written by one thread only and starts on its own cache line.
 typedef struct {
-    char symbol[MAX_SYMBOL_LEN];    // Enough space for the stock symbol 
-    double price;                    
-    long long int time;              
-    double volume;                   
-    long long int recv_time;    // Time when data were received by the producer and added to the fifo queue
-} stock_data_t;
-
-// Struct to hold candlestick data 
+  // Owned by the consumer worker of the symbol
+  _Alignas(CACHE_LINE_SIZE) candle_series_t candles;  // Open 1-minute candles
+  tlog_t *log;                // Trades, binary columnar log of the current partition
+  int64_t log_end;            // Exchange time the partition ends, a trade at or after it rolls the log
+  char log_path[CHECKPOINT_PATH_LEN];
+  uint64_t log_rows;          // Trades of 'log_path' (and the partitions after it) in the candles, of the whole replay in a replay
+  checkpoint_part_t checkpoint; // Taken for sleepyhead, which writes it with the windows
+  shm_symbol_t *shm;          // Record in the shared memory feed, NULL if not published (sleepyhead writes its stats)
+  indicator_set_t indicators; // Technical indicators, fed every accepted trade and every closed minute
+
+  // Owned by sleepyhead
+  _Alignas(CACHE_LINE_SIZE) rolling_t rolling;   // SMA, VWAP and volume windows
+  struct timeval prev_time;   // Time of the previous candlestick save
+  log_file_t *file_candlestick;
+  log_file_t *file_sma_volume;
+  log_file_t *file_indicators;  // NULL if the symbol has no indicators
+  int indicator_values;       // Values of every closed candle, as many as the indicators have
+
+  latency_prev_t latency_prev[STAGES];  // Previous latency snapshots
+
+  // Owned by the producer of the symbol's connection
+  _Alignas(CACHE_LINE_SIZE) int subscribed;   // Subscription state on the current connection
+  backlog_counts_t overflow;  // Trades dropped, conflated or spilled by the overflow policy
+  uint64_t replay_skip;       // Trades the replay skips, the restored checkpoint already has them
+  int64_t replay_closed;      // Oldest minute left open by the last close the replay sent
+
+  // Each histogram is written by the thread of its stage only
+  latency_hist_t latency[STAGES];
+} symbol_state_t;
+
+// Closed candle with the values of the symbol's indicators after it, from a worker to sleepyhead
 typedef struct {
-  double open_price;
-  double close_price;
-  double high_price;
-  double low_price;
-  double volume;
-  int first;    // Flag to indicate the first entry for the candlestick
-} candlestick_t;
-
-// Queue struct for shared buffer between producer and consumers
+  candle_t candle;
+  double indicator[INDICATOR_MAX_VALUES];
+} closed_candle_t;
+
+// Consumer worker, owns the symbols assigned to it by 'shard_of[]'.
+// Workers are cache line aligned, the bell (written by the connections) has a line of its own.
+typedef struct {
+  _Alignas(CACHE_LINE_SIZE) int id;
+  pthread_t thread;
+  spsc_ring_t **rings;  // Lock-free ring from each connection to this worker
+  int next_ring;        // Ring to drain first next time, so no connection starves the others
+  spsc_ring_t *candles; // Closed candles (closed_candle_t), drained by sleepyhead
+  metrics_thread_t *metrics;
+  uint64_t checkpoint_epoch;  // Last checkpoint the worker took its part of
+  _Alignas(CACHE_LINE_SIZE) spsc_event_t bell;  // Rung by the connections after publishing (only with several connections)
+} worker_t;
+
+// WebSocket connection, with its own service thread, lws context and parser.
+// All the trades of a symbol arrive over the connection of the symbol and go through one ring
+// to the symbol's worker, so they stay in order. A connection is monitored and reconnected on
+// its own. Only its thread touches it, except 'resync' (set by the thread reloading the symbols).
+// Connections are cache line aligned, so two threads never write the same line.
 typedef struct {
-  stock_data_t buf[QUEUESIZE];  // Buffer holding stock data
-  long head, tail;
-  int full, empty;
-  pthread_mutex_t *mut;
-  pthread_cond_t *notFull, *notEmpty;
-} queue;
-
-// Stock symbol subscription messages
-const char *sympol_message[] = {"{\"type\":\"subscribe\",\"symbol\":\"GOOGL\"}", "{\"type\":\"subscribe\",\"symbol\":\"BINANCE:BTCUSDT\"}", "{\"type\":\"subscribe\",\"symbol\":\"AAPL\"}", "{\"type\":\"subscribe\",\"symbol\":\"NVDA\"}"};
-// Stock symbols being tracked
-const char *stock_symbols[] = { "GOOGL", "BINANCE:BTCUSDT", "AAPL", "NVDA" };
+  _Alignas(CACHE_LINE_SIZE) int id;
+  pthread_t thread;
+  struct lws_context *context;  // Created once, a reconnection only opens a new connection on it
+  struct lws *wsi;              // Current WebSocket connection
+  log_buffer_t *log;            // Output buffers of the connection's thread
+  trade_parser_t parser;        // Joins fragmented messages for the trade parser
+  stock_data_t frame_trades[MAX_FRAME_TRADES];  // Trades decoded from the current message
+  int64_t frame_recv_ns;        // Monotonic time the current message was received
+  trade_t **stage;              // Trades of the current message per worker, waiting to be published
+  size_t *staged;
+  backlog_t *backlog;           // Trades per worker that didn't fit in its ring (not with the block policy)
+  metrics_thread_t *metrics;
+  int sync_cursor;              // Next symbol to check when syncing subscriptions
+  _Atomic int resync;           // The symbols were reloaded, sync the subscriptions
+  int continues_pings;
+  long long last_tick;          // Wall-clock time of the last tick (ms)
+
+  // Reconnection state, times are monotonic ns
+  int connection_flag;          // 1 while connected, 0 after a drop, -1 after a failed attempt
+  int connecting;               // A connection attempt is in flight
+  int closing;                  // The connection is being dropped on purpose
+  int reconnect_attempts;       // Attempts since the last drop, picks the backoff
+  int64_t next_attempt_ns;      // Earliest time of the next attempt
+  int64_t attempt_ns;           // Start of the attempt in flight
+  int64_t last_message_ns;      // Last message of the current connection
+  int64_t drop_ns;              // Start of the current outage, 0 while there is none
+  int64_t gap_start_ns;         // Last message before the outage
+  int64_t reconnect_ns;         // Drop to connection established of the last reconnection
+  int64_t handshake_ns;         // Attempt to connection established of the last connection
+  int gap_pending;              // Reconnected, the gap ends at the first message
+  int tls_resumed;              // The last TLS handshake resumed a cached session
+  unsigned long long reconnects;// Completed reconnections
+  int64_t reconnect_ns_max, gap_ns_max;
+} connection_t;
 
 // Global variables, arrays, structures, etc.
-int connection_flag = 1;  
-int continues_pings = 0;
-int count[NUMBER_OF_SYMBOLS] = {0}; 
 int skip = 0;
 int termination = 0;
-pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
-pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER; 
-
-queue *fifo; 
-struct lws_context *context;
-
-candlestick_t candlestick[NUMBER_OF_SYMBOLS] = {0};
-int sympol_counter[NUMBER_OF_SYMBOLS] = {0}; 
-double price_sum[NUMBER_OF_SYMBOLS] = {0};
-double sma_1min[NUMBER_OF_SYMBOLS][15] = {0};
-double volume_1min[NUMBER_OF_SYMBOLS][15] = {0};
-double volume_15min[NUMBER_OF_SYMBOLS] = {0};
-double sma_15min[NUMBER_OF_SYMBOLS] = {0};
-
-// File pointers for logging
-FILE *file[NUMBER_OF_SYMBOLS];              
-FILE *file_candlestick[NUMBER_OF_SYMBOLS];
-FILE *file_sma_volume[NUMBER_OF_SYMBOLS];
-FILE *candlestick_time_diff;
-FILE *file_fin_pro_delay;
-FILE *file_pro_con_delay;
+int reload_symbols = 0;     // Set by SIGHUP, the producer of the first connection reloads the symbols file
+int header_symbols = 0;     // Number of symbols listed in the header of the global files
+const char *symbols_file = DEFAULT_SYMBOLS_FILE;
+int window_minutes[ROLLING_MAX_WINDOWS];  // Lengths of the rolling windows
+int number_of_windows = 0;
+long long grace_ms = CANDLE_DEFAULT_GRACE_MS;   // Late trades accepted up to this long after the end of a minute
+spsc_event_t candle_bell;     // Rung by the workers when they publish candles
+_Atomic int candles_closed;   // Set on termination to stop sleepyhead
+_Atomic int snapshot_due;     // Set by the producer's ticks, sleepyhead saves the latencies
+_Atomic uint64_t checkpoint_epoch;  // Bumped by sleepyhead to start a checkpoint, each worker then takes its part
+
+worker_t *workers;            // Pool of consumer workers, symbol ID % number_of_workers owns the symbol
+int number_of_workers = DEFAULT_WORKERS;
+connection_t *connections;    // WebSocket connections, symbol ID % number_of_connections picks the connection
+int number_of_connections = 1;
+_Atomic int trades_closed;    // Set on termination, wakes up the workers sleeping on their bell
+pthread_rwlock_t registry_lock = PTHREAD_RWLOCK_INITIALIZER;  // Reloading the symbols excludes the lookups
+int insecure_tls = 0;         // Accept a self-signed certificate ('-k')
+char server_address[MAX_URL_LEN];   // WebSocket server, from the '-u' URL
+char server_path[MAX_URL_LEN];
+int server_port;
+int server_ssl;
+const char *replay_dir = NULL;    // Replay the trade logs of this directory instead of the live feed
+double replay_speed = 0;          // Multiple of the recorded pace, 0 for as fast as possible
+int64_t replay_start_ns;          // Start of the replay, for the throughput report
+unsigned long long replay_trades; // Trades replayed
+const char *shm_name = NULL;      // Shared memory feed ('-m'), SHM_FEED_DEFAULT_NAME on a live run
+shm_feed_t *shm_feed;             // NULL if turned off
+int64_t archive_period = ARCHIVE_HOUR_MS; // Length of a trade log partition ('-p')
+const char *placement = NULL;     // Thread placement ('-R'), NULL for none
+size_t queue_size = QUEUESIZE;    // Capacity of the trade rings ('-q')
+backlog_policy_t overflow_policy = BACKLOG_BLOCK;   // Full trade ring policy ('-o')
+const char *metrics_endpoint = NULL;  // Metrics server ('-M'), NULL for none
+const char *indicators_file = NULL;   // Indicators of the symbols ('-I'), NULL for none
+indicator_config_t indicator_config;  // Loaded from it, for the whole run
+const char *checkpoint_file = NULL;   // Checkpoint of the aggregator state ('-C'), DEFAULT_CHECKPOINT_FILE on a live run
+checkpoint_writer_t checkpoint_writer;  // Checkpoint being written (sleepyhead, then main at exit)
+int checkpoint_pending;       // Workers whose part of the checkpoint sleepyhead hasn't got yet
+metrics_thread_t *sleepyhead_metrics;
+
+// Files for logging, written in the background by the log writer
+log_file_t *candlestick_time_diff;
+log_file_t *file_latency;
+log_file_t *file_reconnects;
+log_buffer_t *producer_log;   // Output buffers of the first connection's producer (and of main before the threads start)
+log_buffer_t *sleepyhead_log; // Output buffers of sleepyhead
 
 // Producer and consumer function declarations
-void *producer ();
-void *consumer_read_data ();
+void *producer (void *arg);
+void *replay_producer (void *arg);
+void *consumer_read_data (void *arg);
 void *sleepyhead ();
 
-// Queue function declarations
-queue *queueInit (void);
-void queueDelete (queue *q);
-void queueAdd (queue *q, stock_data_t in);
-void queueDel (queue *q, stock_data_t *out);
-
 // Function declarations for various operations
-void process_trade(stock_data_t trade, candlestick_t *candlestick);
+void close_candles(worker_t *worker, symbol_state_t *st, long long watermark);
+void close_minutes(worker_t *worker, symbol_state_t *st, int64_t minute);
+int publish_candles(worker_t *worker, symbol_state_t *st, const candle_t *candles, int n);
+void take_checkpoint(worker_t *worker);
+void start_checkpoint();
+int add_checkpoint(int worker, uint64_t epoch);
+void commit_checkpoint();
+void restore_checkpoint();
+unsigned long long rebuild_from_logs();
+void rebuild_close(symbol_state_t *st, int64_t watermark);
+void rebuild_close_minutes(symbol_state_t *st, int64_t minute);
+void rebuild_candles(symbol_state_t *st, const candle_t *candles, int n);
+void save_candle(const closed_candle_t *closed, char **row, size_t *row_size);
+int candles_ready(void *arg);
+size_t take_trades(worker_t *worker, trade_t *batch);
+int trades_ready(void *arg);
+void send_ticks(connection_t *conn);
+void send_tick(connection_t *conn, long long time);
+void write_latency_snapshot();
 void create_txt_files();
+void create_symbol_files(symbol_t *sym);
+void roll_trade_log(symbol_t *sym, symbol_state_t *st, int64_t time);
+void write_symbols_header();
+void write_rolling_stats(symbol_t *sym, symbol_state_t *st, int print);
+void write_indicators(symbol_state_t *st, const closed_candle_t *closed);
+void on_symbol_change(symbol_t *sym, int subscribed);
+void publish_live(symbol_state_t *st, const trade_t *trade);
+void publish_stats(symbol_state_t *st, const closed_candle_t *closed);
 void handle_sigint(int sig);
+void handle_sighup(int sig);
 void send_message(struct lws *wsi, const char *message);
-void parse_json_data(const char *json_text);
+void parse_json_data(connection_t *conn, const char *json_text, size_t len);
+void parse_json_data_slow(connection_t *conn, const char *json_text, size_t len, long long recv_time);
+int stage_trade(connection_t *conn, const stock_data_t *trade, long long recv_time);
+int queue_trade(connection_t *conn, const trade_t *trade);
+int queue_close(connection_t *conn, int id, int64_t minute);
+int publish_trades(connection_t *conn);
+uint64_t flush_backlogs(connection_t *conn);
+backlog_counts_t *symbol_overflow(int id);
+void collect_metrics(FILE *out, void *arg);
 static int callback_ws(struct lws *wsi, enum lws_callback_reasons reason, void *user, void *in, size_t len);
-void create_client();
+void create_context(connection_t *conn);
+void connect_client(connection_t *conn);
+void schedule_reconnect(connection_t *conn);
+void drop_connection(connection_t *conn, const char *reason);
+void log_reconnect(connection_t *conn, int64_t now);
+int parse_url(const char *url);
 
 // WebSocket protocol setup
 static struct lws_protocols protocols[] = {
@@ -119,260 +374,786 @@ static struct lws_protocols protocols[] = {
 };
 
 // Main function to initialize threads and handle signal interruptions
-int main ()
+int main (int argc, char *argv[])
 {
-  signal(SIGINT, handle_sigint); // Handle Ctrl+C to cleanly exit
+  int opt, policy;
+  const char *windows = ROLLING_DEFAULT_WINDOWS;
+  const char *url = DEFAULT_URL;
+
+  // Parse command line options
+  while ((opt = getopt(argc, argv, "w:c:s:W:g:u:kr:x:m:p:R:q:o:M:I:C:")) != -1) {
+    switch (opt) {
+      case 'w':
+        number_of_workers = atoi(optarg);
+        break;
+      case 'c':
+        number_of_connections = atoi(optarg);
+        break;
+      case 's':
+        symbols_file = optarg;
+        break;
+      case 'W':
+        windows = optarg;
+        break;
+      case 'g':
+        grace_ms = atoll(optarg);
+        break;
+      case 'u':
+        url = optarg;
+        break;
+      case 'k':
+        insecure_tls = 1;
+        break;
+      case 'r':
+        replay_dir = optarg;
+        break;
+      case 'x':
+        replay_speed = atof(optarg);
+        break;
+      case 'm':
+        shm_name = optarg;
+        break;
+      case 'p':
+        archive_period = archive_parse_period(optarg);
+        break;
+      case 'R':
+        placement = optarg;
+        break;
+      case 'q':
+        queue_size = (size_t)atol(optarg);
+        break;
+      case 'o':
+        policy = backlog_parse_policy(optarg);
+        if (policy < 0) {
+          fprintf(stderr, COLOR_RED"Invalid policy '%s', expected block, drop-oldest, conflate or spill\n"COLOR_RESET, optarg);
+          exit(1);
+        }
+        overflow_policy = (backlog_policy_t)policy;
+        break;
+      case 'M':
+        metrics_endpoint = optarg;
+        break;
+      case 'I':
+        indicators_file = optarg;
+        break;
+      case 'C':
+        checkpoint_file = optarg;
+        break;
+      default:
+        fprintf(stderr, "Usage: %s [-w workers] [-c connections] [-s symbols_file] [-W windows] [-g grace_ms] [-u url [-k]] [-r replay_dir [-x speed]] [-m shm_name] [-p hour|day] [-R placement] [-q queue_size] [-o policy] [-M endpoint] [-I indicators_file] [-C checkpoint_file]\n", argv[0]);
+        exit(1);
+    }
+  }
+  if (number_of_workers < 1) number_of_workers = 1;
+  if (number_of_connections < 1 || replay_dir != NULL) number_of_connections = 1;
+  if (replay_dir != NULL) overflow_policy = BACKLOG_BLOCK;   // A replay loses nothing and waits instead
+  if (checkpoint_file == NULL && replay_dir == NULL) checkpoint_file = DEFAULT_CHECKPOINT_FILE;
+  if (checkpoint_file != NULL && strcmp(checkpoint_file, "none") == 0) checkpoint_file = NULL;
+  if (queue_size < 2) queue_size = 2;
+  number_of_windows = rolling_parse_windows(windows, window_minutes, ROLLING_MAX_WINDOWS);
+  if (number_of_windows < 0) {
+    fprintf(stderr, COLOR_RED"Invalid windows '%s', expected up to %d lengths in minutes like %s\n"COLOR_RESET,
+            windows, ROLLING_MAX_WINDOWS, ROLLING_DEFAULT_WINDOWS);
+    exit(1);
+  }
+  if (parse_url(url) < 0) {
+    fprintf(stderr, COLOR_RED"Invalid URL '%s', expected ws://host[:port][/path] or wss://...\n"COLOR_RESET, url);
+    exit(1);
+  }
+  if (grace_ms < 0 || grace_ms > CANDLE_MAX_GRACE_MS) {
+    fprintf(stderr, COLOR_RED"Invalid grace period %lld ms, expected 0 to %lld ms\n"COLOR_RESET, grace_ms, (long long)CANDLE_MAX_GRACE_MS);
+    exit(1);
+  }
 
-  pthread_t pro, con, sleepy;     // Declare thread identifiers
+  if (archive_period == 0) {
+    fprintf(stderr, COLOR_RED"Invalid partition, expected \"hour\" or \"day\"\n"COLOR_RESET);
+    exit(1);
+  }
+  if (indicators_file != NULL && indicator_config_load(&indicator_config, indicators_file) < 0) {
+    exit(1);
+  }
+  if (placement != NULL) {
+    if (rt_configure(placement) < 0) exit(1);
+    rt_print_config();
+  }
 
-  // Initialize first-time flags for candlestick tracking
-  for(int i = 0; i < NUMBER_OF_SYMBOLS; i++) {
-    candlestick[i].first = 1;
+  signal(SIGINT, handle_sigint); // Handle Ctrl+C to cleanly exit
+  signal(SIGHUP, handle_sighup); // Handle SIGHUP to reload the symbols file
+
+  pthread_t sleepy;          // Declare thread identifiers
+  log_stats_t log_stats;
+  archive_stats_t archive_stats;
+
+  // Every thread that writes files gets its own buffers, the writer thread does the file I/O
+  log_writer_init(LOG_BUFFER_SIZE, LOG_FLUSH_MS);
+  producer_log = log_buffer_create();
+  sleepyhead_log = log_buffer_create();
+  if (producer_log == NULL || sleepyhead_log == NULL) {
+    fprintf (stderr, COLOR_RED"main: Log Buffer Init failed.\n"COLOR_RESET);
+    exit (1);
   }
 
   create_txt_files();   // Create necessary files
 
-  fifo = queueInit ();
-  if (fifo ==  NULL) {
-      fprintf (stderr, COLOR_RED"main: Queue Init failed.\n"COLOR_RESET);
+  // Shared memory feed, the symbols get their record when they are loaded
+  if (shm_name == NULL && replay_dir == NULL) shm_name = SHM_FEED_DEFAULT_NAME;
+  if (shm_name != NULL && strcmp(shm_name, "none") != 0) {
+    shm_feed = shm_feed_create(shm_name, SHM_FEED_DEFAULT_CAPACITY);
+    if (shm_feed == NULL) {
+      fprintf(stderr, COLOR_RED"main: Error creating the shared memory feed %s: %s\n"COLOR_RESET, shm_name, strerror(errno));
+      exit(1);
+    }
+  }
+
+  // Load the symbols, this also creates the files of each symbol
+  if (symbols_load(symbols_file, on_symbol_change) < 0) {
+    exit(1);
+  }
+  write_symbols_header();
+  log_commit(producer_log);
+
+  // Warm restart: the state of the last checkpoint and the trades logged after it
+  if (checkpoint_file != NULL) restore_checkpoint();
+
+  // Create the trade rings (one per connection) and the candle ring of every worker
+  spsc_event_init(&candle_bell);
+  if (posix_memalign((void **)&workers, CACHE_LINE_SIZE, number_of_workers * sizeof(worker_t)) != 0) {
+    fprintf (stderr, COLOR_RED"main: Worker Init failed.\n"COLOR_RESET);
+    exit (1);
+  }
+  memset(workers, 0, number_of_workers * sizeof(worker_t));
+  for(int w = 0; w < number_of_workers; w++) {
+    workers[w].id = w;
+    spsc_event_init(&workers[w].bell);
+    workers[w].rings = (spsc_ring_t **) calloc(number_of_connections, sizeof(spsc_ring_t *));
+    workers[w].candles = spsc_ring_init (CANDLE_QUEUESIZE, sizeof (closed_candle_t));
+    if (workers[w].rings == NULL || workers[w].candles == NULL) {
+        fprintf (stderr, COLOR_RED"main: Ring Init failed.\n"COLOR_RESET);
+        exit (1);
+    }
+    for(int c = 0; c < number_of_connections; c++) {
+      workers[w].rings[c] = spsc_ring_init (queue_size, sizeof (trade_t));
+      if (workers[w].rings[c] == NULL) {
+        fprintf (stderr, COLOR_RED"main: Ring Init failed.\n"COLOR_RESET);
+        exit (1);
+      }
+    }
+  }
+
+  // Create the connections with their parser and staging area for every worker
+  if (posix_memalign((void **)&connections, CACHE_LINE_SIZE, number_of_connections * sizeof(connection_t)) != 0) {
+    fprintf (stderr, COLOR_RED"main: Connection Init failed.\n"COLOR_RESET);
+    exit (1);
+  }
+  memset(connections, 0, number_of_connections * sizeof(connection_t));
+  for(int c = 0; c < number_of_connections; c++) {
+    connection_t *conn = &connections[c];
+    conn->id = c;
+    conn->sync_cursor = c;
+    conn->log = c == 0 ? producer_log : log_buffer_create();  // The first connection also reloads the symbols
+    conn->stage = (trade_t **) calloc(number_of_workers, sizeof(trade_t *));
+    conn->staged = (size_t *) calloc(number_of_workers, sizeof(size_t));
+    conn->backlog = (backlog_t *) calloc(number_of_workers, sizeof(backlog_t));
+    if (conn->log == NULL || conn->stage == NULL || conn->staged == NULL || conn->backlog == NULL ||
+        trade_parser_init(&conn->parser, PARSER_INITIAL_SIZE) < 0) {
+      fprintf (stderr, COLOR_RED"main: Connection Init failed.\n"COLOR_RESET);
+      exit (1);
+    }
+    for(int w = 0; w < number_of_workers; w++) {
+      char spill_path[64];
+      snprintf(spill_path, sizeof(spill_path), "spill.%d.%d.tmp", c, w);
+      conn->stage[w] = (trade_t *) malloc(MAX_FRAME_TRADES * sizeof(trade_t));
+      if (conn->stage[w] == NULL ||
+          backlog_init(&conn->backlog[w], overflow_policy, queue_size, CANDLE_MINUTE_MS, spill_path, symbol_overflow) < 0) {
+        fprintf (stderr, COLOR_RED"main: Connection Init failed.\n"COLOR_RESET);
+        exit (1);
+      }
+    }
+  }
+
+  // Consumers with a CPU of their own spin on their rings instead of sleeping
+  if (rt_busy_poll(number_of_workers)) {
+    for(int w = 0; w < number_of_workers; w++) {
+      spsc_event_busy_poll(&workers[w].bell, 1);
+      for(int c = 0; c < number_of_connections; c++) {
+        spsc_event_busy_poll(&workers[w].rings[c]->not_empty, 1);
+      }
+    }
+  }
+
+  // Everything is allocated: lock the memory, then place main, the log writer, the archiver and
+  // the metrics server started below inherit its CPUs
+  rt_lock_memory();
+  rt_place_self(RT_MAIN, 0);
+
+  metrics_init(metric_defs, METRICS);
+  metrics_add_collector(collect_metrics, NULL);
+  if (metrics_endpoint != NULL) {
+    if (metrics_serve(metrics_endpoint) < 0) {
+      fprintf (stderr, COLOR_RED"main: Metrics Server Start failed.\n"COLOR_RESET);
       exit (1);
+    }
+    printf("Serving metrics on %s\n", metrics_endpoint);
+  }
+
+  if (log_writer_start() < 0) {
+    fprintf (stderr, COLOR_RED"main: Log Writer Start failed.\n"COLOR_RESET);
+    exit (1);
+  }
+
+  // Compresses the trade log partitions as the workers close them
+  if (replay_dir == NULL && archive_start() < 0) {
+    fprintf (stderr, COLOR_RED"main: Archiver Start failed.\n"COLOR_RESET);
+    exit (1);
   }
-  
-  create_client(); // Initialize WebSocket client
 
-  // Create producer and consumer threads
-  pthread_create (&pro, NULL, producer, NULL);
-  pthread_create (&con, NULL, consumer_read_data, NULL);
+  if (replay_dir == NULL) {
+    srand(time(NULL) ^ getpid());   // Clients don't pick the same reconnection jitter
+    for(int c = 0; c < number_of_connections; c++) {
+      create_context(&connections[c]); // WebSocket context of the whole run, the producer connects
+    }
+  }
+
+  // Create producer (one per connection), consumer and sleepyhead threads
+  for(int c = 0; c < number_of_connections; c++) {
+    pthread_create (&connections[c].thread, NULL, replay_dir != NULL ? replay_producer : producer, &connections[c]);
+  }
+  for(int w = 0; w < number_of_workers; w++) {
+    pthread_create (&workers[w].thread, NULL, consumer_read_data, &workers[w]);
+  }
   pthread_create (&sleepy, NULL, sleepyhead, NULL);
 
   // Wait for threads to finish
-  pthread_join (pro, NULL);
-  pthread_join (con, NULL);
+  for(int c = 0; c < number_of_connections; c++) {
+    pthread_join (connections[c].thread, NULL);
+  }
+  for(int w = 0; w < number_of_workers; w++) {
+    pthread_join (workers[w].thread, NULL);
+  }
+  if (replay_dir != NULL) {
+    double seconds = (latency_now_ns() - replay_start_ns) / 1e9;
+    printf("Replayed %llu trades in %.3f s, %.0f trades/s\n", replay_trades, seconds, seconds > 0 ? replay_trades / seconds : 0.0);
+  }
+  // The workers are done, sleepyhead saves the candles they published and stops
+  atomic_store (&candles_closed, 1);
+  spsc_event_wake_all (&candle_bell);
   pthread_join (sleepy, NULL);
+  metrics_stop();             // The collectors read the rings and connections freed below
+  write_latency_snapshot();   // Latencies since the last snapshot of sleepyhead
+
+  // Every thread stopped: the last checkpoint has all the trades the workers took
+  if (checkpoint_file != NULL) {
+    checkpoint_begin(&checkpoint_writer);
+    for(int i = 0; i < symbol_count(); i++) {
+      symbol_state_t *st = symbol_get(i)->state;
+      if (checkpoint_take(&st->checkpoint, &st->candles, &st->indicators, st->log_path, st->log_rows) < 0 ||
+          checkpoint_add(&checkpoint_writer, symbol_get(i)->name, &st->checkpoint, &st->rolling) < 0) {
+        fprintf(stderr, COLOR_RED"main: Out of memory for the checkpoint of %s\n"COLOR_RESET, symbol_get(i)->name);
+      }
+    }
+    commit_checkpoint();
+  }
+
+  for(int c = 0; c < number_of_connections; c++) {
+    connection_t *conn = &connections[c];
+    if (conn->reconnects == 0) continue;
+    printf("Connection %d reconnects: %llu, max outage %.1f ms, max data gap %.1f ms\n",
+           c, conn->reconnects, conn->reconnect_ns_max / 1e6, conn->gap_ns_max / 1e6);
+  }
+  if (overflow_policy != BACKLOG_BLOCK) {
+    for(int c = 0; c < number_of_connections; c++) {
+      for(int w = 0; w < number_of_workers; w++) {
+        backlog_t *b = &connections[c].backlog[w];
+        printf("Connection %d to worker %d (%s): max %llu trades waiting, %llu left at exit, %llu ticks dropped\n", c, w,
+               backlog_policy_name(overflow_policy), (unsigned long long)b->waiting_max,
+               (unsigned long long)backlog_waiting(b), (unsigned long long)b->ticks_dropped);
+      }
+    }
+  }
 
-  // Close all files associated with each stock symbol
-  for(int i = 0; i < NUMBER_OF_SYMBOLS; i++) {
-    fclose(file[i]);
-    fclose(file_candlestick[i]);
-    fclose(file_sma_volume[i]);
+  // Write everything the threads left in their buffers
+  log_writer_stop();
+  log_writer_stats(&log_stats);
+  printf("Log writer: %llu bytes in %llu flushes (avg %.0f us, max %.0f us), %llu stalls, %zu KB of buffers%s\n",
+         log_stats.bytes, log_stats.flushes,
+         log_stats.flushes ? log_stats.flush_ns_total / 1e3 / log_stats.flushes : 0.0,
+         log_stats.flush_ns_max / 1e3, log_stats.stalls, log_stats.budget / 1024,
+         log_stats.uring ? ", io_uring" : "");
+
+  // Close all files associated with each stock symbol and free its state
+  unsigned long long late_trades = 0;
+  for(int i = 0; i < symbol_count(); i++) {
+    symbol_state_t *st = symbol_get(i)->state;
+    late_trades += st->candles.late;
+    if (st->overflow.dropped || st->overflow.conflated || st->overflow.spilled) {
+      printf("%s overflow: %llu dropped, %llu conflated, %llu spilled\n", symbol_get(i)->name,
+             (unsigned long long)st->overflow.dropped, (unsigned long long)st->overflow.conflated,
+             (unsigned long long)st->overflow.spilled);
+    }
+    if (st->log != NULL) {
+      if (tlog_close(st->log) < 0) perror("Error closing trade log");
+      else archive_submit(st->log_path);
+    }
+    log_close(st->file_candlestick);
+    log_close(st->file_sma_volume);
+    if (st->file_indicators != NULL) log_close(st->file_indicators);
+    rolling_free(&st->rolling);
+    indicator_set_free(&st->indicators);
+    checkpoint_part_free(&st->checkpoint);
+    free(st);
+  }
+  symbols_free();
+  indicator_config_free(&indicator_config);
+  checkpoint_writer_free(&checkpoint_writer);
+  printf("Late trades dropped: %llu\n", late_trades);
+
+  // Compress the partitions that were still open
+  archive_stop(&archive_stats);
+  if (replay_dir == NULL) {
+    printf("Archiver: %llu partitions, %llu -> %llu bytes (%.1fx), avg %.1f ms, max %.1f ms, %llu failed\n",
+           archive_stats.files, archive_stats.raw_bytes, archive_stats.compressed_bytes,
+           archive_stats.compressed_bytes ? (double)archive_stats.raw_bytes / archive_stats.compressed_bytes : 0.0,
+           archive_stats.files ? archive_stats.ns_total / 1e6 / archive_stats.files : 0.0,
+           archive_stats.ns_max / 1e6, archive_stats.failed);
   }
 
   // Close other global files
-  fclose(candlestick_time_diff);
-  fclose(file_fin_pro_delay);
-  fclose(file_pro_con_delay);
+  log_close(candlestick_time_diff);
+  log_close(file_latency);
+  log_close(file_reconnects);
+  shm_feed_close(shm_feed);
 
   // Clean up
-  queueDelete (fifo);
+  for(int c = 0; c < number_of_connections; c++) {
+    for(int w = 0; w < number_of_workers; w++) {
+      free (connections[c].stage[w]);
+    }
+    for(int w = 0; w < number_of_workers; w++) {
+      backlog_free (&connections[c].backlog[w]);
+    }
+    free (connections[c].stage);
+    free (connections[c].staged);
+    free (connections[c].backlog);
+    trade_parser_free(&connections[c].parser);
+  }
+  free (connections);
+  for(int w = 0; w < number_of_workers; w++) {
+    for(int c = 0; c < number_of_connections; c++) {
+      spsc_ring_delete (workers[w].rings[c]);
+    }
+    free (workers[w].rings);
+    spsc_ring_delete (workers[w].candles);
+  }
+  free (workers);
 
   return 0;
 }
 
-// Producer function responsible for WebSocket communication and queueing data
-void *producer ()
+// Producer function responsible for the WebSocket communication of one connection and queueing its data.
+// The lws context is created once; a dropped connection only starts a new connection attempt
+// on it, so the TLS context (and cached sessions) survive, and the ticks keep going meanwhile.
+void *producer (void *arg)
 {
-  int count_attempts = 0;
-  while(!termination) {
-    lws_service(context, 1000); // Service the WebSocket connection
-      
-    if(connection_flag == 0 || connection_flag == -1) { 
-        // Connection issue, re-create client
-        lws_cancel_service(context);
-        lws_context_destroy(context);
-        create_client();
-    } 
-
-    // Handle reconnection attempts
-    if(connection_flag != 1) {
-      count_attempts += 1;  // Count continuous failed reconnection attempts
-      printf(COLOR_YELLOW"\nTRYING TO RECONNECT\n"COLOR_RESET);
-
-      if(count_attempts > 10){  // Too many failed attempts, sleep for 10-sec
-        sleep(10);
-      }
+  connection_t *conn = (connection_t *)arg;
+  int64_t wait_ns;
+  struct timespec pause;
+  int changes;
 
-      // Waiting to reconnect
-      while (1) {
-        lws_service(context, 1000);
-        
-        if(connection_flag == 1) { // Reconnection completed
-          count_attempts = 0;
-          break;
-        } 
-
-        if(connection_flag == -1) { // Client connection error, need to re-create client
-          usleep(500000);
-          connection_flag = 0;
-          break;
+  rt_place_self(RT_PRODUCER, conn->id);
+  conn->metrics = metrics_thread("producer", conn->id);
+  while(!termination) {
+    metrics_set(conn->metrics, M_CONNECTED, conn->connection_flag == 1);
+    metrics_set(conn->metrics, M_CONTINUOUS_PINGS, conn->continues_pings);
+    metrics_set(conn->metrics, M_RECONNECTS, conn->reconnects);
+
+    // The first connection reloads the symbols file on SIGHUP, every connection then syncs
+    // the subscriptions of its symbols on its live connection
+    if(conn->id == 0 && reload_symbols) {
+        reload_symbols = 0;
+        pthread_rwlock_wrlock(&registry_lock);
+        changes = symbols_load(symbols_file, on_symbol_change);
+        pthread_rwlock_unlock(&registry_lock);
+        if(changes > 0) {
+            write_symbols_header();
+            log_commit(producer_log);
         }
- 
-        if(termination) { // Clean up WebSocket context and exit function
-          lws_cancel_service(context);
-          lws_context_destroy(context);
-          return (NULL);
+    }
+    if(atomic_exchange(&conn->resync, 0)) {
+        conn->sync_cursor = conn->id;
+        if(conn->connection_flag == 1) lws_callback_on_writable(conn->wsi);
+    }
+
+    // Not connected: start the next attempt when it is due, and only tick until then
+    if(conn->connection_flag != 1 && !conn->connecting) {
+        wait_ns = conn->next_attempt_ns - latency_now_ns();
+        if(wait_ns > 0) {
+            if(wait_ns > RECONNECT_POLL_MS * 1000000LL) wait_ns = RECONNECT_POLL_MS * 1000000LL;
+            pause.tv_sec = 0;
+            pause.tv_nsec = wait_ns;
+            nanosleep(&pause, NULL);
+            send_ticks(conn);
+            continue;
         }
-      }
+        connect_client(conn);
+    }
+
+    // Service the WebSocket connection, coming back soon while trades wait for room in a ring
+    lws_service(conn->context, flush_backlogs(conn) > 0 ? 1 : 1000);
+    send_ticks(conn);
+
+    // A connection that went completely silent is dead even if TCP hasn't noticed yet
+    if(conn->connection_flag == 1 && latency_now_ns() - conn->last_message_ns > STALE_CONNECTION_MS * 1000000LL) {
+        drop_connection(conn, "no messages");
     }
   }
 
   // Clean up WebSocket context and exit function
-  lws_cancel_service(context);
-  lws_context_destroy(context);
+  lws_cancel_service(conn->context);
+  lws_context_destroy(conn->context);
   return (NULL);
 }
 
-// Save 1-minute aggregated data (candlestick, SMA, volume)
-void *sleepyhead () 
+// Replay producer: feeds the trade logs of the symbols to the workers in exchange time order,
+// as fast as possible or at 'replay_speed' times the recorded pace. Before a trade, the worker
+// closes the minutes of its symbol the live run had closed by then (its trades and the wall-clock
+// ticks, see tlog.h), so the same trades are late; a last tick at the latest trade closes the
+// minutes of the symbols that stopped trading.
+void *replay_producer (void *arg)
 {
-    int ret;
-    struct timespec timeout; // Used to wake up the function
-    struct timeval prev_time[NUMBER_OF_SYMBOLS], current_time[NUMBER_OF_SYMBOLS]; // Used to capture the time difference between candlestick saves
-    long long int time_diff;
+    connection_t *conn = (connection_t *)arg;
+    replay_t replay;
+    trade_t trade;
+    double price, volume;
+    symbol_t *sym;
+    symbol_state_t *st;
+    char **paths;
+    long long first_time = 0, last_time = 0;
+    int64_t time, closed, ahead_ns;
+    struct timespec pause;
+    int id, count;
+
+    rt_place_self(RT_PRODUCER, conn->id);
+    conn->metrics = metrics_thread("producer", conn->id);
+    if (replay_init(&replay, symbol_count()) < 0) {
+        fprintf(stderr, COLOR_RED"replay: Init failed.\n"COLOR_RESET);
+        exit(1);
+    }
+    for (int i = 0; i < symbol_count(); i++) {
+        count = archive_list(replay_dir, symbol_get(i)->name, &paths);
+        if (count <= 0) {
+            fprintf(stderr, COLOR_YELLOW"replay: no trade log of %s in %s\n"COLOR_RESET, symbol_get(i)->name, replay_dir);
+        }
+        if (count >= 0 && replay_add(&replay, paths, count, i) < 0) {
+            fprintf(stderr, COLOR_RED"replay: Out of memory.\n"COLOR_RESET);
+            exit(1);
+        }
+        archive_list_free(paths, count > 0 ? count : 0);
+    }
 
-    for(int i = 0; i < NUMBER_OF_SYMBOLS; i++) {
-      gettimeofday(&prev_time[i], NULL);
+    memset(&trade, 0, sizeof(trade));
+    replay_start_ns = latency_now_ns();
+    conn->frame_recv_ns = replay_start_ns;
+    while (!termination && replay_next(&replay, &id, &price, &volume, &time, &closed)) {
+        sym = symbol_get(id);
+        st = sym->state;
+        trade.time = time;
+        if (!atomic_load_explicit(&sym->active, memory_order_relaxed)) continue;
+        if (st->replay_skip > 0) {  // Already in the restored checkpoint
+            st->replay_skip--;
+            continue;
+        }
+        if (replay_trades == 0) first_time = last_time = trade.time;
+        if (trade.time > last_time) last_time = trade.time;
+
+        // Wait until the trade is due, handing the workers what is staged first
+        if (replay_speed > 0) {
+            ahead_ns = replay_start_ns + (int64_t)((trade.time - first_time) * 1e6 / replay_speed) - latency_now_ns();
+            if (ahead_ns > 0) {
+                publish_trades(conn);
+                pause.tv_sec = ahead_ns / 1000000000LL;
+                pause.tv_nsec = ahead_ns % 1000000000LL;
+                nanosleep(&pause, NULL);
+                conn->frame_recv_ns = latency_now_ns();
+            }
+        }
+        if (closed > st->replay_closed) {
+            if (queue_close(conn, id, closed) < 0) break;
+            st->replay_closed = closed;
+        }
+
+        trade.id = id;
+        trade.price = trade_fixed(price);
+        trade.volume = trade_fixed(volume);
+        if (queue_trade(conn, &trade) < 0) break;
+        metrics_add(conn->metrics, M_TRADES_RECEIVED, 1);
+        replay_trades++;
+    }
+    publish_trades(conn);
+    if (replay_trades > 0) send_tick(conn, last_time);
+    if (replay.bad > 0) {
+        fprintf(stderr, COLOR_YELLOW"replay: %d trade log partitions could not be read completely\n"COLOR_RESET, replay.bad);
     }
+    replay_free(&replay);
 
-    while (!termination) {
-        clock_gettime(CLOCK_REALTIME, &timeout); // Get current time
-        timeout.tv_sec += 60;                    // Set timeout to 60 seconds (1 minute)
+    // The workers drain their rings and stop (a replay is a single connection)
+    for (int w = 0; w < number_of_workers; w++) {
+        spsc_ring_close(workers[w].rings[0]);
+    }
+    return (NULL);
+}
 
-        pthread_mutex_lock(&lock);  // The mutexed isn't really used, but the function 'pthread_cond_timedwait()' required it
+// Save 1-minute aggregated data (candlestick, SMA, volume).
+// Drains the candles the workers closed, sleeping while there are none.
+void *sleepyhead () 
+{
+    closed_candle_t batch[CANDLE_BATCH];
+    char *row = NULL;           // One row of the time difference file
+    size_t row_size = 0;
+    size_t n, marks;
+    int waiting = 1;
+    int64_t next_checkpoint_ns = latency_now_ns() + CHECKPOINT_INTERVAL_MS * 1000000LL;
+
+    rt_place_self(RT_SLEEPYHEAD, 0);
+    sleepyhead_metrics = metrics_thread("sleepyhead", 0);
+    while (waiting) {
+        // Sleep until a worker publishes candles, on termination drain what is left and stop
+        if (spsc_event_wait(&candle_bell, candles_ready, NULL, &candles_closed) < 0) {
+            waiting = 0;
+        }
 
-        // Wait for the condition to be signaled or for the timeout to expire
-        while (!termination) {
-            ret = pthread_cond_timedwait(&cond, &lock, &timeout);
-            if (ret == ETIMEDOUT) {
-                break; // Timeout occurred
+        for(int w = 0; w < number_of_workers; w++) {
+            while ((n = spsc_ring_try_pop_batch(workers[w].candles, batch, CANDLE_BATCH)) > 0) {
+                marks = 0;
+                for(size_t k = 0; k < n; k++) {
+                    if (batch[k].candle.id == CHECKPOINT_MARK) {
+                        // The worker's part: the windows now hold every candle it closed before
+                        add_checkpoint(w, atomic_load(&checkpoint_epoch));
+                        marks++;
+                        continue;
+                    }
+                    save_candle(&batch[k], &row, &row_size);
+                }
+                metrics_add(sleepyhead_metrics, M_CANDLES_SAVED, n - marks);
             }
         }
 
-        pthread_mutex_unlock(&lock);
+        // Start the next checkpoint once the last one is written
+        if (checkpoint_file != NULL && waiting && checkpoint_pending == 0 && latency_now_ns() >= next_checkpoint_ns) {
+            start_checkpoint();
+            next_checkpoint_ns = latency_now_ns() + CHECKPOINT_INTERVAL_MS * 1000000LL;
+        }
 
-        if (termination) {
-            break; // Break out of the loop if termination is signaled
+        if (atomic_exchange(&snapshot_due, 0)) {
+            write_latency_snapshot();
+            metrics_add(sleepyhead_metrics, M_LATENCY_SNAPSHOTS, 1);
         }
+        log_commit(sleepyhead_log);
+        metrics_add(sleepyhead_metrics, M_WAKEUPS, 1);
+    }
+    free(row);
+    return (NULL);
+}
 
-        // Process each stock symbol
-        for(int i = 0; i < NUMBER_OF_SYMBOLS; i++) {
-            // No data received from a sympol, try reconnecting
-            if(sympol_counter[i] == 0) {
-                connection_flag = 0;
-                fprintf(file_candlestick[i], "no_data\n");
-                fprintf(candlestick_time_diff, "0\t");
-                fprintf(file_sma_volume[i], "no_data\n");
-                skip = 1;   // Indicate to not save candlestick[i], because there are no data collected
-            }
+// Doorbell condition of sleepyhead: any worker has closed candles waiting, or a latency snapshot is due
+int candles_ready(void *arg)
+{
+    if (atomic_load_explicit(&snapshot_due, memory_order_relaxed)) return 1;
+    for(int w = 0; w < number_of_workers; w++) {
+        if (spsc_ring_size(workers[w].candles) > 0) return 1;
+    }
+    return 0;
+}
 
-            if(skip == 0) {
-                count[i] += 1;  //  Count how many times a candlestick is saved for each symbol
-                volume_1min[i][count[i]%15] = candlestick[i].volume;   // Store the last 15 1-min volumes
-                sma_1min[i][count[i]%15] = price_sum[i]/sympol_counter[i];   // Store the last 15 1-min SMAs
+// Save one closed candle: move the symbol's windows on and write its candlestick, SMA/VWAP/volume,
+// indicators and time difference rows. Every minute of a symbol arrives once and in order, empty ones too.
+void save_candle(const closed_candle_t *closed, char **row, size_t *row_size)
+{
+    const candle_t *candle = &closed->candle;
+    symbol_t *sym = symbol_get(candle->id);
+    symbol_state_t *st = sym->state;
+    struct timeval current_time; // Used to capture the time difference between candlestick saves
+    long long int time_diff = 0;
+    int row_len = 0, symbols;
+
+    latency_record(&st->latency[STAGE_CANDLE], latency_now_ns() - candle->closed_ns);
+
+    // Close the minute: every window moves on, even if the minute had no trades
+    rolling_push(&st->rolling, &candle->bucket);
+    if (st->shm != NULL) publish_stats(st, closed);
+
+    // Unsubscribed symbols keep their windows moving but nothing is saved
+    if(!atomic_load_explicit(&sym->active, memory_order_acquire)) return;
+
+    if(candle->bucket.trades == 0) {
+        // No data received from a sympol (the producer watches the connection itself)
+        log_printf(sleepyhead_log, st->file_candlestick, "no_data\n");
+        skip = 1;   // Indicate to not save the candlestick, because there are no data collected
+    }
 
-                // Calculate 15-min total volume and SMA
-                for(int j = 0; j < 15; j++) {              
-                    volume_15min[i] += volume_1min[i][j];
-                    sma_15min[i] += sma_1min[i][j];
-                }
-                sma_15min[i] = sma_15min[i]/15.0;
+    // Save SMA, VWAP and total volume of every window, and the indicators
+    write_rolling_stats(sym, st, skip == 0);
+    if (st->file_indicators != NULL) write_indicators(st, closed);
+
+    if(skip == 0) {
+        // Save candlestick to file
+        log_printf(sleepyhead_log, st->file_candlestick, "%.4f\t%.4f\t%.4f\t%.4f\t%.4f\n",
+                trade_decimal(candle->open), trade_decimal(candle->close), trade_decimal(candle->high),
+                trade_decimal(candle->low), trade_decimal(candle->volume));
+
+        // Calculate the time difference between the current and previous candlestick save of the symbol
+        gettimeofday(&current_time, NULL);
+        time_diff = (long long)current_time.tv_sec * 1000000LL + current_time.tv_usec - ((long long)st->prev_time.tv_sec * 1000000LL + st->prev_time.tv_usec);
+        st->prev_time = current_time;
+
+        // Print candlestick
+        printf("Open_Price: %.4f, Close_Price: %.4f, High_Price: %.4f, Low_Price: %.4f, Volume: %.4f\n\n", 
+            trade_decimal(candle->open), trade_decimal(candle->close), trade_decimal(candle->high),
+            trade_decimal(candle->low), trade_decimal(candle->volume));
+    }
+    skip = 0; // Reset flag
+
+    // Save the time difference in the symbol's column, with a 0 for every other symbol
+    symbols = symbol_count();
+    if (*row_size < (size_t)symbols * 24 + 2) {
+        char *grown = (char *) realloc(*row, (size_t)symbols * 24 + 2);
+        if (grown == NULL) {   // The row of this candle is lost, the old buffer is kept
+            fprintf(stderr, COLOR_RED"Out of memory for the time differences of %s\n"COLOR_RESET, sym->name);
+            return;
+        }
+        *row = grown;
+        *row_size = (size_t)symbols * 24 + 2;
+    }
+    for(int j = 0; j < symbols; j++) {
+        row_len += snprintf(*row + row_len, *row_size - row_len, "%lld\t", j == candle->id ? time_diff : 0LL);
+    }
+    row_len += snprintf(*row + row_len, *row_size - row_len, "\n");
+    log_write(sleepyhead_log, candlestick_time_diff, *row, row_len);
+}
+
+// Consumer worker: aggregates and logs the trades of the symbols assigned to it
+void *consumer_read_data (void *arg)
+{
+  worker_t *worker = (worker_t *)arg;
+  trade_t batch[CONSUMER_BATCH];        // Trades drained from the ring in one go
+  size_t n;
+  int i, c, symbols, ticks, closes, late;
+  symbol_state_t *st;
 
-                // Save candlestick, SMA, and total volume to files
-                fprintf(file_candlestick[i], "%.4f\t%.4f\t%.4f\t%.4f\t%.4f\n", 
-                        candlestick[i].open_price, candlestick[i].close_price, candlestick[i].high_price, candlestick[i].low_price, candlestick[i].volume); 
-                fprintf(file_sma_volume[i], "%.4f\t%.4f\n", sma_15min[i], volume_15min[i]);
+  int64_t now;               // Time the batch was taken out of the ring
 
-                // Calculate and save the time difference between the currunt and previous candlestick save for each symbol
-                gettimeofday(&current_time[i], NULL);
-                time_diff = (long long)current_time[i].tv_sec * 1000000LL + current_time[i].tv_usec - ((long long)prev_time[i].tv_sec * 1000000LL + prev_time[i].tv_usec);
-                prev_time[i] = current_time[i];
+  rt_place_self(RT_CONSUMER, worker->id);
+  worker->metrics = metrics_thread("consumer", worker->id);
+  while(!termination) {
+    // Drain the trades currently in a ring, spinning and then sleeping while they are empty
+    n = take_trades (worker, batch);
+    if(n == 0) { // The rings were closed by the termination signal
+        break;
+    }
 
-                fprintf(candlestick_time_diff, "%lld\t", time_diff);
+    now = latency_now_ns();
+    symbols = symbol_count();
+    ticks = closes = 0;
 
-                // Print candlestick, SMA, and total volume to files 
-                printf (COLOR_MAGENTA"CANDLESTICK, SMA, VOLUME:\n"COLOR_RESET);
-                printf("%s: SMA_(15-min): %.4f, Volume_(15-min): %.4f\n", stock_symbols[i], sma_15min[i], volume_15min[i]);
-                printf("Open_Price: %.4f, Close_Price: %.4f, High_Price: %.4f, Low_Price: %.4f, Volume: %.4f\n\n", 
-                    candlestick[i].open_price, candlestick[i].close_price, candlestick[i].high_price, candlestick[i].low_price, candlestick[i].volume);
-            }
-            skip = 0; // Reset flag
+    for(size_t k = 0; k < n; k++) {
+      const trade_t *trade = &batch[k];   // Used in place, the ring already copied it out
 
-            // Reset candlestick data for next minute
-            memset(&candlestick[i], 0, sizeof(candlestick_t));
-            candlestick[i].first = 1;
+      // Replay: close the minutes of a symbol where the live run had closed them by its next trade
+      if(trade->id == CLOSE_ID) {
+        closes++;
+        close_minutes(worker, symbol_get((int)trade->price)->state, trade->time);
+        continue;
+      }
+
+      // Wall-clock tick of a connection: close the minutes of this worker's symbols on that
+      // connection that stopped trading (the tick is behind all their trades in this ring)
+      if(trade->id <= TICK_ID) {
+        c = TICK_ID - trade->id;
+        ticks++;
+        for(i = worker->id; i < symbols; i += number_of_workers) {
+          if(i % number_of_connections != c) continue;
+          st = symbol_get(i)->state;
+          close_candles(worker, st, trade->time - TICK_LAG_MS);
         }
-        fprintf(candlestick_time_diff, "\n"); 
+        continue;
+      }
+
+      i = trade->id;   // The producer already matched the symbol
+      st = symbol_get(i)->state;
+
+      latency_record(&st->latency[STAGE_QUEUE], trade_age_ns(trade, now));
 
-        // Reset arrays for next minute
-        memset(volume_15min, 0, sizeof(volume_15min));
-        memset(sma_15min, 0, sizeof(sma_15min));
-        memset(price_sum, 0, sizeof(price_sum));       
-        memset(sympol_counter, 0, sizeof(sympol_counter)); 
+      /*// Print each trade 
+      printf (COLOR_BLUE"%s\n"COLOR_RESET, symbol_get(i)->name);
+      printf("Price: %.4f\n", trade_decimal(trade->price));
+      printf("Time: %lld\n", (long long)trade->time);
+      printf("Volume: %4f\n", trade_decimal(trade->volume));*/
+
+      // Close the minutes the trade's exchange time moved past, then add it to the candle of its minute.
+      // Trades for a minute that is already closed are late and dropped (counted in 'late').
+      if(trade->time > st->candles.watermark) {
+        close_candles(worker, st, trade->time);
+      }
+      late = candle_add_trade(&st->candles, trade->time, trade->price, trade->volume) < 0;
+
+      // Append the trade details (price, volume, time) to the symbol's trade log, with the oldest
+      // minute left open, in the partition of its exchange time (late trades are logged too, in
+      // the current partition)
+      if (trade->time >= st->log_end) roll_trade_log(symbol_get(i), st, trade->time);
+      if (st->log != NULL && tlog_append(st->log, trade_decimal(trade->price), trade_decimal(trade->volume), trade->time,
+                                         st->candles.next_close) < 0) {
+        fprintf(stderr, COLOR_RED"Error writing the trade log of %s\n"COLOR_RESET, symbol_get(i)->name);
+      } else {
+        st->log_rows++;   // Position of the checkpoints in the log
+      }
+      if (late) {
+        metrics_add(worker->metrics, M_LATE_TRADES, 1);
+        continue;
+      }
+      indicator_set_trade(&st->indicators, trade->price, trade->volume, trade->time);
+      if (st->shm != NULL) publish_live(st, trade);
     }
-    return (NULL);
+    metrics_add(worker->metrics, M_BATCHES, 1);
+    metrics_add(worker->metrics, M_TRADES_CONSUMED, n - ticks - closes);
+    metrics_add(worker->metrics, M_TICKS, ticks);
+
+    // Sleepyhead started a checkpoint (a tick comes at least every second to notice it)
+    if(worker->checkpoint_epoch != atomic_load_explicit(&checkpoint_epoch, memory_order_relaxed)) {
+      take_checkpoint(worker);
+    }
+  }
+  return (NULL);
 }
 
-void *consumer_read_data ()
+// Take the next batch of trades of a worker: from its only ring, or with several connections from
+// the next non-empty ring in turn, sleeping on the worker's bell while they are all empty.
+// Returns 0 once the rings were closed.
+size_t take_trades(worker_t *worker, trade_t *batch)
 {
-  stock_data_t trade; 
+  size_t n;
+  int c;
 
-  struct timeval time_val;
-  long long int str_time;   // Time when data were received by the consumer and stored
-  long long int fin_to_pro_delay, pro_to_con_delay; // Calculate the delay between finnhub-producer and produre-consumer
+  if (number_of_connections == 1) return spsc_ring_pop_batch (worker->rings[0], batch, CONSUMER_BATCH);
 
-  while(!termination) {
-    pthread_mutex_lock (fifo->mut); // Lock the mutex to ensure exclusive access to the shared queue
-    // If the queue is empty, wait for a producer to signal it
-    while (fifo->empty) {
-        pthread_cond_wait (fifo->notEmpty, fifo->mut);
-        if(termination) { // Close thread if termination flag is set
-            pthread_mutex_unlock (fifo->mut);
-            return (NULL);
-        } 
-    }
-    queueDel (fifo, &trade);    // Remove (consume) the trade data from the queue
-    pthread_mutex_unlock (fifo->mut);    // Unlock the mutex after accessing the shared resource
-    pthread_cond_signal (fifo->notFull);    // Signal the producer that the queue is no longer full (room for more items)
-    
-
-    // Loop through all stock symbols to find the matching symbol
-    for(int i = 0; i < NUMBER_OF_SYMBOLS; i++) {
-      if(strcmp(trade.symbol, stock_symbols[i]) == 0) {
-        // Write the trade details (price, volume, time) to the corresponding file
-        fprintf(file[i], "%.4f\t%.4f\t\t%lld\n",
-                trade.price, trade.volume, trade.time);
-
-        gettimeofday(&time_val, NULL);  // Get the time when date were stored
-        str_time = (long long)time_val.tv_sec * 1000000LL + time_val.tv_usec;
-
-        // Calculate the delay between finnhub-producer and produre-consumer
-        fin_to_pro_delay = (long long)(trade.recv_time / 1000) - trade.time;    // Calculate in ms
-        pro_to_con_delay = str_time - trade.recv_time ;                         // Calculate in us
-
-        // Log the time when the trade data was received and stored
-        fprintf(file_fin_pro_delay, "%lld\t", fin_to_pro_delay);
-        fprintf(file_pro_con_delay, "%lld\t", pro_to_con_delay);
-        
-        // Update symbol counters and price summation 
-        sympol_counter[i] += 1;
-        price_sum[i] = price_sum[i] + trade.price;
-
-        /*// Print each trade 
-        printf (COLOR_BLUE"%s\n"COLOR_RESET, trade.symbol);
-        printf("Price: %.4f\n", trade.price);
-        printf("Time: %lld\n", trade.time);
-        printf("Volume: %4f\n", trade.volume);*/
-
-        // Process the trade data to update the candlestick
-        process_trade(trade, &candlestick[i]);
-      } else {
-      fprintf(file_fin_pro_delay, "0\t");
-      fprintf(file_pro_con_delay, "0\t");
-      }
+  while (1) {
+    for (int k = 0; k < number_of_connections; k++) {
+      c = worker->next_ring;
+      worker->next_ring = (c + 1) % number_of_connections;
+      n = spsc_ring_try_pop_batch (worker->rings[c], batch, CONSUMER_BATCH);
+      if (n > 0) return n;
+    }
+    if (spsc_event_wait (&worker->bell, trades_ready, worker, &trades_closed) < 0) return 0;
   }
-  fprintf(file_fin_pro_delay, "\n");
-  fprintf(file_pro_con_delay, "\n");
+}
+
+// Doorbell condition of a worker: any of its rings has trades waiting
+int trades_ready(void *arg)
+{
+  worker_t *worker = (worker_t *)arg;
+
+  for (int c = 0; c < number_of_connections; c++) {
+    if (spsc_ring_size (worker->rings[c]) > 0) return 1;
   }
-  return (NULL);
+  return 0;
 }
 
 // Function to handle SIGINT (Ctrl+C) and clean up resources
@@ -380,91 +1161,575 @@ void handle_sigint(int sig)
 {
   termination = 1;  // Indicate that the programm should begin shutting down 
   // Unstuck/wake up threads that are waiting
-  pthread_cond_signal (fifo->notFull);
-  pthread_cond_signal (fifo->notEmpty);
-  pthread_cond_signal (&cond);
+  atomic_store (&trades_closed, 1);
+  for(int w = 0; w < number_of_workers; w++) {
+    for(int c = 0; c < number_of_connections; c++) {
+      spsc_ring_close (workers[w].rings[c]);
+    }
+    spsc_event_wake_all (&workers[w].bell);
+  }
+  // Stop sleepyhead once it has saved the candles already published
+  atomic_store (&candles_closed, 1);
+  spsc_event_wake_all (&candle_bell);
+  log_writer_wake();  // Start writing what is buffered while the threads finish
+}
+
+// Function to handle SIGHUP, the first connection's producer reloads the symbols file on its next iteration
+void handle_sighup(int sig)
+{
+  reload_symbols = 1;
 }
 
 // Function to create text files
 void create_txt_files() 
 {
   // Open the file for logging the time diff
-  candlestick_time_diff = fopen("candlestick_time_differences.txt", "w");
+  candlestick_time_diff = log_open("candlestick_time_differences.txt");
   if (candlestick_time_diff == NULL) {
     perror("Error opening time_receive.txt");
     exit(1); 
   }
 
-  // Open the file for logging the time when data is received
-  file_fin_pro_delay = fopen("finnhub_producer_delay.txt", "w");
-  if (file_fin_pro_delay == NULL) {
-    perror("Error opening time_receive.txt");
+  // Open the file for the latency snapshots of the pipeline stages
+  file_latency = log_open("latency.txt");
+  if (file_latency == NULL) {
+    perror("Error opening latency.txt");
     exit(1); 
   }
+  log_printf(producer_log, file_latency, "Time\tSymbol\tStage\tCount\tp50_us\tp99_us\tp99.9_us\tMax_us\n");
 
-  // Open the file for logging the current system time when data is stored
-  file_pro_con_delay = fopen("producer_consumer_delay.txt", "w");
-  if (file_pro_con_delay == NULL) {
-    perror("Error opening time_stored.txt");
+  // Open the file for the reconnections of the WebSocket client
+  file_reconnects = log_open("reconnects.txt");
+  if (file_reconnects == NULL) {
+    perror("Error opening reconnects.txt");
     exit(1); 
   }
+  log_printf(producer_log, file_reconnects, "Time\tConnection\tOutage_ms\tHandshake_ms\tGap_ms\tTLS_resumed\n");
+}
 
-   // Create the necessary files for each symbol
-  for (int i = 0; i < NUMBER_OF_SYMBOLS; i++) {
-      char filename[70];
-      char filename_cs[70];
-      char filename_sma_volume[70];
-      char filename_candlestick_time_diff[70];
-      snprintf(filename, sizeof(filename), "%s.txt", stock_symbols[i]);
-      snprintf(filename_cs, sizeof(filename_cs), "%s_candlestick.txt", stock_symbols[i]);
-      snprintf(filename_sma_volume, sizeof(filename_sma_volume), "%s_sma_volume.txt", stock_symbols[i]);
-      snprintf(filename_candlestick_time_diff, sizeof(filename_candlestick_time_diff), "%s_candlestick_time_diff.txt", stock_symbols[i]);
-
-      file[i] = fopen(filename, "w");
-      if (file[i] == NULL) {
-        perror("Error opening file");
-        exit(1);
-      }
+// Close the trade log partition of a symbol, hand it to the archiver and open the partition of
+// exchange time 'time'. Called by the symbol's worker, once per partition (hour or day).
+void roll_trade_log(symbol_t *sym, symbol_state_t *st, int64_t time)
+{
+  int64_t start = archive_partition_start(time, archive_period);
 
-      file_candlestick[i] = fopen(filename_cs, "w");
-      if (file_candlestick[i] == NULL) {
-        perror("Error opening file");
-        exit(1);
-      }
+  if (st->log != NULL) {
+    if (tlog_close(st->log) < 0) perror("Error closing trade log");
+    else archive_submit(st->log_path);
+    st->log = NULL;
+  }
+  st->log_end = start + archive_period;
+  st->log_rows = 0;
+  if (archive_partition_path(st->log_path, sizeof(st->log_path), sym->name, start, archive_period) < 0) {
+    fprintf(stderr, COLOR_RED"No name left for the trade log partition of %s\n"COLOR_RESET, sym->name);
+    return;
+  }
+  st->log = tlog_create(st->log_path, sym->name);
+  if (st->log == NULL) {
+    fprintf(stderr, COLOR_RED"Error creating the trade log %s: %s\n"COLOR_RESET, st->log_path, strerror(errno));
+  }
+}
 
-      file_sma_volume[i] = fopen(filename_sma_volume, "w");
-      if (file_sma_volume[i] == NULL) {
-        perror("Error opening file");
-        exit(1);
-      }
+// Function to create the files of a newly registered symbol
+void create_symbol_files(symbol_t *sym)
+{
+  symbol_state_t *st = sym->state;
+  char filename_cs[70];
+  char filename_sma_volume[70];
+  snprintf(filename_cs, sizeof(filename_cs), "%s_candlestick.txt", sym->name);
+  snprintf(filename_sma_volume, sizeof(filename_sma_volume), "%s_sma_volume.txt", sym->name);
+
+  st->file_candlestick = log_open(filename_cs);
+  if (st->file_candlestick == NULL) {
+    perror("Error opening file");
+    exit(1);
+  }
 
-      // Set headers for each file to label the columns
-      fprintf(file[i], "Price\t\tVolume\t\tTime\n"); 
-      fprintf(file_candlestick[i], "Open\t\tClose\t\tHigh\t\tLow\t\tVolume\n"); 
-      fprintf(file_sma_volume[i], "SMA\t\tVolume\n"); 
-      fprintf(candlestick_time_diff, "%s\t", stock_symbols[i]); 
-      fprintf(file_fin_pro_delay, "%s\t", stock_symbols[i]); 
-      fprintf(file_pro_con_delay, "%s\t", stock_symbols[i]); 
+  st->file_sma_volume = log_open(filename_sma_volume);
+  if (st->file_sma_volume == NULL) {
+    perror("Error opening file");
+    exit(1);
+  }
+
+  // Set headers for each file to label the columns
+  log_printf(producer_log, st->file_candlestick, "Open\t\tClose\t\tHigh\t\tLow\t\tVolume\n");
+  if (st->indicator_values > 0) {
+    char filename_indicators[70], header[INDICATOR_MAX_VALUES * (INDICATOR_LABEL_LEN + 16) + 8];
+    int len = snprintf(header, sizeof(header), "Minute");
+    snprintf(filename_indicators, sizeof(filename_indicators), "%s_indicators.txt", sym->name);
+    st->file_indicators = log_open(filename_indicators);
+    if (st->file_indicators == NULL) {
+      perror("Error opening file");
+      exit(1);
+    }
+    for (int v = 0; v < st->indicator_values; v++) {
+      header[len++] = '\t';
+      len += indicator_set_column(&st->indicators, v, header + len, sizeof(header) - len);
+    }
+    header[len++] = '\n';
+    log_write(producer_log, st->file_indicators, header, len);
+  }
+  for (int w = 0; w < number_of_windows; w++) {
+    char name[16];
+    rolling_window_name(window_minutes[w], name, sizeof(name));
+    log_printf(producer_log, st->file_sma_volume, "SMA_%s\tVWAP_%s\tVolume_%s%s", name, name, name,
+               w == number_of_windows - 1 ? "\n" : "\t");
+  }
+}
+
+// Function to label the columns of the global files with the symbols.
+// Called again when new symbols are added, the header line is written with a single call
+// so it never splits a row written by another thread.
+void write_symbols_header()
+{
+  int symbols = symbol_count();
+  size_t size = (size_t)symbols * MAX_SYMBOL_LEN + 2;
+  char *header;
+  int len = 0;
+
+  if (symbols == header_symbols) return;
+  header_symbols = symbols;
+
+  header = (char *) malloc(size);
+  if (header == NULL) {
+    fprintf (stderr, COLOR_RED"write_symbols_header: Out of memory for the header.\n"COLOR_RESET);
+    exit (1);
+  }
+  for (int i = 0; i < symbols; i++) {
+    len += snprintf(header + len, size - len, "%s\t", symbol_get(i)->name);
+  }
+  len += snprintf(header + len, size - len, "\n");
+
+  log_write(producer_log, candlestick_time_diff, header, len);
+  free(header);
+}
+
+// Function to save (and print) the SMA, VWAP and volume of every window of a symbol.
+// Windows without any trade get 'no_data' for their SMA and VWAP.
+void write_rolling_stats(symbol_t *sym, symbol_state_t *st, int print)
+{
+  char line[ROLLING_MAX_WINDOWS * 72];
+  char name[16];
+  int len = 0;
+  rolling_stats_t stats;
+
+  if (print) printf (COLOR_MAGENTA"CANDLESTICK, SMA, VWAP, VOLUME:\n"COLOR_RESET);
+  for (int w = 0; w < number_of_windows; w++) {
+    rolling_get(&st->rolling, w, &stats);
+    if (stats.trades > 0) {
+      len += snprintf(line + len, sizeof(line) - len, "%.4f\t%.4f\t%.4f\t", stats.sma, stats.vwap, stats.volume);
+    } else {
+      len += snprintf(line + len, sizeof(line) - len, "no_data\tno_data\t%.4f\t", stats.volume);
+    }
+    if (print) {
+      rolling_window_name(window_minutes[w], name, sizeof(name));
+      printf("%s: SMA_(%s): %.4f, VWAP_(%s): %.4f, Volume_(%s): %.4f\n", sym->name, name, stats.sma, name, stats.vwap, name, stats.volume);
+    }
+  }
+  line[len - 1] = '\n';  // Replace the last tab
+  log_write(sleepyhead_log, st->file_sma_volume, line, len);
+}
+
+// Function to save the indicators of a symbol after a closed minute, 'no_data' for those that
+// haven't seen enough minutes yet
+void write_indicators(symbol_state_t *st, const closed_candle_t *closed)
+{
+  char line[INDICATOR_MAX_VALUES * 24 + 24];
+  int len = snprintf(line, sizeof(line), "%lld", (long long)closed->candle.minute);
+
+  for (int v = 0; v < st->indicator_values; v++) {
+    if (isnan(closed->indicator[v])) len += snprintf(line + len, sizeof(line) - len, "\tno_data");
+    else len += snprintf(line + len, sizeof(line) - len, "\t%.4f", closed->indicator[v]);
+  }
+  line[len++] = '\n';
+  log_write(sleepyhead_log, st->file_indicators, line, len);
+}
+
+// Registry callback: attach state and files to new symbols and mark the subscriptions to sync
+void on_symbol_change(symbol_t *sym, int subscribed)
+{
+  symbol_state_t *st;
+
+  if (sym->state == NULL) {
+    if (posix_memalign((void **)&st, CACHE_LINE_SIZE, sizeof(symbol_state_t)) != 0) {
+      fprintf(stderr, COLOR_RED"Error allocating state of %s\n"COLOR_RESET, sym->name);
+      exit(1);
+    }
+    memset(st, 0, sizeof(symbol_state_t));
+    if (rolling_init(&st->rolling, window_minutes, number_of_windows) < 0) {
+      fprintf(stderr, COLOR_RED"Error allocating the windows of %s\n"COLOR_RESET, sym->name);
+      exit(1);
+    }
+    candle_series_init(&st->candles, sym->id, CANDLE_MINUTE_MS);
+    if (indicator_set_init(&st->indicators, &indicator_config, sym->name) < 0) {
+      fprintf(stderr, COLOR_RED"Error allocating the indicators of %s\n"COLOR_RESET, sym->name);
+      exit(1);
+    }
+    st->indicator_values = st->indicators.values;
+    st->log_end = replay_dir == NULL ? INT64_MIN : INT64_MAX;   // The first trade opens the log, a replay writes none
+    gettimeofday(&st->prev_time, NULL);
+    if (shm_feed != NULL && (st->shm = shm_feed_add(shm_feed, sym->id, sym->name)) == NULL) {
+      fprintf(stderr, COLOR_YELLOW"%s is not published to the shared memory feed (more than %d symbols)\n"COLOR_RESET,
+              sym->name, SHM_FEED_DEFAULT_CAPACITY);
+    }
+    sym->state = st;
+    create_symbol_files(sym);
+  }
+
+  printf(COLOR_YELLOW"%s %s\n"COLOR_RESET, subscribed ? "Subscribing to" : "Unsubscribing from", sym->name);
+
+  // Wake up the symbol's connection to rescan its symbols (none are running on the first load)
+  if (connections != NULL) {
+    connection_t *conn = &connections[sym->id % number_of_connections];
+    atomic_store(&conn->resync, 1);
+    if (conn->context != NULL) lws_cancel_service(conn->context);
+  }
+}
+
+// Publish the last trade of a symbol and the candle of its latest minute to the shared memory feed (symbol's worker)
+void publish_live(symbol_state_t *st, const trade_t *trade)
+{
+  const candle_t *candle = candle_current(&st->candles);
+  int64_t now = latency_now_ns();
+  shm_live_t live;
+
+  memset(&live, 0, sizeof(live));
+  live.trades = st->shm->live.trades + 1;   // Only this worker writes the section
+  live.price = trade_decimal(trade->price);
+  live.volume = trade_decimal(trade->volume);
+  live.time = trade->time;
+  live.pub_ns = now - trade_age_ns(trade, now);
+  if (candle != NULL) {
+    live.minute = candle->minute;
+    live.open = trade_decimal(candle->open);
+    live.high = trade_decimal(candle->high);
+    live.low = trade_decimal(candle->low);
+    live.close = trade_decimal(candle->close);
+    live.candle_volume = trade_decimal(candle->volume);
+    live.candle_trades = candle->bucket.trades;
+  }
+  live.update_ns = now;
+  shm_feed_write(&st->shm->live_seq, &st->shm->live, &live, sizeof(live));
+}
+
+// Publish the rolling windows and indicators of a symbol after its minute 'closed' was pushed (sleepyhead)
+void publish_stats(symbol_state_t *st, const closed_candle_t *closed)
+{
+  shm_stats_t stats;
+  rolling_stats_t r;
+
+  _Static_assert(SHM_FEED_MAX_WINDOWS >= ROLLING_MAX_WINDOWS, "the feed must hold every window");
+  _Static_assert(SHM_FEED_MAX_INDICATORS >= INDICATOR_MAX_VALUES, "the feed must hold every indicator");
+  memset(&stats, 0, sizeof(stats));
+  stats.minute = closed->candle.minute;
+  stats.windows = number_of_windows;
+  for (int w = 0; w < number_of_windows; w++) {
+    rolling_get(&st->rolling, w, &r);
+    stats.window[w].minutes = window_minutes[w];
+    stats.window[w].full = r.full;
+    stats.window[w].trades = r.trades;
+    stats.window[w].sma = r.sma;
+    stats.window[w].vwap = r.vwap;
+    stats.window[w].volume = r.volume;
+  }
+  stats.indicators = st->indicator_values;
+  for (int v = 0; v < st->indicator_values; v++) {
+    indicator_set_column(&st->indicators, v, stats.indicator[v].name, sizeof(stats.indicator[v].name));
+    stats.indicator[v].value = closed->indicator[v];
+  }
+  stats.update_ns = latency_now_ns();
+  shm_feed_write(&st->shm->stats_seq, &st->shm->stats, &stats, sizeof(stats));
+}
+
+// Close the candles of a symbol whose minutes ended (plus the grace period) before 'watermark',
+// move its indicators on and publish them to sleepyhead. Waits while the candle ring is full.
+void close_candles(worker_t *worker, symbol_state_t *st, long long watermark) {
+  candle_t candles[CANDLE_BATCH];
+  int n;
+
+  do {
+    n = candle_close(&st->candles, watermark, grace_ms, candles, CANDLE_BATCH);
+  } while (publish_candles(worker, st, candles, n) == CANDLE_BATCH);
+}
+
+// The same for the minutes of a symbol before 'minute', as a trade log recorded them (replay)
+void close_minutes(worker_t *worker, symbol_state_t *st, int64_t minute) {
+  candle_t candles[CANDLE_BATCH];
+  int n;
+
+  do {
+    n = candle_close_before(&st->candles, minute, candles, CANDLE_BATCH);
+  } while (publish_candles(worker, st, candles, n) == CANDLE_BATCH);
+}
+
+// Move the indicators of a symbol on with its 'n' closed candles and publish them to sleepyhead.
+// Returns 'n', or 0 once the candle ring was closed by the termination signal.
+int publish_candles(worker_t *worker, symbol_state_t *st, const candle_t *candles, int n) {
+  closed_candle_t closed[CANDLE_BATCH];
+
+  if (n == 0) return 0;
+  for (int k = 0; k < n; k++) {
+    closed[k].candle = candles[k];
+    closed[k].candle.closed_ns = latency_now_ns();
+    indicator_set_candle(&st->indicators, &candles[k], closed[k].indicator);
+  }
+  if (spsc_ring_push_batch(worker->candles, closed, n) < 0) return 0;
+  spsc_event_signal(&candle_bell);
+  metrics_add(worker->metrics, M_CANDLES_CLOSED, n);
+  return n;
+}
+
+// Start a checkpoint: every worker takes its part after its current batch (sleepyhead)
+void start_checkpoint()
+{
+  checkpoint_begin(&checkpoint_writer);
+  checkpoint_pending = number_of_workers;
+  atomic_fetch_add(&checkpoint_epoch, 1);
+}
+
+// Take the worker's part of the checkpoint sleepyhead started: copy the state of its symbols and
+// send the mark behind the candles they closed so far, so sleepyhead adds the windows as of the
+// same minute
+void take_checkpoint(worker_t *worker)
+{
+  uint64_t epoch = atomic_load(&checkpoint_epoch);
+  closed_candle_t mark;
+  symbol_state_t *st;
+
+  worker->checkpoint_epoch = epoch;
+  for(int i = worker->id; i < symbol_count(); i += number_of_workers) {
+    st = symbol_get(i)->state;
+    if (checkpoint_take(&st->checkpoint, &st->candles, &st->indicators, st->log_path, st->log_rows) == 0) {
+      st->checkpoint.epoch = epoch;
+    }
+  }
+  memset(&mark, 0, sizeof(mark));
+  mark.candle.id = CHECKPOINT_MARK;
+  if (spsc_ring_push_batch(worker->candles, &mark, 1) < 0) return;
+  spsc_event_signal(&candle_bell);
+}
+
+// Add the symbols of a worker to the checkpoint once its mark arrived, and write the checkpoint
+// after the last worker's (sleepyhead). Symbols added since the worker took its part wait for the
+// next one. Returns -1 if a symbol is left out.
+int add_checkpoint(int worker, uint64_t epoch)
+{
+  symbol_state_t *st;
+  int ret = 0;
+
+  for(int i = worker; i < symbol_count(); i += number_of_workers) {
+    st = symbol_get(i)->state;
+    if (st->checkpoint.epoch != epoch) continue;
+    if (checkpoint_add(&checkpoint_writer, symbol_get(i)->name, &st->checkpoint, &st->rolling) < 0) {
+      fprintf(stderr, COLOR_RED"Out of memory for the checkpoint of %s\n"COLOR_RESET, symbol_get(i)->name);
+      ret = -1;
+    }
+  }
+  if (--checkpoint_pending == 0) {
+    commit_checkpoint();
+    metrics_add(sleepyhead_metrics, M_CHECKPOINTS, 1);
+  }
+  return ret;
+}
+
+// Write the checkpoint over the previous one
+void commit_checkpoint()
+{
+  struct timeval now;
+
+  gettimeofday(&now, NULL);
+  if (checkpoint_commit(&checkpoint_writer, checkpoint_file, (int64_t)now.tv_sec * 1000 + now.tv_usec / 1000) < 0) {
+    fprintf(stderr, COLOR_RED"Error writing the checkpoint %s: %s\n"COLOR_RESET, checkpoint_file, strerror(errno));
   }
-  fprintf(candlestick_time_diff, "\n");
-  fprintf(file_fin_pro_delay, "\n");
-  fprintf(file_pro_con_delay, "\n");
 }
 
-void process_trade(stock_data_t trade, candlestick_t *candlestick) {
-  // Update the candlestick data
-  candlestick->close_price = trade.price;
-  candlestick->high_price = fmax(candlestick->high_price, trade.price);
-  candlestick->low_price = fmin(candlestick->low_price, trade.price);
-  candlestick->volume += trade.volume;
+// Restore the symbols of the checkpoint, then bring them up to date: a live run adds the trades
+// their trade logs got after it, a replay skips the trades it already has. Called by main before
+// the threads start; symbols that are not tracked any more are left out.
+void restore_checkpoint()
+{
+  checkpoint_t ckpt;
+  const checkpoint_symbol_t *s;
+  symbol_state_t *st;
+  int64_t start = latency_now_ns();
+  unsigned long long rebuilt = 0;
+  int id, restored = 0;
+
+  if (checkpoint_load(&ckpt, checkpoint_file) != 0) return;  // None yet, or unusable (reported)
+  for(s = checkpoint_next(&ckpt, NULL); s != NULL; s = checkpoint_next(&ckpt, s)) {
+    if ((id = symbol_lookup(s->symbol, strlen(s->symbol))) < 0) continue;
+    st = symbol_get(id)->state;
+    if (checkpoint_restore(s, &st->candles, &st->rolling, &st->indicators) < 0) continue;
+    snprintf(st->log_path, sizeof(st->log_path), "%s", s->log_path);
+    st->log_rows = s->log_rows;
+    st->replay_skip = replay_dir != NULL ? s->log_rows : 0;
+    restored++;
+  }
+  if (replay_dir == NULL) rebuilt = rebuild_from_logs();
+  printf("Restored %d symbols from %s (%.0f s old), %llu trades added from the trade logs in %.1f ms\n",
+         restored, checkpoint_file, (double)(time(NULL) - ckpt.hdr->written / 1000), rebuilt,
+         (latency_now_ns() - start) / 1e6);
+  checkpoint_free(&ckpt);
+}
+
+// Add the trades logged after the checkpoint to the restored symbols: the rest of the partition
+// it had reached and the partitions after it, in the order they were logged, with the minutes
+// closed as their worker closed them. Returns the number of trades added.
+unsigned long long rebuild_from_logs()
+{
+  replay_t replay;
+  symbol_state_t *st;
+  char **paths, stem[CHECKPOINT_PATH_LEN + 2];
+  double price, volume;
+  int64_t time, closed, fixed_price, fixed_volume;
+  unsigned long long added = 0;
+  size_t len;
+  int id, count, first;
+
+  if (replay_init(&replay, symbol_count()) < 0) {
+    fprintf(stderr, COLOR_RED"Out of memory to rebuild the checkpoint\n"COLOR_RESET);
+    return 0;
+  }
+  for(int i = 0; i < symbol_count(); i++) {
+    st = symbol_get(i)->state;
+    if (st->log_path[0] == '\0' || (count = archive_list(".", symbol_get(i)->name, &paths)) <= 0) continue;
+
+    // Partitions sort by time: the one of the checkpoint (.tlog, or .tlz once archived) and the later ones
+    snprintf(stem, sizeof(stem), "./%s", st->log_path);
+    len = strrchr(stem, '.') - stem;
+    stem[len] = '\0';
+    for(first = 0; first < count && strcmp(paths[first], stem) < 0; first++);
+    if (first < count && strncmp(paths[first], stem, len) == 0 && paths[first][len] == '.') {
+      st->replay_skip = st->log_rows;
+    } else if (first < count) {
+      // The partition is gone with its trades, the position moves to the next one
+      snprintf(st->log_path, sizeof(st->log_path), "%s", paths[first] + 2);
+      st->log_rows = 0;
+    }
+    if (replay_add(&replay, paths + first, count - first, i) < 0) {
+      fprintf(stderr, COLOR_RED"Out of memory to rebuild the checkpoint\n"COLOR_RESET);
+    }
+    archive_list_free(paths, count);
+  }
 
-  // If this is the first trade in the 1-min period, initialize the candlestick
-  if(candlestick->first == 1){
-    candlestick->open_price = trade.price;
-    candlestick->low_price = trade.price;
-    candlestick->high_price = trade.price;
-    candlestick->first = 0; // Mark that the first trade has been processed
+  while (replay_next(&replay, &id, &price, &volume, &time, &closed)) {
+    st = symbol_get(id)->state;
+    if (st->replay_skip > 0) {
+      st->replay_skip--;
+      continue;
+    }
+    if (closed > st->candles.next_close) rebuild_close_minutes(st, closed);
+    if (time > st->candles.watermark) rebuild_close(st, time);
+    fixed_price = trade_fixed(price);
+    fixed_volume = trade_fixed(volume);
+    if (candle_add_trade(&st->candles, time, fixed_price, fixed_volume) == 0) {
+      indicator_set_trade(&st->indicators, fixed_price, fixed_volume, time);
+    }
+    st->log_rows++;
+    added++;
+  }
+  if (replay.bad > 0) {
+    fprintf(stderr, COLOR_YELLOW"%d trade log partitions could not be read completely\n"COLOR_RESET, replay.bad);
   }
+  replay_free(&replay);
+  return added;
+}
+
+// Close the minutes of a symbol being rebuilt, like close_candles() but straight into its
+// indicators and windows (they were saved by the run that took the trades)
+void rebuild_close(symbol_state_t *st, int64_t watermark)
+{
+  candle_t candles[CANDLE_BATCH];
+  int n;
+
+  do {
+    n = candle_close(&st->candles, watermark, grace_ms, candles, CANDLE_BATCH);
+    rebuild_candles(st, candles, n);
+  } while (n == CANDLE_BATCH);
+}
+
+// The same for the minutes before 'minute', like close_minutes()
+void rebuild_close_minutes(symbol_state_t *st, int64_t minute)
+{
+  candle_t candles[CANDLE_BATCH];
+  int n;
+
+  do {
+    n = candle_close_before(&st->candles, minute, candles, CANDLE_BATCH);
+    rebuild_candles(st, candles, n);
+  } while (n == CANDLE_BATCH);
+}
+
+void rebuild_candles(symbol_state_t *st, const candle_t *candles, int n)
+{
+  double values[INDICATOR_MAX_VALUES];
+
+  for (int k = 0; k < n; k++) {
+    indicator_set_candle(&st->indicators, &candles[k], values);
+    rolling_push(&st->rolling, &candles[k].bucket);
+  }
+}
+
+// Send a wall-clock tick to every worker once a second, so the candles of symbols
+// without trades are closed too. Ticks go through the trade rings, after the trades before them,
+// each connection ticks for its own symbols.
+void send_ticks(connection_t *conn) {
+    static long long last_snapshot = 0;     // Only the first connection asks for snapshots
+    struct timeval time_val;
+    long long now;
+
+    gettimeofday(&time_val, NULL);
+    now = (long long)time_val.tv_sec * 1000LL + time_val.tv_usec / 1000;
+    if (now - conn->last_tick < TICK_INTERVAL_MS) return;
+    conn->last_tick = now;
+
+    // Ask sleepyhead for a latency snapshot
+    if (conn->id == 0 && now - last_snapshot >= LATENCY_SNAPSHOT_MS) {
+        if (last_snapshot != 0) {
+            atomic_store(&snapshot_due, 1);
+            spsc_event_signal(&candle_bell);
+        }
+        last_snapshot = now;
+    }
+
+    send_tick(conn, now);
+}
+
+// Push a tick of the connection with the given time (ms) to every worker
+void send_tick(connection_t *conn, long long time) {
+    trade_t tick;
+
+    memset(&tick, 0, sizeof(tick));
+    tick.id = TICK_ID - conn->id;
+    tick.time = time;
+    for (int w = 0; w < number_of_workers; w++) {
+        if (termination || backlog_publish(&conn->backlog[w], workers[w].rings[conn->id], &tick, 1) < 0) return;
+        if (number_of_connections > 1) spsc_event_signal(&workers[w].bell);
+    }
+}
+
+// Function to save the latency percentiles of every stage and symbol since the previous snapshot
+void write_latency_snapshot() {
+    struct timeval time_val;
+    long long now;
+    latency_stats_t stats;
+    symbol_t *sym;
+    symbol_state_t *st;
+
+    gettimeofday(&time_val, NULL);
+    now = (long long)time_val.tv_sec * 1000LL + time_val.tv_usec / 1000;
+
+    for (int i = 0; i < symbol_count(); i++) {
+        sym = symbol_get(i);
+        st = sym->state;
+        for (int s = 0; s < STAGES; s++) {
+            if (latency_snapshot(&st->latency[s], &st->latency_prev[s], &stats) == 0) continue;
+            log_printf(sleepyhead_log, file_latency, "%lld\t%s\t%s\t%llu\t%.3f\t%.3f\t%.3f\t%.3f\n",
+                       now, sym->name, stage_names[s], (unsigned long long)stats.count,
+                       stats.p50 / 1e3, stats.p99 / 1e3, stats.p999 / 1e3, stats.max / 1e3);
+        }
+    }
+    log_commit(sleepyhead_log);
 }
 
 void send_message(struct lws *wsi, const char *message) {
@@ -476,18 +1741,186 @@ void send_message(struct lws *wsi, const char *message) {
     lws_write(wsi, p, message_len, LWS_WRITE_TEXT); // Send the message through the WebSocket
 }
 
-// Function to parse JSON data and extract trade information (symbol, price, time, volume)
-void parse_json_data(const char *json_text) {
+// Function to parse a received message and queue its trades (symbol, price, time, volume).
+// Trade messages are decoded in place by the fast parser, anything else goes through jansson.
+// The trades are staged per worker and published once at the end, one wake-up per worker.
+void parse_json_data(connection_t *conn, const char *json_text, size_t len) {
     struct timeval time_val;
+    long long recv_time;
+    int n;
+
+    // Capture time when the message is received by the producer, every trade in it arrived together
+    conn->frame_recv_ns = latency_now_ns();
+    gettimeofday(&time_val, NULL);
+    recv_time = (long long)time_val.tv_sec * 1000000LL + time_val.tv_usec;
+
+    n = trade_parse(json_text, len, conn->frame_trades, MAX_FRAME_TRADES);
+    metrics_add(conn->metrics, M_MESSAGES, 1);
+
+    // The symbols file can't be reloaded while another connection looks up symbols
+    pthread_rwlock_rdlock(&registry_lock);
+    if (n == PARSE_SLOW) {
+        parse_json_data_slow(conn, json_text, len, recv_time);
+    } else {
+        conn->continues_pings = 0; // Reset ping counter on valid data
+        for (int i = 0; i < n; i++) {
+            if (stage_trade(conn, &conn->frame_trades[i], recv_time) < 0) break;
+        }
+    }
+    pthread_rwlock_unlock(&registry_lock);
+
+    publish_trades(conn);
+}
+
+// Find the symbol of the trade, stamp it and stage it for the worker that owns the symbol.
+// A full stage is published right away. Returns -1 if the program is terminating.
+int stage_trade(connection_t *conn, const stock_data_t *trade, long long recv_time) {
+    trade_t hot;
+
+    // Find the ID of the symbol in the registry, skip symbols we don't track
+    hot.id = symbol_lookup(trade->symbol, strlen(trade->symbol));
+    if (hot.id < 0 || !atomic_load_explicit(&symbol_get(hot.id)->active, memory_order_relaxed)) return 0;
+    metrics_add(conn->metrics, M_TRADES_RECEIVED, 1);
+    latency_record(&((symbol_state_t *)symbol_get(hot.id)->state)->latency[STAGE_NETWORK], recv_time * 1000LL - trade->time * 1000000LL);
+
+    // From here on the trade is the compact fixed-point record
+    hot.price = trade_fixed(trade->price);
+    hot.volume = trade_fixed(trade->volume);
+    hot.time = trade->time;
+    hot.pub_ns = 0;
+    return queue_trade(conn, &hot);
+}
+
+// Stage a trade of a known symbol for the worker that owns the symbol.
+// A full stage is published right away. Returns -1 if the program is terminating.
+int queue_trade(connection_t *conn, const trade_t *trade) {
+    int w = trade->id % number_of_workers;
+
+    conn->stage[w][conn->staged[w]++] = *trade;
+    if (conn->staged[w] == MAX_FRAME_TRADES) return publish_trades(conn);
+    return 0;
+}
+
+// Stage a close of the minutes of symbol 'id' before 'minute' for its worker, behind the
+// symbol's trades staged so far (replay only)
+int queue_close(connection_t *conn, int id, int64_t minute) {
+    int w = id % number_of_workers;
+    trade_t *close = &conn->stage[w][conn->staged[w]++];
+
+    memset(close, 0, sizeof(trade_t));
+    close->id = CLOSE_ID;
+    close->price = id;
+    close->time = minute;
+    if (conn->staged[w] == MAX_FRAME_TRADES) return publish_trades(conn);
+    return 0;
+}
+
+// Add the staged trades of the connection to its ring of each worker in one batch. A full ring is
+// waited for, or with another overflow policy the trades wait in the connection's backlog.
+// Returns -1 if the program is terminating.
+int publish_trades(connection_t *conn) {
+    int ret = 0;
+    int64_t now = latency_now_ns();
+    symbol_state_t *st;
+    trade_t *stage;
+
+    for (int w = 0; w < number_of_workers; w++) {
+        if (conn->staged[w] == 0) continue;
+        stage = conn->stage[w];
+        for (size_t k = 0; k < conn->staged[w]; k++) {
+            stage[k].pub_ns = (uint32_t)now;
+            if (stage[k].id < 0) continue;   // A close of a replay
+            st = symbol_get(stage[k].id)->state;
+            latency_record(&st->latency[STAGE_PRODUCER], now - conn->frame_recv_ns);
+        }
+        if (termination || backlog_publish(&conn->backlog[w], workers[w].rings[conn->id], stage, conn->staged[w]) < 0) {  // If termination flag is raised return
+            ret = -1;
+        }
+        if (number_of_connections > 1) spsc_event_signal(&workers[w].bell);
+        conn->staged[w] = 0;
+    }
+    return ret;
+}
+
+// Move the trades waiting in the backlogs of the connection into the rings the workers made room in.
+// Returns the number of trades still waiting.
+uint64_t flush_backlogs(connection_t *conn) {
+    uint64_t waiting = 0;
+    backlog_t *b;
+
+    if (overflow_policy == BACKLOG_BLOCK) return 0;
+    for (int w = 0; w < number_of_workers; w++) {
+        b = &conn->backlog[w];
+        if (backlog_waiting(b) == 0) continue;
+        waiting += backlog_flush(b, workers[w].rings[conn->id]);
+        if (number_of_connections > 1) spsc_event_signal(&workers[w].bell);
+    }
+    metrics_set(conn->metrics, M_BACKLOG_WAITING, waiting);
+    return waiting;
+}
+
+// Overflow counters of the symbol with this ID, for the backlogs
+backlog_counts_t *symbol_overflow(int id) {
+    return &((symbol_state_t *)symbol_get(id)->state)->overflow;
+}
+
+// Metrics read on demand by the metrics server: depth of the rings, overflow of the symbols and
+// the log writer. Only reads counters and atomics the threads publish anyway.
+void collect_metrics(FILE *out, void *arg) {
+    log_stats_t log_stats;
+    symbol_t *sym;
+    backlog_counts_t *counts;
+    int active = 0;
+
+    metrics_header(out, "pi_queue_depth", "Trades in the ring from a connection to a worker", METRIC_GAUGE);
+    for (int w = 0; w < number_of_workers; w++) {
+        for (int c = 0; c < number_of_connections; c++) {
+            fprintf(out, "pi_queue_depth{connection=\"%d\",worker=\"%d\"} %zu\n", c, w, spsc_ring_size(workers[w].rings[c]));
+        }
+    }
+    metrics_header(out, "pi_queue_capacity", "Capacity of each trade ring", METRIC_GAUGE);
+    fprintf(out, "pi_queue_capacity %zu\n", workers[0].rings[0]->capacity);
+    metrics_header(out, "pi_candle_queue_depth", "Closed candles of a worker waiting for sleepyhead", METRIC_GAUGE);
+    for (int w = 0; w < number_of_workers; w++) {
+        fprintf(out, "pi_candle_queue_depth{worker=\"%d\"} %zu\n", w, spsc_ring_size(workers[w].candles));
+    }
+
+    // The registry doesn't change while the symbols are listed
+    pthread_rwlock_rdlock(&registry_lock);
+    metrics_header(out, "pi_symbols_active", "Symbols subscribed", METRIC_GAUGE);
+    for (int i = 0; i < symbol_count(); i++) active += atomic_load_explicit(&symbol_get(i)->active, memory_order_relaxed);
+    fprintf(out, "pi_symbols_active %d\n", active);
+    if (overflow_policy != BACKLOG_BLOCK) {
+        metrics_header(out, "pi_overflow_trades_total", "Trades dropped, conflated or spilled by the overflow policy", METRIC_COUNTER);
+        for (int i = 0; i < symbol_count(); i++) {
+            sym = symbol_get(i);
+            counts = &((symbol_state_t *)sym->state)->overflow;
+            fprintf(out, "pi_overflow_trades_total{symbol=\"%s\",action=\"dropped\"} %llu\n", sym->name, (unsigned long long)atomic_load(&counts->dropped));
+            fprintf(out, "pi_overflow_trades_total{symbol=\"%s\",action=\"conflated\"} %llu\n", sym->name, (unsigned long long)atomic_load(&counts->conflated));
+            fprintf(out, "pi_overflow_trades_total{symbol=\"%s\",action=\"spilled\"} %llu\n", sym->name, (unsigned long long)atomic_load(&counts->spilled));
+        }
+    }
+    pthread_rwlock_unlock(&registry_lock);
+
+    log_writer_stats(&log_stats);
+    metrics_header(out, "pi_log_writer_bytes_total", "Bytes written by the log writer", METRIC_COUNTER);
+    fprintf(out, "pi_log_writer_bytes_total %llu\n", log_stats.bytes);
+    metrics_header(out, "pi_log_writer_stalls_total", "Times a pipeline thread waited for a log buffer", METRIC_COUNTER);
+    fprintf(out, "pi_log_writer_stalls_total %llu\n", log_stats.stalls);
+}
+
+// Slow path: parse JSON data with jansson (pings, errors and anything the fast parser doesn't handle)
+void parse_json_data_slow(connection_t *conn, const char *json_text, size_t len, long long recv_time) {
     json_t *root, *data, *symbol, *price, *time, *volume;   // JSON objects to hold parsed data
     json_error_t error;         // Error object for handling JSON parsing errors
     size_t i;                   // Loop variable
     stock_data_t trade;         // Structure to hold trade data
 
-    // Load the JSON data
-    root = json_loads(json_text, 0, &error);
+    // Load the JSON data, the receive buffer isn't NUL terminated
+    root = json_loadb(json_text, len, 0, &error);
     if (!root) {
         fprintf(stderr, COLOR_RED"error: on line %d: %s\n"COLOR_RESET, error.line, error.text);
+        metrics_add(conn->metrics, M_PARSE_ERRORS, 1);
         return;
     }
 
@@ -499,19 +1932,21 @@ void parse_json_data(const char *json_text) {
         
         // Continuous pings mean no data from stocks
         // Check if the number of continuous pings has exceeded the limit
-        continues_pings += 1;
-        if(continues_pings > PING_LIMIT){
-            connection_flag = 0;    // Proceed to disconnect and reconnet
+        conn->continues_pings += 1;
+        metrics_add(conn->metrics, M_PINGS, 1);
+        if(conn->continues_pings > PING_LIMIT){
+            drop_connection(conn, "pings only");  // Proceed to disconnect and reconnet
         }
         return;
     }
-    continues_pings = 0; // Reset ping counter on valid data
+    conn->continues_pings = 0; // Reset ping counter on valid data
 
     // Loop through each item in the "data" array
     for (i = 0; i < json_array_size(JSON_data); i++) {
         data = json_array_get(JSON_data, i);    // Get the ith element from the array
         if (!json_is_object(data)) {            // Ensure the element is an object
             fprintf(stderr, COLOR_RED"error: data %zu is not an object\n"COLOR_RESET, i + 1);
+            metrics_add(conn->metrics, M_PARSE_ERRORS, 1);
             json_decref(root);                  // Free JSON object memory
             return;
         }
@@ -520,6 +1955,7 @@ void parse_json_data(const char *json_text) {
         symbol = json_object_get(data, "s");
         if (!json_is_string(symbol)) {
             fprintf(stderr, COLOR_RED"error: symbol is not a string\n"COLOR_RESET);
+            metrics_add(conn->metrics, M_PARSE_ERRORS, 1);
             json_decref(root);
             return;
         }
@@ -528,6 +1964,7 @@ void parse_json_data(const char *json_text) {
         price = json_object_get(data, "p");
         if (!json_is_number(price)) {
             fprintf(stderr, COLOR_RED"error: price is not a number\n"COLOR_RESET);
+            metrics_add(conn->metrics, M_PARSE_ERRORS, 1);
             json_decref(root);
             return;
         }
@@ -536,6 +1973,7 @@ void parse_json_data(const char *json_text) {
         volume = json_object_get(data, "v");
         if (!json_is_number(volume)) {
             fprintf(stderr, COLOR_RED"error: time is not a string\n"COLOR_RESET);
+            metrics_add(conn->metrics, M_PARSE_ERRORS, 1);
             json_decref(root);
             return;
         }
@@ -544,6 +1982,14 @@ void parse_json_data(const char *json_text) {
         time = json_object_get(data, "t");
         if (!json_is_integer(time)) {
             fprintf(stderr, COLOR_RED"error: time is not a string\n"COLOR_RESET);
+            metrics_add(conn->metrics, M_PARSE_ERRORS, 1);
+            json_decref(root);
+            return;
+        }
+        // Candles bucket the exchange time by minute from the epoch
+        if (json_integer_value(time) < 0) {
+            fprintf(stderr, COLOR_RED"error: time is before the epoch\n"COLOR_RESET);
+            metrics_add(conn->metrics, M_PARSE_ERRORS, 1);
             json_decref(root);
             return;
         }
@@ -555,26 +2001,7 @@ void parse_json_data(const char *json_text) {
         trade.time = json_integer_value(time);
         trade.volume = json_number_value(volume);
 
-        // Capture time when data are received by the producer and added to the shared queue
-        gettimeofday(&time_val, NULL);           
-        trade.recv_time = (long long)time_val.tv_sec * 1000000LL + time_val.tv_usec;
-
-        // Lock the queue mutex before modifying the shared queue      
-        pthread_mutex_lock (fifo->mut);
-        
-        while (fifo->full) {
-          pthread_cond_wait (fifo->notFull, fifo->mut);
-          if(termination) { // If termination flag is raised return
-            json_decref(root);
-            return;
-          }
-        }
-
-        if(!termination) {  
-        queueAdd (fifo, trade); // Add the new trade data to the queue
-        pthread_mutex_unlock (fifo->mut);   // Unlock the queue mutex after adding data
-        pthread_cond_signal (fifo->notEmpty);    // Signal that the queue is no longer empty
-        } else {  // If termination flag is raised return
+        if(stage_trade(conn, &trade, recv_time) < 0) {  // If termination flag is raised return
           json_decref(root);
           return;
         }
@@ -586,34 +2013,88 @@ void parse_json_data(const char *json_text) {
 
 // WebSocket callback function for handling events from the WebSocket
 static int callback_ws(struct lws *wsi, enum lws_callback_reasons reason, void *user, void *in, size_t len) {
+    connection_t *conn = (connection_t *)lws_context_user(lws_get_context(wsi));
+
     switch (reason) {
         case LWS_CALLBACK_CLIENT_ESTABLISHED:   // Event: Connection established
-            printf(COLOR_GREEN"\nConnection established\n"COLOR_RESET);
-            connection_flag = 1;                // Set connection flag to indicate active connection
+            conn->last_message_ns = latency_now_ns();
+            conn->handshake_ns = conn->last_message_ns - conn->attempt_ns;
+#if defined(LWS_WITH_TLS_SESSIONS)
+            conn->tls_resumed = server_ssl && lws_tls_session_is_reused(wsi);
+#endif
+            printf(COLOR_GREEN"\nConnection %d established in %.1f ms%s\n"COLOR_RESET, conn->id, conn->handshake_ns / 1e6,
+                   conn->tls_resumed ? " (TLS session resumed)" : "");
+            conn->connection_flag = 1;          // Set connection flag to indicate active connection
+            conn->connecting = 0;
+            conn->closing = 0;
+            conn->continues_pings = 0;
+            conn->reconnect_attempts = 0;
+            conn->wsi = wsi;
+            if(conn->drop_ns != 0) {            // Reconnected, the data gap ends at the first message
+              conn->reconnect_ns = conn->last_message_ns - conn->drop_ns;
+              conn->gap_pending = 1;
+              conn->drop_ns = 0;
+            }
+            // A new connection has no subscriptions, subscribe to every active symbol of it again
+            for(int i = conn->id; i < symbol_count(); i += number_of_connections) {
+              ((symbol_state_t *)symbol_get(i)->state)->subscribed = 0;
+            }
+            conn->sync_cursor = conn->id;
             lws_callback_on_writable(wsi);      // Mark the connection as writable
             break;
 
         case LWS_CALLBACK_CLIENT_RECEIVE:       // Event: Message received from server
             //printf(COLOR_YELLOW"Received message\n" COLOR_RESET); 
-            // Parse the received JSON data
-            parse_json_data((char *)in);
+            // Join the message if it arrives in pieces, then parse the received JSON data
+            conn->last_message_ns = latency_now_ns();
+            if(conn->gap_pending) log_reconnect(conn, conn->last_message_ns);
+            {
+              size_t msg_len;
+              int final = lws_is_final_fragment(wsi) && lws_remaining_packet_payload(wsi) == 0;
+              const char *msg = trade_parser_feed(&conn->parser, (const char *)in, len, final, &msg_len);
+              if (msg != NULL) parse_json_data(conn, msg, msg_len);
+            }
             break;
 
         case LWS_CALLBACK_CLIENT_WRITEABLE:      // Event: Ready to send data
-            // Send subscription messages for all stock symbols
-            for(int i = 0; i < NUMBER_OF_SYMBOLS; i++){
-              send_message(wsi, sympol_message[i]);
+            // Send one (un)subscribe message for the next symbol of the connection whose subscription
+            // is out of sync, and ask for another writeable callback while there are more
+            for(; conn->sync_cursor < symbol_count(); conn->sync_cursor += number_of_connections) {
+              symbol_t *sym = symbol_get(conn->sync_cursor);
+              symbol_state_t *st = sym->state;
+              int active = atomic_load_explicit(&sym->active, memory_order_relaxed);
+              char message[MAX_MESSAGE_LEN];
+
+              if(st->subscribed == active) continue;
+              snprintf(message, sizeof(message), "{\"type\":\"%s\",\"symbol\":\"%s\"}", active ? "subscribe" : "unsubscribe", sym->name);
+              send_message(wsi, message);
+              st->subscribed = active;
+              conn->sync_cursor += number_of_connections;
+              lws_callback_on_writable(wsi);
+              break;
             }
             break;
 
         case LWS_CALLBACK_CLIENT_CLOSED:    // Event: Connection closed 
-            connection_flag = 0;            // Set connection flag to zero to try reconnecting
-            printf(COLOR_RED"Connection closed\n"COLOR_RESET);
+            conn->connection_flag = 0;      // Set connection flag to zero to try reconnecting
+            conn->wsi = NULL;
+            conn->closing = 0;
+            if(conn->drop_ns == 0) {        // Start of the outage, the gap started with the last message
+              conn->drop_ns = latency_now_ns();
+              conn->gap_start_ns = conn->gap_pending ? conn->drop_ns : conn->last_message_ns;
+              conn->gap_pending = 0;
+            }
+            printf(COLOR_RED"Connection %d closed\n"COLOR_RESET, conn->id);
+            if(!termination) schedule_reconnect(conn);
             break;
 
         case LWS_CALLBACK_CLIENT_CONNECTION_ERROR:  // Event: Connection error occurred
-            connection_flag = -1;                   // Set connection flag to indicate error
-            printf(COLOR_RED"Client connection error\n"COLOR_RESET);
+            conn->connection_flag = -1;             // Set connection flag to indicate error
+            printf(COLOR_RED"Connection %d error: %s\n"COLOR_RESET, conn->id, in ? (const char *)in : "unknown");
+            if(conn->connecting && !termination) {
+              conn->connecting = 0;
+              schedule_reconnect(conn);
+            }
             break;
 
         default:
@@ -622,102 +2103,130 @@ static int callback_ws(struct lws *wsi, enum lws_callback_reasons reason, void *
     return 0;
 }
 
-// Function to create a WebSocket client and establish a connection
-void create_client() {
+// Function to create the WebSocket context of the whole run. The SSL library is initialized once
+// and the client TLS context is kept, so reconnections resume the cached TLS session.
+void create_context(connection_t *conn) {
     struct lws_context_creation_info context_creation_info;
-    struct lws_client_connect_info client_connect_info;
-    struct lws *wsi;
 
     // Initialize context information
     memset(&context_creation_info, 0, sizeof(context_creation_info));
     context_creation_info.protocols = protocols;
     context_creation_info.port = CONTEXT_PORT_NO_LISTEN;
     context_creation_info.options = LWS_SERVER_OPTION_DO_SSL_GLOBAL_INIT;
+    context_creation_info.user = conn;       // Found again by the callback with lws_context_user()
+#if defined(LWS_WITH_TLS_SESSIONS)
+    context_creation_info.tls_session_timeout = TLS_SESSION_TIMEOUT_S;
+    context_creation_info.tls_session_cache_max = 4;
+#endif
 
     // Create the context
-    context = lws_create_context(&context_creation_info);
-    if (context == NULL) {
+    conn->context = lws_create_context(&context_creation_info);
+    if (conn->context == NULL) {
         printf(COLOR_RED"Error creating context information\n"COLOR_RESET);
         exit(1);
     }
+}
+
+// Function to start a connection attempt on the context, its outcome arrives in callback_ws
+void connect_client(connection_t *conn) {
+    struct lws_client_connect_info client_connect_info;
 
     // Initialize client connection info structure
     memset(&client_connect_info, 0, sizeof(client_connect_info));
-    client_connect_info.context = context;
-    client_connect_info.address = "ws.finnhub.io";
-    client_connect_info.path = "/?token=cr7nsa1r01qotnb3qq60cr7nsa1r01qotnb3qq6g";  // Path with token
-    client_connect_info.port = 443;
+    client_connect_info.context = conn->context;
+    client_connect_info.address = server_address;
+    client_connect_info.path = server_path;             // Path with token
+    client_connect_info.port = server_port;
     client_connect_info.host = client_connect_info.address;     // Host address
     client_connect_info.origin = client_connect_info.address;   // Origin for the WebSocket connection
     client_connect_info.protocol = protocols[0].name;   // WebSocket protocol to use
-    client_connect_info.ssl_connection = LCCSCF_USE_SSL;    // Use SSL for connection
-    client_connect_info.userdata = fifo;                // Pass the fifo queue as user data
+    client_connect_info.ssl_connection = server_ssl ? LCCSCF_USE_SSL : 0;    // Use SSL for wss:// only
+    if (server_ssl && insecure_tls) {
+        client_connect_info.ssl_connection |= LCCSCF_ALLOW_SELFSIGNED | LCCSCF_SKIP_SERVER_CERT_HOSTNAME_CHECK;
+    }
 
-    // Create the WebSocket connection
-    wsi = lws_client_connect_via_info(&client_connect_info);
-    if (wsi == NULL) {                   // Check if connection failed
+    // Create the WebSocket connection, a failure may also have been reported to the callback already
+    conn->attempt_ns = latency_now_ns();
+    conn->connecting = 1;
+    if (lws_client_connect_via_info(&client_connect_info) == NULL && conn->connecting) {
         printf(COLOR_RED"Failed to establish connection\n"COLOR_RESET);
-        lws_context_destroy(context);    // Destroy the context if connection fails
-        exit(1);                        // Exit with an error code
+        conn->connecting = 0;
+        conn->connection_flag = -1;
+        schedule_reconnect(conn);
     }
 }
 
-queue *queueInit (void)
-{
-  queue *q;
-
-  q = (queue *)malloc (sizeof (queue));
-  if (q == NULL) return (NULL);
-
-  q->empty = 1;
-  q->full = 0;
-  q->head = 0;
-  q->tail = 0;
-  q->mut = (pthread_mutex_t *) malloc (sizeof (pthread_mutex_t));
-  pthread_mutex_init (q->mut, NULL);
-  q->notFull = (pthread_cond_t *) malloc (sizeof (pthread_cond_t));
-  pthread_cond_init (q->notFull, NULL);
-  q->notEmpty = (pthread_cond_t *) malloc (sizeof (pthread_cond_t));
-  pthread_cond_init (q->notEmpty, NULL);
-	
-  return (q);
-}
-
-void queueDelete (queue *q)
-{
-  pthread_mutex_destroy (q->mut);
-  free (q->mut);	
-  pthread_cond_destroy (q->notFull);
-  free (q->notFull);
-  pthread_cond_destroy (q->notEmpty);
-  free (q->notEmpty);
-  free (q);
-}
+// Pick the time of the next connection attempt: right away after a drop, then after an exponential
+// backoff with jitter (half fixed, half random), so a flapping server isn't hammered
+void schedule_reconnect(connection_t *conn) {
+    long long base, delay = 0;
 
-void queueAdd (queue *q, stock_data_t in)
-{
-  q->buf[q->tail] = in;
-  q->tail++;
-  if (q->tail == QUEUESIZE)
-    q->tail = 0;
-  if (q->tail == q->head)
-    q->full = 1;
-  q->empty = 0;
+    if (conn->reconnect_attempts > 0) {
+        base = (long long)RECONNECT_MIN_MS << (conn->reconnect_attempts < 10 ? conn->reconnect_attempts - 1 : 9);
+        if (base > RECONNECT_MAX_MS) base = RECONNECT_MAX_MS;
+        delay = base / 2 + rand() % (base / 2 + 1);
+        printf(COLOR_YELLOW"Reconnecting %d in %lld ms (attempt %d)\n"COLOR_RESET, conn->id, delay, conn->reconnect_attempts + 1);
+    }
+    conn->reconnect_attempts++;
+    conn->next_attempt_ns = latency_now_ns() + delay * 1000000LL;
+}
 
-  return;
+// Close the current connection from the service thread, the callback then reconnects
+void drop_connection(connection_t *conn, const char *reason) {
+    if (conn->wsi == NULL || conn->closing) return;
+    printf(COLOR_YELLOW"Dropping connection %d: %s\n"COLOR_RESET, conn->id, reason);
+    conn->closing = 1;
+    lws_set_timeout(conn->wsi, PENDING_TIMEOUT_USER_OK, LWS_TO_KILL_ASYNC);
 }
 
-void queueDel (queue *q, stock_data_t *out)
-{
-  *out = q->buf[q->head];
+// First message after a reconnection: save the outage (drop to connection established),
+// the handshake and the data gap (last message before the drop to this one)
+void log_reconnect(connection_t *conn, int64_t now) {
+    struct timeval time_val;
+    int64_t gap_ns = now - conn->gap_start_ns;
+
+    conn->gap_pending = 0;
+    conn->reconnects++;
+    if (conn->reconnect_ns > conn->reconnect_ns_max) conn->reconnect_ns_max = conn->reconnect_ns;
+    if (gap_ns > conn->gap_ns_max) conn->gap_ns_max = gap_ns;
+
+    gettimeofday(&time_val, NULL);
+    log_printf(conn->log, file_reconnects, "%lld\t%d\t%.3f\t%.3f\t%.3f\t%d\n",
+               (long long)time_val.tv_sec * 1000LL + time_val.tv_usec / 1000, conn->id,
+               conn->reconnect_ns / 1e6, conn->handshake_ns / 1e6, gap_ns / 1e6, conn->tls_resumed);
+    log_commit(conn->log);
+}
 
-  q->head++;
-  if (q->head == QUEUESIZE)
-    q->head = 0;
-  if (q->head == q->tail)
-    q->empty = 1;
-  q->full = 0;
+// Function to split a ws:// or wss:// URL into the server address, port and path of the client.
+// Returns -1 if the URL is invalid.
+int parse_url(const char *url) {
+    const char *host, *end, *colon;
+    size_t len;
+
+    if (strncmp(url, "wss://", 6) == 0) {
+        server_ssl = 1;
+        server_port = 443;
+        host = url + 6;
+    } else if (strncmp(url, "ws://", 5) == 0) {
+        server_ssl = 0;
+        server_port = 80;
+        host = url + 5;
+    } else {
+        return -1;
+    }
 
-  return;
+    end = strchr(host, '/');
+    if (end == NULL) end = host + strlen(host);
+    colon = memchr(host, ':', end - host);
+    len = (colon != NULL ? colon : end) - host;
+    if (len == 0 || len >= sizeof(server_address)) return -1;
+    memcpy(server_address, host, len);
+    server_address[len] = '\0';
+
+    if (colon != NULL) {
+        server_port = atoi(colon + 1);
+        if (server_port <= 0 || server_port > 65535) return -1;
+    }
+    snprintf(server_path, sizeof(server_path), "%s", *end == '/' ? end : "/");
+    return 0;
 }
-  
@@ -0,0 +1,199 @@
+/*
+Historical candles and rolling windows at any resolution, from the trade logs pi_code recorded.
+>Usage: ./pi_query [-d dir] [-s symbols_file | symbol ...] [-i interval] [-f from] [-t to] [-W windows] [-g grace_ms] [-j threads] [-o out_dir] [-b]
+  -d: directory of the trade logs, partitions (.tlog/.tlz) or a single <SYMBOL>.tlog (default ".")
+  -s: file with the symbols, like pi_code's (default "symbols.conf" when no symbol is given)
+  -i: candle interval, a number and s, m, h or d, e.g. 30s, 1m, 15m, 4h, 1d (default 1m)
+  -f: start of the exchange time range, UTC "YYYY-MM-DD[THH[:MM[:SS]]]" or ms since the epoch (default everything)
+  -t: end of the range (excluded), same format
+  -W: rolling windows in minutes, multiples of the interval (default those of pi_code's "1,5,15,60"
+      that are, or a single candle)
+  -g: grace period in ms for late trades, as pi_code's '-g' (default 2000)
+  -j: threads (default one per core)
+  -o: directory of the output files, one per symbol: <SYMBOL>_<interval>.csv (default ".")
+  -b: write <SYMBOL>_<interval>.qry binary files instead (see query.h, python_for_plots/query.py)
+>The trades go through the candle and window code of pi_code's workers and sleepyhead, so at 1m
+ the candles and the SMA, VWAP and volume of every window are those of the live run (see query.h).
+ Partitions are aggregated on all threads and only the .tlz blocks of the range are decoded.
+*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include "query.h"
+#include "symbols.h"
+
+#define DEFAULT_SYMBOLS_FILE "symbols.conf"
+
+static long long now_ns (void)
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// Time given as ms since the epoch or as a UTC date and time. Returns -1 if invalid.
+static int parse_time (const char *spec, int64_t *ms)
+{
+  struct tm tm;
+  const char *end;
+  char *num_end;
+  long long n;
+
+  if (strchr (spec, '-') == NULL) {
+    n = strtoll (spec, &num_end, 10);
+    if (num_end == spec || *num_end != '\0') return -1;
+    *ms = n;
+    return 0;
+  }
+  memset (&tm, 0, sizeof (tm));
+  end = strptime (spec, "%Y-%m-%d", &tm);
+  if (end != NULL && *end == 'T') {
+    end = strptime (end + 1, "%H", &tm);
+    if (end != NULL && *end == ':') end = strptime (end + 1, "%M", &tm);
+    if (end != NULL && *end == ':') end = strptime (end + 1, "%S", &tm);
+  }
+  if (end == NULL || *end != '\0') return -1;
+  *ms = (int64_t)timegm (&tm) * 1000;
+  return 0;
+}
+
+static void ignore_change (symbol_t *sym, int subscribed)
+{
+}
+
+int main (int argc, char *argv[])
+{
+  query_t q;
+  query_result_t *results;
+  const char **symbols;
+  const char *symbols_file = NULL, *out_dir = ".", *windows = NULL;
+  char path[PATH_MAX], name[16];
+  int opt, count, binary = 0, failed = 0;
+  int defaults[ROLLING_MAX_WINDOWS];
+  unsigned long long trades = 0, late = 0;
+  long long start;
+
+  memset (&q, 0, sizeof (q));
+  q.dir = ".";
+  q.interval = 60000;
+  q.from = 0;
+  q.to = INT64_MAX;
+  q.grace_ms = CANDLE_DEFAULT_GRACE_MS;
+  q.threads = (int)sysconf (_SC_NPROCESSORS_ONLN);
+
+  while ((opt = getopt (argc, argv, "d:s:i:f:t:W:g:j:o:b")) != -1) {
+    switch (opt) {
+      case 'd':
+        q.dir = optarg;
+        break;
+      case 's':
+        symbols_file = optarg;
+        break;
+      case 'i':
+        q.interval = query_parse_interval (optarg);
+        break;
+      case 'f':
+      case 't':
+        if (parse_time (optarg, opt == 'f' ? &q.from : &q.to) < 0) {
+          fprintf (stderr, "Invalid time '%s', expected YYYY-MM-DD[THH[:MM[:SS]]] or ms since the epoch\n", optarg);
+          return 1;
+        }
+        break;
+      case 'W':
+        windows = optarg;
+        break;
+      case 'g':
+        q.grace_ms = atoll (optarg);
+        break;
+      case 'j':
+        q.threads = atoi (optarg);
+        break;
+      case 'o':
+        out_dir = optarg;
+        break;
+      case 'b':
+        binary = 1;
+        break;
+      default:
+        fprintf (stderr, "Usage: %s [-d dir] [-s symbols_file | symbol ...] [-i interval] [-f from] [-t to] [-W windows] [-g grace_ms] [-j threads] [-o out_dir] [-b]\n", argv[0]);
+        return 1;
+    }
+  }
+  if (q.interval == 0) {
+    fprintf (stderr, "Invalid interval, expected e.g. 30s, 1m, 15m, 4h or 1d\n");
+    return 1;
+  }
+  if (q.threads < 1) q.threads = 1;
+
+  // pi_code's default windows that are whole candles, or a single candle
+  if (windows != NULL) {
+    q.windows = rolling_parse_windows (windows, q.window_minutes, ROLLING_MAX_WINDOWS);
+    if (q.windows < 0) {
+      fprintf (stderr, "Invalid windows '%s', expected up to %d lengths in minutes\n", windows, ROLLING_MAX_WINDOWS);
+      return 1;
+    }
+  } else {
+    count = rolling_parse_windows (ROLLING_DEFAULT_WINDOWS, defaults, ROLLING_MAX_WINDOWS);
+    for (int w = 0; w < count; w++) {
+      if (defaults[w] * 60000LL % q.interval == 0) q.window_minutes[q.windows++] = defaults[w];
+    }
+    if (q.windows == 0) {
+      q.window_minutes[0] = (int)((q.interval + 59999) / 60000);
+      q.windows = 1;
+    }
+  }
+  if (query_check (&q) != NULL) {
+    fprintf (stderr, "Invalid query: %s\n", query_check (&q));
+    return 1;
+  }
+
+  // Symbols from the command line or from the symbols file
+  if (optind < argc) {
+    count = argc - optind;
+    symbols = (const char **) (argv + optind);
+  } else {
+    if (symbols_load (symbols_file != NULL ? symbols_file : DEFAULT_SYMBOLS_FILE, ignore_change) < 0) return 1;
+    count = symbol_count ();
+    symbols = (const char **) malloc ((count > 0 ? count : 1) * sizeof (char *));
+    if (symbols == NULL) return 1;
+    for (int i = 0; i < count; i++) symbols[i] = symbol_get (i)->name;
+  }
+
+  results = (query_result_t *) calloc (count > 0 ? count : 1, sizeof (query_result_t));
+  if (results == NULL) return 1;
+
+  start = now_ns ();
+  if (query_run (&q, symbols, count, results) < 0) {
+    fprintf (stderr, "Out of memory\n");
+    return 1;
+  }
+
+  query_interval_name (q.interval, name, sizeof (name));
+  for (int i = 0; i < count; i++) {
+    snprintf (path, sizeof (path), "%s/%s_%s.%s", out_dir, symbols[i], name, binary ? "qry" : "csv");
+    if ((binary ? query_write_binary (&q, &results[i], path) : query_write_csv (&q, &results[i], path)) < 0) {
+      fprintf (stderr, "Error writing %s: %s\n", path, strerror (errno));
+      failed = 1;
+    }
+    printf ("%-20s %8zu candles %12llu trades %8llu late %4d partitions%s\n", symbols[i], results[i].count,
+            (unsigned long long)results[i].trades, (unsigned long long)results[i].late, results[i].partitions,
+            results[i].bad ? " (some could not be read)" : "");
+    trades += results[i].trades;
+    late += results[i].late;
+  }
+  printf ("%llu trades in %.3f s on %d threads, %llu late\n", trades, (now_ns () - start) / 1e9, q.threads, late);
+
+  query_free (results, count);
+  free (results);
+  if (optind >= argc) {
+    free (symbols);
+    symbols_free ();
+  }
+  return failed;
+}
@@ -0,0 +1,31 @@
+import pandas as pd
+import matplotlib.pyplot as plt
+
+# Plot the latency snapshots of latency.txt: one subplot per pipeline stage, p50 and p99 of each symbol
+file_path = 'D:/vs_code_python_projects/t11/latency.txt'  # Path to the input file
+
+# Read the snapshots, times are ms since the epoch and latencies are in us
+df = pd.read_csv(file_path, sep='\t')
+df['Time'] = pd.to_datetime(df['Time'], unit='ms')
+stages = ['network_producer', 'producer_queue', 'queue_consumer', 'consumer_candle']
+
+# Set the plot style to dark background
+plt.style.use('dark_background')
+
+fig, axes = plt.subplots(2, 2, figsize=(12, 8))
+for ax, stage in zip(axes.flat, stages):
+    for symbol, rows in df[df['Stage'] == stage].groupby('Symbol'):
+        line, = ax.plot(rows['Time'], rows['p50_us'], linewidth=0.8, label=f'{symbol} p50')
+        ax.plot(rows['Time'], rows['p99_us'], linewidth=0.8, linestyle='--', color=line.get_color(), label=f'{symbol} p99')
+    ax.set_title(stage)
+    ax.set_yscale('log')
+    ax.set_xlabel('Time')
+    ax.set_ylabel('Latency (us)')
+    ax.grid(True, color='gray', linestyle='--', linewidth=0.5)
+    ax.legend(fontsize='small')
+
+# Adjust layout to prevent overlap
+plt.tight_layout()
+
+# Show the plot
+plt.show()
@@ -0,0 +1,55 @@
+import numpy as np
+import pandas as pd
+
+# Reader of the binary query results (<SYMBOL>_<interval>.qry) written by pi_query -b, see query.h.
+
+HEADER = np.dtype([
+    ('magic', 'S8'),
+    ('version', '<u4'),
+    ('header_size', '<u4'),
+    ('interval', '<i8'),
+    ('rows', '<u8'),
+    ('windows', '<u4'),
+    ('record_size', '<u4'),
+    ('window_minutes', '<i4', (8,)),
+    ('symbol', 'S32'),
+    ('reserved', '<u8', (3,)),
+])
+
+MAGIC = b'PIQRY\x00\x00\x01'
+
+
+def window_name(minutes):
+    return f'{minutes // 60}h' if minutes % 60 == 0 else f'{minutes}m'
+
+
+def load(file_path):
+    """Return the header and a numpy record array with one row per candle."""
+    header = np.fromfile(file_path, dtype=HEADER, count=1)
+    if len(header) != 1 or header['magic'][0] != MAGIC:
+        raise ValueError(f'{file_path} is not a query result')
+    header = header[0]
+
+    # Named like the columns of the CSV output
+    fields = [('Time', '<i8'), ('Trades', '<i8'), ('Open', '<f8'), ('High', '<f8'), ('Low', '<f8'),
+              ('Close', '<f8'), ('Volume', '<f8')]
+    for minutes in header['window_minutes'][:header['windows']]:
+        name = window_name(int(minutes))
+        fields += [(f'SMA_{name}', '<f8'), (f'VWAP_{name}', '<f8'), (f'Volume_{name}', '<f8')]
+    record = np.dtype(fields)
+    if record.itemsize != header['record_size']:
+        raise ValueError(f'{file_path}: unexpected record size {header["record_size"]}')
+
+    data = np.fromfile(file_path, dtype=record, count=int(header['rows']), offset=int(header['header_size']))
+    return header, data
+
+
+def load_dataframe(file_path):
+    """Return the candles and windows as a DataFrame indexed by candle start."""
+    header, data = load(file_path)
+    df = pd.DataFrame({name: data[name] for name in data.dtype.names[1:]})
+    df.index = pd.to_datetime(data['Time'], unit='ms')
+    df.index.name = 'Time'
+    df.attrs['symbol'] = header['symbol'].decode()
+    df.attrs['interval_ms'] = int(header['interval'])
+    return df
@@ -10,6 +10,9 @@ file_paths = [
     r'D:\vs_code_python_projects\t11\NVDA_sma_volume.txt'
 ]
 
+# Window to plot, one of the windows pi_code was run with (-W, default 1m, 5m, 15m, 1h)
+window = '15m'
+
 # Initialize a list to hold the dataframes
 data_list = []
 
@@ -17,6 +20,7 @@ data_list = []
 for file_path in file_paths:
     # Read the data from the file
     df = pd.read_csv(file_path, sep=r"\s+")
+    df = df[[f'SMA_{window}', f'Volume_{window}']]  # Keep the window to plot
     df.columns = ['SMA', 'Volume']  # Set the column names
     
     # Replace 'no_data' with NaN to handle missing data
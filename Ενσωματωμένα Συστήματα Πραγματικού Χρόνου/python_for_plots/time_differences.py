@@ -2,9 +2,8 @@ import pandas as pd
 import matplotlib.pyplot as plt
 import os
 
-# Run for files: finnhub_producer_delay.txt, producer_consumer_delay.txt and candlestick_time_differences.txt
-# Depending on the .txt file please modify line 36 according the notes in the comments 
-file_path = r'D:\vs_code_python_projects\t11\producer_consumer_delay.txt'  # Path to the input file
+# Run for file: candlestick_time_differences.txt (the pipeline latencies are plotted by latency.py)
+file_path = r'D:\vs_code_python_projects\t11\candlestick_time_differences.txt'  # Path to the input file
 output_directory = os.path.dirname(file_path) # Output path 
 
 # Read the input file
@@ -33,9 +32,7 @@ for i, file_name in enumerate([f'modified_{i+1}.txt' for i in range(4)]):
     df = pd.read_csv(file_path, header=None, skiprows=1, names=[header[i]])
     
     # Convert to seconds
-    df[header[i]] = df[header[i]].astype(float) / 1000000    # In finnhub_producer_delay.txt unit of measurement is msec, so use '/1000' 
-                                                          # In producer_consumer_delay.txt unit of measurement was usec, so use '/1000000' 
-                                                          # In candlestick_time_differences.txt unit of measurement was usec, so use '/1000000' 
+    df[header[i]] = df[header[i]].astype(float) / 1000000    # In candlestick_time_differences.txt unit of measurement is usec
                                                        
     # Overwrite the original file with modified values
     df.to_csv(file_path, index=False, header=True)
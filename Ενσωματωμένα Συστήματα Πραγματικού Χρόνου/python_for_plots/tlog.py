@@ -0,0 +1,64 @@
+import numpy as np
+import pandas as pd
+
+# Reader of the binary trade logs (<SYMBOL>.tlog) written by pi_code, see tlog.h for the layout.
+# The columns are mapped straight from the file with numpy.memmap, nothing is parsed.
+
+HEADER = np.dtype([
+    ('magic', 'S8'),
+    ('version', '<u4'),
+    ('header_size', '<u4'),
+    ('block_rows', '<u4'),
+    ('columns', '<u4'),
+    ('rows', '<u8'),
+    ('footer_offset', '<u8'),
+    ('symbol', 'S32'),
+])
+
+# Schema entries follow the header fields, 3 in a version 1 log (no 'closed' column), 4 from version 2
+COLUMN = np.dtype([('name', 'S8'), ('dtype', 'S4'), ('offset', '<u4')])
+
+MAGIC = b'TLOG\x00\x00\x00\x01'
+
+
+def read_header(file_path):
+    """Return the header fields and the schema entries of the columns."""
+    header = np.fromfile(file_path, dtype=HEADER, count=1)
+    if len(header) != 1 or header['magic'][0] != MAGIC:
+        raise ValueError(f'{file_path} is not a trade log')
+    columns = np.fromfile(file_path, dtype=COLUMN, count=int(header['columns'][0]), offset=HEADER.itemsize)
+    return header[0], columns
+
+
+def load(file_path):
+    """Return the symbol and a dict of numpy arrays, one per column (price, volume, time, and closed from version 2)."""
+    header, columns = read_header(file_path)
+    block_rows = int(header['block_rows'])
+    rows = int(header['rows'])
+
+    # One record of this dtype is a whole block, each column of it is an array of 'block_rows' values
+    names = [c['name'].decode() for c in columns]
+    formats = [(c['dtype'].decode(), (block_rows,)) for c in columns]
+    offsets = [int(c['offset']) for c in columns]
+    block = np.dtype({'names': names, 'formats': formats, 'offsets': offsets,
+                      'itemsize': sum(np.dtype(f).itemsize for f in formats)})
+
+    # A log that is still being written (or crashed) may claim rows that are not in the file yet
+    blocks = (rows + block_rows - 1) // block_rows
+    file_blocks = (np.memmap(file_path, mode='r').size - int(header['header_size'])) // block.itemsize
+    if blocks > file_blocks:
+        blocks = file_blocks
+        rows = blocks * block_rows
+
+    data = np.memmap(file_path, dtype=block, mode='r', offset=int(header['header_size']), shape=(blocks,))
+    return header['symbol'].decode(), {name: data[name].reshape(-1)[:rows] for name in names}
+
+
+def load_dataframe(file_path):
+    """Return the trades of a log as a DataFrame indexed by trade time."""
+    symbol, columns = load(file_path)
+    df = pd.DataFrame({'Price': columns['price'], 'Volume': columns['volume']})
+    df.index = pd.to_datetime(columns['time'], unit='ms')
+    df.index.name = 'Time'
+    df.attrs['symbol'] = symbol
+    return df
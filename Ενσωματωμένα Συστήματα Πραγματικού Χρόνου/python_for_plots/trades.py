@@ -0,0 +1,33 @@
+import matplotlib.pyplot as plt
+import tlog
+
+# Define file paths for the four trade logs
+file_paths = [
+    'D:/vs_code_python_projects/t11/GOOGL.tlog',
+    'D:/vs_code_python_projects/t11/BINANCE:BTCUSDT.tlog',
+    'D:/vs_code_python_projects/t11/AAPL.tlog',
+    'D:/vs_code_python_projects/t11/NVDA.tlog'
+]
+
+# Set the plot style to dark background
+plt.style.use('dark_background')
+
+# Create a figure with 4 subplots (price on top, volume below)
+fig, axes = plt.subplots(4, 2, figsize=(12, 12))
+
+for i, file_path in enumerate(file_paths):
+    # Load the trades straight from the binary log, no text parsing
+    df = tlog.load_dataframe(file_path)
+    symbol = df.attrs['symbol']
+
+    # Plot price in the left subplot and volume in the right subplot of each row
+    axes[i, 0].plot(df.index, df['Price'], color='#BE62EA', linewidth=0.5)
+    axes[i, 0].set_title(f'{symbol} - Price of each trade')
+    axes[i, 1].plot(df.index, df['Volume'], color='#62EABF', linewidth=0.5)
+    axes[i, 1].set_title(f'{symbol} - Volume of each trade')
+
+# Adjust layout to prevent overlap
+plt.tight_layout()
+
+# Show the plots
+plt.show()
@@ -0,0 +1,501 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "query.h"
+#include "archive.h"
+#include "tlog.h"
+#include "tlz.h"
+#include "trade.h"
+
+#define CLOSE_BATCH CANDLE_MAX_OPEN
+
+_Static_assert (sizeof (query_header_t) == QUERY_HEADER_SIZE, "query header must be 128 bytes");
+
+// Partition of a symbol, in the order archive_list() gives them
+typedef struct {
+  char *path;
+  int symbol;               // Index of the symbol's result
+  int compressed;
+  int ok;                   // Opened, the times below are known
+  uint64_t rows;
+  int64_t min_time;         // Earliest, latest and first logged trade time
+  int64_t max_time;
+  int64_t first_time;
+  int selected;             // Holds trades the result needs
+  int64_t prev_max;         // Latest trade time of the symbol's partitions before it, INT64_MIN if none
+  int64_t first_bucket;     // Interval of the symbol's first trade
+  candle_t *candles;        // Closed by this partition, consecutive intervals
+  size_t count;
+  size_t max;
+  uint64_t trades;
+  uint64_t late;
+  int bad;
+} part_t;
+
+typedef struct query_ctx {
+  const query_t *q;
+  query_result_t *results;
+  int symbols;
+  part_t *parts;
+  int part_count;
+  int *first_part;          // Partitions of symbol i are [first_part[i], first_part[i + 1])
+  int window_buckets[ROLLING_MAX_WINDOWS];
+  int64_t warm_from;        // Trades before this feed neither the candles nor the windows of the range
+  void (*task) (struct query_ctx *ctx, int i);
+  int tasks;
+  _Atomic int next;
+  _Atomic int failed;
+} query_ctx_t;
+
+// Interval given as a number and a unit, "30s", "5m", "1h" or "1d". Returns it in ms, 0 if invalid.
+int64_t query_parse_interval (const char *spec)
+{
+  char *end;
+  long n = strtol (spec, &end, 10);
+
+  if (end == spec || n < 1 || n > 366 * 24 * 3600) return 0;
+  if (strcmp (end, "s") == 0) return n * 1000LL;
+  if (strcmp (end, "m") == 0 || *end == '\0') return n * 60000LL;
+  if (strcmp (end, "h") == 0) return n * 3600000LL;
+  if (strcmp (end, "d") == 0) return n * 86400000LL;
+  return 0;
+}
+
+// Short name of an interval for file names and headers, e.g. "30s", "5m" or "1h"
+const char *query_interval_name (int64_t interval, char *buf, int size)
+{
+  if (interval % 86400000LL == 0) snprintf (buf, size, "%lldd", (long long)(interval / 86400000LL));
+  else if (interval % 3600000LL == 0) snprintf (buf, size, "%lldh", (long long)(interval / 3600000LL));
+  else if (interval % 60000LL == 0) snprintf (buf, size, "%lldm", (long long)(interval / 60000LL));
+  else snprintf (buf, size, "%llds", (long long)(interval / 1000LL));
+  return buf;
+}
+
+// Returns NULL if the query can be run, what is wrong with it otherwise
+const char *query_check (const query_t *q)
+{
+  if (q->interval < 1000 || q->interval % 1000 != 0) return "the interval must be a whole number of seconds";
+  if (q->grace_ms < 0 || q->grace_ms > (CANDLE_MAX_OPEN - 2) * q->interval) return "the grace period must be 0 to 6 intervals";
+  if (q->from >= q->to) return "the time range is empty";
+  if (q->windows < 1 || q->windows > ROLLING_MAX_WINDOWS) return "invalid number of windows";
+  for (int w = 0; w < q->windows; w++) {
+    if (q->window_minutes[w] * 60000LL % q->interval != 0) return "the windows must be multiples of the interval";
+  }
+  if (q->threads < 1) return "at least one thread is needed";
+  return NULL;
+}
+
+// Run 'task' for 0 .. tasks - 1 on the query's threads, the calling thread being one of them
+static void *task_thread (void *arg)
+{
+  query_ctx_t *ctx = (query_ctx_t *)arg;
+  int i;
+
+  while ((i = atomic_fetch_add (&ctx->next, 1)) < ctx->tasks) ctx->task (ctx, i);
+  return (NULL);
+}
+
+static void run_tasks (query_ctx_t *ctx, void (*task) (query_ctx_t *, int), int tasks)
+{
+  int n = ctx->q->threads < tasks ? ctx->q->threads : tasks, started = 0;
+  pthread_t threads[n > 1 ? n - 1 : 1];
+
+  ctx->task = task;
+  ctx->tasks = tasks;
+  atomic_store (&ctx->next, 0);
+  while (started < n - 1 && pthread_create (&threads[started], NULL, task_thread, ctx) == 0) started++;
+  task_thread (ctx);
+  for (int t = 0; t < started; t++) pthread_join (threads[t], NULL);
+}
+
+// Earliest, latest and first trade time of a partition
+static void scan_part (query_ctx_t *ctx, int i)
+{
+  part_t *p = &ctx->parts[i];
+  tlz_reader_t packed;
+  tlog_reader_t raw;
+  const double *price, *volume;
+  const int64_t *time;
+  double *buf = NULL;
+  uint32_t n;
+
+  p->min_time = INT64_MAX;
+  p->max_time = p->first_time = INT64_MIN;
+  if (p->compressed) {
+    if (tlz_open (p->path, &packed) < 0) return;
+    p->rows = packed.rows;
+    if (packed.blocks > 0) {
+      p->min_time = packed.index[0].from_min;
+      p->max_time = packed.index[packed.blocks - 1].upto_max;
+      // The first trade of the symbol starts its candles, it is the first one of the first block
+      buf = (double *) malloc (TLZ_BLOCK_ROWS * (sizeof (double) * 2 + sizeof (int64_t)));
+      if (buf == NULL || tlz_block (&packed, 0, buf, buf + TLZ_BLOCK_ROWS, (int64_t *)(buf + 2 * TLZ_BLOCK_ROWS), NULL) == 0) {
+        free (buf);
+        tlz_release (&packed);
+        return;
+      }
+      p->first_time = ((int64_t *)(buf + 2 * TLZ_BLOCK_ROWS))[0];
+      free (buf);
+    }
+    tlz_release (&packed);
+  } else {
+    if (tlog_open (p->path, &raw) < 0) return;
+    p->rows = raw.rows;
+    for (uint64_t b = 0; b < raw.blocks; b++) {
+      n = tlog_block (&raw, b, &price, &volume, &time);
+      if (b == 0) p->first_time = time[0];
+      for (uint32_t k = 0; k < n; k++) {
+        if (time[k] < p->min_time) p->min_time = time[k];
+        if (time[k] > p->max_time) p->max_time = time[k];
+      }
+    }
+    tlog_release (&raw);
+  }
+  p->ok = 1;
+}
+
+// Close the candles of 'series' up to 'watermark' into the partition's list
+static int close_into (part_t *p, candle_series_t *series, int64_t watermark, int64_t grace_ms)
+{
+  candle_t *grown;
+  int n;
+
+  do {
+    if (p->count + CLOSE_BATCH > p->max) {
+      p->max = p->max ? p->max * 2 : 128;
+      grown = (candle_t *) realloc (p->candles, p->max * sizeof (candle_t));
+      if (grown == NULL) return -1;
+      p->candles = grown;
+    }
+    n = candle_close (series, watermark, grace_ms, p->candles + p->count, CLOSE_BATCH);
+    p->count += n;
+  } while (n == CLOSE_BATCH);
+  return 0;
+}
+
+// Feed one block of trades to the series, as the worker does for each trade
+static int add_block (part_t *p, candle_series_t *series, const query_t *q,
+                      const double *price, const double *volume, const int64_t *time, uint32_t n)
+{
+  for (uint32_t k = 0; k < n; k++) {
+    if (time[k] > series->watermark && close_into (p, series, time[k], q->grace_ms) < 0) return -1;
+    if (candle_add_trade (series, time[k], trade_fixed (price[k]), trade_fixed (volume[k])) < 0) p->late++;
+  }
+  p->trades += n;
+  return 0;
+}
+
+// Aggregate one partition into candles. Its series resumes from the state the partitions (and
+// blocks) before it left: every interval the grace period has passed since their latest trade is
+// closed, and the series' watermark is that trade's time.
+static void aggregate_part (query_ctx_t *ctx, int i)
+{
+  const query_t *q = ctx->q;
+  part_t *p = &ctx->parts[i];
+  candle_series_t series;
+  tlz_reader_t packed;
+  tlog_reader_t raw;
+  const double *price, *volume;
+  const int64_t *time;
+  double *buf = NULL;
+  uint64_t first = 0, end;
+  int64_t latest = p->prev_max, resume;
+  uint32_t n;
+  int err = 0;
+
+  if (!p->selected) return;
+  candle_series_init (&series, p->symbol, q->interval);
+
+  if (p->compressed) {
+    if (tlz_open (p->path, &packed) < 0) {
+      p->bad = 1;
+      return;
+    }
+    // Only the blocks that can hold trades of the range are decoded
+    tlz_range (&packed, ctx->warm_from, q->to, &first, &end);
+    if (first > 0 && packed.index[first - 1].upto_max > latest) latest = packed.index[first - 1].upto_max;
+  } else if (tlog_open (p->path, &raw) < 0) {
+    p->bad = 1;
+    return;
+  }
+
+  if (latest != INT64_MIN) {
+    resume = candle_bucket (latest - q->grace_ms, q->interval);
+    series.next_close = resume > p->first_bucket ? resume : p->first_bucket;
+    series.watermark = latest;
+  }
+
+  if (p->compressed) {
+    buf = (double *) malloc (TLZ_BLOCK_ROWS * (sizeof (double) * 2 + sizeof (int64_t)));
+    if (buf == NULL) err = -1;
+    for (uint64_t b = first; b < end && err == 0; b++) {
+      n = tlz_block (&packed, b, buf, buf + TLZ_BLOCK_ROWS, (int64_t *)(buf + 2 * TLZ_BLOCK_ROWS), NULL);
+      if (n == 0) {
+        p->bad = 1;
+        continue;
+      }
+      err = add_block (p, &series, q, buf, buf + TLZ_BLOCK_ROWS, (int64_t *)(buf + 2 * TLZ_BLOCK_ROWS), n);
+    }
+    free (buf);
+    tlz_release (&packed);
+  } else {
+    for (uint64_t b = 0; b < raw.blocks && err == 0; b++) {
+      n = tlog_block (&raw, b, &price, &volume, &time);
+      err = add_block (p, &series, q, price, volume, time, n);
+    }
+    tlog_release (&raw);
+  }
+
+  // The minutes still open are handed over as they are, the next partition's trades merge into them
+  if (err == 0 && p->trades > 0) {
+    err = close_into (p, &series, (candle_bucket (series.watermark, q->interval) + 1) * q->interval + q->grace_ms, q->grace_ms);
+  }
+  if (err < 0) atomic_store (&ctx->failed, 1);
+}
+
+// Merge the candles of a symbol's partitions into one series, push the windows candle by
+// candle and keep the rows of the range
+static void finish_symbol (query_ctx_t *ctx, int s)
+{
+  const query_t *q = ctx->q;
+  query_result_t *res = &ctx->results[s];
+  candle_t *merged = NULL;
+  rolling_t rolling;
+  int64_t base = 0, last = INT64_MIN, bucket, from_bucket = candle_bucket (q->from, q->interval);
+  size_t filled = 0, size, idx;
+  part_t *p;
+
+  for (int i = ctx->first_part[s]; i < ctx->first_part[s + 1]; i++) {
+    p = &ctx->parts[i];
+    res->partitions += p->selected;
+    res->bad += p->bad || !p->ok;
+    res->trades += p->trades;
+    res->late += p->late;
+    if (p->count == 0) continue;
+    if (last == INT64_MIN) base = candle_bucket (p->candles[0].minute, q->interval);
+    bucket = candle_bucket (p->candles[p->count - 1].minute, q->interval);
+    if (bucket > last) last = bucket;
+  }
+  if (last == INT64_MIN) return;
+
+  size = last - base + 1;
+  merged = (candle_t *) malloc (size * sizeof (candle_t));
+  res->rows = (query_row_t *) malloc (size * sizeof (query_row_t));
+  if (merged == NULL || res->rows == NULL || rolling_init (&rolling, ctx->window_buckets, q->windows) < 0) {
+    free (merged);
+    atomic_store (&ctx->failed, 1);
+    return;
+  }
+
+  // Each partition's candles are consecutive intervals, the first ones of a partition may be the
+  // last ones of the previous partition still open when it ended
+  for (int i = ctx->first_part[s]; i < ctx->first_part[s + 1]; i++) {
+    p = &ctx->parts[i];
+    for (size_t k = 0; k < p->count; k++) {
+      bucket = candle_bucket (p->candles[k].minute, q->interval);
+      if (bucket < base) continue;
+      idx = bucket - base;
+      while (filled < idx) {
+        memset (&merged[filled], 0, sizeof (candle_t));
+        merged[filled].id = s;
+        merged[filled].minute = (base + filled) * q->interval;
+        filled++;
+      }
+      if (idx < filled) candle_merge (&merged[idx], &p->candles[k]);
+      else merged[filled++] = p->candles[k];
+    }
+  }
+
+  for (size_t k = 0; k < filled; k++) {
+    rolling_push (&rolling, &merged[k].bucket);
+    if (base + (int64_t)k < from_bucket || merged[k].minute >= q->to) continue;
+    res->rows[res->count].candle = merged[k];
+    for (int w = 0; w < q->windows; w++) rolling_get (&rolling, w, &res->rows[res->count].window[w]);
+    res->count++;
+  }
+  rolling_free (&rolling);
+  free (merged);
+}
+
+// Run the query for 'count' symbols, results[i] gets the candles of symbols[i].
+// Returns -1 if it ran out of memory; partitions that can't be read are counted in 'bad'.
+int query_run (const query_t *q, const char *const *symbols, int count, query_result_t *results)
+{
+  query_ctx_t ctx;
+  char **paths;
+  int n, max = 0, ret = 0, longest = 1;
+  part_t *grown;
+  int64_t latest, first_bucket;
+
+  memset (&ctx, 0, sizeof (ctx));
+  memset (results, 0, count * sizeof (query_result_t));
+  ctx.q = q;
+  ctx.results = results;
+  ctx.symbols = count;
+  for (int w = 0; w < q->windows; w++) ctx.window_buckets[w] = (int)(q->window_minutes[w] * 60000LL / q->interval);
+
+  // Windows of the first candle of the range reach back to the longest window's first interval
+  for (int w = 0; w < q->windows; w++) {
+    if (ctx.window_buckets[w] > longest) longest = ctx.window_buckets[w];
+  }
+  ctx.warm_from = (candle_bucket (q->from, q->interval) - longest + 1) * q->interval;
+
+  ctx.first_part = (int *) calloc (count + 1, sizeof (int));
+  if (ctx.first_part == NULL) return -1;
+  for (int s = 0; s < count; s++) {
+    results[s].symbol = symbols[s];
+    ctx.first_part[s] = ctx.part_count;
+    n = archive_list (q->dir, symbols[s], &paths);
+    for (int k = 0; k < n; k++) {
+      if (ctx.part_count == max) {
+        max = max ? max * 2 : 64;
+        grown = (part_t *) realloc (ctx.parts, max * sizeof (part_t));
+        if (grown == NULL) {
+          archive_list_free (paths, n);
+          ret = -1;
+          goto done;
+        }
+        ctx.parts = grown;
+      }
+      memset (&ctx.parts[ctx.part_count], 0, sizeof (part_t));
+      ctx.parts[ctx.part_count].path = paths[k];   // Owned by the partition from now on
+      ctx.parts[ctx.part_count].symbol = s;
+      ctx.parts[ctx.part_count].compressed = strcmp (paths[k] + strlen (paths[k]) - 4, ".tlz") == 0;
+      ctx.part_count++;
+    }
+    if (n > 0) free (paths);
+  }
+  ctx.first_part[count] = ctx.part_count;
+
+  run_tasks (&ctx, scan_part, ctx.part_count);
+
+  // Pick the partitions with trades of the range (or of the windows before it), with the latest
+  // trade time before each: the partitions of a symbol follow each other in time
+  for (int s = 0; s < count; s++) {
+    latest = INT64_MIN;
+    first_bucket = INT64_MIN;
+    for (int i = ctx.first_part[s]; i < ctx.first_part[s + 1]; i++) {
+      part_t *p = &ctx.parts[i];
+      if (!p->ok || p->rows == 0) continue;
+      if (first_bucket == INT64_MIN) {
+        if (p->first_time == INT64_MIN) break;    // The symbol's first partition can't be decoded
+        first_bucket = candle_bucket (p->first_time, q->interval);
+      }
+      p->first_bucket = first_bucket;
+      p->prev_max = latest;
+      p->selected = p->max_time >= ctx.warm_from && p->min_time < q->to;
+      if (p->max_time > latest) latest = p->max_time;
+    }
+  }
+
+  run_tasks (&ctx, aggregate_part, ctx.part_count);
+  run_tasks (&ctx, finish_symbol, count);
+  if (atomic_load (&ctx.failed)) ret = -1;
+
+done:
+  for (int i = 0; i < ctx.part_count; i++) {
+    free (ctx.parts[i].path);
+    free (ctx.parts[i].candles);
+  }
+  free (ctx.parts);
+  free (ctx.first_part);
+  return ret;
+}
+
+void query_free (query_result_t *results, int count)
+{
+  for (int s = 0; s < count; s++) {
+    free (results[s].rows);
+    results[s].rows = NULL;
+    results[s].count = 0;
+  }
+}
+
+// CSV of one symbol: time (ms), the candle and the SMA, VWAP and volume of every window.
+// Empty candles and windows without trades leave their prices empty.
+int query_write_csv (const query_t *q, const query_result_t *result, const char *path)
+{
+  FILE *fp = fopen (path, "w");
+  const query_row_t *row;
+  const candle_t *c;
+  char name[16];
+  int err;
+
+  if (fp == NULL) return -1;
+  fprintf (fp, "Time,Open,High,Low,Close,Volume,Trades");
+  for (int w = 0; w < q->windows; w++) {
+    rolling_window_name (q->window_minutes[w], name, sizeof (name));
+    fprintf (fp, ",SMA_%s,VWAP_%s,Volume_%s", name, name, name);
+  }
+  fputc ('\n', fp);
+
+  for (size_t r = 0; r < result->count; r++) {
+    row = &result->rows[r];
+    c = &row->candle;
+    if (c->bucket.trades > 0) {
+      fprintf (fp, "%lld,%.6f,%.6f,%.6f,%.6f,%.6f,%lld", (long long)c->minute, trade_decimal (c->open),
+               trade_decimal (c->high), trade_decimal (c->low), trade_decimal (c->close), trade_decimal (c->volume),
+               (long long)c->bucket.trades);
+    } else {
+      fprintf (fp, "%lld,,,,,0.000000,0", (long long)c->minute);
+    }
+    for (int w = 0; w < q->windows; w++) {
+      if (row->window[w].trades > 0) fprintf (fp, ",%.6f,%.6f,%.6f", row->window[w].sma, row->window[w].vwap, row->window[w].volume);
+      else fprintf (fp, ",,,%.6f", row->window[w].volume);
+    }
+    fputc ('\n', fp);
+  }
+  err = ferror (fp) ? -1 : 0;
+  if (fclose (fp) != 0) err = -1;
+  return err;
+}
+
+// Binary file of one symbol, see query_header_t
+int query_write_binary (const query_t *q, const query_result_t *result, const char *path)
+{
+  FILE *fp = fopen (path, "wb");
+  query_header_t hdr;
+  double record[7 + 3 * ROLLING_MAX_WINDOWS];
+  const query_row_t *row;
+  const candle_t *c;
+  int64_t whole[2];
+  int fields = 7 + 3 * q->windows, err = 0;
+
+  if (fp == NULL) return -1;
+  memset (&hdr, 0, sizeof (hdr));
+  memcpy (hdr.magic, QUERY_MAGIC, sizeof (hdr.magic));
+  hdr.version = QUERY_VERSION;
+  hdr.header_size = QUERY_HEADER_SIZE;
+  hdr.interval = q->interval;
+  hdr.rows = result->count;
+  hdr.windows = q->windows;
+  hdr.record_size = fields * sizeof (double);
+  for (int w = 0; w < q->windows; w++) hdr.window_minutes[w] = q->window_minutes[w];
+  strncpy (hdr.symbol, result->symbol, sizeof (hdr.symbol) - 1);
+  if (fwrite (&hdr, sizeof (hdr), 1, fp) != 1) err = -1;
+
+  for (size_t r = 0; r < result->count && err == 0; r++) {
+    row = &result->rows[r];
+    c = &row->candle;
+    whole[0] = c->minute;
+    whole[1] = c->bucket.trades;
+    memcpy (record, whole, sizeof (whole));
+    record[2] = c->bucket.trades > 0 ? trade_decimal (c->open) : NAN;
+    record[3] = c->bucket.trades > 0 ? trade_decimal (c->high) : NAN;
+    record[4] = c->bucket.trades > 0 ? trade_decimal (c->low) : NAN;
+    record[5] = c->bucket.trades > 0 ? trade_decimal (c->close) : NAN;
+    record[6] = trade_decimal (c->volume);
+    for (int w = 0; w < q->windows; w++) {
+      record[7 + 3 * w] = row->window[w].sma;
+      record[8 + 3 * w] = row->window[w].vwap;
+      record[9 + 3 * w] = row->window[w].volume;
+    }
+    if (fwrite (record, sizeof (double), fields, fp) != (size_t)fields) err = -1;
+  }
+  if (fclose (fp) != 0) err = -1;
+  return err;
+}
@@ -0,0 +1,78 @@
+#ifndef QUERY_H
+#define QUERY_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "candle.h"
+#include "rolling.h"
+
+// Historical query of the recorded trade logs (.tlog and .tlz partitions, see archive.h).
+// The trades of a symbol go through the same candle and rolling window code as its worker and
+// sleepyhead, in the order they were logged, so a 1-minute query gives the candles and windows the
+// live run saved (ticks aside: a live tick may close a quiet minute a little earlier and drop a
+// trade the query keeps). Any other interval is bucketed the same way.
+//
+// The partitions of every symbol are aggregated in parallel. The candle state a partition starts
+// from only depends on the latest trade time before it, which the partition indexes give, and a
+// minute split over two partitions is merged with candle_merge(). The windows are then pushed
+// candle by candle per symbol, also in parallel.
+
+#define QUERY_MAGIC "PIQRY\0\0\1"
+#define QUERY_VERSION 1
+#define QUERY_HEADER_SIZE 128
+
+typedef struct {
+  const char *dir;                          // Directory of the trade logs
+  int64_t interval;                         // Candle length, ms
+  int64_t from;                             // Exchange time range [from, to), ms since the epoch
+  int64_t to;
+  int64_t grace_ms;                         // As pi_code's '-g', at most (CANDLE_MAX_OPEN - 2) intervals
+  int windows;
+  int window_minutes[ROLLING_MAX_WINDOWS];  // Multiples of the interval
+  int threads;
+} query_t;
+
+// Candle of the result and the windows that end with it
+typedef struct {
+  candle_t candle;
+  rolling_stats_t window[ROLLING_MAX_WINDOWS];
+} query_row_t;
+
+typedef struct {
+  const char *symbol;
+  query_row_t *rows;        // Every interval from the first candle in range to the last, empty ones too
+  size_t count;
+  uint64_t trades;          // Trades aggregated, the ones before the range that feed the windows included
+  uint64_t late;            // Trades dropped as late
+  int partitions;           // Partitions read
+  int bad;                  // Partitions that could not be opened or had a corrupt block
+} query_result_t;
+
+// Binary output of one symbol: the header, then 'rows' records of
+//   int64 start, int64 trades, f8 open, high, low, close, volume, then f8 sma, vwap, volume per window
+// (NaN open/high/low/close for an empty candle, NaN sma/vwap for a window without trades).
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  uint32_t header_size;
+  int64_t interval;
+  uint64_t rows;
+  uint32_t windows;
+  uint32_t record_size;
+  int32_t window_minutes[ROLLING_MAX_WINDOWS];
+  char symbol[32];
+  uint64_t reserved[3];
+} query_header_t;
+
+// Query functions
+int64_t query_parse_interval (const char *spec);
+const char *query_interval_name (int64_t interval, char *buf, int size);
+const char *query_check (const query_t *q);
+int query_run (const query_t *q, const char *const *symbols, int count, query_result_t *results);
+void query_free (query_result_t *results, int count);
+
+// Output functions
+int query_write_csv (const query_t *q, const query_result_t *result, const char *path);
+int query_write_binary (const query_t *q, const query_result_t *result, const char *path);
+
+#endif
@@ -0,0 +1,183 @@
+#include <stdlib.h>
+#include <string.h>
+#include "replay.h"
+
+int replay_init (replay_t *r, int max_sources)
+{
+  memset (r, 0, sizeof (replay_t));
+  r->sources = (replay_source_t *) calloc (max_sources, sizeof (replay_source_t));
+  r->heap = (int *) calloc (max_sources, sizeof (int));
+  r->max = max_sources;
+  if (r->sources == NULL || r->heap == NULL) {
+    replay_free (r);
+    return -1;
+  }
+  return 0;
+}
+
+// Order of two sources by their next trade
+static int before (const replay_t *r, int a, int b)
+{
+  const replay_source_t *x = &r->sources[a], *y = &r->sources[b];
+  int64_t tx = x->time[x->row], ty = y->time[y->row];
+
+  return tx < ty || (tx == ty && x->id < y->id);
+}
+
+static void sift_up (replay_t *r, int k)
+{
+  int parent, tmp;
+
+  while (k > 0) {
+    parent = (k - 1) / 2;
+    if (!before (r, r->heap[k], r->heap[parent])) break;
+    tmp = r->heap[k];
+    r->heap[k] = r->heap[parent];
+    r->heap[parent] = tmp;
+    k = parent;
+  }
+}
+
+static void sift_down (replay_t *r, int k)
+{
+  int child, tmp;
+
+  while ((child = 2 * k + 1) < r->heap_size) {
+    if (child + 1 < r->heap_size && before (r, r->heap[child + 1], r->heap[child])) child++;
+    if (!before (r, r->heap[child], r->heap[k])) break;
+    tmp = r->heap[k];
+    r->heap[k] = r->heap[child];
+    r->heap[child] = tmp;
+    k = child;
+  }
+}
+
+static void close_part (replay_source_t *s)
+{
+  if (!s->opened) return;
+  if (s->compressed) tlz_release (&s->packed);
+  else tlog_release (&s->reader);
+  s->opened = 0;
+}
+
+static int open_part (replay_t *r, replay_source_t *s)
+{
+  const char *path = s->paths[s->part];
+  size_t len = strlen (path);
+
+  s->compressed = len > 4 && strcmp (path + len - 4, ".tlz") == 0;
+  if (s->compressed && s->buf_price == NULL) {
+    s->buf_price = (double *) malloc (TLZ_BLOCK_ROWS * sizeof (double));
+    s->buf_volume = (double *) malloc (TLZ_BLOCK_ROWS * sizeof (double));
+    s->buf_time = (int64_t *) malloc (TLZ_BLOCK_ROWS * sizeof (int64_t));
+    s->buf_closed = (int64_t *) malloc (TLZ_BLOCK_ROWS * sizeof (int64_t));
+    if (s->buf_price == NULL || s->buf_volume == NULL || s->buf_time == NULL || s->buf_closed == NULL) return -1;
+  }
+  if ((s->compressed ? tlz_open (path, &s->packed) : tlog_open (path, &s->reader)) < 0) {
+    r->bad++;
+    return -1;
+  }
+  s->opened = 1;
+  s->block = 0;
+  return 0;
+}
+
+// Load the next block of the source, moving on to its next partitions as they run out.
+// Returns the rows of the block, 0 once the last partition is exhausted.
+static uint32_t load_block (replay_t *r, replay_source_t *s)
+{
+  uint32_t rows;
+
+  while (s->part < s->parts) {
+    if (s->opened) {
+      if (s->compressed) {
+        rows = tlz_block (&s->packed, s->block, s->buf_price, s->buf_volume, s->buf_time, s->buf_closed);
+        if (rows == 0 && s->block < s->packed.blocks) r->bad++;
+        s->price = s->buf_price;
+        s->volume = s->buf_volume;
+        s->time = s->buf_time;
+        s->closed = s->buf_closed;
+      } else {
+        rows = tlog_block (&s->reader, s->block, &s->price, &s->volume, &s->time);
+        s->closed = tlog_closed (&s->reader, s->block);
+      }
+      s->block++;
+      if (rows > 0) return rows;
+      close_part (s);
+      s->part++;
+    }
+    while (s->part < s->parts && open_part (r, s) < 0) s->part++;
+  }
+  return 0;
+}
+
+// Add the partitions of a symbol, oldest first (the paths are copied). Returns -1 if there is
+// no room or memory; partitions that can't be opened are skipped and counted in 'bad'.
+int replay_add (replay_t *r, char **paths, int count, int id)
+{
+  replay_source_t *s;
+
+  if (r->count == r->max) return -1;
+  s = &r->sources[r->count];
+  s->paths = (char **) calloc (count > 0 ? count : 1, sizeof (char *));
+  if (s->paths == NULL) return -1;
+  for (int i = 0; i < count; i++) {
+    if ((s->paths[i] = strdup (paths[i])) == NULL) {
+      for (int k = 0; k < i; k++) free (s->paths[k]);
+      free (s->paths);
+      s->paths = NULL;
+      return -1;
+    }
+  }
+  s->parts = count;
+  s->id = id;
+  s->rows = load_block (r, s);
+  if (s->rows > 0) {
+    r->heap[r->heap_size++] = r->count;
+    sift_up (r, r->heap_size - 1);
+  }
+  r->count++;
+  return 0;
+}
+
+// Take the next trade and the minutes closed with it. Returns 0 once every log is exhausted.
+int replay_next (replay_t *r, int *id, double *price, double *volume, int64_t *time, int64_t *closed)
+{
+  replay_source_t *s;
+
+  if (r->heap_size == 0) return 0;
+  s = &r->sources[r->heap[0]];
+  *id = s->id;
+  *price = s->price[s->row];
+  *volume = s->volume[s->row];
+  *time = s->time[s->row];
+  *closed = s->closed != NULL ? s->closed[s->row] : -1;
+
+  // Move the source on to its next trade, dropping it when it has none left
+  if (++s->row == s->rows) {
+    s->row = 0;
+    s->rows = load_block (r, s);
+    if (s->rows == 0) r->heap[0] = r->heap[--r->heap_size];
+  }
+  sift_down (r, 0);
+  return 1;
+}
+
+void replay_free (replay_t *r)
+{
+  replay_source_t *s;
+
+  for (int i = 0; i < r->count; i++) {
+    s = &r->sources[i];
+    close_part (s);
+    for (int k = 0; k < s->parts; k++) free (s->paths[k]);
+    free (s->paths);
+    free (s->buf_price);
+    free (s->buf_volume);
+    free (s->buf_time);
+    free (s->buf_closed);
+  }
+  free (r->sources);
+  free (r->heap);
+  memset (r, 0, sizeof (replay_t));
+}
@@ -0,0 +1,53 @@
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include <stdint.h>
+#include "tlog.h"
+#include "tlz.h"
+
+// Merge of several trade logs (one per symbol) by exchange time.
+// The log of a symbol is a list of partitions (.tlog, or .tlz compressed by the archiver) read one
+// after the other, each in the order it was written, so a symbol's trades come out exactly in the
+// order its worker saw them live; between symbols the oldest trade goes first, ties by ID.
+// Each trade comes with the oldest minute of its symbol still open once it was taken live
+// (-1 if the log doesn't have them, see tlog.h).
+
+// Position in the trade log of one symbol
+typedef struct {
+  char **paths;             // Partitions, oldest first
+  int parts;
+  int part;                 // Current partition, open if 'opened' is set
+  int opened;
+  int compressed;           // The current partition is a .tlz, its blocks are decoded into 'buf_*'
+  tlog_reader_t reader;
+  tlz_reader_t packed;
+  int id;                   // Symbol ID
+  uint64_t block;           // Next block and current row
+  uint32_t row;
+  uint32_t rows;            // Rows in the current block
+  const double *price;
+  const double *volume;
+  const int64_t *time;
+  const int64_t *closed;    // NULL if the partition has no minutes closed
+  double *buf_price;
+  double *buf_volume;
+  int64_t *buf_time;
+  int64_t *buf_closed;
+} replay_source_t;
+
+typedef struct {
+  replay_source_t *sources;
+  int count;
+  int max;
+  int *heap;                // Indices of the sources that have trades left, oldest trade first
+  int heap_size;
+  int bad;                  // Partitions that could not be opened or had a corrupt block
+} replay_t;
+
+// Replay functions
+int replay_init (replay_t *r, int max_sources);
+int replay_add (replay_t *r, char **paths, int count, int id);
+int replay_next (replay_t *r, int *id, double *price, double *volume, int64_t *time, int64_t *closed);
+void replay_free (replay_t *r);
+
+#endif
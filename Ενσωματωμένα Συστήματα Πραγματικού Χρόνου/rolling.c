@@ -0,0 +1,112 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "rolling.h"
+
+// Parse a comma separated list of window lengths in minutes (e.g. "1,5,15,60").
+// Returns the number of windows, or -1 if the list is invalid.
+int rolling_parse_windows (const char *spec, int *minutes, int max)
+{
+  int n = 0;
+  long m;
+  char *end;
+
+  while (*spec != '\0') {
+    m = strtol (spec, &end, 10);
+    if (end == spec || m < 1 || m > 24 * 60 || n == max) return -1;
+    minutes[n++] = (int)m;
+    if (*end == ',') end++;
+    else if (*end != '\0') return -1;
+    spec = end;
+  }
+  return n ? n : -1;
+}
+
+// Short name of a window for file headers and prints, e.g. "15m" or "1h"
+const char *rolling_window_name (int minutes, char *buf, int size)
+{
+  if (minutes % 60 == 0) snprintf (buf, size, "%dh", minutes / 60);
+  else snprintf (buf, size, "%dm", minutes);
+  return buf;
+}
+
+int rolling_init (rolling_t *r, const int *minutes, int windows)
+{
+  memset (r, 0, sizeof (rolling_t));
+  if (windows < 1 || windows > ROLLING_MAX_WINDOWS) return -1;
+
+  for (int w = 0; w < windows; w++) {
+    r->window[w].minutes = minutes[w];
+    if (minutes[w] > r->capacity) r->capacity = minutes[w];
+  }
+  r->windows = windows;
+
+  r->ring = (rolling_bucket_t *) calloc (r->capacity, sizeof (rolling_bucket_t));
+  return r->ring == NULL ? -1 : 0;
+}
+
+void rolling_free (rolling_t *r)
+{
+  free (r->ring);
+  r->ring = NULL;
+}
+
+// Add one trade (fixed point) to a bucket. Only its notional is rounded, once, here.
+void rolling_add_trade (rolling_bucket_t *b, int64_t price, int64_t volume)
+{
+  b->trades++;
+  b->price_sum += price;
+  b->volume += volume;
+  b->notional += trade_notional (price, volume);
+}
+
+static void bucket_add (rolling_bucket_t *sum, const rolling_bucket_t *b)
+{
+  sum->trades += b->trades;
+  sum->price_sum += b->price_sum;
+  sum->volume += b->volume;
+  sum->notional += b->notional;
+}
+
+static void bucket_sub (rolling_bucket_t *sum, const rolling_bucket_t *b)
+{
+  sum->trades -= b->trades;
+  sum->price_sum -= b->price_sum;
+  sum->volume -= b->volume;
+  sum->notional -= b->notional;
+}
+
+// Close a minute: add its bucket to every window and drop the bucket that left each window.
+// O(windows), independent of the window lengths.
+void rolling_push (rolling_t *r, const rolling_bucket_t *bucket)
+{
+  size_t slot = r->pushed % r->capacity;
+
+  for (int w = 0; w < r->windows; w++) {
+    rolling_window_t *win = &r->window[w];
+    if (r->pushed >= (uint64_t)win->minutes)
+      bucket_sub (&win->sum, &r->ring[(r->pushed - win->minutes) % r->capacity]);
+    bucket_add (&win->sum, bucket);
+  }
+
+  // The slot is overwritten only after the longest window dropped the bucket it held
+  r->ring[slot] = *bucket;
+  r->pushed++;
+}
+
+// Statistics of any set of sums (used for the windows and by the brute-force check)
+void rolling_stats (const rolling_bucket_t *sum, rolling_stats_t *out)
+{
+  out->trades = sum->trades;
+  out->volume = (double)sum->volume / ROLLING_SCALE;
+  out->sma = sum->trades > 0 ? (double)sum->price_sum / ROLLING_SCALE / sum->trades : NAN;
+  out->vwap = sum->volume > 0 ? (double)sum->notional / sum->volume : NAN;
+  out->full = 0;
+}
+
+void rolling_get (const rolling_t *r, int w, rolling_stats_t *out)
+{
+  rolling_stats (&r->window[w].sum, out);
+  out->full = r->pushed >= (uint64_t)r->window[w].minutes;
+}
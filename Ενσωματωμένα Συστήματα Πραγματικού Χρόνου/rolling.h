@@ -0,0 +1,55 @@
+#ifndef ROLLING_H
+#define ROLLING_H
+
+#include <stdint.h>
+#include "trade.h"
+
+// Rolling statistics over several windows of 1-minute buckets.
+// Every quantity is kept as an exact fixed-point integer (1e-6 units, those of the trades), so the
+// running sums that are updated in O(1) per bucket are always identical to summing the buckets again.
+
+#define ROLLING_SCALE TRADE_SCALE   // Fixed-point units per unit of price, volume and notional
+#define ROLLING_MAX_WINDOWS 8
+#define ROLLING_DEFAULT_WINDOWS "1,5,15,60"
+
+// Trades of one minute (or the running sums of a whole window)
+typedef struct {
+  int64_t trades;
+  int64_t price_sum;    // Sum of the trade prices
+  int64_t volume;       // Sum of the trade volumes
+  int64_t notional;     // Sum of price * volume of each trade
+} rolling_bucket_t;
+
+typedef struct {
+  int minutes;            // Window length in buckets
+  rolling_bucket_t sum;   // Running sums of the last 'minutes' buckets
+} rolling_window_t;
+
+typedef struct {
+  rolling_bucket_t *ring;   // The last 'capacity' buckets, capacity is the longest window
+  int capacity;
+  uint64_t pushed;          // Number of buckets pushed so far
+  int windows;
+  rolling_window_t window[ROLLING_MAX_WINDOWS];
+} rolling_t;
+
+// Statistics of one window
+typedef struct {
+  int64_t trades;
+  double sma;       // Trade-weighted mean price of all the trades in the window
+  double vwap;      // Volume-weighted average price
+  double volume;
+  int full;         // 1 once the window has seen 'minutes' buckets
+} rolling_stats_t;
+
+// Rolling functions
+int rolling_parse_windows (const char *spec, int *minutes, int max);
+const char *rolling_window_name (int minutes, char *buf, int size);
+int rolling_init (rolling_t *r, const int *minutes, int windows);
+void rolling_free (rolling_t *r);
+void rolling_add_trade (rolling_bucket_t *b, int64_t price, int64_t volume);
+void rolling_push (rolling_t *r, const rolling_bucket_t *bucket);
+void rolling_get (const rolling_t *r, int w, rolling_stats_t *out);
+void rolling_stats (const rolling_bucket_t *sum, rolling_stats_t *out);
+
+#endif
@@ -0,0 +1,334 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include "rt_thread.h"
+
+#define RT_RUNTIME_PATH "/proc/sys/kernel/sched_rt_runtime_us"
+
+// Fallbacks reported once per role
+enum { WARN_CPU = 1, WARN_POLICY = 2, WARN_PRIORITY = 4 };
+
+static const char *role_names[RT_ROLES] = { "main", "producer", "consumer", "sleepyhead" };
+
+static rt_config_t config;          // All zero: any CPU, SCHED_OTHER
+static int configured;              // rt_configure() succeeded, threads place themselves
+static cpu_set_t allowed;           // CPUs the process may use, for roles without a list
+static _Atomic int warned[RT_ROLES];
+
+static void warn_once (rt_role_t role, int bit, const char *fmt, ...)
+{
+  va_list ap;
+
+  if (atomic_fetch_or (&warned[role], bit) & bit) return;
+  va_start (ap, fmt);
+  vfprintf (stderr, fmt, ap);
+  va_end (ap);
+}
+
+const char *rt_role_name (rt_role_t role)
+{
+  return role_names[role];
+}
+
+static const char *policy_name (int policy)
+{
+  return policy == SCHED_FIFO ? "fifo" : policy == SCHED_RR ? "rr" : "other";
+}
+
+// CPU list like "0", "2,3" or "1-3", "-" for any CPU. Returns -1 if invalid.
+static int parse_cpus (const char *spec, rt_role_config_t *r)
+{
+  const char *p = spec;
+  char *end;
+  long first, last;
+
+  r->cpu_count = 0;
+  if (strcmp (spec, "-") == 0) return 0;
+  while (*p != '\0') {
+    first = last = strtol (p, &end, 10);
+    if (end == p) return -1;
+    if (*end == '-') {
+      p = end + 1;
+      last = strtol (p, &end, 10);
+      if (end == p) return -1;
+    }
+    if (first < 0 || last < first || last >= CPU_SETSIZE) return -1;
+    for (long cpu = first; cpu <= last; cpu++) {
+      if (r->cpu_count == RT_MAX_CPUS) return -1;
+      r->cpus[r->cpu_count++] = (int)cpu;
+    }
+    if (*end == ',') end++;
+    else if (*end != '\0') return -1;
+    p = end;
+  }
+  return r->cpu_count > 0 ? 0 : -1;
+}
+
+// One line: "<role> <cpus> [<policy> [<priority>]]", "mlock" or "busy-poll". Returns an error message or NULL.
+static const char *parse_line (char *line)
+{
+  char *token[5], *save, *end;
+  int count = 0, role;
+  rt_role_config_t *r;
+
+  if ((end = strchr (line, '#')) != NULL) *end = '\0';
+  for (char *t = strtok_r (line, " \t\r\n", &save); t != NULL; t = strtok_r (NULL, " \t\r\n", &save)) {
+    if (count == 5) return "too many fields";
+    token[count++] = t;
+  }
+  if (count == 0) return NULL;
+
+  if (strcmp (token[0], "mlock") == 0 || strcmp (token[0], "busy-poll") == 0) {
+    if (count > 1) return "options take no value";
+    if (token[0][0] == 'm') config.mlock = 1;
+    else config.busy_poll = 1;
+    return NULL;
+  }
+
+  for (role = 0; role < RT_ROLES && strcmp (token[0], role_names[role]) != 0; role++)
+    ;
+  if (role == RT_ROLES) return "unknown role, expected main, producer, consumer or sleepyhead";
+  if (count < 2 || count > 4) return "expected <role> <cpus> [<policy> [<priority>]]";
+  r = &config.role[role];
+  if (parse_cpus (token[1], r) < 0) return "invalid CPU list, expected e.g. 0, 2,3, 1-3 or -";
+
+  r->policy = SCHED_OTHER;
+  r->priority = 0;
+  if (count > 2) {
+    if (strcmp (token[2], "fifo") == 0) r->policy = SCHED_FIFO;
+    else if (strcmp (token[2], "rr") == 0) r->policy = SCHED_RR;
+    else if (strcmp (token[2], "other") != 0) return "invalid policy, expected other, fifo or rr";
+  }
+  if (r->policy != SCHED_OTHER) {
+    if (count < 4) return "fifo and rr need a priority";
+    r->priority = (int)strtol (token[3], &end, 10);
+    if (*end != '\0' || r->priority < sched_get_priority_min (r->policy) || r->priority > sched_get_priority_max (r->policy))
+      return "invalid priority, expected 1 to 99";
+  } else if (count > 3) {
+    return "other takes no priority";
+  }
+  return NULL;
+}
+
+// Read the placement from a file, or from its lines given inline separated by ';'.
+// Returns -1 (with a message on stderr) if the configuration is invalid.
+int rt_configure (const char *spec)
+{
+  FILE *fp;
+  char line[256], *inline_spec, *save, *part;
+  const char *error = NULL;
+  int number = 0;
+  rt_role_config_t *consumer = &config.role[RT_CONSUMER];
+
+  memset (&config, 0, sizeof (config));
+  fp = fopen (spec, "r");
+  if (fp != NULL) {
+    while (error == NULL && fgets (line, sizeof (line), fp) != NULL) {
+      number++;
+      error = parse_line (line);
+    }
+    fclose (fp);
+  } else if (strchr (spec, ';') != NULL || strchr (spec, ' ') != NULL) {
+    if ((inline_spec = strdup (spec)) == NULL) return -1;
+    for (part = strtok_r (inline_spec, ";", &save); error == NULL && part != NULL; part = strtok_r (NULL, ";", &save)) {
+      number++;
+      snprintf (line, sizeof (line), "%s", part);
+      error = parse_line (line);
+    }
+    free (inline_spec);
+  } else {
+    perror ("Error opening thread placement file");
+    return -1;
+  }
+  if (error != NULL) {
+    fprintf (stderr, "rt: %s, entry %d: %s\n", spec, number, error);
+    return -1;
+  }
+
+  // Drop the CPUs the process can't use, a role left without any runs anywhere
+  if (sched_getaffinity (0, sizeof (allowed), &allowed) < 0) {
+    CPU_ZERO (&allowed);
+    for (int cpu = 0; cpu < sysconf (_SC_NPROCESSORS_ONLN) && cpu < CPU_SETSIZE; cpu++) CPU_SET (cpu, &allowed);
+  }
+  for (int role = 0; role < RT_ROLES; role++) {
+    rt_role_config_t *r = &config.role[role];
+    int kept = 0;
+    for (int k = 0; k < r->cpu_count; k++) {
+      if (CPU_ISSET (r->cpus[k], &allowed)) r->cpus[kept++] = r->cpus[k];
+      else fprintf (stderr, "rt: CPU %d of %s is not available, dropped\n", r->cpus[k], role_names[role]);
+    }
+    r->cpu_count = kept;
+  }
+
+  // A spinning consumer needs CPUs of its own
+  if (config.busy_poll) {
+    for (int role = 0; role < RT_ROLES && config.busy_poll; role++) {
+      if (role == RT_CONSUMER) continue;
+      for (int k = 0; k < config.role[role].cpu_count; k++) {
+        for (int c = 0; c < consumer->cpu_count; c++) {
+          if (config.role[role].cpus[k] == consumer->cpus[c]) config.busy_poll = 0;
+        }
+      }
+    }
+    if (consumer->cpu_count == 0 || !config.busy_poll) {
+      fprintf (stderr, "rt: busy-poll needs the consumers on CPUs no other role uses, turned off\n");
+      config.busy_poll = 0;
+    }
+  }
+
+  // The kernel throttles real-time threads that never sleep (by default 50 ms every second),
+  // a spinning consumer would stall for that long, so it stays SCHED_OTHER on its CPUs
+  if (config.busy_poll && consumer->policy != SCHED_OTHER) {
+    long runtime = 0;
+    if ((fp = fopen (RT_RUNTIME_PATH, "r")) != NULL) {
+      if (fscanf (fp, "%ld", &runtime) != 1) runtime = 0;
+      fclose (fp);
+    }
+    if (runtime != -1) {
+      fprintf (stderr, "rt: busy-polling consumers run SCHED_OTHER unless %s is -1\n", RT_RUNTIME_PATH);
+      consumer->policy = SCHED_OTHER;
+      consumer->priority = 0;
+    }
+  }
+  configured = 1;
+  return 0;
+}
+
+// Whether 'threads' consumers busy-poll, each needs a CPU of its own
+int rt_busy_poll (int threads)
+{
+  if (config.busy_poll && threads > config.role[RT_CONSUMER].cpu_count) {
+    fprintf (stderr, "rt: busy-poll needs a CPU per consumer (%d for %d), turned off\n",
+             config.role[RT_CONSUMER].cpu_count, threads);
+    config.busy_poll = 0;
+  }
+  return config.busy_poll;
+}
+
+void rt_print_config (void)
+{
+  const rt_role_config_t *r;
+
+  if (!configured) return;
+  printf ("Thread placement:");
+  for (int role = 0; role < RT_ROLES; role++) {
+    r = &config.role[role];
+    printf (" %s ", role_names[role]);
+    if (r->cpu_count == 0) printf ("-");
+    for (int k = 0; k < r->cpu_count; k++) printf ("%s%d", k ? "," : "", r->cpus[k]);
+    printf (" %s", policy_name (r->policy));
+    if (r->policy != SCHED_OTHER) printf (" %d", r->priority);
+    printf (role < RT_ROLES - 1 ? ";" : "");
+  }
+  printf ("%s%s\n", config.mlock ? "; mlock" : "", config.busy_poll ? "; busy-poll" : "");
+}
+
+// Lock the memory of the process (with 'mlock' in the configuration) so the pipeline never
+// waits for a page fault. Call it once the buffers are allocated, before starting the threads.
+// Returns -1 if the memory could not be locked.
+int rt_lock_memory (void)
+{
+  pthread_attr_t attr;
+  struct rlimit lim;
+  int flags = MCL_CURRENT | MCL_FUTURE;
+  char *heap;
+
+  if (!configured || !config.mlock) return 0;
+
+  // Freed memory stays in the heap and large blocks come from it too, so a free() followed by a
+  // malloc() never faults again; fault some in now
+  mallopt (M_TRIM_THRESHOLD, -1);
+  mallopt (M_MMAP_MAX, 0);
+  if ((heap = (char *) malloc (RT_HEAP_PREFAULT)) != NULL) {
+    memset (heap, 0, RT_HEAP_PREFAULT);
+    free (heap);
+  }
+
+  // Threads created from now on get a smaller stack, all of it is locked
+  if (pthread_attr_init (&attr) == 0) {
+    pthread_attr_setstacksize (&attr, RT_STACK_SIZE);
+    pthread_setattr_default_np (&attr);
+    pthread_attr_destroy (&attr);
+  }
+
+  // Without CAP_IPC_LOCK a later mapping (a trade log growing) would fail past RLIMIT_MEMLOCK,
+  // so only the current memory is locked
+  if (geteuid () != 0 && getrlimit (RLIMIT_MEMLOCK, &lim) == 0 && lim.rlim_cur != RLIM_INFINITY) {
+    fprintf (stderr, "rt: RLIMIT_MEMLOCK is %llu KiB, only the current memory gets locked\n",
+             (unsigned long long)lim.rlim_cur / 1024);
+    flags = MCL_CURRENT;
+  }
+  if (mlockall (flags) < 0) {
+    fprintf (stderr, "rt: mlockall failed (%s), the memory is not locked\n", strerror (errno));
+    return -1;
+  }
+  return 0;
+}
+
+// Touch the top of the stack, locked pages are faulted in once
+static void __attribute__((noinline)) prefault_stack (void)
+{
+  volatile char stack[RT_STACK_PREFAULT];
+
+  for (size_t i = 0; i < sizeof (stack); i += 4096) stack[i] = 0;
+}
+
+// Apply the placement of 'role' to the calling thread, the index-th of its role.
+// Returns -1 if a setting fell back (reported once per role), 0 otherwise.
+int rt_place_self (rt_role_t role, int index)
+{
+  const rt_role_config_t *r = &config.role[role];
+  struct sched_param param;
+  struct rlimit lim;
+  cpu_set_t set;
+  int err, ret = 0;
+
+  if (!configured) return 0;
+
+  // The k-th CPU of the list (main gets them all, its housekeeping threads share them), or any
+  // CPU: threads start with the CPUs and policy of main, which may be placed already
+  if (r->cpu_count == 0) {
+    set = allowed;
+  } else {
+    CPU_ZERO (&set);
+    if (role == RT_MAIN) {
+      for (int k = 0; k < r->cpu_count; k++) CPU_SET (r->cpus[k], &set);
+    } else {
+      CPU_SET (r->cpus[index % r->cpu_count], &set);
+    }
+  }
+  err = pthread_setaffinity_np (pthread_self (), sizeof (set), &set);
+  if (err != 0) {
+    warn_once (role, WARN_CPU, "rt: %s can't be pinned (%s), it runs on any CPU\n", role_names[role], strerror (err));
+    ret = -1;
+  }
+
+  // Unprivileged, RLIMIT_RTPRIO may still allow a lower priority
+  param.sched_priority = r->priority;
+  err = pthread_setschedparam (pthread_self (), r->policy, &param);
+  if (err == EPERM && getrlimit (RLIMIT_RTPRIO, &lim) == 0 && lim.rlim_cur > 0) {
+    param.sched_priority = lim.rlim_cur < (rlim_t)r->priority ? (int)lim.rlim_cur : r->priority;
+    err = pthread_setschedparam (pthread_self (), r->policy, &param);
+    if (err == 0) warn_once (role, WARN_PRIORITY, "rt: %s priority lowered to %d by RLIMIT_RTPRIO\n", role_names[role], param.sched_priority);
+  }
+  if (err != 0) {
+    param.sched_priority = 0;
+    pthread_setschedparam (pthread_self (), SCHED_OTHER, &param);
+    warn_once (role, WARN_POLICY, "rt: %s can't run %s %d (%s), it runs SCHED_OTHER\n", role_names[role],
+               policy_name (r->policy), r->priority, strerror (err));
+    ret = -1;
+  }
+
+  if (config.mlock) prefault_stack ();
+  return ret;
+}
@@ -0,0 +1,50 @@
+#ifndef RT_THREAD_H
+#define RT_THREAD_H
+
+#include <stddef.h>
+
+// Real-time placement of the pipeline threads.
+// Every role gets a CPU list, a scheduling policy and a priority, read from a file (see rt.conf)
+// or from the same lines given inline, separated by ';'. A thread places itself with
+// rt_place_self() when it starts. Threads started by the main thread after it placed itself (the
+// log writer, the archiver) inherit its CPUs and policy.
+// Without the privileges (CAP_SYS_NICE / RLIMIT_RTPRIO, CAP_IPC_LOCK / RLIMIT_MEMLOCK) or CPUs,
+// a setting falls back to what is allowed and the run goes on; each fallback is reported once.
+
+#define RT_MAX_CPUS 64
+#define RT_STACK_SIZE (1024 * 1024)     // Stack of the threads created once the memory is locked
+#define RT_STACK_PREFAULT (64 * 1024)   // Stack touched by every placed thread
+#define RT_HEAP_PREFAULT (8 * 1024 * 1024) // Heap faulted in and kept once the memory is locked
+
+typedef enum {
+  RT_MAIN,          // Main thread, and the housekeeping threads it starts
+  RT_PRODUCER,      // One per connection
+  RT_CONSUMER,      // One per worker
+  RT_SLEEPYHEAD,
+  RT_ROLES
+} rt_role_t;
+
+typedef struct {
+  int cpus[RT_MAX_CPUS];  // Thread k of the role runs on cpus[k % cpu_count], main on all of them
+  int cpu_count;          // 0: any CPU
+  int policy;             // SCHED_OTHER, SCHED_FIFO or SCHED_RR
+  int priority;           // 1-99 for SCHED_FIFO and SCHED_RR
+} rt_role_config_t;
+
+typedef struct {
+  rt_role_config_t role[RT_ROLES];
+  int mlock;              // Lock the memory and pre-fault the heap and stacks
+  int busy_poll;          // Consumers spin on their rings instead of sleeping
+} rt_config_t;
+
+// Configuration functions
+int rt_configure (const char *spec);
+int rt_busy_poll (int threads);
+void rt_print_config (void);
+
+// Placement functions
+int rt_lock_memory (void);
+int rt_place_self (rt_role_t role, int index);
+const char *rt_role_name (rt_role_t role);
+
+#endif
@@ -0,0 +1,165 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "shm_feed.h"
+
+#define SHM_FEED_HEADER_SIZE CACHE_LINE_SIZE   // The records start on a cache line
+
+_Static_assert (sizeof (shm_feed_header_t) <= SHM_FEED_HEADER_SIZE, "shm feed header must fit in a cache line");
+_Static_assert (sizeof (shm_symbol_t) % CACHE_LINE_SIZE == 0, "shm feed records must be whole cache lines");
+
+static shm_feed_t *shm_feed_map (const char *name, int fd, size_t size, int writer)
+{
+  shm_feed_t *feed = (shm_feed_t *) calloc (1, sizeof (shm_feed_t));
+  char *map;
+
+  if (feed == NULL) return (NULL);
+  map = mmap (NULL, size, writer ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+  if (map == MAP_FAILED) {
+    free (feed);
+    return (NULL);
+  }
+  strncpy (feed->name, name, SHM_FEED_NAME_LEN - 1);
+  feed->writer = writer;
+  feed->size = size;
+  feed->hdr = (shm_feed_header_t *)map;
+  feed->records = (shm_symbol_t *)(map + SHM_FEED_HEADER_SIZE);
+  return feed;
+}
+
+// Create (replace) the segment 'name' with room for 'capacity' symbols. Returns NULL with errno set on failure.
+// A reader that still maps the old segment sees it closed.
+shm_feed_t *shm_feed_create (const char *name, uint32_t capacity)
+{
+  size_t size = SHM_FEED_HEADER_SIZE + (size_t)capacity * sizeof (shm_symbol_t);
+  shm_feed_t *feed;
+  int fd, err;
+
+  if (strlen (name) >= SHM_FEED_NAME_LEN) {
+    errno = ENAMETOOLONG;
+    return (NULL);
+  }
+  shm_unlink (name);
+  fd = shm_open (name, O_RDWR | O_CREAT | O_EXCL, 0644);
+  if (fd < 0) return (NULL);
+  if (ftruncate (fd, size) < 0 || (feed = shm_feed_map (name, fd, size, 1)) == NULL) {
+    err = errno;
+    close (fd);
+    shm_unlink (name);
+    errno = err;
+    return (NULL);
+  }
+  close (fd);   // The mapping keeps the segment
+
+  // ftruncate zero-filled the segment: every record is unused and never written
+  feed->hdr->version = SHM_FEED_VERSION;
+  feed->hdr->header_size = SHM_FEED_HEADER_SIZE;
+  feed->hdr->record_size = sizeof (shm_symbol_t);
+  feed->hdr->capacity = capacity;
+  feed->hdr->writer_pid = getpid ();
+  atomic_store_explicit (&feed->hdr->magic, SHM_FEED_MAGIC, memory_order_release);
+  return feed;
+}
+
+// Give symbol 'id' its record. Returns NULL if the ID doesn't fit in the segment.
+// Called by the thread that loads the symbols, before any trade of the symbol is published.
+shm_symbol_t *shm_feed_add (shm_feed_t *feed, int id, const char *symbol)
+{
+  shm_symbol_t *rec;
+
+  if (id < 0 || (uint32_t)id >= feed->hdr->capacity) return (NULL);
+  rec = &feed->records[id];
+  if (atomic_load_explicit (&rec->used, memory_order_relaxed)) return rec;
+
+  strncpy (rec->name, symbol, SHM_FEED_NAME_LEN - 1);
+  rec->id = id;
+  atomic_store_explicit (&rec->used, 1, memory_order_release);
+  if ((uint32_t)id >= atomic_load_explicit (&feed->hdr->count, memory_order_relaxed))
+    atomic_store_explicit (&feed->hdr->count, id + 1, memory_order_release);
+  return rec;
+}
+
+// Unmap the segment. The writer marks it closed and removes its name, the readers that
+// mapped it keep the last values.
+void shm_feed_close (shm_feed_t *feed)
+{
+  if (feed == NULL) return;
+  if (feed->writer) {
+    atomic_store_explicit (&feed->hdr->closed, 1, memory_order_release);
+    shm_unlink (feed->name);
+  }
+  munmap (feed->hdr, feed->size);
+  free (feed);
+}
+
+// Map the segment 'name' read-only. Returns NULL with errno set if it doesn't exist or has another layout.
+shm_feed_t *shm_feed_open (const char *name)
+{
+  const shm_feed_header_t *hdr;
+  shm_feed_t *feed;
+  struct stat st;
+  int fd = shm_open (name, O_RDONLY, 0);
+
+  if (fd < 0) return (NULL);
+  if (fstat (fd, &st) < 0) {
+    close (fd);
+    return (NULL);
+  }
+  if ((size_t)st.st_size < SHM_FEED_HEADER_SIZE) {
+    close (fd);
+    errno = EPROTO;   // Not created by shm_feed_create (yet)
+    return (NULL);
+  }
+  feed = shm_feed_map (name, fd, st.st_size, 0);
+  close (fd);
+  if (feed == NULL) return (NULL);
+
+  hdr = feed->hdr;
+  if (atomic_load_explicit (&hdr->magic, memory_order_acquire) != SHM_FEED_MAGIC || hdr->version != SHM_FEED_VERSION ||
+      hdr->header_size != SHM_FEED_HEADER_SIZE || hdr->record_size != sizeof (shm_symbol_t) ||
+      SHM_FEED_HEADER_SIZE + (size_t)hdr->capacity * sizeof (shm_symbol_t) > feed->size) {
+    munmap (feed->hdr, feed->size);
+    free (feed);
+    errno = EPROTO;
+    return (NULL);
+  }
+  return feed;
+}
+
+// Record of symbol 'id', NULL if the writer hasn't added it
+shm_symbol_t *shm_feed_symbol (const shm_feed_t *feed, int id)
+{
+  shm_symbol_t *rec;
+
+  if (id < 0 || (uint32_t)id >= atomic_load_explicit (&feed->hdr->count, memory_order_acquire)) return (NULL);
+  rec = &feed->records[id];
+  return atomic_load_explicit (&rec->used, memory_order_acquire) ? rec : NULL;
+}
+
+// Record of a symbol by name (a linear scan, keep the pointer)
+shm_symbol_t *shm_feed_find (const shm_feed_t *feed, const char *symbol)
+{
+  uint32_t count = atomic_load_explicit (&feed->hdr->count, memory_order_acquire);
+  shm_symbol_t *rec;
+
+  for (uint32_t id = 0; id < count; id++) {
+    rec = shm_feed_symbol (feed, id);
+    if (rec != NULL && strncmp (rec->name, symbol, SHM_FEED_NAME_LEN) == 0) return rec;
+  }
+  return (NULL);
+}
+
+uint32_t shm_feed_read_live (const shm_symbol_t *rec, shm_live_t *out)
+{
+  return shm_feed_read (&rec->live_seq, &rec->live, out, sizeof (shm_live_t));
+}
+
+uint32_t shm_feed_read_stats (const shm_symbol_t *rec, shm_stats_t *out)
+{
+  return shm_feed_read (&rec->stats_seq, &rec->stats, out, sizeof (shm_stats_t));
+}
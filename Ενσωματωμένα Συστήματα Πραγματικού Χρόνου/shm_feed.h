@@ -0,0 +1,142 @@
+#ifndef SHM_FEED_H
+#define SHM_FEED_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include "spsc_ring.h"
+
+// Live data of every symbol in a POSIX shared memory segment (/dev/shm/<name>), for other processes.
+// The segment is a header followed by one fixed-size record per symbol ID. A record has two
+// sections, each with a single writer and its own sequence counter (seqlock): the last trade and
+// open candle, written by the symbol's worker at every trade, and the rolling windows and indicators,
+// written by sleepyhead when a minute is closed. Readers map the segment read-only and copy a section without
+// locks or system calls, retrying if a write was in progress; a writer never waits for readers.
+// All the times of the records are CLOCK_MONOTONIC (ns), so a reader on the same machine can tell
+// how old a value is.
+
+#define SHM_FEED_MAGIC 0x44454546u          // "FEED"
+#define SHM_FEED_VERSION 2
+#define SHM_FEED_DEFAULT_NAME "/pi_code"
+#define SHM_FEED_DEFAULT_CAPACITY 1024      // Records of the segment, symbols with a larger ID are not published
+#define SHM_FEED_NAME_LEN 32
+#define SHM_FEED_MAX_WINDOWS 8
+#define SHM_FEED_MAX_INDICATORS 16
+
+// Last trade and open candle of a symbol
+typedef struct {
+  int64_t update_ns;        // Time of the write
+  uint64_t trades;          // Trades of the symbol since the start
+  double price;             // Last trade
+  double volume;
+  int64_t time;             // Exchange time of the last trade (ms since the epoch)
+  int64_t pub_ns;           // Time the producer published the trade to the worker
+  int64_t minute;           // Open candle of the latest minute, start in ms since the epoch
+  double open;
+  double high;
+  double low;
+  double close;
+  double candle_volume;
+  int64_t candle_trades;
+} shm_live_t;
+
+// Rolling statistics of one window, as of the last closed minute
+typedef struct {
+  int32_t minutes;          // Window length
+  int32_t full;             // 1 once the window has seen 'minutes' minutes
+  int64_t trades;
+  double sma;
+  double vwap;
+  double volume;
+} shm_window_t;
+
+// Value of a technical indicator (see indicator.h), NAN until it has seen enough minutes
+typedef struct {
+  char name[SHM_FEED_NAME_LEN];   // e.g. "ema(20)" or "bollinger(20,2).upper"
+  double value;
+} shm_indicator_t;
+
+typedef struct {
+  int64_t update_ns;        // Time of the write
+  int64_t minute;           // Last closed minute, start in ms since the epoch
+  int32_t windows;
+  int32_t reserved;
+  shm_window_t window[SHM_FEED_MAX_WINDOWS];
+  int32_t indicators;
+  int32_t reserved2;
+  shm_indicator_t indicator[SHM_FEED_MAX_INDICATORS];
+} shm_stats_t;
+
+// Record of one symbol, each section on its own cache lines so the two writers don't share any
+typedef struct {
+  char name[SHM_FEED_NAME_LEN];
+  int32_t id;
+  _Atomic int32_t used;     // Set once the symbol has been added
+
+  _Alignas(CACHE_LINE_SIZE) _Atomic uint32_t live_seq;   // Odd while the section is being written
+  shm_live_t live;
+
+  _Alignas(CACHE_LINE_SIZE) _Atomic uint32_t stats_seq;
+  shm_stats_t stats;
+} shm_symbol_t;
+
+typedef struct {
+  _Atomic uint32_t magic;     // Stored last, the segment is ready once it is set
+  uint32_t version;
+  uint32_t header_size;
+  uint32_t record_size;
+  uint32_t capacity;
+  _Atomic uint32_t count;     // Records in use, IDs below it
+  _Atomic int32_t closed;     // Set when the writer exits, the values stop changing
+  int32_t writer_pid;
+} shm_feed_header_t;
+
+// Writer or reader mapping of a segment
+typedef struct {
+  char name[SHM_FEED_NAME_LEN];
+  int writer;
+  size_t size;
+  shm_feed_header_t *hdr;
+  shm_symbol_t *records;
+} shm_feed_t;
+
+// Write section 'data' of 'size' bytes under the sequence counter 'seq' (single writer)
+static inline void shm_feed_write (_Atomic uint32_t *seq, void *section, const void *data, size_t size)
+{
+  uint32_t s = atomic_load_explicit (seq, memory_order_relaxed);
+
+  atomic_store_explicit (seq, s + 1, memory_order_relaxed);
+  atomic_thread_fence (memory_order_release);   // The odd counter is visible before any of the data
+  __builtin_memcpy (section, data, size);
+  atomic_store_explicit (seq, s + 2, memory_order_release);
+}
+
+// Copy a section written by shm_feed_write. The copy can be torn while a write is in progress,
+// the counter tells and the copy is done again. Returns the (even) counter of the copied version,
+// 0 if the section was never written.
+static inline uint32_t shm_feed_read (const _Atomic uint32_t *seq, const void *section, void *out, size_t size)
+{
+  uint32_t s1, s2;
+
+  for (;;) {
+    s1 = atomic_load_explicit (seq, memory_order_acquire);
+    if (s1 & 1) continue;   // Being written, a write is a few hundred ns
+    __builtin_memcpy (out, section, size);
+    atomic_thread_fence (memory_order_acquire);   // The copy is done before the counter is checked again
+    s2 = atomic_load_explicit (seq, memory_order_relaxed);
+    if (s1 == s2) return s1;
+  }
+}
+
+// Writer functions
+shm_feed_t *shm_feed_create (const char *name, uint32_t capacity);
+shm_symbol_t *shm_feed_add (shm_feed_t *feed, int id, const char *symbol);
+void shm_feed_close (shm_feed_t *feed);
+
+// Reader functions
+shm_feed_t *shm_feed_open (const char *name);
+shm_symbol_t *shm_feed_symbol (const shm_feed_t *feed, int id);
+shm_symbol_t *shm_feed_find (const shm_feed_t *feed, const char *symbol);
+uint32_t shm_feed_read_live (const shm_symbol_t *rec, shm_live_t *out);
+uint32_t shm_feed_read_stats (const shm_symbol_t *rec, shm_stats_t *out);
+
+#endif
@@ -0,0 +1,287 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include "spsc_ring.h"
+
+#define SPIN_MIN 64       // Lower bound of the adaptive spin budget
+#define SPIN_MAX 16384    // Upper bound of the adaptive spin budget
+
+// Spinning only helps when the other side runs on another core, so it is disabled on a single CPU
+static uint32_t spin_max = SPIN_MAX;
+
+// Hint to the core that we are busy-waiting
+static inline void cpu_relax (void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause ();
+#elif defined(__arm__) || defined(__aarch64__)
+  __asm__ __volatile__ ("yield" ::: "memory");
+#endif
+}
+
+static long futex (_Atomic uint32_t *addr, int op, uint32_t val)
+{
+  return syscall (SYS_futex, addr, op, val, NULL, NULL, 0);
+}
+
+void spsc_event_init (spsc_event_t *ev)
+{
+  atomic_init (&ev->seq, 0);
+  atomic_init (&ev->sleeping, 0);
+  ev->spin_limit = spin_max < SPIN_MIN ? spin_max : SPIN_MIN;
+  ev->busy_poll = 0;
+}
+
+// Make the waiter spin without ever sleeping (a thread with a CPU of its own): the other side
+// then never makes a futex call either. Set it before the waiter starts.
+void spsc_event_busy_poll (spsc_event_t *ev, int on)
+{
+  ev->busy_poll = on;
+}
+
+// Wake up the waiting side if it went to sleep. The seq_cst fence pairs with the one in
+// event_wait(): either the waiter sees the new index, or we see its 'sleeping' flag.
+// Clearing the flag makes sure a burst of pushes costs one futex call, not one per trade.
+void spsc_event_signal (spsc_event_t *ev)
+{
+  atomic_thread_fence (memory_order_seq_cst);
+  if (atomic_load_explicit (&ev->sleeping, memory_order_relaxed) != 0 &&
+      atomic_exchange_explicit (&ev->sleeping, 0, memory_order_acq_rel) != 0) {
+    atomic_fetch_add_explicit (&ev->seq, 1, memory_order_release);
+    futex (&ev->seq, FUTEX_WAKE_PRIVATE, INT_MAX);
+  }
+}
+
+// Unconditionally wake up everyone sleeping on the event (only uses async-signal-safe calls)
+void spsc_event_wake_all (spsc_event_t *ev)
+{
+  atomic_fetch_add_explicit (&ev->seq, 1, memory_order_seq_cst);
+  futex (&ev->seq, FUTEX_WAKE_PRIVATE, INT_MAX);
+}
+
+// Consumer check: refresh the cached tail and report if there is something to read
+static int ring_not_empty (void *arg)
+{
+  spsc_ring_t *r = arg;
+
+  r->tail_cache = atomic_load_explicit (&r->tail, memory_order_acquire);
+  return r->tail_cache != atomic_load_explicit (&r->head, memory_order_relaxed);
+}
+
+// Producer check: refresh the cached head and report if there is a free slot
+static int ring_not_full (void *arg)
+{
+  spsc_ring_t *r = arg;
+
+  r->head_cache = atomic_load_explicit (&r->head, memory_order_acquire);
+  return atomic_load_explicit (&r->tail, memory_order_relaxed) - r->head_cache < r->capacity;
+}
+
+// Spin for a while, then sleep on the futex until 'ready(arg)' holds.
+// Returns 0 when the condition holds and -1 when '*closed' was set.
+// The thread that sets '*closed' must call spsc_event_wake_all() afterwards.
+int spsc_event_wait (spsc_event_t *ev, int (*ready)(void *), void *arg, _Atomic int *closed)
+{
+  uint32_t seq;
+
+  if (ev->busy_poll) {
+    while (!ready (arg)) {
+      if (atomic_load_explicit (closed, memory_order_acquire)) return -1;
+      cpu_relax ();
+    }
+    return 0;
+  }
+
+  // Spin phase: cheap when the other side is only a few hundred nanoseconds away
+  for (uint32_t i = 0; i < ev->spin_limit; i++) {
+    if (ready (arg)) {
+      if (ev->spin_limit < spin_max) ev->spin_limit <<= 1;    // Spinning paid off, spin longer next time
+      return 0;
+    }
+    if (atomic_load_explicit (closed, memory_order_relaxed)) return -1;
+    cpu_relax ();
+  }
+  if (ev->spin_limit > SPIN_MIN) ev->spin_limit >>= 1;        // Spinning was wasted, spin less next time
+
+  // Sleep phase
+  while (1) {
+    seq = atomic_load_explicit (&ev->seq, memory_order_acquire);
+    atomic_store_explicit (&ev->sleeping, 1, memory_order_seq_cst);
+    atomic_thread_fence (memory_order_seq_cst);
+
+    if (ready (arg)) {
+      atomic_store_explicit (&ev->sleeping, 0, memory_order_relaxed);
+      return 0;
+    }
+    if (atomic_load_explicit (closed, memory_order_acquire)) {
+      atomic_store_explicit (&ev->sleeping, 0, memory_order_relaxed);
+      return -1;
+    }
+
+    futex (&ev->seq, FUTEX_WAIT_PRIVATE, seq);    // Returns at once if 'seq' already moved
+  }
+}
+
+spsc_ring_t *spsc_ring_init (size_t capacity, size_t elem_size)
+{
+  spsc_ring_t *r;
+  size_t size = 1;
+
+  while (size < capacity) size <<= 1;   // Round up to a power of two so indices can be masked
+
+  if (sysconf (_SC_NPROCESSORS_ONLN) <= 1) spin_max = 0;
+
+  if (posix_memalign ((void **)&r, CACHE_LINE_SIZE, sizeof (spsc_ring_t)) != 0) return (NULL);
+  memset (r, 0, sizeof (spsc_ring_t));
+
+  if (posix_memalign ((void **)&r->buf, CACHE_LINE_SIZE, size * elem_size) != 0) {
+    free (r);
+    return (NULL);
+  }
+
+  atomic_init (&r->head, 0);
+  atomic_init (&r->tail, 0);
+  atomic_init (&r->closed, 0);
+  r->capacity = size;
+  r->mask = size - 1;
+  r->elem_size = elem_size;
+  spsc_event_init (&r->not_empty);
+  spsc_event_init (&r->not_full);
+
+  return (r);
+}
+
+void spsc_ring_delete (spsc_ring_t *r)
+{
+  free (r->buf);
+  free (r);
+}
+
+// Add one element, waiting while the ring is full. Returns -1 if the ring was closed.
+int spsc_ring_push (spsc_ring_t *r, const void *in)
+{
+  size_t tail = atomic_load_explicit (&r->tail, memory_order_relaxed);
+
+  if (tail - r->head_cache == r->capacity && !ring_not_full (r)) {
+    if (spsc_event_wait (&r->not_full, ring_not_full, r, &r->closed) < 0) return -1;
+  }
+
+  memcpy (r->buf + (tail & r->mask) * r->elem_size, in, r->elem_size);
+  atomic_store_explicit (&r->tail, tail + 1, memory_order_release);
+  spsc_event_signal (&r->not_empty);
+
+  return 0;
+}
+
+// Copy 'k' elements to the free slots at 'tail' (in at most two chunks, the second one only if
+// the batch wraps around), publish them and wake up the consumer
+static void ring_put (spsc_ring_t *r, size_t tail, const char *in, size_t k)
+{
+  size_t first = r->capacity - (tail & r->mask);
+
+  if (first > k) first = k;
+  memcpy (r->buf + (tail & r->mask) * r->elem_size, in, first * r->elem_size);
+  memcpy (r->buf, in + first * r->elem_size, (k - first) * r->elem_size);
+  atomic_store_explicit (&r->tail, tail + k, memory_order_release);
+  spsc_event_signal (&r->not_empty);
+}
+
+// Add 'n' elements with a single publish of 'tail' and a single wake-up of the consumer, so the
+// consumer sees them as one contiguous batch. If they don't fit, the ring is filled and
+// published in as few chunks as the free space allows. Returns -1 if the ring was closed.
+int spsc_ring_push_batch (spsc_ring_t *r, const void *data, size_t n)
+{
+  const char *in = data;
+  size_t tail = atomic_load_explicit (&r->tail, memory_order_relaxed);
+  size_t room, k;
+
+  while (n > 0) {
+    room = r->capacity - (tail - r->head_cache);
+    if (room < n && ring_not_full (r)) room = r->capacity - (tail - r->head_cache);
+    if (room == 0) {
+      if (spsc_event_wait (&r->not_full, ring_not_full, r, &r->closed) < 0) return -1;
+      room = r->capacity - (tail - r->head_cache);
+    }
+
+    k = n < room ? n : room;
+    ring_put (r, tail, in, k);
+    tail += k;
+    in += k * r->elem_size;
+    n -= k;
+  }
+
+  return 0;
+}
+
+// Add up to 'n' elements without waiting, as one batch. Returns the number added, 0 if the ring
+// is full or closed.
+size_t spsc_ring_try_push_batch (spsc_ring_t *r, const void *data, size_t n)
+{
+  size_t tail = atomic_load_explicit (&r->tail, memory_order_relaxed);
+  size_t room = r->capacity - (tail - r->head_cache);
+
+  if (atomic_load_explicit (&r->closed, memory_order_relaxed)) return 0;
+  if (room < n && ring_not_full (r)) room = r->capacity - (tail - r->head_cache);
+  if (n > room) n = room;
+  if (n > 0) ring_put (r, tail, data, n);
+  return n;
+}
+
+// Copy up to 'max' of the available elements out and release their slots
+static size_t ring_take (spsc_ring_t *r, size_t head, char *out, size_t max)
+{
+  size_t n, first;
+
+  n = r->tail_cache - head;
+  if (n > max) n = max;
+
+  // Copy in at most two chunks, the second one only if the batch wraps around
+  first = r->capacity - (head & r->mask);
+  if (first > n) first = n;
+  memcpy (out, r->buf + (head & r->mask) * r->elem_size, first * r->elem_size);
+  memcpy (out + first * r->elem_size, r->buf, (n - first) * r->elem_size);
+
+  atomic_store_explicit (&r->head, head + n, memory_order_release);
+  spsc_event_signal (&r->not_full);
+
+  return n;
+}
+
+// Remove up to 'max' elements at once, waiting while the ring is empty.
+// Returns the number of elements copied to 'out', or 0 if the ring was closed.
+size_t spsc_ring_pop_batch (spsc_ring_t *r, void *out, size_t max)
+{
+  size_t head = atomic_load_explicit (&r->head, memory_order_relaxed);
+
+  if (head == r->tail_cache && !ring_not_empty (r)) {
+    if (spsc_event_wait (&r->not_empty, ring_not_empty, r, &r->closed) < 0) return 0;
+  }
+  return ring_take (r, head, out, max);
+}
+
+// Remove up to 'max' elements at once without waiting. Returns 0 if the ring is empty.
+size_t spsc_ring_try_pop_batch (spsc_ring_t *r, void *out, size_t max)
+{
+  size_t head = atomic_load_explicit (&r->head, memory_order_relaxed);
+
+  if (head == r->tail_cache && !ring_not_empty (r)) return 0;
+  return ring_take (r, head, out, max);
+}
+
+// Approximate number of queued trades (exact when called from either side)
+size_t spsc_ring_size (spsc_ring_t *r)
+{
+  return atomic_load_explicit (&r->tail, memory_order_acquire) - atomic_load_explicit (&r->head, memory_order_acquire);
+}
+
+// Mark the ring as closed and wake up both sides. Safe to call from a signal handler.
+void spsc_ring_close (spsc_ring_t *r)
+{
+  atomic_store_explicit (&r->closed, 1, memory_order_seq_cst);
+  spsc_event_wake_all (&r->not_empty);
+  spsc_event_wake_all (&r->not_full);
+}
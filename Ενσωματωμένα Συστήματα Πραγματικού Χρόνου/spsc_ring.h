@@ -0,0 +1,61 @@
+#ifndef SPSC_RING_H
+#define SPSC_RING_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+#define CACHE_LINE_SIZE 64
+
+// Event counter used to put a thread to sleep on a futex after spinning for a while.
+// The waiter snapshots 'seq', re-checks its condition and sleeps only if 'seq' did not move.
+// There is at most one waiter per event (the single producer or the single consumer).
+typedef struct {
+  _Atomic uint32_t seq;       // Bumped on every wake-up, used as the futex word
+  _Atomic uint32_t sleeping;  // Set while the waiter is sleeping (or about to sleep) on 'seq'
+  uint32_t spin_limit;        // Adaptive spin budget, only touched by the waiting thread
+  uint32_t busy_poll;         // The waiter spins until the condition holds and never sleeps
+} spsc_event_t;
+
+// Lock-free single-producer/single-consumer ring buffer of fixed-size elements (trades, candles).
+// The producer only writes 'tail', the consumer only writes 'head'; each lives on its own
+// cache line together with a cached copy of the other side's index, so in the common case
+// neither side touches the other's cache line.
+typedef struct {
+  // Producer side
+  _Alignas(CACHE_LINE_SIZE) _Atomic size_t tail;   // Next slot to be written
+  size_t head_cache;                                // Producer's last view of 'head'
+
+  // Consumer side
+  _Alignas(CACHE_LINE_SIZE) _Atomic size_t head;   // Next slot to be read
+  size_t tail_cache;                                // Consumer's last view of 'tail'
+
+  _Alignas(CACHE_LINE_SIZE) spsc_event_t not_empty; // Consumer sleeps here when the ring is empty
+  _Alignas(CACHE_LINE_SIZE) spsc_event_t not_full;  // Producer sleeps here when the ring is full
+
+  _Alignas(CACHE_LINE_SIZE) _Atomic int closed;    // Set on shutdown, wakes up and releases both sides
+  size_t capacity;                                  // Number of slots, always a power of two
+  size_t mask;
+  size_t elem_size;                                 // Size of one element in bytes
+  char *buf;
+} spsc_ring_t;
+
+// Ring functions
+spsc_ring_t *spsc_ring_init (size_t capacity, size_t elem_size);
+void spsc_ring_delete (spsc_ring_t *r);
+int spsc_ring_push (spsc_ring_t *r, const void *in);
+int spsc_ring_push_batch (spsc_ring_t *r, const void *in, size_t n);
+size_t spsc_ring_try_push_batch (spsc_ring_t *r, const void *in, size_t n);
+size_t spsc_ring_pop_batch (spsc_ring_t *r, void *out, size_t max);
+size_t spsc_ring_try_pop_batch (spsc_ring_t *r, void *out, size_t max);
+size_t spsc_ring_size (spsc_ring_t *r);
+void spsc_ring_close (spsc_ring_t *r);
+
+// Event functions
+void spsc_event_init (spsc_event_t *ev);
+void spsc_event_signal (spsc_event_t *ev);
+void spsc_event_wake_all (spsc_event_t *ev);
+void spsc_event_busy_poll (spsc_event_t *ev, int on);
+int spsc_event_wait (spsc_event_t *ev, int (*ready)(void *), void *arg, _Atomic int *closed);
+
+#endif
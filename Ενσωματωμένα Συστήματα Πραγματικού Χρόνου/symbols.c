@@ -0,0 +1,189 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <stdint.h>
+#include "symbols.h"
+
+#define HASH_INITIAL_SIZE 64   // Number of hash slots, always a power of two
+
+static symbol_t *blocks[SYMBOL_MAX_BLOCKS];   // Symbol storage, allocated one block at a time
+static int interned = 0;                       // Number of symbols interned (only used by the loading thread)
+static _Atomic int published = 0;              // Number of symbols visible to the other threads
+
+// Open addressing hash table (linear probing) from symbol name to ID, -1 marks an empty slot
+static int *hash_slots = NULL;
+static size_t hash_size = 0;
+
+// FNV-1a hash of the symbol name
+static uint32_t hash_name (const char *name, size_t len)
+{
+  uint32_t h = 2166136261u;
+  for (size_t i = 0; i < len; i++) {
+    h ^= (unsigned char)name[i];
+    h *= 16777619u;
+  }
+  return h;
+}
+
+// Find the hash slot of 'name', or the empty slot where it would be inserted
+static size_t hash_find (const char *name, size_t len)
+{
+  size_t mask = hash_size - 1;
+  size_t slot = hash_name (name, len) & mask;
+  symbol_t *sym;
+
+  while (hash_slots[slot] != -1) {
+    sym = symbol_get (hash_slots[slot]);
+    if (strncmp (sym->name, name, len) == 0 && sym->name[len] == '\0') break;
+    slot = (slot + 1) & mask;
+  }
+  return slot;
+}
+
+// Double the hash table and re-insert every symbol
+static int hash_grow (void)
+{
+  int *old_slots = hash_slots;
+  size_t old_size = hash_size;
+
+  hash_size = old_size ? old_size * 2 : HASH_INITIAL_SIZE;
+  hash_slots = (int *) malloc (hash_size * sizeof (int));
+  if (hash_slots == NULL) {
+    hash_slots = old_slots;
+    hash_size = old_size;
+    return -1;
+  }
+  memset (hash_slots, 0xff, hash_size * sizeof (int));
+
+  for (int id = 0; id < interned; id++) {
+    symbol_t *sym = symbol_get (id);
+    hash_slots[hash_find (sym->name, strlen (sym->name))] = id;
+  }
+  free (old_slots);
+  return 0;
+}
+
+// Intern a symbol name, returning its ID (a new one if the name was never seen)
+static int symbol_intern (const char *name, size_t len)
+{
+  int id;
+  symbol_t *sym;
+
+  if (len == 0 || len >= MAX_SYMBOL_LEN) return -1;
+
+  // Keep the load factor under 1/2 so probe sequences stay short
+  if ((size_t)(interned + 1) * 2 > hash_size && hash_grow () < 0) return -1;
+
+  id = hash_slots[hash_find (name, len)];
+  if (id != -1) return id;
+
+  if (interned == SYMBOL_MAX_BLOCKS * SYMBOL_BLOCK_SIZE) return -1;
+
+  id = interned;
+  if (blocks[id >> SYMBOL_BLOCK_BITS] == NULL) {
+    blocks[id >> SYMBOL_BLOCK_BITS] = (symbol_t *) calloc (SYMBOL_BLOCK_SIZE, sizeof (symbol_t));
+    if (blocks[id >> SYMBOL_BLOCK_BITS] == NULL) return -1;
+  }
+
+  sym = symbol_get (id);
+  memcpy (sym->name, name, len);
+  sym->name[len] = '\0';
+  sym->id = id;
+  atomic_init (&sym->active, 0);
+  sym->state = NULL;
+  interned++;
+
+  hash_slots[hash_find (name, len)] = id;
+  return id;
+}
+
+// Look up the ID of a symbol in O(1), -1 if it was never interned
+int symbol_lookup (const char *name, size_t len)
+{
+  if (hash_size == 0) return -1;
+  return hash_slots[hash_find (name, len)];
+}
+
+symbol_t *symbol_get (int id)
+{
+  return &blocks[id >> SYMBOL_BLOCK_BITS][id & (SYMBOL_BLOCK_SIZE - 1)];
+}
+
+// Number of symbols whose state is initialized, IDs below this are safe to use from any thread
+int symbol_count (void)
+{
+  return atomic_load_explicit (&published, memory_order_acquire);
+}
+
+// Load (or reload) the config file: one symbol per line, '#' starts a comment.
+// Symbols that appear are interned and activated, symbols that disappeared are deactivated,
+// and 'on_change' is called for each of them before the new symbols become visible.
+// Returns the number of changed symbols, or -1 if the file couldn't be read.
+int symbols_load (const char *path, symbol_change_cb on_change)
+{
+  FILE *fp;
+  char line[256];
+  char *start, *end;
+  unsigned char *seen;
+  int id, old_interned = interned, changes = 0;
+
+  fp = fopen (path, "r");
+  if (fp == NULL) {
+    perror ("Error opening symbols file");
+    return -1;
+  }
+
+  seen = (unsigned char *) calloc (SYMBOL_MAX_BLOCKS * SYMBOL_BLOCK_SIZE, 1);
+  if (seen == NULL) {
+    fclose (fp);
+    return -1;
+  }
+
+  while (fgets (line, sizeof (line), fp) != NULL) {
+    // Strip comments and surrounding white space
+    if ((end = strchr (line, '#')) != NULL) *end = '\0';
+    for (start = line; isspace ((unsigned char)*start); start++)
+      ;
+    for (end = start + strlen (start); end > start && isspace ((unsigned char)end[-1]); end--)
+      ;
+    if (end == start) continue;
+
+    id = symbol_intern (start, end - start);
+    if (id < 0) {
+      fprintf (stderr, "symbols: can't register '%.*s'\n", (int)(end - start), start);
+      continue;
+    }
+    seen[id] = 1;
+  }
+  fclose (fp);
+
+  for (id = 0; id < interned; id++) {
+    symbol_t *sym = symbol_get (id);
+    int active = atomic_load_explicit (&sym->active, memory_order_relaxed);
+
+    if (seen[id] == active && id < old_interned) continue;
+
+    // New symbols always get a callback so the application can attach its state
+    atomic_store_explicit (&sym->active, seen[id], memory_order_release);
+    on_change (sym, seen[id]);
+    changes++;
+  }
+  free (seen);
+
+  atomic_store_explicit (&published, interned, memory_order_release);
+  return changes;
+}
+
+void symbols_free (void)
+{
+  for (int b = 0; b < SYMBOL_MAX_BLOCKS; b++) {
+    free (blocks[b]);
+    blocks[b] = NULL;
+  }
+  free (hash_slots);
+  hash_slots = NULL;
+  hash_size = 0;
+  interned = 0;
+  atomic_store (&published, 0);
+}
@@ -0,0 +1,33 @@
+#ifndef SYMBOLS_H
+#define SYMBOLS_H
+
+#include <stddef.h>
+#include <stdatomic.h>
+#include "trade.h"
+
+// Symbols are stored in fixed-size blocks that are never moved, so a symbol's address stays
+// valid while the registry grows and other threads can keep using it without locking
+#define SYMBOL_BLOCK_BITS 6
+#define SYMBOL_BLOCK_SIZE (1 << SYMBOL_BLOCK_BITS)
+#define SYMBOL_MAX_BLOCKS 1024     // Up to 65536 symbols
+
+// Entry of the runtime symbol registry
+typedef struct {
+  char name[MAX_SYMBOL_LEN];
+  int id;                 // Dense integer ID, never reused or changed once interned
+  _Atomic int active;     // 1 while the symbol is in the config file and subscribed
+  void *state;            // Per-symbol state owned by the application
+} symbol_t;
+
+// Called by symbols_load() for every symbol that was added (subscribed = 1) or removed (subscribed = 0)
+typedef void (*symbol_change_cb)(symbol_t *sym, int subscribed);
+
+// Registry functions. Lookups can run in several threads at once, but never while loading
+// (the application serializes them); symbol_get() and symbol_count() can be called from any thread.
+int symbols_load (const char *path, symbol_change_cb on_change);
+int symbol_lookup (const char *name, size_t len);
+symbol_t *symbol_get (int id);
+int symbol_count (void);
+void symbols_free (void);
+
+#endif
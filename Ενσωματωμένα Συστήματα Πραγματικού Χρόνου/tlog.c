@@ -0,0 +1,243 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "tlog.h"
+
+#define TLOG_GROW_BLOCKS 4    // Blocks added to the file every time it runs out of space
+
+_Static_assert (sizeof (tlog_header_t) == TLOG_HEADER_SIZE, "tlog header must be 192 bytes");
+
+static const tlog_column_t schema[TLOG_COLUMNS] = {
+  { "price",  "<f8", 0 },
+  { "volume", "<f8", TLOG_BLOCK_ROWS * sizeof (double) },
+  { "time",   "<i8", TLOG_BLOCK_ROWS * sizeof (double) * 2 },
+  { "closed", "<i8", TLOG_BLOCK_ROWS * (sizeof (double) * 2 + sizeof (int64_t)) },
+};
+
+// Grow the file to 'size' bytes and map all of it again.
+// The space is allocated up front so appends never hit a full disk through a page fault.
+static int tlog_grow (tlog_t *log, size_t size)
+{
+  char *map;
+  int err = posix_fallocate (log->fd, 0, size);
+
+  if (err == EOPNOTSUPP || err == EINVAL) err = ftruncate (log->fd, size) < 0 ? errno : 0;
+  if (err != 0) {
+    errno = err;
+    return -1;
+  }
+
+  map = mmap (NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, log->fd, 0);
+  if (map == MAP_FAILED) return -1;
+  if (log->map != NULL) munmap (log->map, log->map_size);
+
+  log->map = map;
+  log->map_size = size;
+  log->hdr = (tlog_header_t *)map;
+  return 0;
+}
+
+// Point the column pointers at the block that holds row 'log->rows'
+static int tlog_set_block (tlog_t *log)
+{
+  size_t offset = TLOG_HEADER_SIZE + (log->rows / TLOG_BLOCK_ROWS) * TLOG_BLOCK_SIZE;
+
+  if (offset + TLOG_BLOCK_SIZE > log->map_size &&
+      tlog_grow (log, log->map_size + TLOG_GROW_BLOCKS * TLOG_BLOCK_SIZE) < 0) return -1;
+
+  log->price = (double *)(log->map + offset + schema[0].offset);
+  log->volume = (double *)(log->map + offset + schema[1].offset);
+  log->time = (int64_t *)(log->map + offset + schema[2].offset);
+  log->closed = (int64_t *)(log->map + offset + schema[3].offset);
+  log->slot = log->rows % TLOG_BLOCK_ROWS;
+  return 0;
+}
+
+// Create (truncate) the log of 'symbol'. Returns NULL with errno set on failure.
+tlog_t *tlog_create (const char *path, const char *symbol)
+{
+  tlog_t *log = (tlog_t *) calloc (1, sizeof (tlog_t));
+  int err;
+
+  if (log == NULL) return (NULL);
+
+  log->fd = open (path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (log->fd < 0) {
+    free (log);
+    return (NULL);
+  }
+  if (tlog_grow (log, TLOG_HEADER_SIZE + TLOG_GROW_BLOCKS * TLOG_BLOCK_SIZE) < 0 || tlog_set_block (log) < 0) {
+    err = errno;
+    close (log->fd);
+    free (log);
+    errno = err;
+    return (NULL);
+  }
+
+  memcpy (log->hdr->magic, TLOG_MAGIC, sizeof (log->hdr->magic));
+  log->hdr->version = TLOG_VERSION;
+  log->hdr->header_size = TLOG_HEADER_SIZE;
+  log->hdr->block_rows = TLOG_BLOCK_ROWS;
+  log->hdr->columns = TLOG_COLUMNS;
+  strncpy (log->hdr->symbol, symbol, sizeof (log->hdr->symbol) - 1);
+  memcpy (log->hdr->column, schema, sizeof (schema));
+
+  return (log);
+}
+
+// Append one trade, with the oldest minute of the symbol still open after it. Returns -1 if the
+// file could not be grown.
+int tlog_append (tlog_t *log, double price, double volume, int64_t time, int64_t closed)
+{
+  if (log->slot == TLOG_BLOCK_ROWS && tlog_set_block (log) < 0) return -1;
+
+  log->price[log->slot] = price;
+  log->volume[log->slot] = volume;
+  log->time[log->slot] = time;
+  log->closed[log->slot] = closed;
+  log->slot++;
+  log->rows++;
+  log->hdr->rows = log->rows;
+  return 0;
+}
+
+// Write the footer index, trim the pre-grown space and close the file
+int tlog_close (tlog_t *log)
+{
+  uint64_t blocks = (log->rows + TLOG_BLOCK_ROWS - 1) / TLOG_BLOCK_ROWS;
+  size_t footer_offset = TLOG_HEADER_SIZE + blocks * TLOG_BLOCK_SIZE;
+  size_t size = footer_offset + sizeof (tlog_footer_t) + blocks * sizeof (tlog_index_t);
+  tlog_footer_t *footer;
+  tlog_index_t *index;
+  int ret = 0;
+
+  if (size > log->map_size && tlog_grow (log, size) < 0) {
+    ret = -1;
+  } else {
+    footer = (tlog_footer_t *)(log->map + footer_offset);
+    index = (tlog_index_t *)(footer + 1);
+    memcpy (footer->magic, TLOG_FOOTER_MAGIC, sizeof (footer->magic));
+    footer->blocks = blocks;
+
+    for (uint64_t b = 0; b < blocks; b++) {
+      const char *block = log->map + TLOG_HEADER_SIZE + b * TLOG_BLOCK_SIZE;
+      const double *price = (const double *)(block + schema[0].offset);
+      const int64_t *time = (const int64_t *)(block + schema[2].offset);
+      uint32_t n = (b == blocks - 1) ? log->rows - b * TLOG_BLOCK_ROWS : TLOG_BLOCK_ROWS;
+
+      index[b].first_time = time[0];
+      index[b].last_time = time[n - 1];
+      index[b].low = index[b].high = price[0];
+      for (uint32_t i = 1; i < n; i++) {
+        if (price[i] < index[b].low) index[b].low = price[i];
+        if (price[i] > index[b].high) index[b].high = price[i];
+      }
+    }
+    log->hdr->footer_offset = footer_offset;
+  }
+
+  munmap (log->map, log->map_size);
+  if (ret == 0 && ftruncate (log->fd, size) < 0) ret = -1;
+  if (close (log->fd) < 0) ret = -1;
+  free (log);
+  return ret;
+}
+
+// Map a log for reading. Returns -1 with errno set if it can't be opened or isn't a trade log.
+int tlog_open (const char *path, tlog_reader_t *r)
+{
+  struct stat st;
+  const tlog_footer_t *footer;
+  uint64_t fit;
+  int fd = open (path, O_RDONLY);
+
+  memset (r, 0, sizeof (tlog_reader_t));
+  if (fd < 0) return -1;
+  if (fstat (fd, &st) < 0 || (size_t)st.st_size < TLOG_V1_HEADER_SIZE) {
+    close (fd);
+    errno = EINVAL;
+    return -1;
+  }
+
+  r->size = st.st_size;
+  r->map = mmap (NULL, r->size, PROT_READ, MAP_SHARED, fd, 0);
+  close (fd);
+  if (r->map == MAP_FAILED) {
+    r->map = NULL;
+    return -1;
+  }
+  r->hdr = (const tlog_header_t *)r->map;
+
+  if (r->hdr->version == 1) {
+    r->header_size = TLOG_V1_HEADER_SIZE;
+    r->block_size = TLOG_V1_BLOCK_SIZE;
+  } else {
+    r->header_size = TLOG_HEADER_SIZE;
+    r->block_size = TLOG_BLOCK_SIZE;
+  }
+  if (memcmp (r->hdr->magic, TLOG_MAGIC, sizeof (r->hdr->magic)) != 0 ||
+      (r->hdr->version != 1 && r->hdr->version != TLOG_VERSION) || r->hdr->header_size != r->header_size ||
+      r->hdr->block_rows != TLOG_BLOCK_ROWS || r->size < r->header_size) {
+    tlog_release (r);
+    errno = EINVAL;
+    return -1;
+  }
+
+  // A file that is still open (or crashed) may claim rows that are not in the file yet
+  r->rows = r->hdr->rows;
+  fit = (r->size - r->header_size) / r->block_size * TLOG_BLOCK_ROWS;
+  if (r->rows > fit) r->rows = fit;
+  r->blocks = (r->rows + TLOG_BLOCK_ROWS - 1) / TLOG_BLOCK_ROWS;
+
+  if (r->hdr->footer_offset != 0 && r->hdr->footer_offset + sizeof (tlog_footer_t) <= r->size) {
+    footer = (const tlog_footer_t *)(r->map + r->hdr->footer_offset);
+    if (memcmp (footer->magic, TLOG_FOOTER_MAGIC, sizeof (footer->magic)) == 0 && footer->blocks == r->blocks)
+      r->index = (const tlog_index_t *)(footer + 1);
+  }
+  return 0;
+}
+
+// Get the columns of one block. Returns the number of rows in it.
+uint32_t tlog_block (const tlog_reader_t *r, uint64_t block, const double **price, const double **volume, const int64_t **time)
+{
+  const char *base = r->map + r->header_size + block * r->block_size;
+
+  if (block >= r->blocks) return 0;
+  *price = (const double *)(base + schema[0].offset);
+  *volume = (const double *)(base + schema[1].offset);
+  *time = (const int64_t *)(base + schema[2].offset);
+  return (block == r->blocks - 1) ? r->rows - block * TLOG_BLOCK_ROWS : TLOG_BLOCK_ROWS;
+}
+
+// Minutes closed of the rows of one block, NULL past the end or in a version 1 log
+const int64_t *tlog_closed (const tlog_reader_t *r, uint64_t block)
+{
+  if (block >= r->blocks || r->hdr->version == 1) return (NULL);
+  return (const int64_t *)(r->map + r->header_size + block * r->block_size + schema[3].offset);
+}
+
+// First block that may hold trades at or after 'time' (binary search on the index, 0 without one).
+// Returns r->blocks if every trade is older.
+uint64_t tlog_seek_time (const tlog_reader_t *r, int64_t time)
+{
+  uint64_t lo = 0, hi = r->blocks, mid;
+
+  if (r->index == NULL) return 0;
+  while (lo < hi) {
+    mid = lo + (hi - lo) / 2;
+    if (r->index[mid].last_time < time) lo = mid + 1;
+    else hi = mid;
+  }
+  return lo;
+}
+
+void tlog_release (tlog_reader_t *r)
+{
+  if (r->map != NULL) munmap ((void *)r->map, r->size);
+  memset (r, 0, sizeof (tlog_reader_t));
+}
@@ -0,0 +1,103 @@
+#ifndef TLOG_H
+#define TLOG_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Binary, column-oriented, append-only trade log of one symbol (<SYMBOL>.tlog), little-endian.
+//
+//   [header, 128 bytes] [block 0] [block 1] ... [block n-1] [footer]
+//
+// Each block holds TLOG_BLOCK_ROWS rows stored column by column (all prices, then all volumes,
+// then all times, then the minutes closed), so a column of a block is a plain C array and the
+// whole file can be viewed as an array of blocks by numpy.memmap. The last block is padded with zeros.
+// The file is pre-grown and written through mmap; 'rows' in the header is kept up to date while
+// the file is open, the footer (a per-block index) is only written by tlog_close().
+//
+// 'closed' is the oldest minute (time / 60000) of the symbol still open once its worker took the trade, so a
+// replay closes the minutes where the live run did, wall-clock ticks included, and drops the
+// same late trades. Version 1 logs (128-byte header, no 'closed' column) are still read.
+
+#define TLOG_MAGIC "TLOG\0\0\0\1"
+#define TLOG_FOOTER_MAGIC "TLOGIDX\1"
+#define TLOG_VERSION 2
+#define TLOG_HEADER_SIZE 192
+#define TLOG_BLOCK_ROWS 4096
+#define TLOG_COLUMNS 4
+#define TLOG_BLOCK_SIZE (TLOG_BLOCK_ROWS * (sizeof (double) * 2 + sizeof (int64_t) * 2))
+#define TLOG_V1_HEADER_SIZE 128
+#define TLOG_V1_COLUMNS 3
+#define TLOG_V1_BLOCK_SIZE (TLOG_BLOCK_ROWS * (sizeof (double) * 2 + sizeof (int64_t)))
+
+// Schema entry of one column
+typedef struct {
+  char name[8];       // "price", "volume", "time", "closed" (NUL padded)
+  char dtype[4];      // numpy type string, e.g. "<f8"
+  uint32_t offset;    // Byte offset of the column inside a block
+} tlog_column_t;
+
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  uint32_t header_size;
+  uint32_t block_rows;
+  uint32_t columns;
+  uint64_t rows;            // Number of rows written
+  uint64_t footer_offset;   // 0 until the file is closed cleanly
+  char symbol[32];
+  tlog_column_t column[TLOG_COLUMNS];   // The first TLOG_V1_COLUMNS in a version 1 log
+  uint64_t reserved[7];
+} tlog_header_t;
+
+// Index entry of one block, the footer holds one per block
+typedef struct {
+  int64_t first_time;
+  int64_t last_time;
+  double low;
+  double high;
+} tlog_index_t;
+
+typedef struct {
+  char magic[8];
+  uint64_t blocks;          // Followed by 'blocks' tlog_index_t entries
+} tlog_footer_t;
+
+// Writer, owned by a single thread
+typedef struct {
+  int fd;
+  char *map;                // Mapping of the whole pre-grown file
+  size_t map_size;
+  tlog_header_t *hdr;
+  double *price;            // Columns of the current block
+  double *volume;
+  int64_t *time;
+  int64_t *closed;
+  uint32_t slot;            // Next row inside the current block
+  uint64_t rows;
+} tlog_t;
+
+// Reader of a closed file, or of a file that is still being written (no index then)
+typedef struct {
+  const char *map;
+  size_t size;
+  const tlog_header_t *hdr;
+  const tlog_index_t *index;  // NULL if the file was not closed cleanly
+  uint64_t rows;
+  uint64_t blocks;
+  size_t header_size;         // Of the version of the file
+  size_t block_size;
+} tlog_reader_t;
+
+// Writer functions
+tlog_t *tlog_create (const char *path, const char *symbol);
+int tlog_append (tlog_t *log, double price, double volume, int64_t time, int64_t closed);
+int tlog_close (tlog_t *log);
+
+// Reader functions
+int tlog_open (const char *path, tlog_reader_t *r);
+uint32_t tlog_block (const tlog_reader_t *r, uint64_t block, const double **price, const double **volume, const int64_t **time);
+const int64_t *tlog_closed (const tlog_reader_t *r, uint64_t block);
+uint64_t tlog_seek_time (const tlog_reader_t *r, int64_t time);
+void tlog_release (tlog_reader_t *r);
+
+#endif
@@ -0,0 +1,492 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "tlz.h"
+#include "tlog.h"
+#include "trade.h"
+
+#define CODEC_BITS 2
+#define CODEC_RAW 0           // 64-bit doubles
+#define CODEC_DELTA 1         // Fixed point, deltas over their common divisor
+#define CODEC_PLAIN 2         // Fixed point over the common divisor
+#define ROWS_BITS 16
+#define WIDTH_BITS 7          // Bit width of the packed values, 0 to 64
+#define MAX_FIXED 9e12        // Larger values are stored raw (trade_fixed() must not overflow)
+#define MAX_BLOCK_SIZE ((4 * TLZ_BLOCK_ROWS * 65 + 640) / 8)   // Every value escaped, plus the column headers
+
+_Static_assert (sizeof (tlz_header_t) == TLZ_HEADER_SIZE, "tlz header must be 96 bytes");
+
+// Bit stream, least significant bit first
+typedef struct {
+  uint8_t *buf;
+  size_t pos;
+  uint64_t acc;
+  int bits;
+} bit_writer_t;
+
+typedef struct {
+  const uint8_t *buf;
+  size_t size;
+  size_t pos;
+  uint64_t acc;
+  int bits;
+  int error;                // Read past the end of the block
+} bit_reader_t;
+
+// Rows of one block and the scratch space to encode or decode it
+typedef struct {
+  double price[TLZ_BLOCK_ROWS];
+  double volume[TLZ_BLOCK_ROWS];
+  int64_t time[TLZ_BLOCK_ROWS];
+  int64_t closed[TLZ_BLOCK_ROWS];
+  int64_t fixed[TLZ_BLOCK_ROWS];
+  uint64_t packed[TLZ_BLOCK_ROWS];
+  uint8_t out[MAX_BLOCK_SIZE];
+} block_buf_t;
+
+static void put32 (bit_writer_t *w, uint64_t value, int n)
+{
+  if (n == 0) return;
+  w->acc |= (value & ((1ULL << n) - 1)) << w->bits;
+  w->bits += n;
+  while (w->bits >= 8) {
+    w->buf[w->pos++] = (uint8_t)w->acc;
+    w->acc >>= 8;
+    w->bits -= 8;
+  }
+}
+
+static void put (bit_writer_t *w, uint64_t value, int n)
+{
+  if (n > 32) {
+    put32 (w, value & 0xffffffffULL, 32);
+    put32 (w, value >> 32, n - 32);
+  } else {
+    put32 (w, value, n);
+  }
+}
+
+static size_t put_end (bit_writer_t *w)
+{
+  if (w->bits > 0) w->buf[w->pos++] = (uint8_t)w->acc;
+  return w->pos;
+}
+
+static uint64_t get32 (bit_reader_t *r, int n)
+{
+  uint64_t value;
+
+  if (n == 0) return 0;
+  while (r->bits < n) {
+    if (r->pos == r->size) {
+      r->error = 1;
+      return 0;
+    }
+    r->acc |= (uint64_t)r->buf[r->pos++] << r->bits;
+    r->bits += 8;
+  }
+  value = r->acc & ((1ULL << n) - 1);
+  r->acc >>= n;
+  r->bits -= n;
+  return value;
+}
+
+static uint64_t get (bit_reader_t *r, int n)
+{
+  uint64_t low;
+
+  if (n <= 32) return get32 (r, n);
+  low = get32 (r, 32);
+  return low | get32 (r, n - 32) << 32;
+}
+
+static uint64_t zigzag (int64_t v)
+{
+  return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+static int64_t unzigzag (uint64_t u)
+{
+  return (int64_t)(u >> 1) ^ -(int64_t)(u & 1);
+}
+
+static uint64_t gcd (uint64_t a, uint64_t b)
+{
+  uint64_t t;
+
+  while (b != 0) {
+    t = a % b;
+    a = b;
+    b = t;
+  }
+  return a;
+}
+
+// Bit width that packs 'n' values in the fewest bits: a flag bit and 'width' bits per value,
+// 64 bits instead for the values that don't fit. Returns the width, the total size in 'cost'.
+static int best_width (const uint64_t *v, uint32_t n, uint64_t *cost)
+{
+  uint32_t count[65] = { 0 };   // Values by bit length
+  uint64_t above = n, c;
+  int best = 64;
+
+  for (uint32_t i = 0; i < n; i++) count[v[i] ? 64 - __builtin_clzll (v[i]) : 0]++;
+  *cost = (uint64_t)n * 65;
+  for (int width = 0; width <= 64; width++) {
+    above -= count[width];
+    c = (uint64_t)n * (1 + width) + above * 64;
+    if (c < *cost) {
+      *cost = c;
+      best = width;
+    }
+  }
+  return best;
+}
+
+static void put_packed (bit_writer_t *w, const uint64_t *v, uint32_t n)
+{
+  uint64_t cost;
+  int width = best_width (v, n, &cost);
+
+  put (w, width, WIDTH_BITS);
+  for (uint32_t i = 0; i < n; i++) {
+    if (width == 64 || v[i] >> width == 0) {
+      put (w, 0, 1);
+      put (w, v[i], width);
+    } else {
+      put (w, 1, 1);
+      put (w, v[i], 64);
+    }
+  }
+}
+
+static void get_packed (bit_reader_t *r, uint64_t *v, uint32_t n)
+{
+  int width = (int)get (r, WIDTH_BITS);
+
+  if (width > 64) {
+    r->error = 1;
+    return;
+  }
+  for (uint32_t i = 0; i < n; i++) v[i] = get (r, get (r, 1) ? 64 : width);
+}
+
+// Deltas (or the values) of a fixed-point column over their common divisor, zigzag encoded
+static uint64_t scale_column (const int64_t *fixed, uint32_t n, int delta, uint64_t *packed)
+{
+  uint64_t g = 0;
+  int64_t d;
+
+  for (uint32_t i = 0; i < n; i++) {
+    d = delta && i > 0 ? fixed[i] - fixed[i - 1] : fixed[i];
+    g = gcd (g, d < 0 ? -(uint64_t)d : (uint64_t)d);
+  }
+  if (g == 0) g = 1;
+  for (uint32_t i = 0; i < n; i++) {
+    d = delta && i > 0 ? fixed[i] - fixed[i - 1] : fixed[i];
+    packed[i] = zigzag (d / (int64_t)g);
+  }
+  return g;
+}
+
+// Price or volume column: fixed point if every value is exactly one, raw doubles otherwise
+static void put_column (bit_writer_t *w, const double *x, uint32_t n, block_buf_t *b)
+{
+  uint64_t g, cost_delta, cost_plain;
+  double back;
+  int codec = CODEC_DELTA;
+
+  for (uint32_t i = 0; i < n; i++) {
+    if (!(x[i] > -MAX_FIXED && x[i] < MAX_FIXED)) codec = CODEC_RAW;
+    else {
+      b->fixed[i] = trade_fixed (x[i]);
+      back = trade_decimal (b->fixed[i]);
+      if (memcmp (&back, &x[i], sizeof (double)) != 0) codec = CODEC_RAW;
+    }
+    if (codec == CODEC_RAW) break;
+  }
+
+  if (codec == CODEC_RAW) {
+    put (w, CODEC_RAW, CODEC_BITS);
+    for (uint32_t i = 0; i < n; i++) {
+      uint64_t u;
+      memcpy (&u, &x[i], sizeof (u));
+      put (w, u, 64);
+    }
+    return;
+  }
+
+  // Prices move by ticks, so their deltas are small; volumes are usually better as plain lots
+  scale_column (b->fixed, n, 0, b->packed);
+  best_width (b->packed, n, &cost_plain);
+  g = scale_column (b->fixed, n, 1, b->packed);
+  best_width (b->packed, n, &cost_delta);
+  if (cost_plain < cost_delta) {
+    codec = CODEC_PLAIN;
+    g = scale_column (b->fixed, n, 0, b->packed);
+  }
+  put (w, codec, CODEC_BITS);
+  put (w, g, 64);
+  put_packed (w, b->packed, n);
+}
+
+static void get_column (bit_reader_t *r, double *x, uint32_t n, block_buf_t *b)
+{
+  int codec = (int)get (r, CODEC_BITS);
+  int64_t g, value = 0;
+  uint64_t u;
+
+  if (codec == CODEC_RAW) {
+    for (uint32_t i = 0; i < n; i++) {
+      u = get (r, 64);
+      memcpy (&x[i], &u, sizeof (u));
+    }
+    return;
+  }
+  if (codec != CODEC_DELTA && codec != CODEC_PLAIN) {
+    r->error = 1;
+    return;
+  }
+  g = (int64_t)get (r, 64);
+  get_packed (r, b->packed, n);
+  for (uint32_t i = 0; i < n; i++) {
+    if (codec == CODEC_DELTA) value += unzigzag (b->packed[i]) * g;
+    else value = unzigzag (b->packed[i]) * g;
+    x[i] = trade_decimal (value);
+  }
+}
+
+// Encode the 'n' rows of the block buffer into b->out, with the minutes closed if 'closed' is set.
+// Returns the size in bytes.
+static size_t encode_block (block_buf_t *b, uint32_t n, int closed)
+{
+  bit_writer_t w = { b->out, 0, 0, 0 };
+
+  put (&w, n, ROWS_BITS);
+
+  // Time: the first value, then the first delta and the deltas of the deltas
+  put (&w, (uint64_t)b->time[0], 64);
+  for (uint32_t i = 1; i < n; i++) {
+    b->packed[i - 1] = zigzag (i == 1 ? b->time[1] - b->time[0] : (b->time[i] - b->time[i - 1]) - (b->time[i - 1] - b->time[i - 2]));
+  }
+  put_packed (&w, b->packed, n - 1);
+
+  put_column (&w, b->price, n, b);
+  put_column (&w, b->volume, n, b);
+
+  // Minutes closed: they only move on once a minute, so nearly every delta is 0
+  put (&w, closed, 1);
+  if (closed) {
+    put (&w, (uint64_t)b->closed[0], 64);
+    for (uint32_t i = 1; i < n; i++) b->packed[i - 1] = zigzag (b->closed[i] - b->closed[i - 1]);
+    put_packed (&w, b->packed, n - 1);
+  }
+  return put_end (&w);
+}
+
+// Compress a closed .tlog into 'tlz_path' (written to a temporary file, fsynced and renamed).
+// Returns -1 with errno set on failure, the .tlog is left as it is either way.
+int tlz_compress (const char *tlog_path, const char *tlz_path)
+{
+  tlog_reader_t in;
+  tlz_header_t hdr;
+  tlz_index_t *index = NULL;
+  block_buf_t *b = NULL;
+  char tmp_path[PATH_MAX];
+  const double *price, *volume;
+  const int64_t *time, *closed;
+  uint64_t blocks = 0, offset = TLZ_HEADER_SIZE;
+  uint32_t rows, n = 0;
+  size_t size;
+  FILE *out = NULL;
+  int err = 0, has_closed;
+
+  if (tlog_open (tlog_path, &in) < 0) return -1;
+  has_closed = in.hdr->version != 1;
+  snprintf (tmp_path, sizeof (tmp_path), "%s.tmp", tlz_path);
+  index = (tlz_index_t *) calloc ((in.rows + TLZ_BLOCK_ROWS - 1) / TLZ_BLOCK_ROWS + 1, sizeof (tlz_index_t));
+  b = (block_buf_t *) malloc (sizeof (block_buf_t));
+  out = fopen (tmp_path, "wb");
+  memset (&hdr, 0, sizeof (hdr));
+  if (index == NULL || b == NULL || out == NULL || fwrite (&hdr, sizeof (hdr), 1, out) != 1) goto fail;
+
+  for (uint64_t tb = 0; tb < in.blocks || n > 0; tb++) {
+    rows = tlog_block (&in, tb, &price, &volume, &time);
+    closed = tlog_closed (&in, tb);
+    for (uint32_t i = 0; i <= rows; i++) {
+      // Encode a full block, and the last partial one once the log is exhausted
+      if (n == TLZ_BLOCK_ROWS || (i == rows && tb + 1 >= in.blocks && n > 0)) {
+        tlz_index_t *e = &index[blocks++];
+
+        e->rows = n;
+        e->offset = offset;
+        e->min_time = e->max_time = b->time[0];
+        for (uint32_t k = 1; k < n; k++) {
+          if (b->time[k] < e->min_time) e->min_time = b->time[k];
+          if (b->time[k] > e->max_time) e->max_time = b->time[k];
+        }
+        size = encode_block (b, n, has_closed);
+        e->size = size;
+        if (fwrite (b->out, 1, size, out) != size) goto fail;
+        offset += size;
+        n = 0;
+      }
+      if (i == rows) break;
+      b->price[n] = price[i];
+      b->volume[n] = volume[i];
+      b->time[n] = time[i];
+      b->closed[n] = closed != NULL ? closed[i] : -1;
+      n++;
+    }
+  }
+
+  for (uint64_t k = 0; k < blocks; k++) {
+    index[k].upto_max = k > 0 && index[k - 1].upto_max > index[k].max_time ? index[k - 1].upto_max : index[k].max_time;
+  }
+  for (uint64_t k = blocks; k-- > 0;) {
+    index[k].from_min = k + 1 < blocks && index[k + 1].from_min < index[k].min_time ? index[k + 1].from_min : index[k].min_time;
+  }
+  if (blocks > 0 && fwrite (index, sizeof (tlz_index_t), blocks, out) != blocks) goto fail;
+
+  memcpy (hdr.magic, TLZ_MAGIC, sizeof (hdr.magic));
+  hdr.version = TLZ_VERSION;
+  hdr.header_size = TLZ_HEADER_SIZE;
+  hdr.block_rows = TLZ_BLOCK_ROWS;
+  hdr.rows = in.rows;
+  hdr.blocks = blocks;
+  hdr.index_offset = offset;
+  hdr.raw_size = in.size;
+  memcpy (hdr.symbol, in.hdr->symbol, sizeof (hdr.symbol));
+  if (fseek (out, 0, SEEK_SET) < 0 || fwrite (&hdr, sizeof (hdr), 1, out) != 1 ||
+      fflush (out) != 0 || fsync (fileno (out)) < 0) goto fail;
+  if (fclose (out) != 0) {
+    out = NULL;
+    goto fail;
+  }
+  out = NULL;
+  if (rename (tmp_path, tlz_path) < 0) goto fail;
+
+  tlog_release (&in);
+  free (index);
+  free (b);
+  return 0;
+
+fail:
+  err = errno;
+  if (out != NULL) fclose (out);
+  unlink (tmp_path);
+  tlog_release (&in);
+  free (index);
+  free (b);
+  errno = err;
+  return -1;
+}
+
+// Map a compressed partition for reading. Returns -1 with errno set if it can't be opened or isn't one.
+int tlz_open (const char *path, tlz_reader_t *r)
+{
+  struct stat st;
+  int fd = open (path, O_RDONLY);
+
+  memset (r, 0, sizeof (tlz_reader_t));
+  if (fd < 0) return -1;
+  if (fstat (fd, &st) < 0 || (size_t)st.st_size < TLZ_HEADER_SIZE) {
+    close (fd);
+    errno = EINVAL;
+    return -1;
+  }
+
+  r->size = st.st_size;
+  r->map = mmap (NULL, r->size, PROT_READ, MAP_SHARED, fd, 0);
+  close (fd);
+  if (r->map == MAP_FAILED) {
+    r->map = NULL;
+    return -1;
+  }
+  r->hdr = (const tlz_header_t *)r->map;
+
+  if (memcmp (r->hdr->magic, TLZ_MAGIC, sizeof (r->hdr->magic)) != 0 || r->hdr->version != TLZ_VERSION ||
+      r->hdr->block_rows != TLZ_BLOCK_ROWS || r->hdr->index_offset > r->size ||
+      r->hdr->blocks > (r->size - r->hdr->index_offset) / sizeof (tlz_index_t)) {
+    tlz_release (r);
+    errno = EINVAL;
+    return -1;
+  }
+  r->rows = r->hdr->rows;
+  r->blocks = r->hdr->blocks;
+  r->index = (const tlz_index_t *)(r->map + r->hdr->index_offset);
+  return 0;
+}
+
+// Decode one block into arrays of TLZ_BLOCK_ROWS, 'closed' may be NULL (-1 for every row if the
+// block has no minutes closed). Returns the number of rows, 0 past the end or if it is corrupt.
+uint32_t tlz_block (const tlz_reader_t *r, uint64_t block, double *price, double *volume, int64_t *time, int64_t *closed)
+{
+  static _Thread_local block_buf_t *b;   // Scratch space of the thread, never freed
+  const tlz_index_t *e = &r->index[block];
+  bit_reader_t in;
+  uint32_t n;
+  int64_t delta = 0;
+
+  if (block >= r->blocks || e->offset + e->size > r->hdr->index_offset || e->rows > TLZ_BLOCK_ROWS) return 0;
+  if (b == NULL && (b = (block_buf_t *) malloc (sizeof (block_buf_t))) == NULL) return 0;
+
+  memset (&in, 0, sizeof (in));
+  in.buf = (const uint8_t *)r->map + e->offset;
+  in.size = e->size;
+  n = (uint32_t)get (&in, ROWS_BITS);
+  if (n != e->rows || n == 0) return 0;
+
+  time[0] = (int64_t)get (&in, 64);
+  get_packed (&in, b->packed, n - 1);
+  for (uint32_t i = 1; i < n; i++) {
+    delta = i == 1 ? unzigzag (b->packed[0]) : delta + unzigzag (b->packed[i - 1]);
+    time[i] = time[i - 1] + delta;
+  }
+  get_column (&in, price, n, b);
+  get_column (&in, volume, n, b);
+
+  if (get (&in, 1) == 0) {
+    if (closed != NULL) for (uint32_t i = 0; i < n; i++) closed[i] = -1;
+  } else if (closed != NULL) {
+    closed[0] = (int64_t)get (&in, 64);
+    get_packed (&in, b->packed, n - 1);
+    for (uint32_t i = 1; i < n; i++) closed[i] = closed[i - 1] + unzigzag (b->packed[i - 1]);
+  }
+  return in.error ? 0 : n;
+}
+
+// Blocks [*first, *end) that can hold trades with from <= time < to: every block before 'first'
+// is older than 'from' and every block from 'end' on is at or after 'to'.
+void tlz_range (const tlz_reader_t *r, int64_t from, int64_t to, uint64_t *first, uint64_t *end)
+{
+  uint64_t lo = 0, hi = r->blocks, mid;
+
+  while (lo < hi) {
+    mid = lo + (hi - lo) / 2;
+    if (r->index[mid].upto_max < from) lo = mid + 1;
+    else hi = mid;
+  }
+  *first = lo;
+
+  hi = r->blocks;
+  while (lo < hi) {
+    mid = lo + (hi - lo) / 2;
+    if (r->index[mid].from_min < to) lo = mid + 1;
+    else hi = mid;
+  }
+  *end = lo;
+}
+
+void tlz_release (tlz_reader_t *r)
+{
+  if (r->map != NULL) munmap ((void *)r->map, r->size);
+  memset (r, 0, sizeof (tlz_reader_t));
+}
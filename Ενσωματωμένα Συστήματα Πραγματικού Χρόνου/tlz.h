@@ -0,0 +1,74 @@
+#ifndef TLZ_H
+#define TLZ_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Compressed trade log partition (<SYMBOL>.<partition>.tlz), made from a closed .tlog, little-endian.
+//
+//   [header, 96 bytes] [block 0] [block 1] ... [block n-1] [index]
+//
+// A block holds up to TLZ_BLOCK_ROWS rows as one bit stream, column after column:
+//   time:   delta-of-delta, zigzag encoded (most trades are a few ms apart, so nearly all are tiny)
+//   price:  fixed point (TRADE_SCALE), deltas divided by their common divisor (the tick size)
+//   volume: fixed point divided by the common divisor of the block (the lot size), or deltas if smaller
+//   closed: a flag, then (if the .tlog has the column) the first value and the deltas, zigzag encoded
+// The integers of a column are packed with the bit width that makes the block smallest, the
+// few values that don't fit are escaped to 64 bits. A price or volume column that isn't exactly
+// a fixed-point value (a log written before the pipeline was fixed point) is stored as raw doubles.
+// Decoding gives back the doubles of the .tlog bit for bit.
+//
+// The index has one entry per block with its offset and time bounds, so a range read only
+// decodes the blocks that can hold trades of the range.
+
+#define TLZ_MAGIC "TLZ\0\0\0\0\1"
+#define TLZ_VERSION 1
+#define TLZ_HEADER_SIZE 96
+#define TLZ_BLOCK_ROWS 1024
+
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  uint32_t header_size;
+  uint32_t block_rows;
+  uint32_t reserved;
+  uint64_t rows;
+  uint64_t blocks;
+  uint64_t index_offset;    // Followed by 'blocks' tlz_index_t entries
+  uint64_t raw_size;        // Size of the .tlog it was made from
+  char symbol[32];
+  uint64_t reserved2;
+} tlz_header_t;
+
+// Index entry of one block. Trades are in arrival order, so a late trade can sit in a later block
+// than newer ones: 'upto_max' and 'from_min' only grow from block to block and bound a search.
+typedef struct {
+  int64_t min_time;
+  int64_t max_time;
+  int64_t upto_max;         // Latest time of this block and all the blocks before it
+  int64_t from_min;         // Earliest time of this block and all the blocks after it
+  uint64_t offset;          // Of the block in the file
+  uint32_t size;            // Bytes
+  uint32_t rows;
+} tlz_index_t;
+
+// Reader of a compressed partition
+typedef struct {
+  const char *map;
+  size_t size;
+  const tlz_header_t *hdr;
+  const tlz_index_t *index;
+  uint64_t rows;
+  uint64_t blocks;
+} tlz_reader_t;
+
+// Writer function
+int tlz_compress (const char *tlog_path, const char *tlz_path);
+
+// Reader functions
+int tlz_open (const char *path, tlz_reader_t *r);
+uint32_t tlz_block (const tlz_reader_t *r, uint64_t block, double *price, double *volume, int64_t *time, int64_t *closed);
+void tlz_range (const tlz_reader_t *r, int64_t from, int64_t to, uint64_t *first, uint64_t *end);
+void tlz_release (tlz_reader_t *r);
+
+#endif
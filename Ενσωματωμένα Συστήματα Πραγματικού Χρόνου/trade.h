@@ -0,0 +1,56 @@
+#ifndef TRADE_H
+#define TRADE_H
+
+#include <stdint.h>
+#include <math.h>
+
+#define MAX_SYMBOL_LEN 30
+#define TRADE_SCALE 1000000LL   // Fixed-point units per unit of price and volume (1e-6)
+
+// Struct to hold stock data such as symbol, price, volume, time, as decoded from a message.
+// It only lives in the producer, which turns it into a trade_t for the worker.
+typedef struct {
+    char symbol[MAX_SYMBOL_LEN];    // Enough space for the stock symbol
+    double price;
+    long long int time;
+    double volume;
+} stock_data_t;
+
+// Hot record of a trade from the producer to the worker of its symbol: 32 bytes, so two of
+// them fill a cache line and a ring slot never straddles two. Price and volume are fixed point,
+// rounded from the decoded values once by the producer and turned back into decimals only
+// when they are written out.
+typedef struct {
+    int64_t price;      // TRADE_SCALE units
+    int64_t volume;     // TRADE_SCALE units
+    int64_t time;       // Exchange time (ms since the epoch)
+    int32_t id;         // Symbol ID, negative for the wall-clock ticks and the closes of a replay
+    uint32_t pub_ns;    // Low 32 bits of the monotonic time the trade was published to the worker's ring
+} trade_t;
+
+_Static_assert (sizeof (trade_t) == 32, "trade_t must stay 32 bytes");
+
+static inline int64_t trade_fixed (double value)
+{
+    return llround (value * TRADE_SCALE);
+}
+
+static inline double trade_decimal (int64_t value)
+{
+    return (double)value / TRADE_SCALE;
+}
+
+// price * volume in TRADE_SCALE units, rounded once. The volume is split in whole and
+// fractional units so the products stay in 64 bits for prices up to 9e6.
+static inline int64_t trade_notional (int64_t price, int64_t volume)
+{
+    return price * (volume / TRADE_SCALE) + (price * (volume % TRADE_SCALE) + TRADE_SCALE / 2) / TRADE_SCALE;
+}
+
+// Time since the trade was published, from its 32-bit stamp: exact for anything below 4.2 s
+static inline int64_t trade_age_ns (const trade_t *trade, int64_t now)
+{
+    return (uint32_t)((uint32_t)now - trade->pub_ns);
+}
+
+#endif
@@ -0,0 +1,375 @@
+/*
+Streaming parser for Finnhub trade messages:
+  {"data":[{"c":null,"p":63000.5,"s":"BINANCE:BTCUSDT","t":1727790000000,"v":0.01},...],"type":"trade"}
+It works in place on the receive buffer (no NUL termination needed, no DOM, no allocations)
+and only accepts messages it can decode exactly like jansson would. Anything else (pings,
+escaped strings, unexpected types, invalid JSON) returns PARSE_SLOW so the caller can hand
+the message to jansson, which keeps the output and the error handling identical.
+*/
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+#include "trade_parser.h"
+
+#define MAX_DEPTH 16          // Nesting allowed in the values we skip
+#define MAX_NUMBER_LEN 64     // Longest number token handed to strtod
+
+// Reading position inside the message
+typedef struct {
+  const char *p;
+  const char *end;
+} cursor_t;
+
+// Powers of ten that are exact in a double, used by the fast number conversion
+static const double pow10_exact[] = {
+  1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+  1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+int trade_parser_init (trade_parser_t *p, size_t cap)
+{
+  p->buf = (char *) malloc (cap);
+  p->len = 0;
+  p->cap = p->buf ? cap : 0;
+  return p->buf ? 0 : -1;
+}
+
+void trade_parser_free (trade_parser_t *p)
+{
+  free (p->buf);
+  p->buf = NULL;
+  p->len = p->cap = 0;
+}
+
+// Feed one receive callback's worth of data. Returns the complete message once the final
+// fragment arrived, NULL while more data is expected. An unfragmented message is returned
+// in place; fragments are joined in the reassembly buffer.
+const char *trade_parser_feed (trade_parser_t *p, const char *in, size_t len, int final, size_t *msg_len)
+{
+  char *grown;
+
+  if (p->len == 0 && final) {
+    *msg_len = len;
+    return in;
+  }
+
+  if (p->len + len > p->cap) {
+    size_t cap = p->cap ? p->cap : PARSER_INITIAL_SIZE;
+    while (cap < p->len + len) cap *= 2;
+    grown = (char *) realloc (p->buf, cap);
+    if (grown == NULL) {    // Drop the message, there is no way to parse half of it
+      p->len = 0;
+      return NULL;
+    }
+    p->buf = grown;
+    p->cap = cap;
+  }
+  memcpy (p->buf + p->len, in, len);
+  p->len += len;
+
+  if (!final) return NULL;
+
+  *msg_len = p->len;
+  p->len = 0;     // The data stays in the buffer until the next call
+  return p->buf;
+}
+
+static inline void skip_ws (cursor_t *c)
+{
+  while (c->p < c->end && (*c->p == ' ' || *c->p == '\t' || *c->p == '\n' || *c->p == '\r'))
+    c->p++;
+}
+
+// Consume 'ch' (after optional white space), return 0 if it isn't there
+static inline int expect (cursor_t *c, char ch)
+{
+  skip_ws (c);
+  if (c->p < c->end && *c->p == ch) {
+    c->p++;
+    return 1;
+  }
+  return 0;
+}
+
+// Find the first byte that ends a plain string: a quote, a backslash, a control character
+// or a non-ASCII byte (the last three send the message to the slow path).
+static inline const char *scan_string (const char *p, const char *end)
+{
+#if defined(__SSE2__)
+  const __m128i quote = _mm_set1_epi8 ('"');
+  const __m128i backslash = _mm_set1_epi8 ('\\');
+  const __m128i space = _mm_set1_epi8 (0x20);
+
+  while (end - p >= 16) {
+    __m128i v = _mm_loadu_si128 ((const __m128i *)p);
+    // Signed compare: bytes >= 0x80 are negative, so they are caught together with control characters
+    __m128i m = _mm_or_si128 (_mm_or_si128 (_mm_cmpeq_epi8 (v, quote), _mm_cmpeq_epi8 (v, backslash)),
+                              _mm_cmplt_epi8 (v, space));
+    int mask = _mm_movemask_epi8 (m);
+    if (mask) return p + __builtin_ctz (mask);
+    p += 16;
+  }
+#elif defined(__ARM_NEON)
+  const uint8x16_t quote = vdupq_n_u8 ('"');
+  const uint8x16_t backslash = vdupq_n_u8 ('\\');
+  const int8x16_t space = vdupq_n_s8 (0x20);
+
+  while (end - p >= 16) {
+    uint8x16_t v = vld1q_u8 ((const uint8_t *)p);
+    uint8x16_t m = vorrq_u8 (vorrq_u8 (vceqq_u8 (v, quote), vceqq_u8 (v, backslash)),
+                             vcltq_s8 (vreinterpretq_s8_u8 (v), space));
+    uint64x2_t m64 = vreinterpretq_u64_u8 (m);
+    if (vgetq_lane_u64 (m64, 0) | vgetq_lane_u64 (m64, 1)) break;   // The scalar loop finds the exact byte
+    p += 16;
+  }
+#endif
+  while (p < end && *p != '"' && *p != '\\' && (signed char)*p >= 0x20)
+    p++;
+  return p;
+}
+
+// Parse a string without escapes, returning its contents in place
+static int parse_string (cursor_t *c, const char **s, size_t *n)
+{
+  const char *q;
+
+  if (!expect (c, '"')) return 0;
+  q = scan_string (c->p, c->end);
+  if (q == c->end || *q != '"') return 0;
+  *s = c->p;
+  *n = q - c->p;
+  c->p = q + 1;
+  return 1;
+}
+
+// Parse a JSON number. Integers are returned in '*ival' (is_int = 1), reals in '*dval'.
+// Reals are converted with the exact fast path when the decimal mantissa and the power
+// of ten are both exact in a double (one correctly rounded operation, same as strtod),
+// otherwise with strtod itself.
+static int parse_number (cursor_t *c, long long *ival, double *dval, int *is_int)
+{
+  const char *start, *p;
+  uint64_t mantissa = 0;
+  int digits = 0, frac_digits = 0, exp10 = 0, exp_sign = 1, negative = 0, exp_val = 0;
+  char token[MAX_NUMBER_LEN + 1];
+
+  skip_ws (c);
+  start = p = c->p;
+
+  if (p < c->end && *p == '-') {
+    negative = 1;
+    p++;
+  }
+  if (p == c->end) return 0;
+
+  // Integer part: a single zero or a digit sequence without leading zeros
+  if (*p == '0') {
+    p++;
+    if (p < c->end && *p >= '0' && *p <= '9') return 0;
+  } else if (*p >= '1' && *p <= '9') {
+    while (p < c->end && *p >= '0' && *p <= '9') {
+      if (digits < 19) mantissa = mantissa * 10 + (*p - '0');
+      digits++;
+      p++;
+    }
+  } else {
+    return 0;
+  }
+
+  if (p == c->end || (*p != '.' && *p != 'e' && *p != 'E')) {
+    // Integer token, jansson stores it as a long long
+    if (digits > 18) return 0;
+    *ival = negative ? -(long long)mantissa : (long long)mantissa;
+    *is_int = 1;
+    c->p = p;
+    return 1;
+  }
+
+  if (*p == '.') {
+    p++;
+    if (p == c->end || *p < '0' || *p > '9') return 0;
+    while (p < c->end && *p >= '0' && *p <= '9') {
+      if (digits == 0 && *p == '0') {
+        frac_digits++;    // Leading zeros of the fraction don't count as significant digits
+      } else {
+        if (digits < 19) {
+          mantissa = mantissa * 10 + (*p - '0');
+          frac_digits++;
+        }
+        digits++;
+      }
+      p++;
+    }
+  }
+
+  if (p < c->end && (*p == 'e' || *p == 'E')) {
+    p++;
+    if (p < c->end && (*p == '+' || *p == '-')) {
+      if (*p == '-') exp_sign = -1;
+      p++;
+    }
+    if (p == c->end || *p < '0' || *p > '9') return 0;
+    while (p < c->end && *p >= '0' && *p <= '9') {
+      if (exp_val < 100000) exp_val = exp_val * 10 + (*p - '0');
+      p++;
+    }
+  }
+  c->p = p;
+  *is_int = 0;
+
+  exp10 = exp_sign * exp_val - frac_digits;
+  if (digits <= 19 && mantissa <= (1ULL << 53) && exp10 >= -22 && exp10 <= 22) {
+    double d = (double)mantissa;
+    d = exp10 < 0 ? d / pow10_exact[-exp10] : d * pow10_exact[exp10];
+    *dval = negative ? -d : d;
+    return 1;
+  }
+
+  // Slow conversion, on a NUL-terminated copy of the token
+  if (p - start > MAX_NUMBER_LEN) return 0;
+  memcpy (token, start, p - start);
+  token[p - start] = '\0';
+  *dval = strtod (token, NULL);
+  return isinf (*dval) ? 0 : 1;   // jansson rejects reals that overflow
+}
+
+static int skip_value (cursor_t *c, int depth);
+
+// Skip an array or an object we don't care about
+static int skip_container (cursor_t *c, char close, int depth)
+{
+  const char *s;
+  size_t n;
+
+  if (depth > MAX_DEPTH) return 0;
+  if (expect (c, close)) return 1;
+  do {
+    if (close == '}' && (!parse_string (c, &s, &n) || !expect (c, ':'))) return 0;
+    if (!skip_value (c, depth + 1)) return 0;
+  } while (expect (c, ','));
+  return expect (c, close);
+}
+
+// Skip any JSON value
+static int skip_value (cursor_t *c, int depth)
+{
+  const char *s;
+  size_t n;
+  long long ival;
+  double dval;
+  int is_int;
+
+  skip_ws (c);
+  if (c->p == c->end) return 0;
+
+  switch (*c->p) {
+    case '"':
+      return parse_string (c, &s, &n);
+    case '{':
+      c->p++;
+      return skip_container (c, '}', depth);
+    case '[':
+      c->p++;
+      return skip_container (c, ']', depth);
+    case 't':
+      if (c->end - c->p >= 4 && memcmp (c->p, "true", 4) == 0) { c->p += 4; return 1; }
+      return 0;
+    case 'f':
+      if (c->end - c->p >= 5 && memcmp (c->p, "false", 5) == 0) { c->p += 5; return 1; }
+      return 0;
+    case 'n':
+      if (c->end - c->p >= 4 && memcmp (c->p, "null", 4) == 0) { c->p += 4; return 1; }
+      return 0;
+    default:
+      return parse_number (c, &ival, &dval, &is_int);
+  }
+}
+
+// Parse one element of the "data" array into 'trade'
+static int parse_trade (cursor_t *c, stock_data_t *trade)
+{
+  const char *key, *sym = NULL;
+  size_t key_len, sym_len = 0;
+  long long ival;
+  double dval;
+  int is_int, seen = 0;
+
+  if (!expect (c, '{')) return 0;
+  if (expect (c, '}')) return 0;    // Missing fields, let jansson report it
+
+  do {
+    if (!parse_string (c, &key, &key_len) || !expect (c, ':')) return 0;
+
+    if (key_len == 1 && (key[0] == 's' || key[0] == 'p' || key[0] == 'v' || key[0] == 't')) {
+      int bit = key[0] == 's' ? 1 : key[0] == 'p' ? 2 : key[0] == 'v' ? 4 : 8;
+      if (seen & bit) return 0;    // Duplicate key, jansson keeps the last one
+      seen |= bit;
+
+      if (key[0] == 's') {
+        if (!parse_string (c, &sym, &sym_len)) return 0;
+      } else {
+        if (!parse_number (c, &ival, &dval, &is_int)) return 0;
+        if (key[0] == 'p') trade->price = is_int ? (double)ival : dval;
+        else if (key[0] == 'v') trade->volume = is_int ? (double)ival : dval;
+        else if (is_int && ival >= 0) trade->time = ival;
+        else return 0;                // "t" must be an integer, and not before the epoch
+      }
+    } else if (!skip_value (c, 0)) {
+      return 0;
+    }
+  } while (expect (c, ','));
+
+  if (!expect (c, '}') || seen != 15) return 0;
+
+  // Same as the strncpy() of the slow path: truncated and zero padded
+  if (sym_len > MAX_SYMBOL_LEN - 1) sym_len = MAX_SYMBOL_LEN - 1;
+  memset (trade->symbol, 0, MAX_SYMBOL_LEN);
+  memcpy (trade->symbol, sym, sym_len);
+  return 1;
+}
+
+// Parse a whole trade message into 'out'. Returns the number of trades, or PARSE_SLOW
+// if the message doesn't have the trade schema or holds more than 'max' trades.
+// Nothing is returned from a message that fails half way, the slow path reproduces
+// whatever jansson would have done with it.
+int trade_parse (const char *msg, size_t len, stock_data_t *out, int max)
+{
+  cursor_t c = { msg, msg + len };
+  const char *key;
+  size_t key_len;
+  int n = -1;
+
+  if (!expect (&c, '{')) return PARSE_SLOW;
+  if (expect (&c, '}')) return PARSE_SLOW;
+
+  do {
+    if (!parse_string (&c, &key, &key_len) || !expect (&c, ':')) return PARSE_SLOW;
+
+    if (key_len == 4 && memcmp (key, "data", 4) == 0) {
+      if (n >= 0 || !expect (&c, '[')) return PARSE_SLOW;
+      n = 0;
+      if (!expect (&c, ']')) {
+        do {
+          if (n == max) return PARSE_SLOW;
+          if (!parse_trade (&c, &out[n])) return PARSE_SLOW;
+          n++;
+        } while (expect (&c, ','));
+        if (!expect (&c, ']')) return PARSE_SLOW;
+      }
+    } else if (!skip_value (&c, 0)) {
+      return PARSE_SLOW;
+    }
+  } while (expect (&c, ','));
+
+  if (!expect (&c, '}')) return PARSE_SLOW;
+  skip_ws (&c);
+  if (c.p != c.end || n < 0) return PARSE_SLOW;   // Trailing garbage, or no "data" (pings)
+
+  return n;
+}
@@ -0,0 +1,23 @@
+#ifndef TRADE_PARSER_H
+#define TRADE_PARSER_H
+
+#include <stddef.h>
+#include "trade.h"
+
+#define PARSE_SLOW -1             // Message isn't a plain trade message, use the jansson slow path
+#define PARSER_INITIAL_SIZE 65536 // Initial size of the reassembly buffer
+
+// Joins messages that libwebsockets delivers over several receive callbacks
+typedef struct {
+  char *buf;
+  size_t len;
+  size_t cap;
+} trade_parser_t;
+
+// Parser functions
+int trade_parser_init (trade_parser_t *p, size_t cap);
+void trade_parser_free (trade_parser_t *p);
+const char *trade_parser_feed (trade_parser_t *p, const char *in, size_t len, int final, size_t *msg_len);
+int trade_parse (const char *msg, size_t len, stock_data_t *out, int max);
+
+#endif